@@ -30,27 +30,45 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/filesystem.hpp>
 #include <glibmm.h>
-#include <set>
 #include <map>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <sqlite3.h>
 #include <string>
 
 using Glib::ustring;
 
-using std::multiset;
 using std::map;
 using std::vector;
 using std::unordered_set;
+using std::unordered_map;
+using std::pair;
+using std::shared_ptr;
 using std::string;
+using std::mutex;
+using std::atomic;
 
 using namespace boost::filesystem;
 
+#include "DatabaseSession.hpp"
 #include "css/CSSSpecificity.hpp"
+#include "css/CSSDevice.hpp"
+#include "css/CSSCompoundSelector.hpp"
+#include "css/CSSComplexSelector.hpp"
+#include "css/CSSElement.hpp"
+#include "css/CSSAncestorFilter.hpp"
 #include "css/CSSSelector.hpp"
 #include "css/CSSDeclaration.hpp"
+#include "css/CSSProperty.hpp"
 #include "css/CSSRule.hpp"
+#include "css/CSSRuleList.hpp"
+#include "css/CSSImage.hpp"
+#include "css/CSSStatistics.hpp"
 
 
 /*
@@ -88,12 +106,84 @@ SHOULD ALSO DO
 
 class CSS {
 
+		friend class CSSImage;
+
+	private:
+		//Computed styles, keyed by element signature. Filled in lazily
+		//by cascade(), so it is only ever as big as the number of distinct
+		//element/id/class combinations in the book.
+		mutable unordered_map<string, CSSRule> cascades;
+
+		//Computed styles for match(), keyed by the rules that matched in
+		//cascade order ("3,17,42", then a NUL and the style attribute if
+		//there is one). Elements in different places that pick up the
+		//same rules share one entry.
+		mutable unordered_map<string, CSSRule> styles;
+
+		//Parsed style attributes, keyed by the attribute as written, so
+		//each distinct one is only parsed once however often it appears.
+		mutable unordered_map<string, CSSRule> inline_styles;
+
+		//Only there once enable_statistics() has been called.
+		mutable shared_ptr<CSSStatistics> stats;
+
+		//Every key match() has produced, numbered in the order they turned
+		//up. A computed style is named signature@number, which is what
+		//Content saves, so cascade() can get the exact style back later.
+		//These are saved with the rules.
+		mutable vector<string> style_keys;
+		mutable unordered_map<string, unsigned int> style_index;
+
+		//Held while the caches above are looked in or added to, never
+		//while a style is worked out, so readers on other threads only
+		//wait on each other for a lookup. Entries are never moved or
+		//dropped once added, so references handed out stay good.
+		mutable mutex memo_lock;
+
+		//(selector key, index into rules) for every selector of every
+		//rule, sorted by key and then index. Lookups binary search this
+		//instead of walking the rules.
+		mutable vector<pair<string, unsigned int>> selector_index;
+
+		//(subject key, (rule, part of its selector)) for every compiled
+		//selector, sorted. The subject key is the id, first class or
+		//element of the rightmost compound; see match().
+		mutable vector<pair<string, pair<unsigned int, unsigned int>>> subject_index;
+
+		//The image saved alongside the rules, when loaded from a
+		//database. cascade() and contains_rule() answer from it.
+		CSSImage image;
+
+		//The saved rules, left as saved until load_rules() needs them.
+		mutable string unloaded_rules;
+		mutable atomic<bool> rules_loaded;
+
+		void index_rules();
+		const CSSRule & computed_style(const string & key, const string & signature) const;
+		CSSRule compute(const string & key) const;
+
+		//Everything save_to() keeps, and back again. from_blob() returns
+		//false if the blob is truncated or from another version.
+		string to_blob() const;
+		bool from_blob(const char * data, const size_t length);
+		pair<vector<pair<string, unsigned int>>::const_iterator, vector<pair<string, unsigned int>>::const_iterator> find_selector(const string & key) const;
+
 	public:
-		vector <path> files;
-		multiset <CSSRule> rules;
+		mutable vector <path> files;
+
+		//Sorted by specificity and then source order once loaded. The
+		//rules are the cached stylesheets' own, not copies of them.
+		//Mutable, like files, so that load_rules() can fill them in.
+		mutable CSSRuleList rules;
 
 		CSS();
-		CSS(vector<path> files);
+		CSS(vector<path> files, const CSSDevice & device = CSSDevice());
+
+		//A CSS saved with save_to(). Only its image is read straight
+		//away, so reopening a book compiles no selectors: cascade() on a
+		//name a saved book holds reads the style from the image. The
+		//rules are read in by load_rules() the first time anything,
+		//rules itself included, needs them.
 		CSS(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index);
 
 		CSS(CSS const & cpy);
@@ -101,12 +191,57 @@ class CSS {
 		CSS & operator =(const CSS & cpy);
 		CSS & operator =(CSS && mv);
 
+		//Reads in the rules of a CSS loaded from a database, if that
+		//hasn't happened yet. Call it before using files directly.
+		void load_rules() const;
+
 		CSSRule get_rule(const ustring & selector) const;
 		bool contains_rule(const ustring & selector) const;
 
+		//cascade(), match() and inline_style() can be called from several
+		//threads on the same CSS. Anything that isn't const can't be.
+
+		//The computed style for an element on its own, with no ancestors
+		//or siblings for contextual selectors to match against. Given the
+		//name of a style match() returned, that style.
+		const CSSRule & cascade(const string & signature) const;
+
+		//The computed style for an element in place. filter must hold
+		//the element's ancestors.
+		const CSSRule & match(const CSSElement & element, const CSSAncestorFilter & filter) const;
+
+		//The declarations in a style attribute.
+		const CSSRule & inline_style(const string & style) const;
+		static string signature(const ustring & element, const ustring & id, const vector<ustring> & classes);
+
+		//Start counting lookups and timing style resolution, or stop and
+		//throw the counts away. statistics() is nullptr while off.
+		void enable_statistics();
+		void disable_statistics();
+		const CSSStatistics * statistics() const;
+
 		~CSS();
 
+		/*
+		The rules in file that apply to device, in source order, with any
+		@imports in place. Stylesheets are cached by their contents, so a
+		file that's byte-for-byte the same as one already seen, in this
+		book or any other, isn't parsed again and every CSS using it
+		shares the one copy. A sheet that imports others is parsed again
+		if any of them has changed size or modification time since.
+
+		The cache holds up to stylesheet_cache_limit sheets. Past that, the
+		least recently used sheet that no CSS still holds is dropped to
+		make room; sheets still in use are never dropped, since they would
+		stay in memory anyway, so the cache can run over the limit while
+		they are. Safe to call from several threads.
+		*/
+		static shared_ptr<const vector<CSSRule>> stylesheet(const path & file, const CSSDevice & device = CSSDevice());
+		static size_t stylesheet_cache_size();
+		static void clear_stylesheet_cache();
+
 		void save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index);
+		void save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index);
 
 };
 
@@ -33,6 +33,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <glibmm.h>
 #include <sqlite3.h>
 
+#include "DatabaseSession.hpp"
+
 using std::vector;
 
 using namespace boost::filesystem;
@@ -72,6 +74,7 @@ class Container {
 		void load(path to_dir);
 		void load(sqlite3 * const db, const unsigned int file_id);
 		void save_to(sqlite3 * const db, const unsigned int epub_file_id);
+		void save_to(DatabaseSession & session, const unsigned int epub_file_id);
 
 };
 
@@ -42,11 +42,37 @@ using std::vector;
 using namespace boost::filesystem;
 using namespace Glib;
 
+//Saved as numbers, so new types only ever go on the end.
 enum ContentType {
 	P,
 	H1,
 	H2,
-	HR
+	HR,
+	H3,
+	H4,
+	H5,
+	H6,
+	BLOCKQUOTE,
+	LI,
+	//Any other block, and text that isn't in a block of its own.
+	DIV,
+	PRE,
+	DT,
+	DD,
+	TD,
+	TH,
+	CAPTION,
+	ADDRESS
+};
+
+//How Content::save_to() keeps items: a row each, which can be searched
+//and read a few at a time through a ContentView, or packed a content
+//file at a time, which is far smaller; see PackedContent. The search
+//index reads its text from the rows, so a database with one can't take
+//packed content.
+enum ContentStorage {
+	CONTENT_ROWS,
+	CONTENT_PACKED
 };
 
 class ContentItem {
@@ -59,7 +85,13 @@ class ContentItem {
 		ustring content;
 		ustring stripped_content;
 
-		ContentItem(ContentType type, CSSRule, path file, ustring id, ustring content, ustring stripped_content);
+		//The rows of files and selectors that file and the style's name
+		//are saved as. 0 until the item is saved or if it wasn't loaded
+		//from a database.
+		unsigned int file_id;
+		unsigned int selector_id;
+
+		ContentItem(ContentType type, CSSRule, path file, ustring id, ustring content, ustring stripped_content, const unsigned int file_id = 0, const unsigned int selector_id = 0);
 
 		ContentItem(ContentItem const & cpy);
 		ContentItem(ContentItem && mv) ;
@@ -73,11 +105,18 @@ class ContentItem {
 class Content {
 
 	public :
-		CSS & css;
+		//The rootfile's CSS, which has to outlive this. An Epub copying
+		//its contents points the copies at its own CSS.
+		CSS * css;
 		vector<path> files;
 		vector<ContentItem> items;
 
-		Content(CSS & _css, vector<path> files);
+		//Where the book was unpacked. Items name their file relative to
+		//it, so the same file is saved under the same name whichever
+		//directory the book happened to be unpacked in.
+		path root;
+
+		Content(CSS & _css, vector<path> files, const path & root = path());
 		Content(CSS & _css, sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index);
 
 		Content(Content const & cpy);
@@ -88,6 +127,7 @@ class Content {
 		~Content();
 
 		void save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index);
+		void save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index, const ContentStorage storage = CONTENT_ROWS);
 
 };
 
@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CONTENTVIEW_HEADER
+#define CONTENTVIEW_HEADER
+
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <sqlite3.h>
+
+#include "Content.hpp"
+
+using std::vector;
+
+using namespace boost::filesystem;
+
+class ContentView {
+
+		/*
+		A saved book's content, read from the database as it's asked
+		for rather than all at once. Opening one is two index seeks,
+		however long the book is.
+
+		Items are addressed by content_id, which runs in reading order.
+		at() fetches a window of items from the one asked for onwards, so
+		reading straight through only goes back to the database once per
+		window. file() and range() fetch exactly what they cover.
+
+		Like the connection it reads through, a view is for one thread at
+		a time.
+		*/
+
+	private:
+		CSS * css;
+		sqlite3 * db;
+		unsigned int epub_file_id;
+		unsigned int opf_index;
+		unsigned int window_size;
+
+		sqlite3_int64 first;
+		sqlite3_int64 last;
+
+		//Counting means reading the whole book's index, so it's left
+		//until size() is called.
+		bool counted;
+		size_t count;
+
+		sqlite3_stmt * window_select;
+		sqlite3_stmt * range_select;
+		sqlite3_stmt * file_select;
+
+		//What at() read last, in content_id order.
+		vector<sqlite3_int64> window_ids;
+		vector<ContentItem> window;
+
+		vector<ContentItem> read(sqlite3_stmt * const select, vector<sqlite3_int64> * const ids, const size_t expected);
+		void finalize();
+
+	public:
+		static const unsigned int default_window = 64;
+
+		ContentView(CSS & _css, sqlite3 * const _db, const unsigned int _epub_file_id, const unsigned int _opf_index, const unsigned int _window_size = default_window);
+
+		//Statements belong to their connection, so views aren't copied.
+		ContentView(ContentView const & cpy) = delete;
+		ContentView(ContentView && mv) ;
+		ContentView & operator =(const ContentView & cpy) = delete;
+		ContentView & operator =(ContentView && mv) ;
+
+		~ContentView();
+
+		//How many items there are, and the content_ids of the first and
+		//last. Both ids are 0 if there are none.
+		size_t size();
+		sqlite3_int64 first_id() const;
+		sqlite3_int64 last_id() const;
+
+		//Throws std::out_of_range if this book has no such item.
+		const ContentItem & at(const sqlite3_int64 content_id);
+
+		//Every item with a content_id from first_id to last_id, inclusive.
+		vector<ContentItem> range(const sqlite3_int64 first_id, const sqlite3_int64 last_id);
+
+		//Every item from one content file, in order.
+		vector<ContentItem> file(const path & file);
+
+};
+
+#endif
\ No newline at end of file
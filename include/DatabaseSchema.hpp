@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DATABASESCHEMA_HEADER
+#define DATABASESCHEMA_HEADER
+
+class DatabaseSession;
+
+class DatabaseSchema {
+
+		/*
+		The tables and indexes books are saved to. The schema's version
+		is kept in the database (PRAGMA user_version), so the tables are
+		only created when a database is new or older than this code, and
+		a database written by something newer is refused.
+
+		Secondary indexes can be dropped for a bulk load and built again
+		afterwards, which is much quicker than keeping them up to date a
+		row at a time. Unique indexes are never dropped, because inserts
+		rely on them, and nor are those on epub_file_id, which replacing
+		a book relies on.
+
+		Full-text search is optional: create_search() adds an FTS5 index
+		over content.stripped_content, and from then on Content keeps it
+		up to date as books are saved. It stores only the index, not a
+		second copy of the text.
+		*/
+
+	public:
+		static const int version = 5;
+
+		//Brings the database up to this version. Throws if it is newer.
+		static void create(DatabaseSession & session);
+
+		static int stored_version(DatabaseSession & session);
+
+		static void drop_indexes(DatabaseSession & session);
+		static void create_indexes(DatabaseSession & session);
+
+		//Deletes everything saved for a book, in one transaction, along
+		//with the files and selectors only it used. During a bulk load
+		//those are left for remove_orphans() at the end.
+		static void remove_book(DatabaseSession & session, const unsigned int epub_file_id);
+		static void remove_orphans(DatabaseSession & session);
+
+		//Adds the search index, indexing whatever is already saved.
+		static void create_search(DatabaseSession & session);
+		static bool has_search(DatabaseSession & session);
+
+};
+
+#endif
\ No newline at end of file
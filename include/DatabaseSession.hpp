@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DATABASESESSION_HEADER
+#define DATABASESESSION_HEADER
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+#include <glibmm.h>
+#include <sqlite3.h>
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+using namespace boost::filesystem;
+using Glib::ustring;
+
+class DatabaseSession {
+
+		/*
+		A connection that books are saved through. Each statement is
+		prepared the first time it's asked for and reused after that,
+		however many books go through the session. The schema is checked
+		once when the session opens; see DatabaseSchema.
+
+		Transactions nest, so a caller can put several books in one
+		transaction. The outermost begin() and commit() are BEGIN and
+		END; inside them each level is a savepoint, and rolling one back
+		undoes only that level. If SQLite gives up on the whole
+		transaction itself, every commit() throws until the outermost
+		level has been rolled back too. A commit() that throws leaves its
+		level open, so it needs a rollback() like any other failure.
+		*/
+
+	private:
+		sqlite3 * db;
+		bool owned;
+		unsigned int transaction_depth;
+		//The outermost level is a savepoint too, in a transaction
+		//somebody else began on the connection.
+		bool inside_outer;
+		//SQLite rolled the transaction back underneath the open levels.
+		bool failed;
+		bool bulk_loading;
+		double index_milliseconds;
+
+		unordered_map<string, sqlite3_stmt *> statements;
+
+		void finalize();
+
+	public:
+		//Opens (creating if need be) file, and closes it afterwards.
+		DatabaseSession(const path & file);
+		//Works through a connection the caller owns. If another session
+		//is already open on it, the schema is left to that one.
+		DatabaseSession(sqlite3 * const _db);
+
+		//Statements belong to their connection, so sessions aren't copied.
+		DatabaseSession(DatabaseSession const & cpy) = delete;
+		DatabaseSession(DatabaseSession && mv) ;
+		DatabaseSession & operator =(const DatabaseSession & cpy) = delete;
+		DatabaseSession & operator =(DatabaseSession && mv) ;
+
+		~DatabaseSession();
+
+		//The first session still open on db, or nullptr. Saving through a
+		//bare connection goes through this one when there is one, so
+		//that its statements are reused.
+		static DatabaseSession * open_on(sqlite3 * const db);
+
+		sqlite3 * handle() const;
+
+		//sql, prepared once, reset and with its bindings cleared.
+		sqlite3_stmt * statement(const string & sql);
+		size_t statement_count() const;
+
+		void execute(const string & sql);
+
+		void begin();
+		void commit();
+		void rollback();
+
+		//Drops the secondary indexes until end_bulk_load(), which builds
+		//them again and clears out the files and selectors books replaced
+		//meanwhile left unused. Time spent building them is added up
+		//separately. A session that ends part way through leaves them to
+		//be built the next time the database is opened.
+		void begin_bulk_load();
+		void end_bulk_load();
+		bool is_bulk_loading() const;
+		double index_build_milliseconds() const;
+
+};
+
+class BatchInsert {
+
+		/*
+		Rows for one table, sent rows_per_statement at a time as
+		INSERT ... VALUES (...), (...), ... so that SQLite parses, plans
+		and steps once per batch rather than once per row. Values are
+		given a row at a time, column by column. Whatever is left over
+		is sent by flush(), which has to be called at the end.
+		*/
+
+	private:
+		struct Value {
+			int type;
+			sqlite3_int64 integer;
+			string text;
+		};
+
+		DatabaseSession & session;
+		string prefix;
+		string row;
+		unsigned int columns;
+		unsigned int rows_per_statement;
+		vector<Value> values;
+		size_t n_values;
+
+		Value & next();
+
+	public:
+		static const unsigned int default_rows = 64;
+
+		BatchInsert(DatabaseSession & _session, const string & table, const vector<string> & column_names, const unsigned int rows = default_rows);
+
+		BatchInsert(BatchInsert const & cpy) = delete;
+		BatchInsert(BatchInsert && mv) = delete;
+		BatchInsert & operator =(const BatchInsert & cpy) = delete;
+		BatchInsert & operator =(BatchInsert && mv) = delete;
+
+		~BatchInsert();
+
+		BatchInsert & bind(const sqlite3_int64 value);
+		BatchInsert & bind(const string & value);
+		BatchInsert & bind(const ustring & value);
+		BatchInsert & bind_blob(const string & value);
+
+		void flush();
+
+};
+
+#endif
\ No newline at end of file
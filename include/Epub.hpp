@@ -47,6 +47,10 @@ class Epub {
 	private:
 		bool from_epub;
 
+		//Points each of contents at the entry of css that corresponds to
+		//the one it used in from, which has the same layout.
+		void rebind(const Epub & from);
+
 	public:
 
 		path filename;
@@ -62,7 +66,10 @@ class Epub {
 		vector<CSS> css;
 		vector<Content> contents;
 
-		Epub(string _filename);
+		//With css_statistics, style resolution for each rootfile is
+		//counted and timed while the content is read; see
+		//css_statistics_json().
+		Epub(string _filename, const bool css_statistics = false);
 		Epub(sqlite3 * const db, const unsigned int file_id);
 
 		Epub(Epub const & cpy);
@@ -72,9 +79,24 @@ class Epub {
 
 		~Epub() ;
 
+		//Saving a book that's already saved does nothing, and saving one
+		//that has changed since replaces it. Books are told apart by
+		//hash_string, and a changed book is found by its absolute_path.
 		void save_to(sqlite3 * const db);
+		//In a transaction of its own, or in the one the caller has open.
+		void save_to(DatabaseSession & session, const ContentStorage storage = CONTENT_ROWS);
+
+		//The epub_file_id of the saved book with that hash_string, or 0.
+		static unsigned int find(DatabaseSession & session, const string & _hash_string);
+
+		//A JSON object with the statistics of every rootfile's CSS, or
+		//null for a rootfile that wasn't counted.
+		string css_statistics_json() const;
 
-		static inline size_t compute_epub_hash(const path & _absolute_path);
+		//From the file's path, size and modification time, so a book can
+		//be looked up without being unpacked.
+		static size_t compute_epub_hash(const path & _absolute_path);
+		static string compute_hash_string(const size_t _hash);
 
 };
 
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EPUBSTORE_HEADER
+#define EPUBSTORE_HEADER
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+#include <sqlite3.h>
+
+#include "DatabaseSession.hpp"
+#include "Epub.hpp"
+#include "ContentView.hpp"
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::shared_ptr;
+using std::mutex;
+using std::unordered_set;
+
+using namespace boost::filesystem;
+
+class EpubStoreSettings {
+
+	public:
+		//PRAGMA synchronous: OFF, NORMAL, FULL or EXTRA. NORMAL is safe
+		//in WAL mode; a power cut can only lose the last few commits.
+		string synchronous;
+
+		//PRAGMA cache_size, per connection. Negative is in KiB.
+		int cache_size;
+
+		//PRAGMA mmap_size, per connection, in bytes.
+		long long mmap_size;
+
+		//How long a connection waits on a lock before giving up, in ms.
+		int busy_timeout;
+
+		//Add a full-text index for search() if there isn't one. Once it's
+		//there, saving a book always updates it.
+		bool search;
+
+		//How save() keeps each book's content. CONTENT_PACKED can't be
+		//searched, so it needs search off, and no index there already.
+		ContentStorage storage;
+
+		EpubStoreSettings();
+
+		EpubStoreSettings(EpubStoreSettings const & cpy);
+		EpubStoreSettings(EpubStoreSettings && mv) ;
+		EpubStoreSettings & operator =(const EpubStoreSettings & cpy);
+		EpubStoreSettings & operator =(EpubStoreSettings && mv) ;
+
+		~EpubStoreSettings();
+
+};
+
+//What ingest() did with a file.
+enum IngestResult {
+	//Saved already, as it is now, so not even unpacked.
+	INGEST_UNCHANGED,
+	INGEST_ADDED,
+	//Saved before it last changed, and swapped for the new one.
+	INGEST_REPLACED
+};
+
+class SearchHit {
+
+	public:
+		unsigned int epub_file_id;
+		unsigned int opf_id;
+		unsigned int content_id;
+
+		//The matching text around the hit, with the matched terms in [].
+		string snippet;
+
+		SearchHit();
+		SearchHit(const unsigned int _epub_file_id, const unsigned int _opf_id, const unsigned int _content_id, const string & _snippet);
+
+		SearchHit(SearchHit const & cpy);
+		SearchHit(SearchHit && mv) ;
+		SearchHit & operator =(const SearchHit & cpy);
+		SearchHit & operator =(SearchHit && mv) ;
+
+		~SearchHit();
+
+};
+
+class EpubStoreReaders {
+
+		/*
+		A store's read connections that are still open. The store and
+		each thread holding one share this, so whichever finishes first,
+		the store closing or the thread exiting, closes the connection.
+		A ContentView can still have statements on it then, so the
+		connection is only really closed once they are finalized.
+		*/
+
+	public:
+		mutex lock;
+		unordered_set<sqlite3 *> open;
+
+		EpubStoreReaders();
+
+		EpubStoreReaders(EpubStoreReaders const & cpy) = delete;
+		EpubStoreReaders(EpubStoreReaders && mv) = delete;
+		EpubStoreReaders & operator =(const EpubStoreReaders & cpy) = delete;
+		EpubStoreReaders & operator =(EpubStoreReaders && mv) = delete;
+
+		~EpubStoreReaders();
+
+		//Takes db back from a thread, unless the store already has.
+		void release(sqlite3 * const db);
+
+		//Closes every one still open.
+		void close();
+
+};
+
+class EpubStore {
+
+		/*
+		The library database. It is kept in WAL mode, so readers see the
+		last commit and carry on while a writer is adding books, rather
+		than waiting for it.
+
+		There is one write connection, used through writer() by one
+		thread at a time. Every thread that reads gets a read-only
+		connection of its own from reader(), opened the first time it
+		asks and closed when the thread exits or the store closes,
+		whichever comes first.
+		*/
+
+	private:
+		path file;
+		EpubStoreSettings settings;
+
+		sqlite3 * write_db;
+		unique_ptr<DatabaseSession> write_session;
+
+		shared_ptr<EpubStoreReaders> readers;
+
+		sqlite3 * open(const int flags);
+		void close();
+
+	public:
+		EpubStore(const path & _file, const EpubStoreSettings & _settings = EpubStoreSettings());
+
+		//Connections belong to the store, so stores aren't copied or moved.
+		EpubStore(EpubStore const & cpy) = delete;
+		EpubStore(EpubStore && mv) = delete;
+		EpubStore & operator =(const EpubStore & cpy) = delete;
+		EpubStore & operator =(EpubStore && mv) = delete;
+
+		~EpubStore();
+
+		DatabaseSession & writer();
+
+		//The calling thread's read connection. It belongs to the thread,
+		//so don't hand it to another.
+		sqlite3 * reader();
+
+		//Every book in the library, by epub_file_id.
+		vector<unsigned int> books();
+
+		//A book, read on the calling thread's connection in one read
+		//transaction.
+		Epub load(const unsigned int file_id);
+
+		//Saves book through writer(), with its content kept as the
+		//settings say.
+		void save(Epub & book);
+
+		//Adds the book in file unless it's already here, which costs a
+		//stat() and one lookup. Safe to run over a whole library again
+		//and again.
+		IngestResult ingest(const path & file);
+
+		//A book's content, read as it's needed. css is the rootfile's, from
+		//the loaded book, and has to outlive the view.
+		ContentView content(CSS & css, const unsigned int file_id, const unsigned int opf_index, const unsigned int window = ContentView::default_window);
+
+		//Content matching an FTS5 query, best match first. Throws if the
+		//store was opened without search.
+		vector<SearchHit> search(const string & query, const unsigned int limit = 20);
+
+		const EpubStoreSettings & configuration() const;
+
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EPUBWRITER_HEADER
+#define EPUBWRITER_HEADER
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+#include "Epub.hpp"
+#include "EpubStore.hpp"
+
+using std::deque;
+using std::vector;
+using std::mutex;
+using std::condition_variable;
+using std::thread;
+using std::exception_ptr;
+
+class EpubWriter {
+
+		/*
+		Saves books to a store on a thread of its own, so the threads
+		parsing them never wait on SQLite. Books are moved in with push()
+		and saved in the order they arrive, up to group_size of them to
+		a transaction.
+
+		The queue holds at most capacity books. Once it's full, push()
+		waits for the writer to catch up rather than letting parsed books
+		pile up in memory.
+
+		While a writer is running it is the only user of the store's
+		writer(); reading through the store carries on as normal.
+		*/
+
+	private:
+		EpubStore & store;
+		size_t capacity;
+		size_t group_size;
+
+		mutex queue_mutex;
+		condition_variable not_empty;
+		condition_variable not_full;
+		condition_variable idle;
+
+		deque<Epub> queue;
+		size_t in_flight;
+		bool stopping;
+
+		size_t books_written;
+		size_t transaction_count;
+
+		//The first save that failed, until flush() or close() throws it.
+		exception_ptr error;
+
+		thread worker;
+
+		void run();
+		void write(vector<Epub> & books);
+
+	public:
+		static const size_t default_capacity = 16;
+		static const size_t default_group_size = 8;
+
+		EpubWriter(EpubStore & _store, const size_t _capacity = default_capacity, const size_t _group_size = default_group_size);
+
+		//There is one thread per writer, so writers aren't copied or moved.
+		EpubWriter(EpubWriter const & cpy) = delete;
+		EpubWriter(EpubWriter && mv) = delete;
+		EpubWriter & operator =(const EpubWriter & cpy) = delete;
+		EpubWriter & operator =(EpubWriter && mv) = delete;
+
+		//Saves whatever is still queued first. Errors are dropped; call
+		//close() to see them.
+		~EpubWriter();
+
+		//Safe to call from any number of threads.
+		void push(Epub && book);
+
+		//Waits until every book pushed so far is saved, then throws the
+		//first save that failed, if any did.
+		void flush();
+
+		//flush(), then stops the thread. Nothing can be pushed after.
+		void close();
+
+		size_t written();
+		size_t transactions();
+
+};
+
+#endif
\ No newline at end of file
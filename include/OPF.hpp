@@ -36,6 +36,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <glibmm.h>
 #include <sqlite3.h>
 
+#include "DatabaseSession.hpp"
+
 using std::multimap;
 using std::string;
 using std::map;
@@ -212,6 +214,7 @@ class OPF {
 		vector<ManifestItem> find_manifestitems_by_type(ustring type);
 
 		void save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index);
+		void save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index);
 
 };
 
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PACKEDCONTENT_HEADER
+#define PACKEDCONTENT_HEADER
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+#include <sqlite3.h>
+
+#include "Content.hpp"
+#include "DatabaseSession.hpp"
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+using namespace boost::filesystem;
+
+class PackedContent {
+
+		/*
+		A saved book's content stored a content file at a time: each
+		file's items are serialised into one deflated blob in
+		content_blobs, next to an uncompressed index of where each item
+		starts. Reading a chapter is one row and one inflate, and the
+		database is a fraction of the size of one row per item.
+
+		Packed content isn't searchable: the search index only covers
+		content saved as rows.
+
+		Opening one reads which files there are, but none of the blobs.
+		The last blob inflated is kept, so item() through a chapter only
+		inflates it once.
+		*/
+
+	private:
+		CSS * css;
+		sqlite3 * db;
+		unsigned int epub_file_id;
+		unsigned int opf_index;
+
+		//Each file once, in the order it first comes up in the spine.
+		vector<path> file_list;
+		vector<unsigned int> file_ids;
+
+		//Each blob in the order they were saved, and which file in
+		//file_list it holds. A file the spine lists twice has a blob for
+		//each time.
+		vector<sqlite3_int64> blob_ids;
+		vector<size_t> blob_files;
+		vector<unsigned int> item_counts;
+
+		//The style names items refer to, as they're needed.
+		unordered_map<unsigned int, string> selectors;
+
+		sqlite3_stmt * blob_select;
+		sqlite3_stmt * selector_select;
+
+		//The last blob inflated, and where each of its items starts.
+		sqlite3_int64 cached_blob_id;
+		string cached_data;
+		vector<uint32_t> cached_offsets;
+
+		size_t find(const path & file) const;
+		void inflate(const size_t blob_index);
+		ContentItem decode(const size_t blob_index, const uint32_t offset);
+		void append(const size_t blob_index, vector<ContentItem> & items);
+		const string & selector(const unsigned int selector_id);
+		void finalize();
+
+	public:
+		PackedContent(CSS & _css, sqlite3 * const _db, const unsigned int _epub_file_id, const unsigned int _opf_index);
+
+		//Statements belong to the connection, so these aren't copied.
+		PackedContent(PackedContent const & cpy) = delete;
+		PackedContent(PackedContent && mv) ;
+		PackedContent & operator =(const PackedContent & cpy) = delete;
+		PackedContent & operator =(PackedContent && mv) ;
+
+		~PackedContent();
+
+		//Each file once, in spine order.
+		const vector<path> & files() const;
+
+		//How many items there are in all, or in one file.
+		size_t size() const;
+		size_t size(const path & file) const;
+
+		//Every item in a file, in order. Throws std::out_of_range for a
+		//file this book doesn't have.
+		vector<ContentItem> file(const path & file);
+
+		//The index'th item in a file.
+		ContentItem item(const path & file, const size_t index);
+
+		//Every item in the book, in the order it was saved.
+		vector<ContentItem> all();
+
+		//Packs items, which must have their file_id and selector_id set,
+		//one blob per run of items from the same file.
+		static void save_to(DatabaseSession & session, const vector<ContentItem> & items, const unsigned int epub_file_id, const unsigned int opf_index);
+
+};
+
+#endif
\ No newline at end of file
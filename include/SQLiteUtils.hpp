@@ -45,4 +45,46 @@ inline ustring sqlite3_column_ustring(sqlite3_stmt * stmt, unsigned int colnum)
 	return ustring( (char *) sqlite3_column_text(stmt, colnum) );
 }
 
+class SQLiteReadTransaction {
+
+		/*
+		Everything read on db while one of these is in scope comes from
+		one snapshot, so a writer committing part way through a load
+		can't leave the result half old and half new. If db is already
+		in a transaction, that one is left to do the job.
+		*/
+
+	private:
+		sqlite3 * db;
+		bool began;
+
+	public:
+		SQLiteReadTransaction(sqlite3 * const _db) :
+			db(_db),
+			began(false)
+		{
+			if(sqlite3_get_autocommit(db)) {
+				if(sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+					throw - 1;
+				}
+
+				began = true;
+			}
+		}
+
+		SQLiteReadTransaction(SQLiteReadTransaction const & cpy) = delete;
+		SQLiteReadTransaction(SQLiteReadTransaction && mv) = delete;
+		SQLiteReadTransaction & operator =(const SQLiteReadTransaction & cpy) = delete;
+		SQLiteReadTransaction & operator =(SQLiteReadTransaction && mv) = delete;
+
+		~SQLiteReadTransaction()
+		{
+			//Nothing was written, so if it won't commit it can just go.
+			if(began && sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+				sqlite3_exec(db, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+			}
+		}
+
+};
+
 #endif
\ No newline at end of file
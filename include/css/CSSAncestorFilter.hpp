@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_ANCESTOR_FILTER_HEADER
+#define CSS_ANCESTOR_FILTER_HEADER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#include "CSSElement.hpp"
+
+class CSSAncestorFilter {
+
+		/*
+		A counting Bloom filter over the names, ids and classes of the
+		elements above the one being matched. Content pushes each element
+		before walking its children and pops it afterwards.
+
+		If any of the ancestor hashes a selector needs is missing here,
+		the selector can't match and the walk up the tree is skipped.
+		A hit only means it might match.
+		*/
+
+	private:
+		static const unsigned int size = 4096;
+		static const unsigned int mask = size - 1;
+
+		vector<uint16_t> counters;
+
+		void update(const CSSElement & element, const int delta);
+
+	public:
+		CSSAncestorFilter();
+
+		CSSAncestorFilter(CSSAncestorFilter const & cpy);
+		CSSAncestorFilter(CSSAncestorFilter && mv) ;
+		CSSAncestorFilter & operator =(const CSSAncestorFilter & cpy);
+		CSSAncestorFilter & operator =(CSSAncestorFilter && mv) ;
+
+		~CSSAncestorFilter();
+
+		void push(const CSSElement & element);
+		void pop(const CSSElement & element);
+
+		bool may_contain(const uint32_t hash) const;
+		bool may_contain(const vector<uint32_t> & hashes) const;
+
+		//Keys are the element name, #id or .class.
+		static uint32_t hash(const string & key);
+
+};
+
+#endif
\ No newline at end of file
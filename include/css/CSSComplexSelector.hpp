@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_COMPLEX_SELECTOR_HEADER
+#define CSS_COMPLEX_SELECTOR_HEADER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#include "CSSSpecificity.hpp"
+#include "CSSCompoundSelector.hpp"
+
+class CSSComplexSelector {
+
+		/*
+		One comma-separated part of a selector, compiled: compounds
+		from left to right, each carrying the combinator that joins
+		it to the one before. div.chapter > p span is
+
+			div.chapter (none), p (child), span (descendant)
+
+		text is the selector written out in a normalised form, which
+		is what CSSSelector::matches compares against.
+
+		ancestor_hashes are the CSSAncestorFilter hashes of the names,
+		ids and classes that must appear somewhere above the subject,
+		so most selectors that can't match are thrown out without
+		walking the tree.
+		*/
+
+	public:
+		vector<CSSCompoundSelector> compounds;
+		CSSSpecificity specificity;
+		string text;
+		vector<uint32_t> ancestor_hashes;
+
+		CSSComplexSelector();
+
+		CSSComplexSelector(CSSComplexSelector const & cpy);
+		CSSComplexSelector(CSSComplexSelector && mv) ;
+		CSSComplexSelector & operator =(const CSSComplexSelector & cpy);
+		CSSComplexSelector & operator =(CSSComplexSelector && mv) ;
+
+		~CSSComplexSelector();
+
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_COMPOUND_SELECTOR_HEADER
+#define CSS_COMPOUND_SELECTOR_HEADER
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+enum CSSCombinator {
+	CSS_COMBINATOR_NONE,		// The leftmost compound
+	CSS_COMBINATOR_DESCENDANT,	// p span
+	CSS_COMBINATOR_CHILD,		// p > span
+	CSS_COMBINATOR_ADJACENT,	// h1 + p
+	CSS_COMBINATOR_SIBLING		// h1 ~ p
+};
+
+class CSSCompoundSelector {
+
+		/*
+		One run of simple selectors with no combinator in between,
+		like p.chapter#one. The element is empty for * (or where it's
+		left out), and anything that isn't an element, id or class
+		(attribute selectors, pseudo-classes, pseudo-elements) is kept
+		as written in other.
+		*/
+
+	public:
+		string element;
+		string id;
+		vector<string> classes;
+		vector<string> other;
+
+		//How this compound relates to the one to its left.
+		CSSCombinator combinator;
+
+		CSSCompoundSelector();
+
+		CSSCompoundSelector(CSSCompoundSelector const & cpy);
+		CSSCompoundSelector(CSSCompoundSelector && mv) ;
+		CSSCompoundSelector & operator =(const CSSCompoundSelector & cpy);
+		CSSCompoundSelector & operator =(CSSCompoundSelector && mv) ;
+
+		~CSSCompoundSelector();
+
+};
+
+#endif
\ No newline at end of file
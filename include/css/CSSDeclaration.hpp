@@ -28,16 +28,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef CSS_DECLARATION_HEADER
 #define CSS_DECLARATION_HEADER
 
-#include <memory>
+#include <string>
 
 class CSSDeclaration;
 
 #include "CSSSpecificity.hpp"
-#include "CSSRule.hpp"
 #include "CSSValue.hpp"
 
-using std::shared_ptr;
-using std::weak_ptr;
+using std::string;
 
 enum CSSPropertyType {
 
@@ -218,7 +216,9 @@ enum CSSPropertyType {
 	WORD_BREAK,
 	WORD_SPACING,
 	WORD_WRAP,
-	Z_INDEX
+	Z_INDEX,
+	//
+	CSS_PROPERTY_UNKNOWN
 
 };
 
@@ -264,11 +264,11 @@ class CSSDeclaration {
 
 	public:
 		CSSPropertyType type;
-		shared_ptr<CSSValueType> value;
+		string value;
 		CSSSpecificity specificity;
-		weak_ptr<CSSRule> parent;
+		bool important;
 
-		CSSDeclaration(CSSPropertyType _type, shared_ptr<CSSValueType> _value, CSSSpecificity _specificity, weak_ptr<CSSRule> _parent);
+		CSSDeclaration(CSSPropertyType _type, string _value, CSSSpecificity _specificity, bool _important = false);
 
 		CSSDeclaration(CSSDeclaration const & cpy);
 		CSSDeclaration(CSSDeclaration && mv) ;
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_DEVICE_HEADER
+#define CSS_DEVICE_HEADER
+
+#include <string>
+
+using std::string;
+
+class CSSDevice {
+
+		/*
+		What the stylesheets are being read for. @media blocks and
+		@import media lists are checked against this once, while the
+		stylesheet is parsed, and anything that doesn't apply is left
+		out of the rules altogether.
+
+		The default is a colour screen the size of a typical reader.
+		*/
+
+	public:
+		string media_type;
+
+		//In CSS pixels.
+		unsigned int width;
+		unsigned int height;
+
+		//Bits per colour component, zero for a monochrome device, and
+		//bits per pixel for a monochrome one, zero otherwise.
+		unsigned int color;
+		unsigned int monochrome;
+
+		CSSDevice();
+		CSSDevice(const string media_type, const unsigned int width, const unsigned int height, const unsigned int color, const unsigned int monochrome);
+
+		CSSDevice(CSSDevice const & cpy);
+		CSSDevice(CSSDevice && mv) ;
+		CSSDevice & operator =(const CSSDevice & cpy);
+		CSSDevice & operator =(CSSDevice && mv) ;
+
+		~CSSDevice();
+
+		//Whether a media query list, like "screen and (min-width: 40em), print",
+		//applies. An empty list applies to everything.
+		bool matches(const string & media) const;
+
+		//Tells one profile from another, for caching what was parsed with it.
+		string key() const;
+
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_ELEMENT_HEADER
+#define CSS_ELEMENT_HEADER
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class CSSElement {
+
+		/*
+		An element as the selector matching sees it: its name, id and
+		classes, plus links to its parent and to the element just before
+		it among its siblings. Content builds these on the stack as it
+		walks the document, so the links are only good for as long as
+		the walk is below them.
+		*/
+
+	public:
+		string element;
+		string id;
+		vector<string> classes;
+
+		//The style attribute, as written.
+		string style;
+
+		const CSSElement * parent;
+		const CSSElement * previous;
+
+		CSSElement();
+		CSSElement(const string element, const string id, const vector<string> classes, const CSSElement * parent, const CSSElement * previous);
+
+		CSSElement(CSSElement const & cpy);
+		CSSElement(CSSElement && mv) ;
+		CSSElement & operator =(const CSSElement & cpy);
+		CSSElement & operator =(CSSElement && mv) ;
+
+		~CSSElement();
+
+		bool has_class(const string & name) const;
+
+		//element#id.class.class, with the classes sorted.
+		string signature() const;
+
+};
+
+#endif
\ No newline at end of file
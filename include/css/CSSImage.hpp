@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_IMAGE_HEADER
+#define CSS_IMAGE_HEADER
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/filesystem.hpp>
+
+using std::uint32_t;
+using std::shared_ptr;
+using std::string;
+
+using namespace boost::filesystem;
+
+class CSS;
+class CSSRule;
+
+#include "CSSDeclaration.hpp"
+
+class CSSImage {
+
+		/*
+		A compiled CSS written out flat, so that it can be mapped
+		straight into memory and read where it lies: a header, then the
+		rule table, the declarations, the selector index, the computed
+		styles and a pool that every string in the others points into.
+		Opening one is a single mmap plus a bounds check of the tables.
+		Lookups are binary searches and array indexing, with no
+		allocation.
+
+		CSS::save_to() keeps one next to the rules, and a CSS loaded
+		back from the database answers cascade() from it, so reopening
+		a book never compiles a selector. An image read from the
+		database is copied into memory in one piece rather than mapped.
+
+		Images are tied to the version in the header and to the byte
+		order they were written in. Anything else is refused rather than
+		converted; write it again from the CSS.
+		*/
+
+	private:
+		//The mapped file or copied blob, let go of when the last copy
+		//does.
+		shared_ptr<const char> mapping;
+		size_t length;
+
+		const char * rule_table;
+		const char * declaration_table;
+		const char * index_table;
+		const char * style_table;
+		const char * pair_table;
+		const char * pool;
+
+		uint32_t n_rules;
+		uint32_t n_declarations;
+		uint32_t n_index;
+		uint32_t n_styles;
+		uint32_t n_pairs;
+		uint32_t pool_size;
+
+		//Checks the header and every table against length.
+		void check();
+
+	public:
+		CSSImage();
+		CSSImage(const path & file);
+		CSSImage(const char * data, const size_t length);
+
+		CSSImage(CSSImage const & cpy);
+		CSSImage(CSSImage && mv) ;
+		CSSImage & operator =(const CSSImage & cpy);
+		CSSImage & operator =(CSSImage && mv) ;
+
+		~CSSImage();
+
+		//The image of css, as bytes or written to file.
+		static string to_blob(const CSS & css);
+		static void write(const CSS & css, const path & file);
+
+		//True until something has been loaded.
+		bool empty() const;
+
+		unsigned int count() const;
+
+		//A rule's selector as written, pointing into the image, or
+		//nullptr if there's no such rule.
+		const char * selector(const unsigned int rule, uint32_t & selector_length) const;
+		bool contains_rule(const string & selector) const;
+
+		//The computed style match() named name (signature@number), or
+		//-1 if the image doesn't have it.
+		int find_style(const string & name) const;
+
+		//A property's value in a saved style, pointing into the image,
+		//or nullptr if the style doesn't set it.
+		const char * find_declaration(const int style, const CSSPropertyType type, uint32_t & value_length, bool & important) const;
+
+		//A saved style in full, the same as cascade() worked it out.
+		CSSRule style(const int style) const;
+
+};
+
+#endif
\ No newline at end of file
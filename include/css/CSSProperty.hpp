@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_PROPERTY_HEADER
+#define CSS_PROPERTY_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "CSSDeclaration.hpp"
+
+using std::size_t;
+using std::uint32_t;
+using std::string;
+using std::vector;
+using std::pair;
+
+/*
+Property names are looked up through a perfect hash. The hash is
+a case-folding FNV-1a, and it is constexpr so that the lookup in
+CSSPropertyType_from_string can switch directly on the hash of each
+known property name. Two names hashing to the same value would be
+a duplicate case label, so the compiler proves that the hash is
+perfect over the table; a single string compare afterwards rejects
+unknown names that happen to land on a label.
+*/
+
+constexpr char css_property_fold(const char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+constexpr uint32_t css_property_hash(const char * name, const size_t length, const uint32_t hash = 2166136261u)
+{
+	return length == 0 ? hash : css_property_hash(name + 1, length - 1, (hash ^ (uint32_t)(unsigned char) css_property_fold(*name)) * 16777619u);
+}
+
+template<size_t N>
+constexpr uint32_t css_property_hash(const char (&name)[N])
+{
+	return css_property_hash(name, N - 1);
+}
+
+CSSPropertyType CSSPropertyType_from_string(const char * name, const size_t length);
+
+inline CSSPropertyType CSSPropertyType_from_string(const string & name)
+{
+	return CSSPropertyType_from_string(name.data(), name.length());
+}
+
+/*
+Shorthands expand to the longhand properties that they set. The
+returned array is static, so nothing is allocated; properties
+which are not shorthands have no longhands.
+*/
+size_t CSSPropertyType_longhands(const CSSPropertyType type, const CSSPropertyType * & longhands);
+
+/*
+Split a declaration into the (property, value) pairs that it sets.
+The declaration itself always comes first; shorthands are followed
+by their longhands with the value distributed between them.
+*/
+void CSSPropertyType_expand(const CSSPropertyType type, const string & value, vector<pair<CSSPropertyType, string>> & out);
+
+#endif
\ No newline at end of file
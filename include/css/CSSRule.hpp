@@ -31,12 +31,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <map>
 #include <vector>
-#include <memory>
 
 using std::string;
 using std::map;
 using std::vector;
-using std::shared_ptr;
 
 class CSSRule;
 
@@ -48,7 +46,8 @@ class CSSRule {
 		CSSSelector selector;
 		string collation_key;
 		map<string, string> raw_pairs;
-		vector<shared_ptr<CSSDeclaration>> declarations;
+		vector<CSSDeclaration> declarations;
+		unsigned int source_order;
 
 		CSSRule();
 		CSSRule(string selector);
@@ -66,6 +65,9 @@ class CSSRule {
 		friend inline bool operator>=(const CSSRule & lhs, const CSSRule & rhs);
 
 		void add(const CSSRule & rhs);
+		void add_declaration(const string & name, const string & value);
+
+		const CSSDeclaration * find_declaration(const CSSPropertyType type) const;
 
 };
 
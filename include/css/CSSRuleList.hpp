@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef CSS_RULE_LIST_HEADER
+#define CSS_RULE_LIST_HEADER
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <boost/iterator/indirect_iterator.hpp>
+
+using std::size_t;
+using std::shared_ptr;
+using std::vector;
+
+class CSS;
+
+#include "CSSRule.hpp"
+
+class CSSRuleList {
+
+		/*
+		The rules of a CSS without copies of them. Each rule stays in the
+		stylesheet it was parsed into, which the stylesheet cache may be
+		sharing with any number of other books, so they are only ever
+		handed out const.
+
+		A rule's own source_order counts from the start of its stylesheet.
+		source_order() here counts on across the stylesheets in the order
+		they were added, which is the order the cascade wants.
+
+		The rules of a CSS loaded from a database are only read in when
+		first asked for. Until then owner is that CSS, and anything
+		reading the list has it read them in first.
+		*/
+
+	private:
+		friend class CSS;
+
+		const CSS * owner;
+
+		vector<shared_ptr<const vector<CSSRule>>> stylesheets;
+		vector<const CSSRule *> entries;
+		vector<unsigned int> orders;
+
+		void load() const;
+
+		//Member for member, leaving the rules where they are, for a CSS
+		//copying or moving its own list.
+		void assign(const CSSRuleList & cpy);
+		void assign(CSSRuleList && mv);
+
+	public:
+		typedef boost::indirect_iterator<vector<const CSSRule *>::const_iterator> const_iterator;
+
+		CSSRuleList();
+
+		CSSRuleList(CSSRuleList const & cpy);
+		CSSRuleList(CSSRuleList && mv) ;
+		CSSRuleList & operator =(const CSSRuleList & cpy);
+		CSSRuleList & operator =(CSSRuleList && mv) ;
+
+		~CSSRuleList();
+
+		//Everything in stylesheet, after whatever is already here.
+		void add(shared_ptr<const vector<CSSRule>> stylesheet);
+
+		//Sort by specificity and then source order.
+		void sort();
+		void clear();
+
+		size_t size() const;
+		bool empty() const;
+		const CSSRule & operator[](const size_t index) const;
+		unsigned int source_order(const size_t index) const;
+
+		const_iterator begin() const;
+		const_iterator end() const;
+
+};
+
+#endif
\ No newline at end of file
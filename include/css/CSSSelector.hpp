@@ -36,6 +36,8 @@ using std::unordered_set;
 using std::vector;
 using std::string;
 
+#include "CSSComplexSelector.hpp"
+
 class CSSSelector {
 
 		/*
@@ -74,11 +76,16 @@ class CSSSelector {
 			? declarations
 		}
 
+		Parsing is done entirely on the selector being built; nothing is
+		shared or initialised behind the scenes, so selectors can be
+		built on any number of threads at once.
+
 		*/
 
 	private:
 		unordered_set<string> selector_keys;
 		vector<ustring> selector_text;
+		vector<CSSComplexSelector> compiled_selectors;
 
 	public:
 		string raw_text;
@@ -100,6 +107,9 @@ class CSSSelector {
 		unsigned int count() const;
 		bool matches(const ustring & name) const;
 
+		const unordered_set<string> & keys() const;
+		const vector<CSSComplexSelector> & compiled() const;
+
 };
 
 inline bool operator==(const CSSSelector & lhs, const CSSSelector & rhs)
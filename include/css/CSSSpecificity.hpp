@@ -28,13 +28,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef CSS_SPECIFICITY_HEADER
 #define CSS_SPECIFICITY_HEADER
 
+#include <cstdint>
+
+using std::uint32_t;
+
 class CSSSpecificity {
 
+		/*
+		The four components are packed into one integer, a in the top
+		byte down to d in the bottom one, so that comparing two
+		specificities is a single integer compare. Each component
+		saturates at 255, which no real selector gets anywhere near.
+		*/
+
 	private:
-		unsigned int a;
-		unsigned int b;
-		unsigned int c;
-		unsigned int d;
+		//CSSImage saves and restores it as it is.
+		friend class CSSImage;
+
+		uint32_t packed;
 
 	public:
 		CSSSpecificity();
@@ -59,23 +70,7 @@ class CSSSpecificity {
 
 inline bool operator==(const CSSSpecificity & lhs, const CSSSpecificity & rhs)
 {
-	if(lhs.d != rhs.d) {
-		return false;
-	}
-
-	if(lhs.c != rhs.c) {
-		return false;
-	}
-
-	if(lhs.b != rhs.b) {
-		return false;
-	}
-
-	if(lhs.a != rhs.a) {
-		return false;
-	}
-
-	return true;
+	return lhs.packed == rhs.packed;
 }
 
 inline bool operator!=(const CSSSpecificity & lhs, const CSSSpecificity & rhs)
@@ -87,44 +82,8 @@ inline bool operator< (const CSSSpecificity & lhs, const CSSSpecificity & rhs)
 {
 	// Is 1,0,0,0 less than 0,1,0,0? No.
 	// Is 0,1,0,0 less than 1,0,0,0? Yes
-
-	// Check greater or less for a, then b etc.
-	// Only cascade through if the values are equal.
-
-	if(lhs.a < rhs.a) {
-		return true;
-	}
-
-	if(lhs.a > rhs.a) {
-		return false;
-	}
-
-	if(lhs.b < rhs.b) {
-		return true;
-	}
-
-	if(lhs.b > rhs.b) {
-		return false;
-	}
-
-	if(lhs.c < rhs.c) {
-		return true;
-	}
-
-	if(lhs.c > rhs.c) {
-		return false;
-	}
-
-	if(lhs.d < rhs.d) {
-		return true;
-	}
-
-	if(lhs.d > rhs.d) {
-		return false;
-	}
-
-	return false;
-
+	// a is in the most significant byte, so this falls out of the packing.
+	return lhs.packed < rhs.packed;
 }
 inline bool operator> (const CSSSpecificity & lhs, const CSSSpecificity & rhs)
 {
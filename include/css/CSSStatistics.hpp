@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CSS_STATISTICS_HEADER
+#define CSS_STATISTICS_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+
+using std::size_t;
+using std::uint64_t;
+using std::string;
+using std::vector;
+using std::pair;
+using std::unordered_map;
+using std::atomic;
+using std::mutex;
+
+class CSSSelectorStatistics {
+
+	public:
+		//Times the selector was looked up or tried against an element.
+		uint64_t lookups;
+		//Lookups that found it, or tries that matched.
+		uint64_t hits;
+		//Lookups that didn't, or tries that failed.
+		uint64_t misses;
+		//Times its rule was merged into a computed style.
+		uint64_t merges;
+
+		CSSSelectorStatistics();
+
+		CSSSelectorStatistics(CSSSelectorStatistics const & cpy);
+		CSSSelectorStatistics(CSSSelectorStatistics && mv) ;
+		CSSSelectorStatistics & operator =(const CSSSelectorStatistics & cpy);
+		CSSSelectorStatistics & operator =(CSSSelectorStatistics && mv) ;
+
+		~CSSSelectorStatistics();
+
+};
+
+class CSSStatistics {
+
+		/*
+		What a CSS spent resolving styles, for finding the stylesheets
+		that cost the most. It is only collected once
+		CSS::enable_statistics() has been called; until then the only
+		cost is a null check in each lookup.
+
+		Selectors are counted by their text as written in the
+		stylesheet, or as asked for in get_rule() and contains_rule(),
+		so selectors that don't exist show up as misses too.
+
+		A CSS shared between threads counts into the one set of
+		statistics, so the totals are atomic and the selectors are
+		behind a lock.
+		*/
+
+	private:
+		mutable mutex lock;
+		unordered_map<string, CSSSelectorStatistics> selectors;
+
+	public:
+		//get_rule() and contains_rule()
+		atomic<uint64_t> lookups;
+		atomic<uint64_t> hits;
+		atomic<uint64_t> misses;
+
+		//cascade() and match() calls, and the selectors match() tried.
+		atomic<uint64_t> cascades;
+		atomic<uint64_t> matches;
+		atomic<uint64_t> candidates;
+		//Candidates the ancestor filter threw out without walking up.
+		atomic<uint64_t> filtered;
+
+		//Computed styles worked out, styles that were already memoised,
+		//and the rules merged into the new ones.
+		atomic<uint64_t> computed;
+		atomic<uint64_t> memoised;
+		atomic<uint64_t> merges;
+
+		//Wall time spent inside the calls above, summed over the threads
+		//making them. Calls nested in another on the same thread are
+		//counted once.
+		atomic<uint64_t> nanoseconds;
+
+		CSSStatistics();
+
+		CSSStatistics(CSSStatistics const & cpy);
+		CSSStatistics(CSSStatistics && mv) ;
+		CSSStatistics & operator =(const CSSStatistics & cpy);
+		CSSStatistics & operator =(CSSStatistics && mv) ;
+
+		~CSSStatistics();
+
+		void clear();
+
+		//Adds to the counts for selector.
+		void count(const string & selector, const uint64_t lookups, const uint64_t hits, const uint64_t misses, const uint64_t merges);
+
+		//The counts for selector so far, all 0 if it hasn't been seen.
+		CSSSelectorStatistics selector(const string & selector) const;
+
+		//The n selectors looked up or tried most often, most first.
+		vector<pair<string, CSSSelectorStatistics>> hottest(const size_t n) const;
+
+		//Everything above as a JSON object. Selectors are listed hottest
+		//first, limited to the first limit of them if limit isn't 0.
+		string to_json(const size_t limit = 0) const;
+
+		//value quoted and escaped for JSON.
+		static string json_string(const string & value);
+
+};
+
+#endif
\ No newline at end of file
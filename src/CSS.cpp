@@ -30,25 +30,55 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <utility>
 #include <fstream>
+#include <sstream>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include <iostream>
-#include <regex>
 #include <limits>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
 
 #include "SQLiteUtils.hpp"
-#include "RegexUtils.hpp"
 
 using std::string;
 using std::move;
 using std::ifstream;
+using std::ostringstream;
+using std::mutex;
+using std::lock_guard;
+using std::shared_ptr;
+using std::make_shared;
+using std::thread;
+using std::atomic;
+using std::exception_ptr;
+using std::current_exception;
+using std::rethrow_exception;
+using std::max;
 using std::pair;
-using std::regex;
-using std::regex_error;
-using std::regex_search;
-using std::regex_match;
-using std::sregex_iterator;
-using std::smatch;
 using std::numeric_limits;
 using std::stod;
+using std::find_if;
+using std::sort;
+using std::min;
+using std::lower_bound;
+using std::unique;
+using std::find;
+using std::make_pair;
+using std::isalnum;
+using std::tolower;
+using std::strchr;
+using std::strtod;
+using std::strtoul;
+using std::to_string;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
 
 //#ifdef DEBUG
 #include <iostream>
@@ -58,970 +88,3092 @@ using std::endl;
 
 namespace {
 
-	regex regex_selector_split;
-	regex regex_id_compound;
-	regex regex_id_single;
-	regex regex_class_compound;
-	regex regex_class_single;
-	regex regex_contextual;
+	inline bool __is_space(const char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f';
+	}
+
+	inline bool __is_ident_char(const char c)
+	{
+		return isalnum((unsigned char) c) || c == '-' || c == '_' || (unsigned char) c >= 0x80;
+	}
+
+	inline bool __skip_space(const string & text, size_t & pos)
+	{
+		const size_t begin = pos;
+
+		while(pos < text.length() && __is_space(text[pos])) {
+			pos++;
+		}
+
+		return pos > begin;
+	}
+
+	//An identifier, escapes and all, starting at pos.
+	inline bool __read_ident(const string & text, size_t & pos, string & out)
+	{
+
+		const size_t begin = pos;
+
+		while(pos < text.length()) {
+			if(text[pos] == '\\' && pos + 1 < text.length()) {
+				pos += 2;
+			}
+			else if(__is_ident_char(text[pos])) {
+				pos++;
+			}
+			else {
+				break;
+			}
+		}
+
+		out = text.substr(begin, pos - begin);
+		return pos > begin;
+
+	}
+
+	//Skip to just past the bracket closing the one at pos, stepping
+	//over quoted strings and nested brackets.
+	inline bool __skip_block(const string & text, size_t & pos, const char open, const char close)
+	{
+
+		int depth = 0;
+		char quote = '\0';
+
+		for( ; pos < text.length(); pos++) {
+
+			const char c = text[pos];
+
+			if(quote != '\0') {
+				if(c == '\\') {
+					pos++;
+				}
+				else if(c == quote) {
+					quote = '\0';
+				}
+			}
+			else if(c == '"' || c == '\'') {
+				quote = c;
+			}
+			else if(c == open) {
+				depth++;
+			}
+			else if(c == close && --depth == 0) {
+				pos++;
+				return true;
+			}
+
+		}
+
+		return false;
+
+	}
+
+	//Pseudo-elements that CSS2 allows with a single colon.
+	inline bool __is_legacy_pseudo_element(const string & name)
+	{
+		return name == "before" || name == "after" || name == "first-line" || name == "first-letter";
+	}
+
+	/*
+	Parse one complex selector starting at pos, stopping at a comma
+	or the end of the text. Specificity is counted as we go: b for
+	ids, c for classes, attributes and pseudo-classes, d for elements
+	and pseudo-elements. Returns false if the selector is malformed.
+	*/
+	bool __parse_complex_selector(const string & text, size_t & pos, CSSComplexSelector & out, unsigned int & b, unsigned int & c, unsigned int & d)
+	{
+
+		CSSCombinator combinator = CSS_COMBINATOR_NONE;
+
+		__skip_space(text, pos);
+
+		while(pos < text.length() && text[pos] != ',') {
+
+			CSSCompoundSelector compound;
+			compound.combinator = combinator;
+
+			const size_t begin = pos;
+
+			if(text[pos] == '*') {
+				pos++;
+			}
+			else if(__is_ident_char(text[pos]) || text[pos] == '\\') {
+				__read_ident(text, pos, compound.element);
+
+				for(auto & ch : compound.element) {
+					ch = tolower((unsigned char) ch);
+				}
+
+				d++;
+			}
+
+			const size_t qualifiers = pos;
+
+			while(pos < text.length()) {
+
+				const char ch = text[pos];
+				string name;
+
+				if(ch == '#') {
+					pos++;
+
+					if(!__read_ident(text, pos, name)) {
+						return false;
+					}
+
+					if(compound.id.empty()) {
+						compound.id = name;
+					}
+					else {
+						//#a#b can only match if they're the same, so keep the extras aside.
+						compound.other.push_back("#" + name);
+					}
+
+					b++;
+				}
+				else if(ch == '.') {
+					pos++;
+
+					if(!__read_ident(text, pos, name)) {
+						return false;
+					}
+
+					compound.classes.push_back(name);
+					c++;
+				}
+				else if(ch == '[') {
+					const size_t start = pos;
+
+					if(!__skip_block(text, pos, '[', ']')) {
+						return false;
+					}
+
+					compound.other.push_back(text.substr(start, pos - start));
+					c++;
+				}
+				else if(ch == ':') {
+					const size_t start = pos;
+					const bool element = (pos + 1 < text.length() && text[pos + 1] == ':');
+					pos += element ? 2 : 1;
+
+					if(!__read_ident(text, pos, name)) {
+						return false;
+					}
+
+					if(pos < text.length() && text[pos] == '(' && !__skip_block(text, pos, '(', ')')) {
+						return false;
+					}
+
+					compound.other.push_back(text.substr(start, pos - start));
+
+					if(element || __is_legacy_pseudo_element(name)) {
+						d++;
+					}
+					else {
+						c++;
+					}
+				}
+				else {
+					break;
+				}
+
+			}
+
+			if(pos == begin) {
+				//Nothing we understand here.
+				return false;
+			}
+
+			out.text += (compound.element.empty() ? text.substr(begin, qualifiers - begin) : compound.element) + text.substr(qualifiers, pos - qualifiers);
+			out.compounds.push_back(move(compound));
+
+			//Now the combinator, if there is one.
+			const bool space = __skip_space(text, pos);
+
+			if(pos == text.length() || text[pos] == ',') {
+				break;
+			}
+
+			if(text[pos] == '>' || text[pos] == '+' || text[pos] == '~') {
+				combinator = (text[pos] == '>') ? CSS_COMBINATOR_CHILD : (text[pos] == '+') ? CSS_COMBINATOR_ADJACENT : CSS_COMBINATOR_SIBLING;
+				out.text += string(" ") + text[pos] + " ";
+				pos++;
+				__skip_space(text, pos);
+
+				if(pos == text.length() || text[pos] == ',') {
+					//A combinator with nothing on its right.
+					return false;
+				}
+			}
+			else if(space) {
+				combinator = CSS_COMBINATOR_DESCENDANT;
+				out.text += " ";
+			}
+			else {
+				return false;
+			}
+
+		}
+
+		return !out.compounds.empty();
+
+	}
+
+	/*
+	Anything to the left of a child or descendant combinator is an
+	ancestor of the subject. (To the left of a sibling combinator it is
+	a sibling of the subject or of one of its ancestors, which says
+	nothing about what's above the subject.)
+	*/
+	void __collect_ancestor_hashes(CSSComplexSelector & selector)
+	{
+
+		for(size_t i = selector.compounds.size() - 1; i > 0; i--) {
+
+			const CSSCombinator combinator = selector.compounds[i].combinator;
+
+			if(combinator != CSS_COMBINATOR_CHILD && combinator != CSS_COMBINATOR_DESCENDANT) {
+				continue;
+			}
+
+			const CSSCompoundSelector & ancestor = selector.compounds[i - 1];
+
+			if(!ancestor.element.empty()) {
+				selector.ancestor_hashes.push_back(CSSAncestorFilter::hash(ancestor.element));
+			}
+
+			if(!ancestor.id.empty()) {
+				selector.ancestor_hashes.push_back(CSSAncestorFilter::hash("#" + ancestor.id));
+			}
+
+			for(auto & name : ancestor.classes) {
+				selector.ancestor_hashes.push_back(CSSAncestorFilter::hash("." + name));
+			}
+
+		}
+
+	}
+
+	inline bool __matches_compound(const CSSCompoundSelector & compound, const CSSElement & element)
+	{
+
+		if(!compound.element.empty() && compound.element != element.element) {
+			return false;
+		}
+
+		if(!compound.id.empty() && compound.id != element.id) {
+			return false;
+		}
+
+		for(auto & name : compound.classes) {
+			if(!element.has_class(name)) {
+				return false;
+			}
+		}
+
+		for(auto & qualifier : compound.other) {
+
+			if(qualifier[0] == '#') {
+				if(qualifier.compare(1, string::npos, element.id) != 0) {
+					return false;
+				}
+			}
+			else if(qualifier == ":first-child") {
+				if(element.previous) {
+					return false;
+				}
+			}
+			else {
+				//Attributes, states and pseudo-elements aren't something
+				//we can see from here, so never match them.
+				return false;
+			}
+
+		}
+
+		return true;
+
+	}
+
+	//Match compounds[0..index] right to left, starting at element.
+	bool __matches_complex(const CSSComplexSelector & selector, const size_t index, const CSSElement * element)
+	{
+
+		if(!__matches_compound(selector.compounds[index], *element)) {
+			return false;
+		}
+
+		if(index == 0) {
+			return true;
+		}
+
+		switch(selector.compounds[index].combinator) {
+
+			case CSS_COMBINATOR_CHILD:
+				return element->parent && __matches_complex(selector, index - 1, element->parent);
+
+			case CSS_COMBINATOR_DESCENDANT:
+				for(const CSSElement * ancestor = element->parent; ancestor; ancestor = ancestor->parent) {
+					if(__matches_complex(selector, index - 1, ancestor)) {
+						return true;
+					}
+				}
+
+				return false;
+
+			case CSS_COMBINATOR_ADJACENT:
+				return element->previous && __matches_complex(selector, index - 1, element->previous);
+
+			case CSS_COMBINATOR_SIBLING:
+				for(const CSSElement * sibling = element->previous; sibling; sibling = sibling->previous) {
+					if(__matches_complex(selector, index - 1, sibling)) {
+						return true;
+					}
+				}
+
+				return false;
+
+			default:
+				return false;
+
+		}
+
+	}
+
+	//The one key every element the selector matches must have, so rules
+	//can be bucketed on it: the id, else a class, else the element name.
+	inline string __subject_key(const CSSComplexSelector & selector)
+	{
+
+		const CSSCompoundSelector & subject = selector.compounds.back();
+
+		if(!subject.id.empty()) {
+			return "#" + subject.id;
+		}
+
+		if(!subject.classes.empty()) {
+			return "." + subject.classes[0];
+		}
+
+		if(!subject.element.empty()) {
+			return subject.element;
+		}
+
+		return "*";
+
+	}
+
+	inline string __trim(const string & text)
+	{
+
+		const size_t begin = text.find_first_not_of(" \t\r\n\f");
+
+		if(begin == string::npos) {
+			return "";
+		}
+
+		return text.substr(begin, text.find_last_not_of(" \t\r\n\f") - begin + 1);
+
+	}
+
+	inline string __lowercase(string text)
+	{
+
+		for(auto & ch : text) {
+			ch = tolower((unsigned char) ch);
+		}
+
+		return text;
+
+	}
+
+	//Everything but the comments, strings left as they are.
+	string __strip_comments(const string & text)
+	{
+
+		string result;
+		result.reserve(text.length());
+
+		char quote = '\0';
+
+		for(size_t pos = 0; pos < text.length(); pos++) {
+
+			const char c = text[pos];
+
+			if(quote != '\0') {
+				result += c;
+
+				if(c == '\\' && pos + 1 < text.length()) {
+					result += text[++pos];
+				}
+				else if(c == quote) {
+					quote = '\0';
+				}
+			}
+			else if(c == '/' && pos + 1 < text.length() && text[pos + 1] == '*') {
+				const size_t close = text.find("*/", pos + 2);
+				pos = (close == string::npos) ? text.length() : close + 1;
+				//A comment still separates whatever is either side of it.
+				result += ' ';
+			}
+			else {
+				if(c == '"' || c == '\'') {
+					quote = c;
+				}
+
+				result += c;
+			}
+
+		}
+
+		return result;
+
+	}
+
+	/*
+	The first of stops at or after pos, and before end, that isn't inside
+	a string, brackets or a nested block. A '}' closing the block we're
+	in always stops the search. Returns end if there isn't one.
+	*/
+	size_t __find_at_level(const string & text, size_t pos, const size_t end, const char * stops)
+	{
+
+		int depth = 0;
+		char quote = '\0';
+
+		for( ; pos < end; pos++) {
+
+			const char c = text[pos];
+
+			if(quote != '\0') {
+				if(c == '\\') {
+					pos++;
+				}
+				else if(c == quote) {
+					quote = '\0';
+				}
+			}
+			else if(c == '"' || c == '\'') {
+				quote = c;
+			}
+			else if(depth == 0 && c != '\0' && strchr(stops, c)) {
+				return pos;
+			}
+			else if(c == '(' || c == '[' || c == '{') {
+				depth++;
+			}
+			else if(c == ')' || c == ']' || c == '}') {
+				if(depth == 0) {
+					return pos;
+				}
+
+				depth--;
+			}
+
+		}
+
+		return end;
+
+	}
+
+	//A length in a media feature, in CSS pixels. An em is taken as 16px.
+	inline bool __media_length(const string & value, double & px)
+	{
+
+		char * unit;
+		px = strtod(value.c_str(), &unit);
+
+		if(unit == value.c_str()) {
+			return false;
+		}
+
+		const string suffix = __lowercase(__trim(unit));
+
+		if(suffix.empty() || suffix == "px") {
+			return true;
+		}
+		else if(suffix == "em" || suffix == "rem") {
+			px *= 16.0;
+		}
+		else if(suffix == "pt") {
+			px *= 96.0 / 72.0;
+		}
+		else if(suffix == "in") {
+			px *= 96.0;
+		}
+		else if(suffix == "cm") {
+			px *= 96.0 / 2.54;
+		}
+		else if(suffix == "mm") {
+			px *= 96.0 / 25.4;
+		}
+		else {
+			return false;
+		}
+
+		return true;
+
+	}
+
+	inline bool __media_compare(const double actual, const double wanted, const int bound)
+	{
+		return (bound > 0) ? actual >= wanted : (bound < 0) ? actual <= wanted : actual == wanted;
+	}
+
+	/*
+	Test one feature, written as it is inside the brackets. Returns
+	false if it's not a feature we know, in which case the whole
+	query doesn't apply.
+	*/
+	bool __media_feature(const string & feature, const CSSDevice & device, bool & result)
+	{
+
+		const size_t colon = feature.find(':');
+		string name = __lowercase(__trim(feature.substr(0, colon)));
+		const string value = (colon == string::npos) ? "" : __lowercase(__trim(feature.substr(colon + 1)));
+
+		//-1 for max-, 1 for min-
+		int bound = 0;
+
+		if(name.compare(0, 4, "min-") == 0) {
+			bound = 1;
+			name = name.substr(4);
+		}
+		else if(name.compare(0, 4, "max-") == 0) {
+			bound = -1;
+			name = name.substr(4);
+		}
+
+		//There's no viewport apart from the device here.
+		if(name.compare(0, 7, "device-") == 0) {
+			name = name.substr(7);
+		}
+
+		if(bound != 0 && value.empty()) {
+			return false;
+		}
+
+		if(name == "width" || name == "height") {
+
+			const double actual = (name == "width") ? device.width : device.height;
+			double wanted = 0;
+
+			if(value.empty()) {
+				result = actual > 0;
+				return true;
+			}
+
+			if(!__media_length(value, wanted)) {
+				return false;
+			}
+
+			result = __media_compare(actual, wanted, bound);
+			return true;
+
+		}
+		else if(name == "color" || name == "monochrome") {
+
+			const double actual = (name == "color") ? device.color : device.monochrome;
+
+			if(value.empty()) {
+				result = actual > 0;
+				return true;
+			}
+
+			char * end;
+			const double wanted = strtod(value.c_str(), &end);
+
+			if(end == value.c_str() || *end != '\0') {
+				return false;
+			}
+
+			result = __media_compare(actual, wanted, bound);
+			return true;
+
+		}
+		else if(name == "orientation" && bound == 0) {
+
+			if(value != "portrait" && value != "landscape") {
+				return false;
+			}
+
+			result = (value == "portrait") == (device.height >= device.width);
+			return true;
+
+		}
+
+		return false;
+
+	}
+
+	//[not|only] type [and (feature)]... or (feature) [and (feature)]...
+	bool __media_query_matches(const string & query, const CSSDevice & device)
+	{
+
+		bool result = true;
+		bool negate = false;
+		bool first = true;
+		bool typed = false;
+
+		size_t pos = 0;
+
+		while(pos < query.length()) {
+
+			if(__is_space(query[pos])) {
+				pos++;
+				continue;
+			}
+
+			if(query[pos] == '(') {
+
+				const size_t close = __find_at_level(query, pos + 1, query.length(), ")");
+				bool matched = false;
+
+				if(close == query.length() || !__media_feature(query.substr(pos + 1, close - pos - 1), device, matched)) {
+					return false;
+				}
+
+				result = result && matched;
+				pos = close + 1;
+
+			}
+			else {
+
+				string word;
+
+				if(!__read_ident(query, pos, word)) {
+					return false;
+				}
+
+				word = __lowercase(word);
+
+				if(word == "and") {
+					continue;
+				}
+				else if(first && word == "not") {
+					negate = true;
+				}
+				else if(first && word == "only") {
+					//Only there to hide the query from CSS2 parsers.
+				}
+				else if(!typed) {
+					typed = true;
+					result = result && (word == "all" || word == device.media_type);
+				}
+				else {
+					return false;
+				}
+
+			}
+
+			first = false;
+
+		}
+
+		return negate ? !result : result;
+
+	}
+
+	//name: value; name: value
+	void __parse_declarations(const string & text, size_t pos, const size_t end, CSSRule & rule)
+	{
+
+		while(pos < end) {
+
+			const size_t stop = __find_at_level(text, pos, end, ";");
+			const string declaration = text.substr(pos, stop - pos);
+			const size_t colon = declaration.find(':');
+
+			if(colon != string::npos) {
+
+				const string name = __lowercase(__trim(declaration.substr(0, colon)));
+				const string value = __trim(declaration.substr(colon + 1));
+
+				if(!name.empty() && !value.empty()) {
+					rule.raw_pairs[name] = value;
+					rule.add_declaration(name, value);
+					#ifdef DEBUG
+					cout << "\tCSS Attribute name: "  << name << endl;
+					cout << "\tCSS Attribute value "  << value << endl;
+					#endif
+				}
+
+			}
+
+			pos = stop + 1;
+
+		}
+
+	}
+
+	//Enough about a file to tell whether it has changed since.
+	struct FileStamp {
+		path file;
+		bool present;
+		uintmax_t size;
+		std::time_t modified;
+	};
+
+	FileStamp __stamp(const path & file)
+	{
+		boost::system::error_code error;
+		FileStamp stamp = { file, exists(file, error), 0, 0 };
+
+		if(stamp.present) {
+			stamp.size = file_size(file, error);
+			stamp.modified = last_write_time(file, error);
+		}
+
+		return stamp;
+	}
+
+	bool __unchanged(const vector<FileStamp> & stamps)
+	{
+		for(auto & stamp : stamps) {
+			const FileStamp now = __stamp(stamp.file);
+
+			if(now.present != stamp.present || now.size != stamp.size || now.modified != stamp.modified) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void __parse_rules(const string & text, size_t pos, const size_t end, const path & file, const CSSDevice & device, vector<CSSRule> & rules, vector<path> & importing, vector<FileStamp> & imports);
+
+	//@import url("file.css") media; prelude is everything after @import.
+	//Every file it names is stamped in imports, whether it's there or
+	//not, before it's read.
+	void __parse_import(const string & prelude, const path & file, const CSSDevice & device, vector<CSSRule> & rules, vector<path> & importing, vector<FileStamp> & imports)
+	{
+
+		string href;
+		string media;
+
+		if(__lowercase(prelude.substr(0, 4)) == "url(") {
+			const size_t close = prelude.find(')');
+
+			if(close == string::npos) {
+				return;
+			}
+
+			href = __trim(prelude.substr(4, close - 4));
+			media = prelude.substr(close + 1);
+		}
+		else if(!prelude.empty() && (prelude[0] == '"' || prelude[0] == '\'')) {
+			const size_t close = prelude.find(prelude[0], 1);
+
+			if(close == string::npos) {
+				return;
+			}
+
+			href = prelude.substr(0, close + 1);
+			media = prelude.substr(close + 1);
+		}
+		else {
+			return;
+		}
+
+		if(href.length() >= 2 && (href[0] == '"' || href[0] == '\'') && href.back() == href[0]) {
+			href = href.substr(1, href.length() - 2);
+		}
+
+		//Anything after a ? or # doesn't name a file in the archive.
+		href = href.substr(0, href.find_first_of("?#"));
+
+		if(href.empty() || href.find("://") != string::npos || !device.matches(media)) {
+			return;
+		}
+
+		//Relative to the importing stylesheet, which is where it sits in
+		//the unpacked archive.
+		path imported = file.parent_path() / href;
+
+		imports.push_back(__stamp(imported));
+
+		if(!exists(imported)) {
+			#ifdef DEBUG
+			cout << "\tCSS Missing import: "  << imported << endl;
+			#endif
+			return;
+		}
+
+		imported = canonical(imported);
+
+		if(find(importing.begin(), importing.end(), imported) != importing.end()) {
+			//It's importing itself, one way or another.
+			return;
+		}
+
+		ifstream cssfile(imported.string(), std::ios::binary);
+		ostringstream buffer;
+		buffer << cssfile.rdbuf();
+
+		const string contents = __strip_comments(buffer.str());
+
+		importing.push_back(imported);
+		__parse_rules(contents, 0, contents.length(), imported, device, rules, importing, imports);
+		importing.pop_back();
+
+	}
+
+	/*
+	Statements from pos to end: style rules, which are kept, and
+	at-rules. @media blocks are parsed in place if the device matches
+	them and dropped otherwise, @imports are parsed in place, and the
+	rest (@font-face, @page, @charset and so on) have nothing to say
+	about how content is styled, so they're skipped whole.
+	*/
+	void __parse_rules(const string & text, size_t pos, const size_t end, const path & file, const CSSDevice & device, vector<CSSRule> & rules, vector<path> & importing, vector<FileStamp> & imports)
+	{
+
+		while(pos < end) {
+
+			const size_t stop = __find_at_level(text, pos, end, "{;");
+
+			if(stop == end) {
+				//Trailing junk, or something that was never closed.
+				break;
+			}
+
+			const string prelude = __trim(text.substr(pos, stop - pos));
+
+			if(text[stop] != '{') {
+
+				//A statement. Only @import means anything here; a stray '}'
+				//or ';' is just stepped over.
+				if(__lowercase(prelude.substr(0, 7)) == "@import") {
+					__parse_import(__trim(prelude.substr(7)), file, device, rules, importing, imports);
+				}
+
+				pos = stop + 1;
+				continue;
+
+			}
+
+			const size_t close = __find_at_level(text, stop + 1, end, "}");
+
+			if(!prelude.empty() && prelude[0] == '@') {
+
+				size_t name_end = 1;
+
+				while(name_end < prelude.length() && __is_ident_char(prelude[name_end])) {
+					name_end++;
+				}
+
+				const string name = __lowercase(prelude.substr(1, name_end - 1));
+
+				if(name == "media" && device.matches(prelude.substr(name_end))) {
+					__parse_rules(text, stop + 1, close, file, device, rules, importing, imports);
+				}
+
+				#ifdef DEBUG
+				if(name != "media") {
+					cout << "\tCSS Skipping @"  << name << endl;
+				}
+				#endif
+
+			}
+			else if(!prelude.empty()) {
+
+				CSSRule rule;
+				rule.selector = CSSSelector(prelude);
+				__parse_declarations(text, stop + 1, close, rule);
+
+				#ifdef DEBUG
+				cout << "\tCSS Closing CSS class " << endl;
+				#endif
+
+				rule.source_order = rules.size();
+				rules.push_back(move(rule));
+
+			}
+
+			pos = close + 1;
+
+		}
+
+	}
+
+	/*
+	Parse one stylesheet. Rules come back in the order they appear,
+	imports included, numbered from zero; CSSRuleList numbers on
+	from there as the files are added to a CSS. Every file an @import
+	named is stamped in imports.
+	*/
+	vector<CSSRule> __parse_stylesheet(const string & contents, const path & file, const CSSDevice & device, vector<FileStamp> & imports)
+	{
+
+		vector<CSSRule> rules;
+		vector<path> importing;
+
+		if(exists(file)) {
+			importing.push_back(canonical(file));
+		}
+
+		const string text = __strip_comments(contents);
+		__parse_rules(text, 0, text.length(), file, device, rules, importing, imports);
+
+		return rules;
+
+	}
+
+	//A parsed stylesheet, with what it was parsed from. The key only has
+	//a hash of the contents, so a hit is only a hit if they're the same
+	//and nothing it imported has changed since.
+	struct CachedStylesheet {
+		string contents;
+		vector<FileStamp> imports;
+		shared_ptr<const vector<CSSRule>> rules;
+		uint64_t last_used;
+	};
+
+	//Parsed stylesheets, keyed by the device and a hash of the file they
+	//came from, so identical files from different books are only parsed
+	//once.
+	mutex stylesheet_cache_lock;
+	unordered_map<string, CachedStylesheet> stylesheet_cache;
+	uint64_t stylesheet_cache_tick = 0;
+
+	//Past this many, the least recently used stylesheet nobody is
+	//holding on to is let go for each new one.
+	const size_t stylesheet_cache_limit = 256;
+
+	//Bump whenever the layout of CSS::to_blob() changes.
+	const uint32_t css_blob_version = 1;
+
+	inline void __write_u32(string & out, const uint32_t value)
+	{
+		out += (char)(value & 0xff);
+		out += (char)((value >> 8) & 0xff);
+		out += (char)((value >> 16) & 0xff);
+		out += (char)((value >> 24) & 0xff);
+	}
+
+	inline void __write_string(string & out, const string & value)
+	{
+		__write_u32(out, value.length());
+		out += value;
+	}
+
+	inline bool __read_u32(const char * data, const size_t length, size_t & pos, uint32_t & value)
+	{
+
+		if(pos > length || length - pos < 4) {
+			return false;
+		}
+
+		const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data + pos);
+		value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+		pos += 4;
+
+		return true;
+
+	}
+
+	inline bool __read_string(const char * data, const size_t length, size_t & pos, string & value)
+	{
+
+		uint32_t size;
+
+		if(!__read_u32(data, length, pos, size) || length - pos < size) {
+			return false;
+		}
+
+		value.assign(data + pos, size);
+		pos += size;
+
+		return true;
+
+	}
+
+	//How many timed calls this thread is inside. Nothing timed in one
+	//CSS calls into another, so one count per thread is enough.
+	thread_local unsigned int __statistics_depth = 0;
+
+	//Adds the time from construction to destruction to stats, if there
+	//are any. Calls made from inside another timed call on the same
+	//thread aren't counted twice.
+	class StatisticsTimer {
+
+		private:
+			CSSStatistics * const stats;
+			steady_clock::time_point start;
+
+		public:
+			StatisticsTimer(CSSStatistics * const _stats) : stats(_stats) {
+				if(stats && __statistics_depth++ == 0) {
+					start = steady_clock::now();
+				}
+			}
+
+			~StatisticsTimer() {
+				if(stats && --__statistics_depth == 0) {
+					stats->nanoseconds += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+				}
+			}
+
+	};
+
+	inline void __count_lookup(CSSStatistics * const stats, const string & selector, const bool hit)
+	{
+
+		if(!stats) {
+			return;
+		}
+
+		stats->count(selector, 1, hit ? 1 : 0, hit ? 0 : 1, 0);
+
+	}
+
+	//get_rule() and contains_rule() count in the totals as well.
+	inline void __count_rule_lookup(CSSStatistics * const stats, const string & selector, const bool hit)
+	{
+
+		if(!stats) {
+			return;
+		}
+
+		stats->lookups++;
+
+		if(hit) {
+			stats->hits++;
+		}
+		else {
+			stats->misses++;
+		}
+
+		__count_lookup(stats, selector, hit);
+
+	}
+
+}
+
+CSSSpecificity::CSSSpecificity() :
+	CSSSpecificity(0, 0, 0, 0)
+{
+
+}
+
+CSSSpecificity::CSSSpecificity(const unsigned int _a, const unsigned int _b, const unsigned int _c, const unsigned int _d) :
+	packed((min(_a, 255u) << 24) | (min(_b, 255u) << 16) | (min(_c, 255u) << 8) | min(_d, 255u))
+{
+
+}
+
+CSSSpecificity::CSSSpecificity(CSSSpecificity const & cpy) :
+	packed(cpy.packed)
+{
+
+}
+
+CSSSpecificity::CSSSpecificity(CSSSpecificity && mv) :
+	packed(move(mv.packed))
+{
+
+}
+
+CSSSpecificity & CSSSpecificity::operator =(const CSSSpecificity & cpy)
+{
+	packed = cpy.packed;
+	return *this;
+}
+
+CSSSpecificity & CSSSpecificity::operator =(CSSSpecificity && mv)
+{
+	packed = move(mv.packed);
+	return *this;
+}
+
+CSSSpecificity::~CSSSpecificity()
+{
+
+}
+
+CSSSelector::CSSSelector() :
+	CSSSelector("")
+{
+
+}
+
+CSSSelector::CSSSelector(const string _raw_text) :
+	selector_keys(),
+	selector_text(),
+	compiled_selectors(),
+	raw_text(_raw_text),
+	specificity()
+{
+
+	if(raw_text.empty()) {
+		return;
+	}
+
+	//The specificity of the whole selector is the sum of its parts;
+	//each compiled part also carries its own.
+	unsigned int b  = 0;
+	unsigned int c  = 0;
+	unsigned int d  = 0;
+
+	size_t pos = 0;
+
+	while(pos < raw_text.length()) {
+
+		CSSComplexSelector selector;
+		unsigned int sb = 0;
+		unsigned int sc = 0;
+		unsigned int sd = 0;
+
+		if(!__parse_complex_selector(raw_text, pos, selector, sb, sc, sd)) {
+			//One bad part invalidates the whole selector, so it matches nothing.
+			#ifdef DEBUG
+			cout << "\tCSS Invalid selector: "  << raw_text << endl;
+			#endif
+			selector_keys.clear();
+			selector_text.clear();
+			compiled_selectors.clear();
+			b = c = d = 0;
+			break;
+		}
+
+		selector.specificity = CSSSpecificity(0, sb, sc, sd);
+		__collect_ancestor_hashes(selector);
+		b += sb;
+		c += sc;
+		d += sd;
+
+		selector_keys.insert(selector.text);
+		selector_text.push_back(selector.text);
+		#ifdef DEBUG
+		cout << "\tCSS Selector: "  << selector.text << endl;
+		#endif
+		compiled_selectors.push_back(move(selector));
+
+		if(pos < raw_text.length() && raw_text[pos] == ',') {
+			pos++;
+		}
+
+	}
+
+	specificity  = CSSSpecificity(0, b, c, d);
+
+}
+
+CSSSelector::CSSSelector(CSSSelector const & cpy) :
+	selector_keys(cpy.selector_keys),
+	selector_text(cpy.selector_text),
+	compiled_selectors(cpy.compiled_selectors),
+	raw_text(cpy.raw_text),
+	specificity(cpy.specificity)
+{
+
+}
+
+CSSSelector::CSSSelector(CSSSelector && mv) :
+	selector_keys(move(mv.selector_keys)),
+	selector_text(move(mv.selector_text)),
+	compiled_selectors(move(mv.compiled_selectors)),
+	raw_text(move(mv.raw_text)),
+	specificity(move(mv.specificity))
+{
+
+}
+
+CSSSelector & CSSSelector::operator =(const CSSSelector & cpy)
+{
+	selector_keys = cpy.selector_keys;
+	selector_text = cpy.selector_text;
+	compiled_selectors = cpy.compiled_selectors;
+	raw_text = cpy.raw_text;
+	specificity = cpy.specificity;
+	return *this;
+}
+
+CSSSelector & CSSSelector::operator =(CSSSelector && mv)
+{
+	selector_keys = move(mv.selector_keys);
+	selector_text = move(mv.selector_text);
+	compiled_selectors = move(mv.compiled_selectors);
+	raw_text = move(mv.raw_text);
+	specificity = move(mv.specificity);
+	return *this;
+}
+
+CSSSelector::~CSSSelector()
+{
+
+}
+
+unsigned int CSSSelector::count() const
+{
+	return selector_keys.size();
+}
+
+bool CSSSelector::matches(const ustring & name) const
+{
+	return selector_keys.count(name.raw()) > 0;
+}
+
+const unordered_set<string> & CSSSelector::keys() const
+{
+	return selector_keys;
+}
+
+const vector<CSSComplexSelector> & CSSSelector::compiled() const
+{
+	return compiled_selectors;
+}
+
+CSSCompoundSelector::CSSCompoundSelector() :
+	element(),
+	id(),
+	classes(),
+	other(),
+	combinator(CSS_COMBINATOR_NONE)
+{
+}
+
+CSSCompoundSelector::CSSCompoundSelector(CSSCompoundSelector const & cpy) :
+	element(cpy.element),
+	id(cpy.id),
+	classes(cpy.classes),
+	other(cpy.other),
+	combinator(cpy.combinator)
+{
+}
+
+CSSCompoundSelector::CSSCompoundSelector(CSSCompoundSelector && mv) :
+	element(move(mv.element)),
+	id(move(mv.id)),
+	classes(move(mv.classes)),
+	other(move(mv.other)),
+	combinator(move(mv.combinator))
+{
+}
+
+CSSCompoundSelector & CSSCompoundSelector::operator =(const CSSCompoundSelector & cpy)
+{
+	element = cpy.element;
+	id = cpy.id;
+	classes = cpy.classes;
+	other = cpy.other;
+	combinator = cpy.combinator;
+	return *this;
+}
+
+CSSCompoundSelector & CSSCompoundSelector::operator =(CSSCompoundSelector && mv)
+{
+	element = move(mv.element);
+	id = move(mv.id);
+	classes = move(mv.classes);
+	other = move(mv.other);
+	combinator = move(mv.combinator);
+	return *this;
+}
+
+CSSCompoundSelector::~CSSCompoundSelector()
+{
+}
+
+CSSComplexSelector::CSSComplexSelector() :
+	compounds(),
+	specificity(),
+	text(),
+	ancestor_hashes()
+{
+}
+
+CSSComplexSelector::CSSComplexSelector(CSSComplexSelector const & cpy) :
+	compounds(cpy.compounds),
+	specificity(cpy.specificity),
+	text(cpy.text),
+	ancestor_hashes(cpy.ancestor_hashes)
+{
+}
+
+CSSComplexSelector::CSSComplexSelector(CSSComplexSelector && mv) :
+	compounds(move(mv.compounds)),
+	specificity(move(mv.specificity)),
+	text(move(mv.text)),
+	ancestor_hashes(move(mv.ancestor_hashes))
+{
+}
+
+CSSComplexSelector & CSSComplexSelector::operator =(const CSSComplexSelector & cpy)
+{
+	compounds = cpy.compounds;
+	specificity = cpy.specificity;
+	text = cpy.text;
+	ancestor_hashes = cpy.ancestor_hashes;
+	return *this;
+}
+
+CSSComplexSelector & CSSComplexSelector::operator =(CSSComplexSelector && mv)
+{
+	compounds = move(mv.compounds);
+	specificity = move(mv.specificity);
+	text = move(mv.text);
+	ancestor_hashes = move(mv.ancestor_hashes);
+	return *this;
+}
+
+CSSComplexSelector::~CSSComplexSelector()
+{
+}
+
+CSSElement::CSSElement() :
+	element(),
+	id(),
+	classes(),
+	style(),
+	parent(nullptr),
+	previous(nullptr)
+{
+}
+
+CSSElement::CSSElement(const string _element, const string _id, const vector<string> _classes, const CSSElement * _parent, const CSSElement * _previous) :
+	element(_element),
+	id(_id),
+	classes(_classes),
+	style(),
+	parent(_parent),
+	previous(_previous)
+{
+
+	for(auto & ch : element) {
+		ch = tolower((unsigned char) ch);
+	}
+
+}
+
+CSSElement::CSSElement(CSSElement const & cpy) :
+	element(cpy.element),
+	id(cpy.id),
+	classes(cpy.classes),
+	style(cpy.style),
+	parent(cpy.parent),
+	previous(cpy.previous)
+{
+}
+
+CSSElement::CSSElement(CSSElement && mv) :
+	element(move(mv.element)),
+	id(move(mv.id)),
+	classes(move(mv.classes)),
+	style(move(mv.style)),
+	parent(mv.parent),
+	previous(mv.previous)
+{
+}
+
+CSSElement & CSSElement::operator =(const CSSElement & cpy)
+{
+	element = cpy.element;
+	id = cpy.id;
+	classes = cpy.classes;
+	style = cpy.style;
+	parent = cpy.parent;
+	previous = cpy.previous;
+	return *this;
+}
+
+CSSElement & CSSElement::operator =(CSSElement && mv)
+{
+	element = move(mv.element);
+	id = move(mv.id);
+	classes = move(mv.classes);
+	style = move(mv.style);
+	parent = mv.parent;
+	previous = mv.previous;
+	return *this;
+}
+
+CSSElement::~CSSElement()
+{
+}
+
+bool CSSElement::has_class(const string & name) const
+{
+	return find(classes.begin(), classes.end(), name) != classes.end();
+}
+
+string CSSElement::signature() const
+{
+
+	string result = element;
+
+	if(!id.empty()) {
+		result += "#";
+		result += id;
+	}
+
+	//Class order doesn't change the style, so don't let it change the signature.
+	vector<string> sorted(classes);
+	sort(sorted.begin(), sorted.end());
+
+	for(auto & name : sorted) {
+		result += ".";
+		result += name;
+	}
+
+	return result;
+
+}
+
+CSSDevice::CSSDevice() :
+	media_type("screen"),
+	width(600),
+	height(800),
+	color(8),
+	monochrome(0)
+{
+}
+
+CSSDevice::CSSDevice(const string _media_type, const unsigned int _width, const unsigned int _height, const unsigned int _color, const unsigned int _monochrome) :
+	media_type(_media_type),
+	width(_width),
+	height(_height),
+	color(_color),
+	monochrome(_monochrome)
+{
+}
+
+CSSDevice::CSSDevice(CSSDevice const & cpy) :
+	media_type(cpy.media_type),
+	width(cpy.width),
+	height(cpy.height),
+	color(cpy.color),
+	monochrome(cpy.monochrome)
+{
+}
+
+CSSDevice::CSSDevice(CSSDevice && mv) :
+	media_type(move(mv.media_type)),
+	width(mv.width),
+	height(mv.height),
+	color(mv.color),
+	monochrome(mv.monochrome)
+{
+}
+
+CSSDevice & CSSDevice::operator =(const CSSDevice & cpy)
+{
+	media_type = cpy.media_type;
+	width = cpy.width;
+	height = cpy.height;
+	color = cpy.color;
+	monochrome = cpy.monochrome;
+	return *this;
+}
+
+CSSDevice & CSSDevice::operator =(CSSDevice && mv)
+{
+	media_type = move(mv.media_type);
+	width = mv.width;
+	height = mv.height;
+	color = mv.color;
+	monochrome = mv.monochrome;
+	return *this;
+}
+
+CSSDevice::~CSSDevice()
+{
+}
+
+bool CSSDevice::matches(const string & media) const
+{
+
+	if(__trim(media).empty()) {
+		return true;
+	}
+
+	//A comma-separated list applies if any of its queries do.
+	size_t pos = 0;
+
+	while(pos <= media.length()) {
+
+		const size_t stop = __find_at_level(media, pos, media.length(), ",");
+		const string query = __trim(media.substr(pos, stop - pos));
+
+		if(!query.empty() && __media_query_matches(query, *this)) {
+			return true;
+		}
+
+		pos = stop + 1;
+
+	}
+
+	return false;
+
+}
+
+string CSSDevice::key() const
+{
+	ostringstream result;
+	result << media_type << " " << width << "x" << height << " " << color << " " << monochrome;
+	return result.str();
+}
+
+CSSAncestorFilter::CSSAncestorFilter() :
+	counters(size, 0)
+{
+}
+
+CSSAncestorFilter::CSSAncestorFilter(CSSAncestorFilter const & cpy) :
+	counters(cpy.counters)
+{
+}
+
+CSSAncestorFilter::CSSAncestorFilter(CSSAncestorFilter && mv) :
+	counters(move(mv.counters))
+{
+}
+
+CSSAncestorFilter & CSSAncestorFilter::operator =(const CSSAncestorFilter & cpy)
+{
+	counters = cpy.counters;
+	return *this;
+}
+
+CSSAncestorFilter & CSSAncestorFilter::operator =(CSSAncestorFilter && mv)
+{
+	counters = move(mv.counters);
+	return *this;
+}
+
+CSSAncestorFilter::~CSSAncestorFilter()
+{
+}
+
+uint32_t CSSAncestorFilter::hash(const string & key)
+{
+
+	//FNV-1a
+	uint32_t result = 2166136261u;
+
+	for(auto ch : key) {
+		result ^= (unsigned char) ch;
+		result *= 16777619u;
+	}
+
+	return result;
+
+}
+
+void CSSAncestorFilter::update(const CSSElement & element, const int delta)
+{
+
+	//Two probes per key, taken from different bits of the one hash.
+	auto apply = [this, delta](const uint32_t h) {
+		counters[h & mask] += delta;
+		counters[(h >> 16) & mask] += delta;
+	};
+
+	if(!element.element.empty()) {
+		apply(hash(element.element));
+	}
+
+	if(!element.id.empty()) {
+		apply(hash("#" + element.id));
+	}
+
+	for(auto & name : element.classes) {
+		apply(hash("." + name));
+	}
+
+}
+
+void CSSAncestorFilter::push(const CSSElement & element)
+{
+	update(element, 1);
+}
+
+void CSSAncestorFilter::pop(const CSSElement & element)
+{
+	update(element, -1);
+}
+
+bool CSSAncestorFilter::may_contain(const uint32_t h) const
+{
+	return counters[h & mask] > 0 && counters[(h >> 16) & mask] > 0;
+}
+
+bool CSSAncestorFilter::may_contain(const vector<uint32_t> & hashes) const
+{
+
+	for(auto h : hashes) {
+		if(!may_contain(h)) {
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+CSSValue::CSSValue() :
+	value(numeric_limits<double>::min()),
+	type(CSS_VALUE_DEFAULT)
+{
+}
+
+CSSValue::CSSValue(CSSValue const & cpy) :
+	value(cpy.value),
+	type(cpy.type)
+{
+}
+
+CSSValue::CSSValue(CSSValue && mv) :
+	value(move(mv.value)),
+	type(move(mv.type))
+{
+}
+
+CSSValue & CSSValue::operator =(const CSSValue & cpy)
+{
+	value = cpy.value;
+	type = cpy.type;
+	return *this;
+}
+
+CSSValue & CSSValue::operator =(CSSValue && mv)
+{
+	value = move(mv.value);
+	type = move(mv.type);
+	return *this;
+}
+
+CSSValue::~CSSValue()
+{
+}
+
+
+CSSDeclaration::CSSDeclaration(CSSPropertyType _type, string _value, CSSSpecificity _specificity, bool _important) :
+	type(_type),
+	value(_value),
+	specificity(_specificity),
+	important(_important)
+{
+
+}
+
+CSSDeclaration::CSSDeclaration(CSSDeclaration const & cpy) :
+	type(cpy.type),
+	value(cpy.value),
+	specificity(cpy.specificity),
+	important(cpy.important)
+{
+
+}
+
+CSSDeclaration::CSSDeclaration(CSSDeclaration && mv) :
+	type(move(mv.type)),
+	value(move(mv.value)),
+	specificity(move(mv.specificity)),
+	important(move(mv.important))
+{
+
+}
+
+CSSDeclaration & CSSDeclaration::operator =(const CSSDeclaration & cpy)
+{
+	type = cpy.type;
+	value = cpy.value;
+	specificity = cpy.specificity;
+	important = cpy.important;
+	return *this;
+}
+
+CSSDeclaration & CSSDeclaration::operator =(CSSDeclaration && mv)
+{
+	type = move(mv.type);
+	value = move(mv.value);
+	specificity = move(mv.specificity);
+	important = move(mv.important);
+	return *this;
+}
+
+CSSDeclaration::~CSSDeclaration()
+{
+}
+
+
+
+CSSRule::CSSRule() :
+	CSSRule("")
+{
+}
+
+CSSRule::CSSRule(string _selector) :
+	selector(_selector),
+	collation_key(ustring(_selector).collate_key()),
+	raw_pairs(),
+	declarations(),
+	source_order(0)
+{
+}
+
+CSSRule::CSSRule(CSSRule const & cpy) :
+	selector(cpy.selector),
+	collation_key(cpy.collation_key),
+	raw_pairs(cpy.raw_pairs),
+	declarations(cpy.declarations),
+	source_order(cpy.source_order)
+{
+}
+
+CSSRule::CSSRule(CSSRule && mv) :
+	selector(move(mv.selector)),
+	collation_key(move(mv.collation_key)),
+	raw_pairs(move(mv.raw_pairs)),
+	declarations(move(mv.declarations)),
+	source_order(move(mv.source_order))
+{
+}
+
+CSSRule & CSSRule::operator =(const CSSRule & cpy)
+{
+	selector = cpy.selector;
+	collation_key = cpy.collation_key;
+	raw_pairs = cpy.raw_pairs;
+	declarations = cpy.declarations;
+	source_order = cpy.source_order;
+	return *this;
+}
+
+CSSRule & CSSRule::operator =(CSSRule && mv)
+{
+	selector = move(mv.selector);
+	collation_key = move(mv.collation_key);
+	raw_pairs = move(mv.raw_pairs);
+	declarations = move(mv.declarations);
+	source_order = move(mv.source_order);
+	return *this;
+}
+
+CSSRule::~CSSRule() { }
+
+void CSSRule::add ( const CSSRule & rhs )
+{
+
+	//Merge rhs over the top of this rule. The caller is expected to
+	//add rules in cascade order, so anything in rhs wins unless the
+	//existing declaration is !important and the new one is not.
+
+	for(auto & pair : rhs.raw_pairs) {
+		raw_pairs[pair.first] = pair.second;
+	}
+
+	for(auto & declaration : rhs.declarations) {
+
+		auto existing = find_if(declarations.begin(), declarations.end(), [&declaration](const CSSDeclaration & d) {
+			return d.type == declaration.type;
+		});
+
+		if(existing == declarations.end()) {
+			declarations.push_back(declaration);
+		}
+		else if(!existing->important || declaration.important) {
+			*existing = declaration;
+		}
+
+	}
+
+}
+
+void CSSRule::add_declaration(const string & name, const string & value)
+{
+
+	const CSSPropertyType type = CSSPropertyType_from_string(name);
+
+	if(type == CSS_PROPERTY_UNKNOWN) {
+		#ifdef DEBUG
+		cout << "\tCSS Unknown property: "  << name << endl;
+		#endif
+		return;
+	}
+
+	//Split off a trailing !important
+	string stripped = value;
+	bool important = false;
+	const auto bang = value.rfind('!');
+
+	if(bang != string::npos) {
+
+		string flag = value.substr(bang + 1);
+		flag.erase(0, flag.find_first_not_of(" \t"));
+		flag.erase(flag.find_last_not_of(" \t") + 1);
+
+		for(auto & c : flag) {
+			c = css_property_fold(c);
+		}
+
+		if(flag.compare("important") == 0) {
+			important = true;
+			stripped = value.substr(0, bang);
+			stripped.erase(stripped.find_last_not_of(" \t") + 1);
+		}
+
+	}
+
+	vector<pair<CSSPropertyType, string>> expanded;
+	CSSPropertyType_expand(type, stripped, expanded);
+
+	//A later declaration of a property replaces an earlier one, unless
+	//only the earlier one is !important. A shorthand counts as each of
+	//the properties it sets.
+	for(auto & declaration : expanded) {
+
+		auto existing = find_if(declarations.begin(), declarations.end(), [&declaration](const CSSDeclaration & d) {
+			return d.type == declaration.first;
+		});
+
+		if(existing == declarations.end()) {
+			declarations.emplace_back(declaration.first, declaration.second, selector.specificity, important);
+		}
+		else if(!existing->important || important) {
+			*existing = CSSDeclaration(declaration.first, declaration.second, selector.specificity, important);
+		}
+
+	}
+
+}
+
+const CSSDeclaration * CSSRule::find_declaration(const CSSPropertyType type) const
+{
+
+	for(auto & declaration : declarations) {
+		if(declaration.type == type) {
+			return &declaration;
+		}
+	}
+
+	return nullptr;
+
+}
+
+CSSRuleList::CSSRuleList() :
+	owner(nullptr),
+	stylesheets(),
+	entries(),
+	orders()
+{
+}
+
+CSSRuleList::CSSRuleList(CSSRuleList const & cpy) :
+	CSSRuleList()
+{
+	cpy.load();
+	assign(cpy);
+}
+
+CSSRuleList::CSSRuleList(CSSRuleList && mv) :
+	CSSRuleList()
+{
+	mv.load();
+	assign(move(mv));
+}
+
+CSSRuleList & CSSRuleList::operator =(const CSSRuleList & cpy)
+{
+	cpy.load();
+	assign(cpy);
+	return *this;
+}
+
+CSSRuleList & CSSRuleList::operator =(CSSRuleList && mv)
+{
+	mv.load();
+	assign(move(mv));
+	return *this;
+}
+
+CSSRuleList::~CSSRuleList() { }
+
+void CSSRuleList::load() const
+{
+	if(owner != nullptr) {
+		owner->load_rules();
+	}
+}
+
+void CSSRuleList::assign(const CSSRuleList & cpy)
+{
+	stylesheets = cpy.stylesheets;
+	entries = cpy.entries;
+	orders = cpy.orders;
+}
+
+void CSSRuleList::assign(CSSRuleList && mv)
+{
+	stylesheets = move(mv.stylesheets);
+	entries = move(mv.entries);
+	orders = move(mv.orders);
+}
+
+void CSSRuleList::add(shared_ptr<const vector<CSSRule>> stylesheet)
+{
+
+	//Stylesheets later in the list win ties, so carry the numbering on
+	//from the end of the last one.
+	unsigned int offset = 0;
+
+	for(auto & added : stylesheets) {
+		offset += added->size();
+	}
+
+	entries.reserve(entries.size() + stylesheet->size());
+	orders.reserve(orders.size() + stylesheet->size());
+
+	for(auto & rule : *stylesheet) {
+		entries.push_back(&rule);
+		orders.push_back(offset + rule.source_order);
+	}
+
+	stylesheets.push_back(move(stylesheet));
+
+}
+
+void CSSRuleList::sort()
+{
+
+	vector<unsigned int> order(entries.size());
+
+	for(unsigned int i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [this](const unsigned int lhs, const unsigned int rhs) {
+		if(entries[lhs]->selector.specificity != entries[rhs]->selector.specificity) {
+			return entries[lhs]->selector.specificity < entries[rhs]->selector.specificity;
+		}
+
+		return orders[lhs] < orders[rhs];
+	});
+
+	vector<const CSSRule *> sorted_entries;
+	vector<unsigned int> sorted_orders;
+
+	sorted_entries.reserve(order.size());
+	sorted_orders.reserve(order.size());
+
+	for(auto i : order) {
+		sorted_entries.push_back(entries[i]);
+		sorted_orders.push_back(orders[i]);
+	}
+
+	entries = move(sorted_entries);
+	orders = move(sorted_orders);
+
+}
+
+void CSSRuleList::clear()
+{
+	stylesheets.clear();
+	entries.clear();
+	orders.clear();
+}
+
+size_t CSSRuleList::size() const
+{
+	load();
+	return entries.size();
+}
+
+bool CSSRuleList::empty() const
+{
+	load();
+	return entries.empty();
+}
+
+const CSSRule & CSSRuleList::operator[](const size_t index) const
+{
+	load();
+	return *entries[index];
+}
+
+unsigned int CSSRuleList::source_order(const size_t index) const
+{
+	load();
+	return orders[index];
+}
+
+CSSRuleList::const_iterator CSSRuleList::begin() const
+{
+	load();
+	return const_iterator(entries.begin());
+}
+
+CSSRuleList::const_iterator CSSRuleList::end() const
+{
+	load();
+	return const_iterator(entries.end());
+}
+
+CSS::CSS() :
+	cascades(),
+	styles(),
+	inline_styles(),
+	stats(),
+	style_keys(),
+	style_index(),
+	memo_lock(),
+	selector_index(),
+	subject_index(),
+	image(),
+	unloaded_rules(),
+	rules_loaded(true),
+	files(),
+	rules()
+{
+}
+
+CSS::CSS(vector<path> _files, const CSSDevice & device) :
+	cascades(),
+	styles(),
+	inline_styles(),
+	stats(),
+	style_keys(),
+	style_index(),
+	memo_lock(),
+	selector_index(),
+	subject_index(),
+	image(),
+	unloaded_rules(),
+	rules_loaded(true),
+	files(_files),
+	rules()
+{
 
-	bool regex_ready = false;
+	//Each stylesheet parses on its own, so spread them over a few
+	//threads and merge the results afterwards in manifest order.
+	vector<shared_ptr<const vector<CSSRule>>> stylesheets(files.size());
+	vector<exception_ptr> errors(files.size());
+	atomic<unsigned int> next(0);
 
-	void _selector_regex_initialise()
-	{
+	auto worker = [&]() {
+		for(unsigned int i = next++; i < files.size(); i = next++) {
 
-		//Prepare the regular expressions for the CSSSelector:
-		try {
-			regex_selector_split = regex("\\s*([a-zA-Z0-9.#\\s]+),*", regex::optimize);
-			regex_id_compound = regex("^[a-zA-Z0-9]+#[a-zA-Z0-9-]+", regex::optimize);
-			regex_id_single = regex("^#[a-zA-Z0-9-]+", regex::optimize);
-			regex_class_compound = regex("^[a-zA-Z0-9]+\\.[a-zA-Z0-9-]+", regex::optimize);
-			regex_class_single = regex("^\\.[a-zA-Z0-9-]+", regex::optimize);
-			regex_contextual = regex("^[a-zA-Z0-9]+\\s[a-zA-Z0-9-]+", regex::optimize);
-		}
-		catch (regex_error re) {
-			cout << "You dun goofed " << endl;
+			#ifdef DEBUG
+			cout << "CSS File is "  << files[i] << endl;
+			#endif
+
+			try {
+				stylesheets[i] = CSS::stylesheet(files[i], device);
+			}
+			catch (...) {
+				errors[i] = current_exception();
+			}
 
-			print_regex_error_fatal(re);
 		}
+	};
 
-		regex_ready = true;
+	const unsigned int n_threads = min<unsigned int>(files.size(), max(1u, thread::hardware_concurrency()));
 
+	vector<thread> threads;
+
+	for(unsigned int i = 1; i < n_threads; i++) {
+		threads.emplace_back(worker);
 	}
 
-}
+	worker();
 
-CSSSpecificity::CSSSpecificity() :
-	CSSSpecificity(0, 0, 0, 0)
-{
+	for(auto & t : threads) {
+		t.join();
+	}
 
-}
+	//The first file that failed, as if they'd been done one at a time.
+	for(auto & error : errors) {
+		if(error) {
+			rethrow_exception(error);
+		}
+	}
 
-CSSSpecificity::CSSSpecificity(const unsigned int _a, const unsigned int _b, const unsigned int _c, const unsigned int _d) :
-	a(_a),
-	b(_b),
-	c(_c),
-	d(_d)
-{
+	for(auto & stylesheet : stylesheets) {
+		rules.add(stylesheet);
+	}
+
+	index_rules();
 
 }
 
-CSSSpecificity::CSSSpecificity(CSSSpecificity const & cpy) :
-	a(cpy.a),
-	b(cpy.b),
-	c(cpy.c),
-	d(cpy.d)
+CSS::CSS(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)  :
+	cascades(),
+	styles(),
+	inline_styles(),
+	stats(),
+	style_keys(),
+	style_index(),
+	memo_lock(),
+	selector_index(),
+	subject_index(),
+	image(),
+	unloaded_rules(),
+	rules_loaded(true),
+	files(),
+	rules()
 {
 
-}
+	int rc;
 
-CSSSpecificity::CSSSpecificity(CSSSpecificity && mv) :
-	a(move(mv.a)),
-	b(move(mv.b)),
-	c(move(mv.c)),
-	d(move(mv.d))
-{
+	const string css_select_sql = "SELECT rules, image FROM css WHERE epub_file_id=? AND opf_id=?;";
+
+	sqlite3_stmt * css_select;
+
+	rc = sqlite3_prepare_v2(db, css_select_sql.c_str(), -1, &css_select, 0);
+
+	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
+		throw - 1;
+	}
+
+	sqlite3_bind_int(css_select, 1, epub_file_id);
+	sqlite3_bind_int(css_select, 2, opf_index);
+
+	rc = sqlite3_step(css_select);
+
+	if(rc == SQLITE_ROW) {
+
+		const char * blob = static_cast<const char *>(sqlite3_column_blob(css_select, 0));
+		const int length = sqlite3_column_bytes(css_select, 0);
+
+		const char * saved_image = static_cast<const char *>(sqlite3_column_blob(css_select, 1));
+		const int image_length = sqlite3_column_bytes(css_select, 1);
+
+		//Saved before there were images, or by another version or on
+		//another machine: read the rules in now instead.
+		if(saved_image != nullptr) {
+			try {
+				image = CSSImage(saved_image, image_length);
+			}
+			catch (...) {
+				image = CSSImage();
+			}
+		}
+
+		if(!image.empty()) {
+			unloaded_rules.assign(blob, length);
+			rules_loaded = false;
+			rules.owner = this;
+		}
+		else if(!from_blob(blob, length)) {
+			sqlite3_finalize(css_select);
+			throw - 1;
+		}
+
+	}
+	else if(rc != SQLITE_DONE) {
+		sqlite3_finalize(css_select);
+		throw - 1;
+	}
+
+	sqlite3_finalize(css_select);
 
 }
 
-CSSSpecificity & CSSSpecificity::operator =(const CSSSpecificity & cpy)
+CSS::CSS(CSS const & cpy) :
+	cascades(),
+	styles(),
+	inline_styles(),
+	stats(cpy.stats ? make_shared<CSSStatistics>(*cpy.stats) : nullptr),
+	style_keys(),
+	style_index(),
+	memo_lock(),
+	selector_index(),
+	subject_index(),
+	image(cpy.image),
+	unloaded_rules(),
+	rules_loaded(true),
+	files(),
+	rules()
 {
-	a = cpy.a;
-	b = cpy.b;
-	c = cpy.c;
-	d = cpy.d;
-	return *this;
+	//cpy may be handing out styles, or reading its rules in, on
+	//another thread.
+	lock_guard<mutex> lock(cpy.memo_lock);
+	cascades = cpy.cascades;
+	styles = cpy.styles;
+	inline_styles = cpy.inline_styles;
+	style_keys = cpy.style_keys;
+	style_index = cpy.style_index;
+	selector_index = cpy.selector_index;
+	subject_index = cpy.subject_index;
+	unloaded_rules = cpy.unloaded_rules;
+	rules_loaded = cpy.rules_loaded.load();
+	files = cpy.files;
+	rules.assign(cpy.rules);
+	rules.owner = rules_loaded ? nullptr : this;
 }
 
-CSSSpecificity & CSSSpecificity::operator =(CSSSpecificity && mv)
+CSS::CSS(CSS && mv) :
+	cascades(move(mv.cascades)),
+	styles(move(mv.styles)),
+	inline_styles(move(mv.inline_styles)),
+	stats(move(mv.stats)),
+	style_keys(move(mv.style_keys)),
+	style_index(move(mv.style_index)),
+	memo_lock(),
+	selector_index(move(mv.selector_index)),
+	subject_index(move(mv.subject_index)),
+	image(move(mv.image)),
+	unloaded_rules(move(mv.unloaded_rules)),
+	rules_loaded(mv.rules_loaded.load()),
+	files(move(mv.files)),
+	rules()
 {
-	a = move(mv.a);
-	b = move(mv.b);
-	c = move(mv.c);
-	d = move(mv.d);
-	return *this;
+	rules.assign(move(mv.rules));
+	rules.owner = rules_loaded ? nullptr : this;
 }
 
-CSSSpecificity::~CSSSpecificity()
+CSS & CSS::operator =(const CSS & cpy)
 {
+	if(this == &cpy) {
+		return *this;
+	}
+
+	{
+		lock_guard<mutex> lock(cpy.memo_lock);
+		cascades = cpy.cascades;
+		styles = cpy.styles;
+		inline_styles = cpy.inline_styles;
+		style_keys = cpy.style_keys;
+		style_index = cpy.style_index;
+		selector_index = cpy.selector_index;
+		subject_index = cpy.subject_index;
+		unloaded_rules = cpy.unloaded_rules;
+		rules_loaded = cpy.rules_loaded.load();
+		files = cpy.files;
+		rules.assign(cpy.rules);
+		rules.owner = rules_loaded ? nullptr : this;
+	}
 
+	stats = cpy.stats ? make_shared<CSSStatistics>(*cpy.stats) : nullptr;
+	image = cpy.image;
+	return *this;
 }
 
-CSSSelector::CSSSelector() :
-	CSSSelector("")
+CSS & CSS::operator =(CSS && mv)
 {
-
+	cascades = move(mv.cascades);
+	styles = move(mv.styles);
+	inline_styles = move(mv.inline_styles);
+	stats = move(mv.stats);
+	style_keys = move(mv.style_keys);
+	style_index = move(mv.style_index);
+	selector_index = move(mv.selector_index);
+	subject_index = move(mv.subject_index);
+	image = move(mv.image);
+	unloaded_rules = move(mv.unloaded_rules);
+	rules_loaded = mv.rules_loaded.load();
+	files = move(mv.files);
+	rules.assign(move(mv.rules));
+	rules.owner = rules_loaded ? nullptr : this;
+	return *this;
 }
 
-CSSSelector::CSSSelector(const string _raw_text) :
-	selector_keys(),
-	selector_text(),
-	raw_text(_raw_text),
-	specificity()
+CSS::~CSS() { }
+
+shared_ptr<const vector<CSSRule>> CSS::stylesheet(const path & file, const CSSDevice & device)
 {
 
-	if(raw_text.empty()) {
-		return;
+	ifstream cssfile(file.string(), std::ios::binary);
+
+	if(!cssfile.is_open()) {
+		throw std::runtime_error("CSS File does not exist!");
 	}
 
-	if(!regex_ready) {
-		_selector_regex_initialise();
+	ostringstream buffer;
+	buffer << cssfile.rdbuf();
+	const string contents = buffer.str();
+
+	//What comes out depends on the device too, and on where the file is
+	//if it imports anything. The contents go in as their hash and length,
+	//to be compared in full on a hit.
+	string key = device.key();
+	key += '\0';
+
+	if(contents.find("@import") != string::npos) {
+		key += file.parent_path().string();
 	}
 
-	unsigned int a  = 0;
-	unsigned int b  = 0;
-	unsigned int c  = 0;
-	unsigned int d  = 0;
+	key += '\0';
+	key += to_string(std::hash<string>()(contents));
+	key += ':';
+	key += to_string(contents.length());
 
-	smatch regex_matches;
-	auto line_begin = sregex_iterator(raw_text.begin(), raw_text.end(), regex_selector_split);
-	auto line_end = sregex_iterator();
-	selector_keys.reserve(distance(line_begin, line_end));
-	selector_text.reserve(distance(line_begin, line_end));
+	auto hit = [&contents](const CachedStylesheet & cached) {
+		return cached.contents == contents && __unchanged(cached.imports);
+	};
 
-	for (sregex_iterator i = line_begin; i != line_end; ++i) {
-		smatch match = *i;
-		string selector = match[1];
+	{
+		lock_guard<mutex> lock(stylesheet_cache_lock);
 
-		if(regex_match(selector, regex_id_compound)) {
-			b++;
-			d++;
-		}
-		else if(regex_match(selector, regex_id_single)) {
-			b++;
-		}
-		else if(regex_match(selector, regex_class_compound)) {
-			c++;
-			d++;
-		}
-		else if(regex_match(selector, regex_class_single)) {
-			c++;
-		}
-		else if(regex_match(selector, regex_contextual)) {
-			d += 2;
+		auto found = stylesheet_cache.find(key);
+
+		if(found != stylesheet_cache.end() && hit(found->second)) {
+			found->second.last_used = ++stylesheet_cache_tick;
+			return found->second.rules;
 		}
-		else {
-			d++;
+	}
+
+	//Parse outside the lock. If another thread gets there first with
+	//the same file, theirs is kept and this one is thrown away. Imports
+	//are stamped before they're read, so one that changes meanwhile is
+	//read again next time.
+	CachedStylesheet cached = { contents, vector<FileStamp>(), nullptr, 0 };
+	cached.rules = make_shared<const vector<CSSRule>>(__parse_stylesheet(contents, file, device, cached.imports));
+	shared_ptr<const vector<CSSRule>> parsed = cached.rules;
+
+	lock_guard<mutex> lock(stylesheet_cache_lock);
+
+	auto found = stylesheet_cache.find(key);
+
+	if(found != stylesheet_cache.end()) {
+
+		if(hit(found->second)) {
+			found->second.last_used = ++stylesheet_cache_tick;
+			return found->second.rules;
 		}
 
-		ustring ustr_selector(selector);
-		selector_keys.insert(ustr_selector.collate_key());
-		selector_text.push_back(ustr_selector);
-		#ifdef DEBUG
-		cout << "\tCSS Selector: "  << selector << endl;
-		#endif
+		//Another file with the same hash, or its imports have changed.
+		cached.last_used = ++stylesheet_cache_tick;
+		found->second = move(cached);
+		return parsed;
+
 	}
 
-	specificity  = CSSSpecificity(a, b, c, d);
+	if(stylesheet_cache.size() >= stylesheet_cache_limit) {
 
-}
+		//Least recently used first, but only if no CSS still holds it:
+		//dropping one that's in use frees nothing.
+		auto oldest = stylesheet_cache.end();
 
-CSSSelector::CSSSelector(CSSSelector const & cpy) :
-	selector_keys(cpy.selector_keys),
-	selector_text(cpy.selector_text),
-	raw_text(cpy.raw_text),
-	specificity(cpy.specificity)
-{
+		for(auto it = stylesheet_cache.begin(); it != stylesheet_cache.end(); ++it) {
+			if(it->second.rules.unique() && (oldest == stylesheet_cache.end() || it->second.last_used < oldest->second.last_used)) {
+				oldest = it;
+			}
+		}
 
-}
+		if(oldest != stylesheet_cache.end()) {
+			stylesheet_cache.erase(oldest);
+		}
 
-CSSSelector::CSSSelector(CSSSelector && mv) :
-	selector_keys(move(mv.selector_keys)),
-	selector_text(move(mv.selector_text)),
-	raw_text(move(mv.raw_text)),
-	specificity(move(mv.specificity))
-{
+	}
+
+	cached.last_used = ++stylesheet_cache_tick;
+	stylesheet_cache.emplace(move(key), move(cached));
+
+	return parsed;
 
 }
 
-CSSSelector & CSSSelector::operator =(const CSSSelector & cpy)
+size_t CSS::stylesheet_cache_size()
 {
-	selector_keys = cpy.selector_keys,
-	selector_text = cpy.selector_text;
-	raw_text = cpy.raw_text;
-	specificity = cpy.specificity;
-	return *this;
+	lock_guard<mutex> lock(stylesheet_cache_lock);
+	return stylesheet_cache.size();
 }
 
-CSSSelector & CSSSelector::operator =(CSSSelector && mv)
+void CSS::clear_stylesheet_cache()
 {
-	selector_keys = move(mv.selector_keys);
-	selector_text = move(mv.selector_text);
-	raw_text = move(mv.raw_text);
-	specificity = move(mv.specificity);
-	return *this;
+	lock_guard<mutex> lock(stylesheet_cache_lock);
+	stylesheet_cache.clear();
 }
 
-CSSSelector::~CSSSelector()
+void CSS::index_rules()
 {
 
-}
+	//Sort once, now that everything is loaded. Equal specificities
+	//keep their source order, which is what the cascade relies on.
+	rules.sort();
 
-unsigned int CSSSelector::count() const
-{
-	return selector_keys.size();
-}
+	selector_index.clear();
+	subject_index.clear();
 
-bool CSSSelector::matches(const ustring & name) const
-{
+	for(unsigned int i = 0; i < rules.size(); i++) {
+		for(auto & key : rules[i].selector.keys()) {
+			selector_index.emplace_back(key, i);
+		}
 
-	string key = name.collate_key();
+		const auto & compiled = rules[i].selector.compiled();
 
-	return selector_keys.count(key) > 0;
+		for(unsigned int j = 0; j < compiled.size(); j++) {
+			subject_index.emplace_back(__subject_key(compiled[j]), make_pair(i, j));
+		}
+	}
 
-}
+	sort(selector_index.begin(), selector_index.end());
+	sort(subject_index.begin(), subject_index.end());
 
-CSSValue::CSSValue() :
-	value(numeric_limits<double>::min()),
-	type(CSS_VALUE_DEFAULT)
-{
-}
+	cascades.clear();
+	styles.clear();
+	style_keys.clear();
+	style_index.clear();
 
-CSSValue::CSSValue(CSSValue const & cpy) :
-	value(cpy.value),
-	type(cpy.type)
-{
 }
 
-CSSValue::CSSValue(CSSValue && mv) :
-	value(move(mv.value)),
-	type(move(mv.type))
+pair<vector<pair<string, unsigned int>>::const_iterator, vector<pair<string, unsigned int>>::const_iterator> CSS::find_selector(const string & key) const
 {
-}
 
-CSSValue & CSSValue::operator =(const CSSValue & cpy)
-{
-	value = cpy.value;
-	type = cpy.type;
-	return *this;
-}
+	auto begin = lower_bound(selector_index.begin(), selector_index.end(), key, [](const pair<string, unsigned int> & entry, const string & k) {
+		return entry.first < k;
+	});
+
+	auto end = begin;
+
+	while(end != selector_index.end() && end->first == key) {
+		++end;
+	}
+
+	return make_pair(begin, end);
 
-CSSValue & CSSValue::operator =(CSSValue && mv)
-{
-	value = move(mv.value);
-	type = move(mv.type);
-	return *this;
 }
 
-CSSValue::~CSSValue()
+void CSS::load_rules() const
 {
-}
 
+	if(rules_loaded) {
+		return;
+	}
 
-CSSDeclaration::CSSDeclaration(CSSPropertyType _type, shared_ptr<CSSValueType> _value, CSSSpecificity _specificity, weak_ptr<CSSRule> _parent) :
-	type(_type),
-	value(_value),
-	specificity(_specificity),
-	parent(_parent)
-{
+	lock_guard<mutex> lock(memo_lock);
+
+	//Another thread may have done it while this one waited.
+	if(rules_loaded) {
+		return;
+	}
+
+	//Read into a CSS of its own, so that the styles already handed out
+	//from the image stay where they are.
+	CSS loaded;
+
+	if(!loaded.from_blob(unloaded_rules.data(), unloaded_rules.length())) {
+		throw std::runtime_error("Saved CSS rules are corrupt!");
+	}
+
+	files = move(loaded.files);
+	rules.assign(move(loaded.rules));
+	selector_index = move(loaded.selector_index);
+	subject_index = move(loaded.subject_index);
+	style_keys = move(loaded.style_keys);
+	style_index = move(loaded.style_index);
+
+	string().swap(unloaded_rules);
+	rules_loaded = true;
 
 }
 
-CSSDeclaration::CSSDeclaration(CSSDeclaration const & cpy) :
-	type(cpy.type),
-	value(cpy.value),
-	specificity(cpy.specificity),
-	parent(cpy.parent)
+CSSRule CSS::get_rule(const ustring & _selector) const
 {
 
+	load_rules();
+
+	StatisticsTimer timer(stats.get());
+
+	auto range = find_selector(_selector.raw());
+
+	__count_rule_lookup(stats.get(), _selector.raw(), range.first != range.second);
+
+	if(range.first != range.second) {
+		//Indices are in rule order, so the first is the least specific.
+		//The copy carries its place in this CSS's cascade, not just in
+		//its own stylesheet.
+		CSSRule rule = rules[range.first->second];
+		rule.source_order = rules.source_order(range.first->second);
+		return rule;
+	}
+
+	//It doesn't exist in the database. Return a CSSRule with all defaults.
+	return CSSRule();
+
 }
 
-CSSDeclaration::CSSDeclaration(CSSDeclaration && mv) :
-	type(move(mv.type)),
-	value(move(mv.value)),
-	specificity(move(mv.specificity)),
-	parent(move(mv.parent))
+bool CSS::contains_rule(const ustring & _selector) const
 {
 
+	StatisticsTimer timer(stats.get());
+
+	bool found;
+
+	//The image has the same index, so there's no need to read the
+	//rules in just for this.
+	if(!rules_loaded) {
+		found = image.contains_rule(_selector.raw());
+	}
+	else {
+		auto range = find_selector(_selector.raw());
+		found = range.first != range.second;
+	}
+
+	__count_rule_lookup(stats.get(), _selector.raw(), found);
+
+	return found;
+
 }
 
-CSSDeclaration & CSSDeclaration::operator =(const CSSDeclaration & cpy)
+string CSS::signature(const ustring & element, const ustring & id, const vector<ustring> & classes)
 {
-	type = cpy.type;
-	value = cpy.value;
-	specificity = cpy.specificity;
-	parent = cpy.parent;
-	return *this;
+	return CSSElement(element, id, vector<string>(classes.begin(), classes.end()), nullptr, nullptr).signature();
 }
 
-CSSDeclaration & CSSDeclaration::operator =(CSSDeclaration && mv)
+const CSSRule & CSS::cascade(const string & _signature) const
 {
-	type = move(mv.type);
-	value = move(mv.value);
-	specificity = move(mv.specificity);
-	parent = move(mv.parent);
-	return *this;
-}
 
-CSSDeclaration::~CSSDeclaration()
-{
-}
+	StatisticsTimer timer(stats.get());
+
+	if(stats) {
+		stats->cascades++;
+	}
+
+	{
+		lock_guard<mutex> lock(memo_lock);
+
+		auto found = cascades.find(_signature);
+
+		if(found != cascades.end()) {
+			if(stats) {
+				stats->memoised++;
+			}
+
+			return found->second;
+		}
+	}
+
+	//Saved with the book, so there's nothing to work out.
+	const int saved = image.find_style(_signature);
+
+	if(saved >= 0) {
+		CSSRule computed = image.style(saved);
+		computed.selector.raw_text = _signature;
+
+		lock_guard<mutex> lock(memo_lock);
+		return cascades.emplace(_signature, move(computed)).first->second;
+	}
+
+	load_rules();
+
+	//One of the styles match() handed out, named for where it came from.
+	const auto at = _signature.find('@');
+	bool named = false;
+	string key;
+
+	{
+		lock_guard<mutex> lock(memo_lock);
 
+		if(at != string::npos) {
 
+			const unsigned long number = strtoul(_signature.c_str() + at + 1, nullptr, 10);
 
-CSSRule::CSSRule() :
-	CSSRule("")
-{
-}
+			if(number < style_keys.size()) {
+				named = true;
+				key = style_keys[number];
+			}
 
-CSSRule::CSSRule(string _selector) :
-	selector(_selector),
-	collation_key(ustring(_selector).collate_key()),
-	raw_pairs(),
-	declarations()
-{
-}
+		}
+	}
 
-CSSRule::CSSRule(CSSRule const & cpy) :
-	selector(cpy.selector),
-	collation_key(cpy.collation_key),
-	raw_pairs(cpy.raw_pairs),
-	declarations(cpy.declarations)
-{
-}
+	if(named) {
+		return computed_style(key, _signature.substr(0, at));
+	}
 
-CSSRule::CSSRule(CSSRule && mv) :
-	selector(move(mv.selector)),
-	collation_key(move(mv.collation_key)),
-	raw_pairs(move(mv.raw_pairs)),
-	declarations(move(mv.declarations))
-{
-}
+	//Split the signature (element#id.class.class) back up into an
+	//element with nothing around it.
+	const string bare = _signature.substr(0, at);
+	const auto element_end = bare.find_first_of("#.");
 
-CSSRule & CSSRule::operator =(const CSSRule & cpy)
-{
-	selector = cpy.selector;
-	collation_key = cpy.collation_key;
-	raw_pairs = cpy.raw_pairs;
-	declarations = cpy.declarations; 
-	return *this;
-}
+	CSSElement element;
+	element.element = bare.substr(0, element_end);
 
-CSSRule & CSSRule::operator =(CSSRule && mv)
-{
-	selector = move(mv.selector);
-	collation_key = move(mv.collation_key);
-	raw_pairs = move(mv.raw_pairs);
-	declarations = move(mv.declarations);
-	return *this;
-}
+	auto begin = element_end;
 
-CSSRule::~CSSRule() { }
+	while(begin != string::npos) {
 
-void CSSRule::add ( const CSSRule & rhs )
-{
-	//TODO: Do we even still need this function?
-}
+		const auto end = bare.find_first_of("#.", begin + 1);
+		const string part = bare.substr(begin + 1, end == string::npos ? string::npos : end - begin - 1);
 
-CSS::CSS() :
-	files(),
-	rules()
-{
-}
+		if(!part.empty()) {
+			if(bare[begin] == '#') {
+				element.id = part;
+			}
+			else {
+				element.classes.push_back(part);
+			}
+		}
 
-CSS::CSS(vector<path> _files) :
-	files(_files),
-	rules()
-{
+		begin = end;
 
-	//prepare the regular expressions:
-	regex regex_selector;
-	regex regex_atrule_single;
-	regex regex_atrule_multiple;
-	regex regex_attr;
-	regex regex_percent;
-	regex regex_em;
-	regex regex_px;
-	regex regex_pt;
-	regex regex_cm;
-	regex regex_comment_single;
-	regex regex_comment_single2;
-	regex regex_comment_start;
-	regex regex_comment_end;
-
-	try {
-		regex_selector = regex("^(.+)\\{", regex::optimize);
-		regex_atrule_single = regex("^@.*;$", regex::optimize);
-		regex_atrule_multiple = regex("^@.*\\{", regex::optimize);
-		regex_attr = regex("([A-Za-z0-9-]+)\\s*:{1}\\s*([^;]*)", regex::optimize);
-		regex_percent = regex("([\\d]+)%", regex::optimize);
-		regex_em = regex("([\\d]+)em", regex::optimize);
-		regex_px = regex("([\\d]+)px", regex::optimize);
-		regex_pt = regex("([\\d]+)pt", regex::optimize);
-		regex_cm = regex("([\\d]+)cm", regex::optimize);
-		regex_comment_single = regex(R"(\/\/.*)", regex::optimize);
-		regex_comment_single2 = regex(R"(\/\*.*\*\/)", regex::optimize);
-		regex_comment_start = regex(R"(\/\/*.*)", regex::optimize);
-		regex_comment_end = regex(R"(.*\*\/)", regex::optimize);
-	}
-	catch (regex_error re) {
-		cout << "You dun goofed " << endl;
-
-		print_regex_error_fatal(re);
-	}
-
-	for (path file : files) {
+	}
 
-		#ifdef DEBUG
-		cout << "CSS File is "  << file << endl;
-		#endif
+	CSSRule computed = match(element, CSSAncestorFilter());
+	computed.selector.raw_text = _signature;
+
+	//Another thread may have got here first; if so, its copy is kept.
+	lock_guard<mutex> lock(memo_lock);
+	return cascades.emplace(_signature, move(computed)).first->second;
 
-		bool class_is_open = false;
-		bool is_at_rule = false;
+}
 
-		ifstream cssfile (file.string());
+const CSSRule & CSS::match(const CSSElement & element, const CSSAncestorFilter & filter) const
+{
 
-		if(cssfile.is_open()) {
+	load_rules();
 
-			CSSRule rule;
+	StatisticsTimer timer(stats.get());
 
-			string line;
+	if(stats) {
+		stats->matches++;
+	}
 
-			while(!cssfile.eof()) {
+	//Only selectors whose subject has one of the element's own keys
+	//can possibly match it.
+	vector<string> candidates;
+	candidates.push_back("*");
 
-				getline(cssfile, line);
+	if(!element.element.empty()) {
+		candidates.push_back(element.element);
+	}
 
-				#ifdef DEBUG
-				cout << "Line is "  << line << endl;
-				#endif
+	if(!element.id.empty()) {
+		candidates.push_back("#" + element.id);
+	}
 
-				//skip blank lines:
-				if(line.length() == 0) {
-					continue;
-				}
+	for(auto & name : element.classes) {
+		candidates.push_back("." + name);
+	}
 
-				if(line.find("}") != string::npos) {
+	//(specificity of the part that matched, rule)
+	vector<pair<CSSSpecificity, unsigned int>> matched;
 
-					#ifdef DEBUG
+	for(auto & candidate : candidates) {
 
-					if (!is_at_rule) {
-						cout << "\tCSS Closing CSS class " << endl;
-					}
+		auto it = lower_bound(subject_index.begin(), subject_index.end(), candidate, [](const pair<string, pair<unsigned int, unsigned int>> & entry, const string & k) {
+			return entry.first < k;
+		});
 
-					#endif
+		for( ; it != subject_index.end() && it->first == candidate; ++it) {
 
-					rules.insert(rule);
+			const CSSRule & rule = rules[it->second.first];
+			const CSSComplexSelector & selector = rule.selector.compiled()[it->second.second];
 
-					rule = CSSRule();
-					class_is_open = false;
-					is_at_rule = false;
-					continue;
+			if(stats) {
+				stats->candidates++;
+			}
 
+			if(!filter.may_contain(selector.ancestor_hashes)) {
+				if(stats) {
+					stats->filtered++;
+					__count_lookup(stats.get(), rule.selector.raw_text, false);
 				}
 
-				//skip at rule lines;
-				if(is_at_rule) {
-					continue;
-				}
+				continue;
+			}
 
-				if(regex_match(line, regex_comment_single)) {
-					//It's a single-line // comment
-					continue;
-				}
+			const bool matches = __matches_complex(selector, selector.compounds.size() - 1, &element);
 
-				if(regex_match(line, regex_comment_single2)) {
-					//It's a single-line /* something */ comment
-					continue;
-				}
+			if(stats) {
+				__count_lookup(stats.get(), rule.selector.raw_text, matches);
+			}
 
-				if(!class_is_open) {
-					//Deal with a new class.
+			if(matches) {
+				matched.emplace_back(selector.specificity, it->second.first);
+			}
 
-					//First, check if it's an at rule;
-					if(regex_match(line, regex_atrule_single)) {
-						//It's a single-line @ rule, ignore it.
-						continue;
-					}
-					else if (regex_match(line, regex_atrule_multiple)) {
-						is_at_rule = true;
-					}
-					else {
-						class_is_open = true;
+		}
 
-						smatch regex_matches;
-						regex_search(line, regex_matches, regex_selector);
+	}
 
-						if(regex_matches.size() != 0) {
-							string selector = regex_matches[1];
-							rule.selector = CSSSelector(selector);
-						}
+	//Cascade order is the specificity of the selector that matched,
+	//then source order. A rule that matches more than once only counts
+	//at its most specific.
+	sort(matched.begin(), matched.end(), [this](const pair<CSSSpecificity, unsigned int> & lhs, const pair<CSSSpecificity, unsigned int> & rhs) {
+		if(lhs.first != rhs.first) {
+			return lhs.first < rhs.first;
+		}
 
-					}
+		return rules.source_order(lhs.second) < rules.source_order(rhs.second);
+	});
 
-				}
-				else {
+	vector<unsigned int> order;
 
-					smatch regex_matches;
-					regex_search(line, regex_matches, regex_attr);
-
-					if(regex_matches.size() != 0) {
-						//We found an attr.
-						string attrname = regex_matches[1];
-						string attrvalue = regex_matches[2];
-						rule.raw_pairs.insert(pair<ustring, ustring>(attrname, attrvalue));
-						#ifdef DEBUG
-						cout << "\tCSS Attribute name: "  << attrname << endl;
-						cout << "\tCSS Attribute value "  << attrvalue << endl;
-						#endif
-						
-						/*
-						if(attrname == "display") {
-							if(attrvalue == "block") {
-								rule.displaytype = DISPLAY_BLOCK;
-							}
-						}
-						else if (attrname == "font-size") {
-							smatch regex_match_size;
-							regex_search(attrvalue, regex_match_size, regex_em);
-
-							if(regex_match_size.size() != 0) {
-								//it's of the form x.xem
-								double size = stod(regex_match_size[1], NULL);
-
-								if(size < 1.0) {
-									rule.fontsize = FONTSIZE_SMALLER;
-								}
-								else if(size == 1.0) {
-									rule.fontsize = FONTSIZE_NORMAL;
-								}
-								else {
-									rule.fontsize = FONTSIZE_LARGER;
-								}
-							}
-						}
-						else if (attrname == "font-weight") {
-							if(attrvalue == "bold") {
-								rule.fontweight = FONTWEIGHT_BOLD;
-							}
-						}
-						else if (attrname == "font-style") {
-							if(attrvalue == "italic") {
-								rule.fontstyle = FONTSTYLE_ITALIC;
-							}
-						}
-						else if (attrname == "margin-top") {
-							smatch regex_match_margin;
-
-							if(regex_search(attrvalue, regex_match_margin, regex_percent)) {
-								string match = regex_match_margin[1];
-								rule.margintop.value = stod(match, NULL);
-								rule.margintop.type = CSS_VALUE_PERCENT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_em)) {
-								string match = regex_match_margin[1];
-								rule.margintop.value = stod(match, NULL);
-								rule.margintop.type = CSS_VALUE_EM;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_px)) {
-								string match = regex_match_margin[1];
-								rule.margintop.value = stod(match, NULL);
-								rule.margintop.type = CSS_VALUE_PX;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_pt)) {
-								string match = regex_match_margin[1];
-								rule.margintop.value = stod(match, NULL);
-								rule.margintop.type = CSS_VALUE_PT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_cm)) {
-								string match = regex_match_margin[1];
-								rule.margintop.value = stod(match, NULL);
-								rule.margintop.type = CSS_VALUE_CM;
-							}
-						}
-						else if (attrname == "margin-bottom") {
-							smatch regex_match_margin;
-
-							if(regex_search(attrvalue, regex_match_margin, regex_percent)) {
-								string match = regex_match_margin[1];
-								rule.marginbottom.value = stod(match, NULL);
-								rule.marginbottom.type = CSS_VALUE_PERCENT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_em)) {
-								string match = regex_match_margin[1];
-								rule.marginbottom.value = stod(match, NULL);
-								rule.marginbottom.type = CSS_VALUE_EM;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_px)) {
-								string match = regex_match_margin[1];
-								rule.marginbottom.value = stod(match, NULL);
-								rule.marginbottom.type = CSS_VALUE_PX;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_pt)) {
-								string match = regex_match_margin[1];
-								rule.marginbottom.value = stod(match, NULL);
-								rule.marginbottom.type = CSS_VALUE_PT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_cm)) {
-								string match = regex_match_margin[1];
-								rule.marginbottom.value = stod(match, NULL);
-								rule.marginbottom.type = CSS_VALUE_CM;
-							}
-						}
-						else if (attrname == "margin") {
-							//to set them all.
-							smatch regex_match_margin;
-
-							if(regex_search(attrvalue, regex_match_margin, regex_percent)) {
-								string match = regex_match_margin[1];
-								double margin = stod(match, NULL);
-								rule.marginbottom.value = margin;
-								rule.margintop.value = margin;
-								rule.marginbottom.type = CSS_VALUE_PERCENT;
-								rule.margintop.type = CSS_VALUE_PERCENT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_em)) {
-								string match = regex_match_margin[1];
-								double margin = stod(match, NULL);
-								rule.marginbottom.value = margin;
-								rule.margintop.value = margin;
-								rule.marginbottom.type = CSS_VALUE_EM;
-								rule.margintop.type = CSS_VALUE_EM;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_px)) {
-								string match = regex_match_margin[1];
-								double margin = stod(match, NULL);
-								rule.marginbottom.value = margin;
-								rule.margintop.value = margin;
-								rule.marginbottom.type = CSS_VALUE_PX;
-								rule.margintop.type = CSS_VALUE_PX;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_pt)) {
-								string match = regex_match_margin[1];
-								double margin = stod(match, NULL);
-								rule.marginbottom.value = margin;
-								rule.margintop.value = margin;
-								rule.marginbottom.type = CSS_VALUE_PT;
-								rule.margintop.type = CSS_VALUE_PT;
-							}
-							else if(regex_search(attrvalue, regex_match_margin, regex_cm)) {
-								string match = regex_match_margin[1];
-								double margin = stod(match, NULL);
-								rule.marginbottom.value = margin;
-								rule.margintop.value = margin;
-								rule.marginbottom.type = CSS_VALUE_CM;
-								rule.margintop.type = CSS_VALUE_CM;
-							}
-						}
-						else if (attrname == "page-break-before") {
-							if(attrvalue == "always") {
-								rule.pagebreakbefore = true;
-							}
-						}
-						else if (attrname == "page-break-after") {
-							if(attrvalue == "always") {
-								rule.pagebreakafter = true;
-							}
-						}
-						else if (attrname == "text-align") {
-							if(attrvalue == "right") {
-								rule.textalign = TEXTALIGN_RIGHT;
-							}
-							else if(attrvalue == "center") {
-								rule.textalign = TEXTALIGN_CENTER;
-							}
-							else {
-								rule.textalign = TEXTALIGN_LEFT;
-							}
-						}
-						else if (attrname == "text-indent") {
-							smatch regex_match_margin;
-
-							if(regex_search(attrvalue, regex_match_margin, regex_percent)) {
-								string match = regex_match_margin[1];
-								rule.textindent.value = stod(match, NULL);
-								rule.textindent.type = CSS_VALUE_PERCENT;
-							}
-						}
-						*/
-					}
-				}
-			}
+	for(auto it = matched.rbegin(); it != matched.rend(); ++it) {
+		if(find(order.begin(), order.end(), it->second) == order.end()) {
+			order.push_back(it->second);
 		}
-		else {
-			throw std::runtime_error("CSS File does not exist!");
+	}
+
+	//order is most important first; the key lists the rules the other
+	//way round, least important first, then any inline style.
+	string key;
+
+	for(auto it = order.rbegin(); it != order.rend(); ++it) {
+		if(!key.empty()) {
+			key += ',';
 		}
+
+		key += to_string(*it);
+	}
+
+	if(!element.style.empty()) {
+		key += '\0';
+		key += element.style;
 	}
+
+	return computed_style(key, element.signature());
+
 }
 
-CSS::CSS(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)  :
-	files(),
-	rules()
+const CSSRule & CSS::computed_style(const string & key, const string & _signature) const
 {
 
-	//Todo: fix this
-	
-	/*
-	
-	int rc;
+	unsigned int number;
 
-	const string css_select_sql = "SELECT * FROM css WHERE epub_file_id=? AND opf_id=?;";
-	const string css_tags_select_sql = "SELECT tagname, tagvalue FROM css_tags WHERE css_id=?;";
+	{
+		lock_guard<mutex> lock(memo_lock);
 
-	sqlite3_stmt * css_select;
-	sqlite3_stmt * css_tags_select;
+		//Every element that ends up with the same rules, in the same order,
+		//shares one computed style.
+		auto found = styles.find(key);
 
-	rc = sqlite3_prepare_v2(db, css_select_sql.c_str(), -1, &css_select, 0);
+		if(found != styles.end()) {
+			if(stats) {
+				stats->memoised++;
+			}
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+			return found->second;
+		}
 
-	rc = sqlite3_prepare_v2(db, css_tags_select_sql.c_str(), -1, &css_tags_select, 0);
+		auto named = style_index.find(key);
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+		if(named == style_index.end()) {
+			number = style_keys.size();
+			style_keys.push_back(key);
+			style_index.emplace(key, number);
+		}
+		else {
+			number = named->second;
+		}
 	}
 
-	sqlite3_bind_int(css_select, 1, epub_file_id);
-	sqlite3_bind_int(css_select, 2, opf_index);
-
-	rc = sqlite3_step(css_select);
+	if(stats) {
+		stats->computed++;
+	}
 
-	while ( rc == SQLITE_ROW ) {
+	CSSRule computed = compute(key);
 
-		//Default-construct the object:
-		CSSRule rule;
+	//signature@number, so that it can be found again by cascade().
+	computed.selector.raw_text = _signature + "@" + to_string(number);
 
-		//Get the basic data
-		unsigned int css_id = sqlite3_column_int(css_select, 0);
-
-		string selector = sqlite3_column_string(css_select, 3);
-		string collation_key = sqlite3_column_string(css_select, 4);
-		DisplayType displaytype = (DisplayType) sqlite3_column_int(css_select, 5);
-		FontSize fontsize = (FontSize) sqlite3_column_int(css_select, 6);
-		FontWeight fontweight = (FontWeight) sqlite3_column_int(css_select, 7);
-		FontStyle fontstyle = (FontStyle) sqlite3_column_int(css_select, 8);
-		double margintop = sqlite3_column_double(css_select, 9);
-		CSSValueType margintop_type = (CSSValueType) sqlite3_column_int(css_select, 10);
-		double marginbottom = sqlite3_column_double(css_select, 11);
-		CSSValueType marginbottom_type = (CSSValueType) sqlite3_column_int(css_select, 12);
-		bool pagebreakbefore = (bool) sqlite3_column_int(css_select, 13);
-		bool pagebreakafter = (bool) sqlite3_column_int(css_select, 14);
-		TextAlign textalign = (TextAlign) sqlite3_column_int(css_select, 15);
-		double textindent = sqlite3_column_double(css_select, 16);
-		CSSValueType textindent_type = (CSSValueType) sqlite3_column_int(css_select, 17);
+	lock_guard<mutex> lock(memo_lock);
+	return styles.emplace(key, move(computed)).first->second;
 
-		rule.selector = CSSSelector(selector);
-		rule.collation_key = collation_key;
-		rule.displaytype = displaytype;
-		rule.fontsize = fontsize;
-		rule.fontweight = fontweight;
-		rule.fontstyle = fontstyle;
-		rule.margintop.value = margintop;
-		rule.margintop.type = margintop_type;
-		rule.marginbottom.value = marginbottom;
-		rule.marginbottom.type = marginbottom_type;
-		rule.pagebreakbefore = pagebreakbefore;
-		rule.pagebreakafter = pagebreakafter;
-		rule.textalign = textalign;
-		rule.textindent.value = textindent;
-		rule.textindent.type = textindent_type;
+}
 
-		int rc2;
+CSSRule CSS::compute(const string & key) const
+{
 
-		sqlite3_bind_int(css_tags_select, 1, css_id);
+	CSSRule computed;
 
-		rc2 = sqlite3_step(css_tags_select);
+	const size_t rules_end = key.find('\0');
+	size_t pos = 0;
 
-		while(rc2 == SQLITE_ROW) {
+	//Later rules win.
+	while(pos < rules_end && pos < key.length()) {
 
-			ustring tagname = sqlite3_column_ustring(css_tags_select, 0);
-			ustring tagvalue = sqlite3_column_ustring(css_tags_select, 1);
+		char * end;
+		const unsigned long index = strtoul(key.c_str() + pos, &end, 10);
 
-			rule.raw_pairs.insert(pair<ustring, ustring>(tagname, tagvalue));
+		if(index >= rules.size()) {
+			throw std::runtime_error("Computed style refers to a CSS rule that doesn't exist!");
+		}
 
-			rc2 = sqlite3_step(css_tags_select);
+		computed.add(rules[index]);
 
+		if(stats) {
+			stats->merges++;
+			stats->count(rules[index].selector.raw_text, 0, 0, 0, 1);
 		}
 
-		rules.insert(rule);
-
-		sqlite3_reset(css_tags_select);
+		pos = (end - key.c_str()) + 1;
 
-		rc = sqlite3_step(css_select);
+	}
 
+	if(rules_end != string::npos) {
+		computed.add(inline_style(key.substr(rules_end + 1)));
 	}
 
-	sqlite3_finalize(css_select);
-	sqlite3_finalize(css_tags_select);
-	
-	*/
+	return computed;
 
 }
 
-CSS::CSS(CSS const & cpy) :
-	files(cpy.files),
-	rules(cpy.rules)
+void CSS::enable_statistics()
 {
+	if(!stats) {
+		stats = make_shared<CSSStatistics>();
+	}
 }
 
-CSS::CSS(CSS && mv) :
-	files(move(mv.files)),
-	rules(move(mv.rules))
+void CSS::disable_statistics()
 {
+	stats.reset();
 }
 
-CSS & CSS::operator =(const CSS & cpy)
+const CSSStatistics * CSS::statistics() const
 {
-	files = cpy.files;
-	rules = cpy.rules;
-	return *this;
+	return stats.get();
 }
 
-CSS & CSS::operator =(CSS && mv)
+const CSSRule & CSS::inline_style(const string & style) const
 {
-	files = move(mv.files);
-	rules = move(mv.rules);
-	return *this;
-}
 
-CSS::~CSS() { }
+	{
+		lock_guard<mutex> lock(memo_lock);
 
-CSSRule CSS::get_rule(const ustring & _selector) const
-{
+		auto found = inline_styles.find(style);
 
-	for(auto & rule : rules) {
-		if(rule.selector.matches(_selector)) {
-			return rule;
+		if(found != inline_styles.end()) {
+			return found->second;
 		}
 	}
 
-	//It doesn't exist in the database. Return a CSSRule with all defaults.
-	return CSSRule();
+	//Inline declarations beat anything a selector can, bar !important.
+	CSSRule rule;
+	rule.selector.specificity = CSSSpecificity(1, 0, 0, 0);
+
+	const string text = __strip_comments(style);
+	__parse_declarations(text, 0, text.length(), rule);
+
+	lock_guard<mutex> lock(memo_lock);
+	return inline_styles.emplace(style, move(rule)).first->second;
 
 }
 
-bool CSS::contains_rule(const ustring & _selector) const
+void CSS::save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)
 {
+	DatabaseSession * open = DatabaseSession::open_on(db);
 
-	if(rules.size() == 0) {
-		return false;
+	if(open != nullptr) {
+		save_to(*open, epub_file_id, opf_index);
+		return;
 	}
 
-	for(auto & rule : rules) {
-		if(rule.selector.matches(_selector)) {
-			return true;
+	DatabaseSession session(db);
+	save_to(session, epub_file_id, opf_index);
+}
+
+void CSS::save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index)
+{
+
+	sqlite3_stmt * css_insert = session.statement("INSERT OR REPLACE INTO css (epub_file_id, opf_id, rules, image) VALUES (?, ?, ?, ?);");
+
+	const string blob = to_blob();
+	const string saved_image = CSSImage::to_blob(*this);
+
+	sqlite3_bind_int(css_insert, 1, epub_file_id);
+	sqlite3_bind_int(css_insert, 2, opf_index);
+	sqlite3_bind_blob(css_insert, 3, blob.data(), blob.length(), SQLITE_STATIC);
+	sqlite3_bind_blob(css_insert, 4, saved_image.data(), saved_image.length(), SQLITE_STATIC);
+
+	int result = sqlite3_step(css_insert);
+
+	sqlite3_reset(css_insert);
+
+	if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
+		throw - 1;
+	}
+
+}
+
+/*
+The blob is little-endian throughout:
+
+	u32 version
+	u32 n_files, then each file as a string
+	u32 n_rules, then each rule in rules order:
+		u32 source_order
+		string selector, string collation_key
+		u32 n_raw_pairs, then name and value strings
+		u32 n_declarations, then u32 type, u32 important, string value
+	u32 n_style_keys, then each key as a string
+
+where a string is its u32 length followed by its bytes. Selectors are
+stored as written and compiled again on load, which is quick and keeps
+the format independent of how they're compiled.
+*/
+string CSS::to_blob() const
+{
+
+	load_rules();
+
+	string blob;
+
+	__write_u32(blob, css_blob_version);
+
+	__write_u32(blob, files.size());
+
+	for(auto & file : files) {
+		__write_string(blob, file.string());
+	}
+
+	__write_u32(blob, rules.size());
+
+	for(unsigned int i = 0; i < rules.size(); i++) {
+
+		const CSSRule & rule = rules[i];
+
+		__write_u32(blob, rules.source_order(i));
+		__write_string(blob, rule.selector.raw_text);
+		__write_string(blob, rule.collation_key);
+
+		__write_u32(blob, rule.raw_pairs.size());
+
+		for(auto & pair : rule.raw_pairs) {
+			__write_string(blob, pair.first);
+			__write_string(blob, pair.second);
+		}
+
+		__write_u32(blob, rule.declarations.size());
+
+		for(auto & declaration : rule.declarations) {
+			__write_u32(blob, declaration.type);
+			__write_u32(blob, declaration.important ? 1 : 0);
+			__write_string(blob, declaration.value);
 		}
+
 	}
 
-	return false;
+	lock_guard<mutex> lock(memo_lock);
+
+	__write_u32(blob, style_keys.size());
+
+	for(auto & key : style_keys) {
+		__write_string(blob, key);
+	}
+
+	return blob;
 
 }
 
-void CSS::save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)
+bool CSS::from_blob(const char * data, const size_t length)
 {
-	//TODO: fix this. 
-	
-	/*
-	
-	int rc;
-	char * errmsg;
-
-	const string css_table_sql = "CREATE TABLE IF NOT EXISTS css("  \
-	                             "css_id 				INTEGER PRIMARY KEY," \
-	                             "epub_file_id			INTEGER NOT NULL," \
-	                             "opf_id 				INTEGER NOT NULL," \
-	                             "selector			 	TEX NOT NULL," \
-	                             "collation_key		 	TEX NOT NULL," \
-	                             "display_type	 		INTEGER NOT NULL," \
-	                             "font_size		 		INTEGER NOT NULL," \
-	                             "font_weight	 		INTEGER NOT NULL," \
-	                             "font_style	 		INTEGER NOT NULL," \
-	                             "margin_top	 		REAL NOT NULL," \
-	                             "margin_top_type		INTEGER NOT NULL," \
-	                             "margin_bottom		REAL NOT NULL," \
-	                             "margin_bottom_type	INTEGER NOT NULL," \
-	                             "pagebreakbefore		INTEGER NOT NULL," \
-	                             "pagebreakafter		INTEGER NOT NULL," \
-	                             "text_align			INTEGER NOT NULL," \
-	                             "text_indent			REAL NOT NULL," \
-	                             "text_indent_type 		INTEGER NOT NULL) ;";
-	sqlite3_exec(db, css_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	const string css_tags_table_sql = "CREATE TABLE IF NOT EXISTS css_tags("  \
-	                                  "css_id INTEGER NOT NULL," \
-	                                  "tagname TEXT NOT NULL," \
-	                                  "tagvalue TEXT NOT NULL) ;";
-	sqlite3_exec(db, css_tags_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	//Tables created.
-	sqlite3_stmt * css_insert;
-	sqlite3_stmt * css_tags_insert;
-
-	const string css_insert_sql = "INSERT INTO css (epub_file_id, opf_id, selector, collation_key, display_type, font_size, font_weight, font_style, margin_top, margin_top_type, margin_bottom, margin_bottom_type, pagebreakbefore, pagebreakafter, text_align, text_indent, text_indent_type) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-	const string css_tags_insert_sql = "INSERT INTO css_tags (css_id, tagname, tagvalue) VALUES (?, ?, ?);";
-
-	rc = sqlite3_prepare_v2(db, css_insert_sql.c_str(), -1, &css_insert, 0);
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+	size_t pos = 0;
+	uint32_t version;
+	uint32_t count;
+
+	if(!__read_u32(data, length, pos, version) || version != css_blob_version) {
+		return false;
+	}
+
+	if(!__read_u32(data, length, pos, count)) {
+		return false;
 	}
 
-	rc = sqlite3_prepare_v2(db, css_tags_insert_sql.c_str(), -1, &css_tags_insert, 0);
+	files.clear();
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+	for(uint32_t i = 0; i < count; i++) {
+		string file;
+
+		if(!__read_string(data, length, pos, file)) {
+			return false;
+		}
+
+		files.push_back(file);
 	}
 
-	for(auto & rule : rules) {
-
-		sqlite3_bind_int(css_insert, 1, epub_file_id);
-		sqlite3_bind_int(css_insert, 2, opf_index);
-		sqlite3_bind_text(css_insert, 3, rule.selector.raw_text.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(css_insert, 4, rule.collation_key.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(css_insert, 5, (int) rule.displaytype);
-		sqlite3_bind_int(css_insert, 6, (int) rule.fontsize);
-		sqlite3_bind_int(css_insert, 7, (int) rule.fontweight);
-		sqlite3_bind_int(css_insert, 8, (int) rule.fontstyle);
-		sqlite3_bind_double(css_insert, 9, rule.margintop.value);
-		sqlite3_bind_int(css_insert, 10, (int) rule.margintop.type);
-		sqlite3_bind_double(css_insert, 11, rule.marginbottom.value);
-		sqlite3_bind_int(css_insert, 12, (int) rule.marginbottom.type);
-		sqlite3_bind_int(css_insert, 13, (int) rule.pagebreakbefore);
-		sqlite3_bind_int(css_insert, 14, (int) rule.pagebreakafter);
-		sqlite3_bind_int(css_insert, 15, (int) rule.textalign);
-		sqlite3_bind_double(css_insert, 16, rule.textindent.value);
-		sqlite3_bind_int(css_insert, 17, (int) rule.textindent.type);
-
-		int result = sqlite3_step(css_insert);
-
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-			throw - 1;
+	if(!__read_u32(data, length, pos, count)) {
+		return false;
+	}
+
+	//Saved with their place in the whole cascade, so they go back in
+	//as a single stylesheet of their own.
+	vector<CSSRule> loaded;
+	loaded.reserve(count);
+
+	for(uint32_t i = 0; i < count; i++) {
+
+		CSSRule rule;
+		string selector;
+		uint32_t n;
+
+		if(!__read_u32(data, length, pos, rule.source_order) || !__read_string(data, length, pos, selector) || !__read_string(data, length, pos, rule.collation_key)) {
+			return false;
 		}
 
-		sqlite3_reset(css_insert);
+		rule.selector = CSSSelector(selector);
+
+		if(!__read_u32(data, length, pos, n)) {
+			return false;
+		}
 
-		//get the new id:
-		const auto key = sqlite3_last_insert_rowid(db);
+		for(uint32_t j = 0; j < n; j++) {
+			string name;
+			string value;
 
-		for(auto & pair : rule.raw_pairs) {
+			if(!__read_string(data, length, pos, name) || !__read_string(data, length, pos, value)) {
+				return false;
+			}
 
-			sqlite3_bind_int(css_tags_insert, 1, key);
-			sqlite3_bind_text(css_tags_insert, 2, pair.first.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_text(css_tags_insert, 3, pair.second.c_str(), -1, SQLITE_STATIC);
+			rule.raw_pairs[name] = value;
+		}
+
+		if(!__read_u32(data, length, pos, n)) {
+			return false;
+		}
+
+		rule.declarations.reserve(n);
 
-			int result = sqlite3_step(css_tags_insert);
+		for(uint32_t j = 0; j < n; j++) {
+			uint32_t type;
+			uint32_t important;
+			string value;
 
-			if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-				throw - 1;
+			if(!__read_u32(data, length, pos, type) || !__read_u32(data, length, pos, important) || !__read_string(data, length, pos, value)) {
+				return false;
 			}
 
-			sqlite3_reset(css_tags_insert);
+			if(type >= CSS_PROPERTY_UNKNOWN) {
+				return false;
+			}
+
+			rule.declarations.emplace_back((CSSPropertyType) type, value, rule.selector.specificity, important != 0);
+		}
+
+		loaded.push_back(move(rule));
 
+	}
+
+	if(!__read_u32(data, length, pos, count)) {
+		return false;
+	}
+
+	vector<string> keys;
+
+	for(uint32_t i = 0; i < count; i++) {
+		string key;
+
+		if(!__read_string(data, length, pos, key)) {
+			return false;
 		}
+
+		keys.push_back(move(key));
 	}
 
-	//Create an index for the css tags
-	const string css_tags_index_sql = "CREATE INDEX index_css_tags ON css_tags(css_id);";
-	sqlite3_exec(db, css_tags_index_sql.c_str(), NULL, NULL, &errmsg);
+	if(pos != length) {
+		return false;
+	}
 
-	//Create an index for the css itself
-	const string css_index_sql = "CREATE INDEX index_css ON css(epub_file_id, opf_id);";
-	sqlite3_exec(db, css_index_sql.c_str(), NULL, NULL, &errmsg);
+	rules.clear();
+	rules.add(make_shared<const vector<CSSRule>>(move(loaded)));
 
-	sqlite3_finalize(css_insert);
-	sqlite3_finalize(css_tags_insert);
-	
-	*/
+	//Rules were saved in order, so this leaves them as they were and
+	//the style keys still point at the right ones.
+	index_rules();
+
+	style_keys = move(keys);
+
+	for(unsigned int i = 0; i < style_keys.size(); i++) {
+		style_index.emplace(style_keys[i], i);
+	}
+
+	return true;
 
 }
+
@@ -0,0 +1,625 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CSS.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::ofstream;
+using std::unordered_map;
+using std::lock_guard;
+using std::move;
+using std::memcmp;
+using std::strtoul;
+using std::lower_bound;
+
+namespace {
+
+	//Bump whenever any of the records below change.
+	const uint32_t css_image_version = 2;
+	const char css_image_magic[4] = { 'E', 'C', 'S', 'S' };
+	const uint32_t css_image_byte_order = 0x01020304;
+
+	//Every record is a run of uint32_t, so everything stays aligned
+	//wherever the header puts it.
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t n_rules;
+		uint32_t n_declarations;
+		uint32_t n_index;
+		uint32_t n_styles;
+		uint32_t n_pairs;
+		uint32_t pool_size;
+	};
+
+	//offset and length into the pool
+	struct String {
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct Rule {
+		String selector;
+		uint32_t source_order;
+		uint32_t first_declaration;
+		uint32_t n_declarations;
+	};
+
+	struct Declaration {
+		uint32_t type;
+		uint32_t important;
+		uint32_t specificity;
+		String value;
+	};
+
+	struct IndexEntry {
+		String key;
+		uint32_t rule;
+	};
+
+	//Computed styles, in the order match() numbered them.
+	struct Style {
+		uint32_t first_declaration;
+		uint32_t n_declarations;
+		uint32_t first_pair;
+		uint32_t n_pairs;
+	};
+
+	//A computed style's raw_pairs.
+	struct Pair {
+		String name;
+		String value;
+	};
+
+	//Strings go into the pool once however often they're used.
+	class PoolWriter {
+
+		public:
+			string pool;
+			unordered_map<string, String> seen;
+
+			String add(const string & value) {
+				auto found = seen.find(value);
+
+				if(found != seen.end()) {
+					return found->second;
+				}
+
+				String result = { (uint32_t) pool.length(), (uint32_t) value.length() };
+				pool += value;
+				seen.emplace(value, result);
+				return result;
+			}
+
+	};
+
+	template <typename T>
+	inline void __append(string & out, const T & record)
+	{
+		out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+	}
+
+	template <typename T>
+	inline const T & __record(const char * table, const uint32_t i)
+	{
+		return reinterpret_cast<const T *>(table)[i];
+	}
+
+	inline int __compare(const char * pool, const String & lhs, const string & rhs)
+	{
+
+		const int result = memcmp(pool + lhs.offset, rhs.data(), std::min<size_t>(lhs.length, rhs.length()));
+
+		if(result != 0) {
+			return result;
+		}
+
+		return (lhs.length < rhs.length()) ? -1 : (lhs.length > rhs.length()) ? 1 : 0;
+
+	}
+
+}
+
+CSSImage::CSSImage() :
+	mapping(),
+	length(0),
+	rule_table(nullptr),
+	declaration_table(nullptr),
+	index_table(nullptr),
+	style_table(nullptr),
+	pair_table(nullptr),
+	pool(nullptr),
+	n_rules(0),
+	n_declarations(0),
+	n_index(0),
+	n_styles(0),
+	n_pairs(0),
+	pool_size(0)
+{
+}
+
+CSSImage::CSSImage(const path & file) :
+	CSSImage()
+{
+
+	const int fd = open(file.c_str(), O_RDONLY);
+
+	if(fd < 0) {
+		throw std::runtime_error("CSS image does not exist!");
+	}
+
+	struct stat info;
+
+	if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Header)) {
+		close(fd);
+		throw std::runtime_error("CSS image is truncated!");
+	}
+
+	length = info.st_size;
+
+	void * mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(mapped == MAP_FAILED) {
+		throw std::runtime_error("CSS image could not be mapped!");
+	}
+
+	const size_t mapped_length = length;
+
+	mapping = shared_ptr<const char>(static_cast<const char *>(mapped), [mapped_length](const char * p) {
+		munmap(const_cast<char *>(p), mapped_length);
+	});
+
+	check();
+
+}
+
+CSSImage::CSSImage(const char * data, const size_t _length) :
+	CSSImage()
+{
+
+	if(_length < sizeof(Header)) {
+		throw std::runtime_error("CSS image is truncated!");
+	}
+
+	//new[] hands back memory aligned for anything, so the records can
+	//be read in place just as from a mapping.
+	char * copy = new char[_length];
+	memcpy(copy, data, _length);
+
+	mapping = shared_ptr<const char>(copy, std::default_delete<const char[]>());
+	length = _length;
+
+	check();
+
+}
+
+void CSSImage::check()
+{
+
+	const Header & header = *reinterpret_cast<const Header *>(mapping.get());
+
+	if(memcmp(header.magic, css_image_magic, 4) != 0 || header.version != css_image_version || header.byte_order != css_image_byte_order) {
+		throw std::runtime_error("CSS image is from another version or machine!");
+	}
+
+	n_rules = header.n_rules;
+	n_declarations = header.n_declarations;
+	n_index = header.n_index;
+	n_styles = header.n_styles;
+	n_pairs = header.n_pairs;
+	pool_size = header.pool_size;
+
+	//Done in 64 bits so silly counts can't wrap around.
+	const uint64_t expected = (uint64_t) sizeof(Header)
+	                          + (uint64_t) n_rules * sizeof(Rule)
+	                          + (uint64_t) n_declarations * sizeof(Declaration)
+	                          + (uint64_t) n_index * sizeof(IndexEntry)
+	                          + (uint64_t) n_styles * sizeof(Style)
+	                          + (uint64_t) n_pairs * sizeof(Pair)
+	                          + pool_size;
+
+	if(expected != length) {
+		throw std::runtime_error("CSS image is truncated!");
+	}
+
+	rule_table = mapping.get() + sizeof(Header);
+	declaration_table = rule_table + n_rules * sizeof(Rule);
+	index_table = declaration_table + n_declarations * sizeof(Declaration);
+	style_table = index_table + n_index * sizeof(IndexEntry);
+	pair_table = style_table + n_styles * sizeof(Style);
+	pool = pair_table + n_pairs * sizeof(Pair);
+
+	//Check every reference once, here, so lookups don't have to.
+	auto valid_string = [this](const String & s) {
+		return s.offset <= pool_size && s.length <= pool_size - s.offset;
+	};
+
+	auto valid_range = [this](const uint32_t first, const uint32_t n) {
+		return first <= n_declarations && n <= n_declarations - first;
+	};
+
+	for(uint32_t i = 0; i < n_rules; i++) {
+		const Rule & rule = __record<Rule>(rule_table, i);
+
+		if(!valid_string(rule.selector) || !valid_range(rule.first_declaration, rule.n_declarations)) {
+			throw std::runtime_error("CSS image is corrupt!");
+		}
+	}
+
+	for(uint32_t i = 0; i < n_declarations; i++) {
+		const Declaration & declaration = __record<Declaration>(declaration_table, i);
+
+		if(!valid_string(declaration.value) || declaration.type >= CSS_PROPERTY_UNKNOWN) {
+			throw std::runtime_error("CSS image is corrupt!");
+		}
+	}
+
+	for(uint32_t i = 0; i < n_index; i++) {
+		const IndexEntry & entry = __record<IndexEntry>(index_table, i);
+
+		if(!valid_string(entry.key) || entry.rule >= n_rules) {
+			throw std::runtime_error("CSS image is corrupt!");
+		}
+	}
+
+	for(uint32_t i = 0; i < n_styles; i++) {
+		const Style & style = __record<Style>(style_table, i);
+
+		if(!valid_range(style.first_declaration, style.n_declarations) || style.first_pair > n_pairs || style.n_pairs > n_pairs - style.first_pair) {
+			throw std::runtime_error("CSS image is corrupt!");
+		}
+	}
+
+	for(uint32_t i = 0; i < n_pairs; i++) {
+		const Pair & pair = __record<Pair>(pair_table, i);
+
+		if(!valid_string(pair.name) || !valid_string(pair.value)) {
+			throw std::runtime_error("CSS image is corrupt!");
+		}
+	}
+
+}
+
+CSSImage::CSSImage(CSSImage const & cpy) :
+	mapping(cpy.mapping),
+	length(cpy.length),
+	rule_table(cpy.rule_table),
+	declaration_table(cpy.declaration_table),
+	index_table(cpy.index_table),
+	style_table(cpy.style_table),
+	pair_table(cpy.pair_table),
+	pool(cpy.pool),
+	n_rules(cpy.n_rules),
+	n_declarations(cpy.n_declarations),
+	n_index(cpy.n_index),
+	n_styles(cpy.n_styles),
+	n_pairs(cpy.n_pairs),
+	pool_size(cpy.pool_size)
+{
+}
+
+CSSImage::CSSImage(CSSImage && mv) :
+	mapping(move(mv.mapping)),
+	length(mv.length),
+	rule_table(mv.rule_table),
+	declaration_table(mv.declaration_table),
+	index_table(mv.index_table),
+	style_table(mv.style_table),
+	pair_table(mv.pair_table),
+	pool(mv.pool),
+	n_rules(mv.n_rules),
+	n_declarations(mv.n_declarations),
+	n_index(mv.n_index),
+	n_styles(mv.n_styles),
+	n_pairs(mv.n_pairs),
+	pool_size(mv.pool_size)
+{
+}
+
+CSSImage & CSSImage::operator =(const CSSImage & cpy)
+{
+	mapping = cpy.mapping;
+	length = cpy.length;
+	rule_table = cpy.rule_table;
+	declaration_table = cpy.declaration_table;
+	index_table = cpy.index_table;
+	style_table = cpy.style_table;
+	pair_table = cpy.pair_table;
+	pool = cpy.pool;
+	n_rules = cpy.n_rules;
+	n_declarations = cpy.n_declarations;
+	n_index = cpy.n_index;
+	n_styles = cpy.n_styles;
+	n_pairs = cpy.n_pairs;
+	pool_size = cpy.pool_size;
+	return *this;
+}
+
+CSSImage & CSSImage::operator =(CSSImage && mv)
+{
+	mapping = move(mv.mapping);
+	length = mv.length;
+	rule_table = mv.rule_table;
+	declaration_table = mv.declaration_table;
+	index_table = mv.index_table;
+	style_table = mv.style_table;
+	pair_table = mv.pair_table;
+	pool = mv.pool;
+	n_rules = mv.n_rules;
+	n_declarations = mv.n_declarations;
+	n_index = mv.n_index;
+	n_styles = mv.n_styles;
+	n_pairs = mv.n_pairs;
+	pool_size = mv.pool_size;
+	return *this;
+}
+
+CSSImage::~CSSImage()
+{
+}
+
+string CSSImage::to_blob(const CSS & css)
+{
+
+	//Everything below reads the rules.
+	css.load_rules();
+
+	PoolWriter pool_writer;
+
+	string rules;
+	string declarations;
+	string index;
+	string styles;
+	string pairs;
+
+	uint32_t n_declarations = 0;
+	uint32_t n_pairs = 0;
+
+	auto append_declarations = [&](const CSSRule & rule) {
+		for(auto & declaration : rule.declarations) {
+			Declaration record = { (uint32_t) declaration.type, declaration.important ? 1u : 0u, declaration.specificity.packed, pool_writer.add(declaration.value) };
+			__append(declarations, record);
+		}
+
+		n_declarations += rule.declarations.size();
+	};
+
+	for(unsigned int i = 0; i < css.rules.size(); i++) {
+
+		const CSSRule & rule = css.rules[i];
+
+		Rule record = { pool_writer.add(rule.selector.raw_text), css.rules.source_order(i), n_declarations, (uint32_t) rule.declarations.size() };
+		__append(rules, record);
+
+		append_declarations(rule);
+
+	}
+
+	//Already sorted by key.
+	for(auto & entry : css.selector_index) {
+		IndexEntry record = { pool_writer.add(entry.first), entry.second };
+		__append(index, record);
+	}
+
+	//The computed styles are worked out here, once, so that reading
+	//them back never has to cascade anything.
+	vector<string> style_keys;
+
+	{
+		lock_guard<mutex> lock(css.memo_lock);
+		style_keys = css.style_keys;
+	}
+
+	for(auto & key : style_keys) {
+
+		const CSSRule computed = css.compute(key);
+
+		Style record = { n_declarations, (uint32_t) computed.declarations.size(), n_pairs, (uint32_t) computed.raw_pairs.size() };
+		__append(styles, record);
+
+		append_declarations(computed);
+
+		for(auto & raw_pair : computed.raw_pairs) {
+			Pair pair = { pool_writer.add(raw_pair.first), pool_writer.add(raw_pair.second) };
+			__append(pairs, pair);
+		}
+
+		n_pairs += computed.raw_pairs.size();
+
+	}
+
+	Header header;
+	memcpy(header.magic, css_image_magic, 4);
+	header.version = css_image_version;
+	header.byte_order = css_image_byte_order;
+	header.n_rules = css.rules.size();
+	header.n_declarations = n_declarations;
+	header.n_index = css.selector_index.size();
+	header.n_styles = style_keys.size();
+	header.n_pairs = n_pairs;
+	header.pool_size = pool_writer.pool.length();
+
+	string blob;
+	__append(blob, header);
+	blob += rules;
+	blob += declarations;
+	blob += index;
+	blob += styles;
+	blob += pairs;
+	blob += pool_writer.pool;
+
+	return blob;
+
+}
+
+void CSSImage::write(const CSS & css, const path & file)
+{
+
+	const string blob = to_blob(css);
+
+	ofstream out(file.string(), std::ios::binary | std::ios::trunc);
+
+	if(!out.is_open()) {
+		throw std::runtime_error("CSS image could not be written!");
+	}
+
+	out.write(blob.data(), blob.length());
+	out.close();
+
+	//A full disk shows up here rather than when the image is opened.
+	if(!out.good()) {
+		throw std::runtime_error("CSS image could not be written!");
+	}
+
+}
+
+bool CSSImage::empty() const
+{
+	return !mapping;
+}
+
+unsigned int CSSImage::count() const
+{
+	return n_rules;
+}
+
+const char * CSSImage::selector(const unsigned int rule, uint32_t & selector_length) const
+{
+
+	if(rule >= n_rules) {
+		return nullptr;
+	}
+
+	const String & text = __record<Rule>(rule_table, rule).selector;
+	selector_length = text.length;
+	return pool + text.offset;
+
+}
+
+bool CSSImage::contains_rule(const string & selector) const
+{
+
+	const IndexEntry * begin = reinterpret_cast<const IndexEntry *>(index_table);
+	const IndexEntry * end = begin + n_index;
+
+	const IndexEntry * found = lower_bound(begin, end, selector, [this](const IndexEntry & entry, const string & key) {
+		return __compare(pool, entry.key, key) < 0;
+	});
+
+	return found != end && __compare(pool, found->key, selector) == 0;
+
+}
+
+int CSSImage::find_style(const string & name) const
+{
+
+	const auto at = name.find('@');
+
+	if(at == string::npos) {
+		return -1;
+	}
+
+	char * end;
+	const unsigned long number = strtoul(name.c_str() + at + 1, &end, 10);
+
+	if(end == name.c_str() + at + 1 || *end != '\0' || number >= n_styles) {
+		return -1;
+	}
+
+	return (int) number;
+
+}
+
+const char * CSSImage::find_declaration(const int style, const CSSPropertyType type, uint32_t & value_length, bool & important) const
+{
+
+	if(style < 0 || (uint32_t) style >= n_styles) {
+		return nullptr;
+	}
+
+	const Style & record = __record<Style>(style_table, style);
+
+	//Computed styles hold each property once.
+	for(uint32_t i = 0; i < record.n_declarations; i++) {
+
+		const Declaration & declaration = __record<Declaration>(declaration_table, record.first_declaration + i);
+
+		if(declaration.type == (uint32_t) type) {
+			value_length = declaration.value.length;
+			important = declaration.important != 0;
+			return pool + declaration.value.offset;
+		}
+
+	}
+
+	return nullptr;
+
+}
+
+CSSRule CSSImage::style(const int style) const
+{
+
+	CSSRule rule;
+
+	if(style < 0 || (uint32_t) style >= n_styles) {
+		return rule;
+	}
+
+	const Style & record = __record<Style>(style_table, style);
+
+	rule.declarations.reserve(record.n_declarations);
+
+	for(uint32_t i = 0; i < record.n_declarations; i++) {
+
+		const Declaration & declaration = __record<Declaration>(declaration_table, record.first_declaration + i);
+
+		CSSSpecificity specificity;
+		specificity.packed = declaration.specificity;
+
+		rule.declarations.emplace_back((CSSPropertyType) declaration.type, string(pool + declaration.value.offset, declaration.value.length), specificity, declaration.important != 0);
+
+	}
+
+	for(uint32_t i = 0; i < record.n_pairs; i++) {
+		const Pair & pair = __record<Pair>(pair_table, record.first_pair + i);
+		rule.raw_pairs.emplace(string(pool + pair.name.offset, pair.name.length), string(pool + pair.value.offset, pair.value.length));
+	}
+
+	return rule;
+
+}
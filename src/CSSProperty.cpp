@@ -0,0 +1,951 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "css/CSSProperty.hpp"
+
+#include <cstring>
+#include <cctype>
+
+using std::strchr;
+using std::isdigit;
+
+namespace {
+
+	inline CSSPropertyType css_property_match(const char * name, const size_t length, const char * candidate, const CSSPropertyType type)
+	{
+
+		for(size_t i = 0; i < length; i++) {
+			if(candidate[i] == '\0' || css_property_fold(name[i]) != candidate[i]) {
+				return CSS_PROPERTY_UNKNOWN;
+			}
+		}
+
+		return (candidate[length] == '\0') ? type : CSS_PROPERTY_UNKNOWN;
+
+	}
+
+	//Longhands are in top, right, bottom, left order where that applies,
+	//which is the order the box shorthands distribute their values in.
+	const CSSPropertyType margin_longhands[] = { MARGIN_TOP, MARGIN_RIGHT, MARGIN_BOTTOM, MARGIN_LEFT };
+	const CSSPropertyType padding_longhands[] = { PADDING_TOP, PADDING_RIGHT, PADDING_BOTTOM, PADDING_LEFT };
+	const CSSPropertyType border_longhands[] = { BORDER_TOP, BORDER_RIGHT, BORDER_BOTTOM, BORDER_LEFT };
+	const CSSPropertyType border_width_longhands[] = { BORDER_TOP_WIDTH, BORDER_RIGHT_WIDTH, BORDER_BOTTOM_WIDTH, BORDER_LEFT_WIDTH };
+	const CSSPropertyType border_style_longhands[] = { BORDER_TOP_STYLE, BORDER_RIGHT_STYLE, BORDER_BOTTOM_STYLE, BORDER_LEFT_STYLE };
+	const CSSPropertyType border_color_longhands[] = { BORDER_TOP_COLOR, BORDER_RIGHT_COLOR, BORDER_BOTTOM_COLOR, BORDER_LEFT_COLOR };
+
+	//Border sides are width, style, colour.
+	const CSSPropertyType border_top_longhands[] = { BORDER_TOP_WIDTH, BORDER_TOP_STYLE, BORDER_TOP_COLOR };
+	const CSSPropertyType border_right_longhands[] = { BORDER_RIGHT_WIDTH, BORDER_RIGHT_STYLE, BORDER_RIGHT_COLOR };
+	const CSSPropertyType border_bottom_longhands[] = { BORDER_BOTTOM_WIDTH, BORDER_BOTTOM_STYLE, BORDER_BOTTOM_COLOR };
+	const CSSPropertyType border_left_longhands[] = { BORDER_LEFT_WIDTH, BORDER_LEFT_STYLE, BORDER_LEFT_COLOR };
+
+	//Font is style, variant, weight, size, line height, family.
+	const CSSPropertyType font_longhands[] = { FONT_STYLE, FONT_VARIANT, FONT_WEIGHT, FONT_SIZE, LINE_HEIGHT, FONT_FAMILY };
+
+	template<size_t N>
+	inline size_t css_longhands(const CSSPropertyType (&table)[N], const CSSPropertyType * & longhands)
+	{
+		longhands = table;
+		return N;
+	}
+
+	//Split a value on whitespace into [begin, end) offsets, keeping
+	//parenthesised groups and quoted strings in one piece.
+	void css_value_tokens(const string & value, vector<pair<size_t, size_t>> & tokens)
+	{
+
+		size_t i = 0;
+		const size_t length = value.length();
+
+		while(i < length) {
+
+			while(i < length && strchr(" \t\r\n", value[i]) != nullptr) {
+				i++;
+			}
+
+			if(i == length) {
+				break;
+			}
+
+			const size_t begin = i;
+			int depth = 0;
+			char quote = '\0';
+
+			for( ; i < length; i++) {
+
+				const char c = value[i];
+
+				if(quote != '\0') {
+					if(c == quote) {
+						quote = '\0';
+					}
+				}
+				else if(c == '"' || c == '\'') {
+					quote = c;
+				}
+				else if(c == '(') {
+					depth++;
+				}
+				else if(c == ')') {
+					depth--;
+				}
+				else if(depth <= 0 && strchr(" \t\r\n", c) != nullptr) {
+					break;
+				}
+
+			}
+
+			tokens.emplace_back(begin, i);
+
+		}
+
+	}
+
+	inline string css_lowercase(const string & value, const pair<size_t, size_t> & token)
+	{
+		string result = value.substr(token.first, token.second - token.first);
+
+		for(auto & c : result) {
+			c = css_property_fold(c);
+		}
+
+		return result;
+	}
+
+	inline bool css_is_keyword(const string & token, const char * const * keywords)
+	{
+		for( ; *keywords != nullptr; ++keywords) {
+			if(token.compare(*keywords) == 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const char * const css_wide_keywords[] = { "inherit", "initial", "unset", nullptr };
+	const char * const border_style_keywords[] = { "none", "hidden", "dotted", "dashed", "solid", "double", "groove", "ridge", "inset", "outset", nullptr };
+	const char * const border_width_keywords[] = { "thin", "medium", "thick", nullptr };
+	const char * const font_style_keywords[] = { "italic", "oblique", nullptr };
+	const char * const font_variant_keywords[] = { "small-caps", nullptr };
+	const char * const font_weight_keywords[] = { "bold", "bolder", "lighter", "100", "200", "300", "400", "500", "600", "700", "800", "900", nullptr };
+
+	inline bool css_is_length(const string & token)
+	{
+		return !token.empty() && (isdigit((unsigned char) token[0]) || token[0] == '.' || token[0] == '-' || token[0] == '+');
+	}
+
+	void css_expand_box(const CSSPropertyType * longhands, const string & value, const vector<pair<size_t, size_t>> & tokens, vector<pair<CSSPropertyType, string>> & out)
+	{
+
+		if(tokens.empty() || tokens.size() > 4) {
+			return;
+		}
+
+		string parts[4];
+
+		for(size_t i = 0; i < tokens.size(); i++) {
+			parts[i] = value.substr(tokens[i].first, tokens[i].second - tokens[i].first);
+		}
+
+		//top [right [bottom [left]]], each missing side copying its opposite.
+		if(tokens.size() < 2) {
+			parts[1] = parts[0];
+		}
+
+		if(tokens.size() < 3) {
+			parts[2] = parts[0];
+		}
+
+		if(tokens.size() < 4) {
+			parts[3] = parts[1];
+		}
+
+		for(size_t i = 0; i < 4; i++) {
+			out.emplace_back(longhands[i], parts[i]);
+		}
+
+	}
+
+	void css_expand_border_side(const CSSPropertyType * longhands, const string & value, const vector<pair<size_t, size_t>> & tokens, vector<pair<CSSPropertyType, string>> & out)
+	{
+
+		string width = "medium";
+		string style = "none";
+		string color = "currentColor";
+
+		for(auto & token : tokens) {
+
+			const string lower = css_lowercase(value, token);
+
+			if(css_is_keyword(lower, border_width_keywords) || css_is_length(lower)) {
+				width = value.substr(token.first, token.second - token.first);
+			}
+			else if(css_is_keyword(lower, border_style_keywords)) {
+				style = lower;
+			}
+			else {
+				color = value.substr(token.first, token.second - token.first);
+			}
+
+		}
+
+		out.emplace_back(longhands[0], width);
+		out.emplace_back(longhands[1], style);
+		out.emplace_back(longhands[2], color);
+
+	}
+
+	void css_expand_font(const string & value, const vector<pair<size_t, size_t>> & tokens, vector<pair<CSSPropertyType, string>> & out)
+	{
+
+		string style = "normal";
+		string variant = "normal";
+		string weight = "normal";
+		string size;
+		string line_height = "normal";
+
+		size_t i = 0;
+
+		//[style || variant || weight]? size[/line-height]? family
+		for( ; i < tokens.size(); i++) {
+
+			const string lower = css_lowercase(value, tokens[i]);
+
+			if(lower.compare("normal") == 0) {
+				continue;
+			}
+			else if(css_is_keyword(lower, font_style_keywords)) {
+				style = lower;
+			}
+			else if(css_is_keyword(lower, font_variant_keywords)) {
+				variant = lower;
+			}
+			else if(css_is_keyword(lower, font_weight_keywords)) {
+				weight = lower;
+			}
+			else {
+				break;
+			}
+
+		}
+
+		if(i == tokens.size()) {
+			//No size, so this is a system font like "caption": leave the shorthand alone.
+			return;
+		}
+
+		size = value.substr(tokens[i].first, tokens[i].second - tokens[i].first);
+		i++;
+
+		const auto slash = size.find('/');
+
+		if(slash != string::npos) {
+			line_height = size.substr(slash + 1);
+			size = size.substr(0, slash);
+		}
+
+		if(line_height.empty() && i < tokens.size()) {
+			//"12px/ 1.5"
+			line_height = value.substr(tokens[i].first, tokens[i].second - tokens[i].first);
+			i++;
+		}
+		else if(i < tokens.size() && value[tokens[i].first] == '/') {
+			//"12px / 1.5" or "12px /1.5"
+			line_height = value.substr(tokens[i].first + 1, tokens[i].second - tokens[i].first - 1);
+			i++;
+
+			if(line_height.empty() && i < tokens.size()) {
+				line_height = value.substr(tokens[i].first, tokens[i].second - tokens[i].first);
+				i++;
+			}
+		}
+
+		if(i == tokens.size() || size.empty()) {
+			//Family is mandatory.
+			return;
+		}
+
+		out.emplace_back(FONT_STYLE, style);
+		out.emplace_back(FONT_VARIANT, variant);
+		out.emplace_back(FONT_WEIGHT, weight);
+		out.emplace_back(FONT_SIZE, size);
+		out.emplace_back(LINE_HEIGHT, line_height);
+		out.emplace_back(FONT_FAMILY, value.substr(tokens[i].first, tokens.back().second - tokens[i].first));
+
+	}
+
+	void css_expand_longhands(const CSSPropertyType type, const string & value, vector<pair<CSSPropertyType, string>> & out)
+	{
+
+		const CSSPropertyType * longhands;
+		const size_t count = CSSPropertyType_longhands(type, longhands);
+
+		if(count == 0) {
+			return;
+		}
+
+		vector<pair<size_t, size_t>> tokens;
+		css_value_tokens(value, tokens);
+
+		if(tokens.size() == 1 && css_is_keyword(css_lowercase(value, tokens[0]), css_wide_keywords)) {
+			//inherit, initial and unset apply to every longhand.
+			for(size_t i = 0; i < count; i++) {
+				out.emplace_back(longhands[i], value);
+				css_expand_longhands(longhands[i], value, out);
+			}
+
+			return;
+		}
+
+		switch(type) {
+
+			case MARGIN:
+			case PADDING:
+			case BORDER_WIDTH:
+			case BORDER_STYLE:
+			case BORDER_COLOR:
+				css_expand_box(longhands, value, tokens, out);
+				break;
+
+			case BORDER:
+
+				for(size_t i = 0; i < count; i++) {
+					out.emplace_back(longhands[i], value);
+					css_expand_longhands(longhands[i], value, out);
+				}
+
+				break;
+
+			case BORDER_TOP:
+			case BORDER_RIGHT:
+			case BORDER_BOTTOM:
+			case BORDER_LEFT:
+				css_expand_border_side(longhands, value, tokens, out);
+				break;
+
+			case FONT:
+				css_expand_font(value, tokens, out);
+				break;
+
+			default:
+				break;
+
+		}
+
+	}
+
+}
+
+CSSPropertyType CSSPropertyType_from_string(const char * name, const size_t length)
+{
+
+	switch(css_property_hash(name, length)) {
+
+		case css_property_hash("align-content"):
+			return css_property_match(name, length, "align-content", ALIGN_CONTENT);
+
+		case css_property_hash("align-items"):
+			return css_property_match(name, length, "align-items", ALIGN_ITEMS);
+
+		case css_property_hash("align-self"):
+			return css_property_match(name, length, "align-self", ALIGN_SELF);
+
+		case css_property_hash("animation"):
+			return css_property_match(name, length, "animation", ANIMATION);
+
+		case css_property_hash("animation-delay"):
+			return css_property_match(name, length, "animation-delay", ANIMATION_DELAY);
+
+		case css_property_hash("animation-direction"):
+			return css_property_match(name, length, "animation-direction", ANIMATION_DIRECTION);
+
+		case css_property_hash("animation-duration"):
+			return css_property_match(name, length, "animation-duration", ANIMATION_DURATION);
+
+		case css_property_hash("animation-fill-mode"):
+			return css_property_match(name, length, "animation-fill-mode", ANIMATION_FILL_MODE);
+
+		case css_property_hash("animation-iteration-count"):
+			return css_property_match(name, length, "animation-iteration-count", ANIMATION_ITERATION_COUNT);
+
+		case css_property_hash("animation-name"):
+			return css_property_match(name, length, "animation-name", ANIMATION_NAME);
+
+		case css_property_hash("animation-play-state"):
+			return css_property_match(name, length, "animation-play-state", ANIMATION_PLAY_STATE);
+
+		case css_property_hash("animation-timing-function"):
+			return css_property_match(name, length, "animation-timing-function", ANIMATION_TIMING_FUNCTION);
+
+		case css_property_hash("backface-visibility"):
+			return css_property_match(name, length, "backface-visibility", BACKFACE_VISIBILITY);
+
+		case css_property_hash("background"):
+			return css_property_match(name, length, "background", BACKGROUND);
+
+		case css_property_hash("background-attachment"):
+			return css_property_match(name, length, "background-attachment", BACKGROUND_ATTACHMENT);
+
+		case css_property_hash("background-clip"):
+			return css_property_match(name, length, "background-clip", BACKGROUND_CLIP);
+
+		case css_property_hash("background-color"):
+			return css_property_match(name, length, "background-color", BACKGROUND_COLOR);
+
+		case css_property_hash("background-image"):
+			return css_property_match(name, length, "background-image", BACKGROUND_IMAGE);
+
+		case css_property_hash("background-origin"):
+			return css_property_match(name, length, "background-origin", BACKGROUND_ORIGIN);
+
+		case css_property_hash("background-position"):
+			return css_property_match(name, length, "background-position", BACKGROUND_POSITION);
+
+		case css_property_hash("background-repeat"):
+			return css_property_match(name, length, "background-repeat", BACKGROUND_REPEAT);
+
+		case css_property_hash("background-size"):
+			return css_property_match(name, length, "background-size", BACKGROUND_SIZE);
+
+		case css_property_hash("border"):
+			return css_property_match(name, length, "border", BORDER);
+
+		case css_property_hash("border-bottom"):
+			return css_property_match(name, length, "border-bottom", BORDER_BOTTOM);
+
+		case css_property_hash("border-bottom-color"):
+			return css_property_match(name, length, "border-bottom-color", BORDER_BOTTOM_COLOR);
+
+		case css_property_hash("border-bottom-left-radius"):
+			return css_property_match(name, length, "border-bottom-left-radius", BORDER_BOTTOM_LEFT_RADIUS);
+
+		case css_property_hash("border-bottom-right-radius"):
+			return css_property_match(name, length, "border-bottom-right-radius", BORDER_BOTTOM_RIGHT_RADIUS);
+
+		case css_property_hash("border-bottom-style"):
+			return css_property_match(name, length, "border-bottom-style", BORDER_BOTTOM_STYLE);
+
+		case css_property_hash("border-bottom-width"):
+			return css_property_match(name, length, "border-bottom-width", BORDER_BOTTOM_WIDTH);
+
+		case css_property_hash("border-collapse"):
+			return css_property_match(name, length, "border-collapse", BORDER_COLLAPSE);
+
+		case css_property_hash("border-color"):
+			return css_property_match(name, length, "border-color", BORDER_COLOR);
+
+		case css_property_hash("border-image"):
+			return css_property_match(name, length, "border-image", BORDER_IMAGE);
+
+		case css_property_hash("border-image-outset"):
+			return css_property_match(name, length, "border-image-outset", BORDER_IMAGE_OUTSET);
+
+		case css_property_hash("border-image-repeat"):
+			return css_property_match(name, length, "border-image-repeat", BORDER_IMAGE_REPEAT);
+
+		case css_property_hash("border-image-slice"):
+			return css_property_match(name, length, "border-image-slice", BORDER_IMAGE_SLICE);
+
+		case css_property_hash("border-image-source"):
+			return css_property_match(name, length, "border-image-source", BORDER_IMAGE_SOURCE);
+
+		case css_property_hash("border-image-width"):
+			return css_property_match(name, length, "border-image-width", BORDER_IMAGE_WIDTH);
+
+		case css_property_hash("border-left"):
+			return css_property_match(name, length, "border-left", BORDER_LEFT);
+
+		case css_property_hash("border-left-color"):
+			return css_property_match(name, length, "border-left-color", BORDER_LEFT_COLOR);
+
+		case css_property_hash("border-left-style"):
+			return css_property_match(name, length, "border-left-style", BORDER_LEFT_STYLE);
+
+		case css_property_hash("border-left-width"):
+			return css_property_match(name, length, "border-left-width", BORDER_LEFT_WIDTH);
+
+		case css_property_hash("border-radius"):
+			return css_property_match(name, length, "border-radius", BORDER_RADIUS);
+
+		case css_property_hash("border-right"):
+			return css_property_match(name, length, "border-right", BORDER_RIGHT);
+
+		case css_property_hash("border-right-color"):
+			return css_property_match(name, length, "border-right-color", BORDER_RIGHT_COLOR);
+
+		case css_property_hash("border-right-style"):
+			return css_property_match(name, length, "border-right-style", BORDER_RIGHT_STYLE);
+
+		case css_property_hash("border-right-width"):
+			return css_property_match(name, length, "border-right-width", BORDER_RIGHT_WIDTH);
+
+		case css_property_hash("border-spacing"):
+			return css_property_match(name, length, "border-spacing", BORDER_SPACING);
+
+		case css_property_hash("border-style"):
+			return css_property_match(name, length, "border-style", BORDER_STYLE);
+
+		case css_property_hash("border-top"):
+			return css_property_match(name, length, "border-top", BORDER_TOP);
+
+		case css_property_hash("border-top-color"):
+			return css_property_match(name, length, "border-top-color", BORDER_TOP_COLOR);
+
+		case css_property_hash("border-top-left-radius"):
+			return css_property_match(name, length, "border-top-left-radius", BORDER_TOP_LEFT_RADIUS);
+
+		case css_property_hash("border-top-right-radius"):
+			return css_property_match(name, length, "border-top-right-radius", BORDER_TOP_RIGHT_RADIUS);
+
+		case css_property_hash("border-top-style"):
+			return css_property_match(name, length, "border-top-style", BORDER_TOP_STYLE);
+
+		case css_property_hash("border-top-width"):
+			return css_property_match(name, length, "border-top-width", BORDER_TOP_WIDTH);
+
+		case css_property_hash("border-width"):
+			return css_property_match(name, length, "border-width", BORDER_WIDTH);
+
+		case css_property_hash("bottom"):
+			return css_property_match(name, length, "bottom", BOTTOM);
+
+		case css_property_hash("box-shadow"):
+			return css_property_match(name, length, "box-shadow", BOX_SHADOW);
+
+		case css_property_hash("box-sizing"):
+			return css_property_match(name, length, "box-sizing", BOX_SIZING);
+
+		case css_property_hash("caption-side"):
+			return css_property_match(name, length, "caption-side", CAPTION_SIDE);
+
+		case css_property_hash("clear"):
+			return css_property_match(name, length, "clear", CLEAR);
+
+		case css_property_hash("clip"):
+			return css_property_match(name, length, "clip", CLIP);
+
+		case css_property_hash("color"):
+			return css_property_match(name, length, "color", COLOR);
+
+		case css_property_hash("column-count"):
+			return css_property_match(name, length, "column-count", COLUMN_COUNT);
+
+		case css_property_hash("column-fill"):
+			return css_property_match(name, length, "column-fill", COLUMN_FILL);
+
+		case css_property_hash("column-gap"):
+			return css_property_match(name, length, "column-gap", COLUMN_GAP);
+
+		case css_property_hash("column-rule"):
+			return css_property_match(name, length, "column-rule", COLUMN_RULE);
+
+		case css_property_hash("column-rule-color"):
+			return css_property_match(name, length, "column-rule-color", COLUMN_RULE_COLOR);
+
+		case css_property_hash("column-rule-style"):
+			return css_property_match(name, length, "column-rule-style", COLUMN_RULE_STYLE);
+
+		case css_property_hash("column-rule-width"):
+			return css_property_match(name, length, "column-rule-width", COLUMN_RULE_WIDTH);
+
+		case css_property_hash("column-span"):
+			return css_property_match(name, length, "column-span", COLUMN_SPAN);
+
+		case css_property_hash("column-width"):
+			return css_property_match(name, length, "column-width", COLUMN_WIDTH);
+
+		case css_property_hash("columns"):
+			return css_property_match(name, length, "columns", COLUMNS);
+
+		case css_property_hash("content"):
+			return css_property_match(name, length, "content", CONTENT);
+
+		case css_property_hash("counter-increment"):
+			return css_property_match(name, length, "counter-increment", COUNTER_INCREMENT);
+
+		case css_property_hash("counter-reset"):
+			return css_property_match(name, length, "counter-reset", COUNTER_RESET);
+
+		case css_property_hash("cursor"):
+			return css_property_match(name, length, "cursor", CURSOR);
+
+		case css_property_hash("direction"):
+			return css_property_match(name, length, "direction", DIRECTION);
+
+		case css_property_hash("display"):
+			return css_property_match(name, length, "display", DISPLAY);
+
+		case css_property_hash("empty-cells"):
+			return css_property_match(name, length, "empty-cells", EMPTY_CELLS);
+
+		case css_property_hash("flex"):
+			return css_property_match(name, length, "flex", FLEX);
+
+		case css_property_hash("flex-basis"):
+			return css_property_match(name, length, "flex-basis", FLEX_BASI);
+
+		case css_property_hash("flex-direction"):
+			return css_property_match(name, length, "flex-direction", FLEX_DIRECTION);
+
+		case css_property_hash("flex-flow"):
+			return css_property_match(name, length, "flex-flow", FLEX_FLOW);
+
+		case css_property_hash("flex-grow"):
+			return css_property_match(name, length, "flex-grow", FLEX_GROW);
+
+		case css_property_hash("flex-shrink"):
+			return css_property_match(name, length, "flex-shrink", FLEX_SHRINK);
+
+		case css_property_hash("flex-wrap"):
+			return css_property_match(name, length, "flex-wrap", FLEX_WRAP);
+
+		case css_property_hash("float"):
+			return css_property_match(name, length, "float", FLOAT);
+
+		case css_property_hash("font"):
+			return css_property_match(name, length, "font", FONT);
+
+		case css_property_hash("font-family"):
+			return css_property_match(name, length, "font-family", FONT_FAMILY);
+
+		case css_property_hash("font-size"):
+			return css_property_match(name, length, "font-size", FONT_SIZE);
+
+		case css_property_hash("font-size-adjust"):
+			return css_property_match(name, length, "font-size-adjust", FONT_SIZE_ADJUST);
+
+		case css_property_hash("font-stretch"):
+			return css_property_match(name, length, "font-stretch", FONT_STRETCH);
+
+		case css_property_hash("font-style"):
+			return css_property_match(name, length, "font-style", FONT_STYLE);
+
+		case css_property_hash("font-variant"):
+			return css_property_match(name, length, "font-variant", FONT_VARIANT);
+
+		case css_property_hash("font-weight"):
+			return css_property_match(name, length, "font-weight", FONT_WEIGHT);
+
+		case css_property_hash("hanging-punctuation"):
+			return css_property_match(name, length, "hanging-punctuation", HANGING_PUNCTUATION);
+
+		case css_property_hash("height"):
+			return css_property_match(name, length, "height", HEIGHT);
+
+		case css_property_hash("icon"):
+			return css_property_match(name, length, "icon", ICON);
+
+		case css_property_hash("justify-content"):
+			return css_property_match(name, length, "justify-content", JUSTIFY_CONTENT);
+
+		case css_property_hash("left"):
+			return css_property_match(name, length, "left", LEFT);
+
+		case css_property_hash("letter-spacing"):
+			return css_property_match(name, length, "letter-spacing", LETTER_SPACING);
+
+		case css_property_hash("line-height"):
+			return css_property_match(name, length, "line-height", LINE_HEIGHT);
+
+		case css_property_hash("list-style"):
+			return css_property_match(name, length, "list-style", LIST_STYLE);
+
+		case css_property_hash("list-style-image"):
+			return css_property_match(name, length, "list-style-image", LIST_STYLE_IMAGE);
+
+		case css_property_hash("list-style-position"):
+			return css_property_match(name, length, "list-style-position", LIST_STYLE_POSITION);
+
+		case css_property_hash("list-style-type"):
+			return css_property_match(name, length, "list-style-type", LIST_STYLE_TYPE);
+
+		case css_property_hash("margin"):
+			return css_property_match(name, length, "margin", MARGIN);
+
+		case css_property_hash("margin-bottom"):
+			return css_property_match(name, length, "margin-bottom", MARGIN_BOTTOM);
+
+		case css_property_hash("margin-left"):
+			return css_property_match(name, length, "margin-left", MARGIN_LEFT);
+
+		case css_property_hash("margin-right"):
+			return css_property_match(name, length, "margin-right", MARGIN_RIGHT);
+
+		case css_property_hash("margin-top"):
+			return css_property_match(name, length, "margin-top", MARGIN_TOP);
+
+		case css_property_hash("max-height"):
+			return css_property_match(name, length, "max-height", MAX_HEIGHT);
+
+		case css_property_hash("max-width"):
+			return css_property_match(name, length, "max-width", MAX_WIDTH);
+
+		case css_property_hash("min-height"):
+			return css_property_match(name, length, "min-height", MIN_HEIGHT);
+
+		case css_property_hash("min-width"):
+			return css_property_match(name, length, "min-width", MIN_WIDTH);
+
+		case css_property_hash("nav-down"):
+			return css_property_match(name, length, "nav-down", NAV_DOWN);
+
+		case css_property_hash("nav-index"):
+			return css_property_match(name, length, "nav-index", NAV_INDEX);
+
+		case css_property_hash("nav-left"):
+			return css_property_match(name, length, "nav-left", NAV_LEFT);
+
+		case css_property_hash("nav-right"):
+			return css_property_match(name, length, "nav-right", NAV_RIGHT);
+
+		case css_property_hash("nav-up"):
+			return css_property_match(name, length, "nav-up", NAV_UP);
+
+		case css_property_hash("opacity"):
+			return css_property_match(name, length, "opacity", OPACITY);
+
+		case css_property_hash("order"):
+			return css_property_match(name, length, "order", ORDER);
+
+		case css_property_hash("outline"):
+			return css_property_match(name, length, "outline", OUTLINE);
+
+		case css_property_hash("outline-color"):
+			return css_property_match(name, length, "outline-color", OUTLINE_COLOR);
+
+		case css_property_hash("outline-offset"):
+			return css_property_match(name, length, "outline-offset", OUTLINE_OFFSET);
+
+		case css_property_hash("outline-style"):
+			return css_property_match(name, length, "outline-style", OUTLINE_STYLE);
+
+		case css_property_hash("outline-width"):
+			return css_property_match(name, length, "outline-width", OUTLINE_WIDTH);
+
+		case css_property_hash("overflow"):
+			return css_property_match(name, length, "overflow", CSS_OVERFLOW);
+
+		case css_property_hash("overflow-x"):
+			return css_property_match(name, length, "overflow-x", CSS_OVERFLOW_X);
+
+		case css_property_hash("overflow-y"):
+			return css_property_match(name, length, "overflow-y", CSS_OVERFLOW_Y);
+
+		case css_property_hash("padding"):
+			return css_property_match(name, length, "padding", PADDING);
+
+		case css_property_hash("padding-bottom"):
+			return css_property_match(name, length, "padding-bottom", PADDING_BOTTOM);
+
+		case css_property_hash("padding-left"):
+			return css_property_match(name, length, "padding-left", PADDING_LEFT);
+
+		case css_property_hash("padding-right"):
+			return css_property_match(name, length, "padding-right", PADDING_RIGHT);
+
+		case css_property_hash("padding-top"):
+			return css_property_match(name, length, "padding-top", PADDING_TOP);
+
+		case css_property_hash("page-break-after"):
+			return css_property_match(name, length, "page-break-after", PAGE_BREAK_AFTER);
+
+		case css_property_hash("page-break-before"):
+			return css_property_match(name, length, "page-break-before", PAGE_BREAK_BEFORE);
+
+		case css_property_hash("page-break-inside"):
+			return css_property_match(name, length, "page-break-inside", PAGE_BREAK_INSIDE);
+
+		case css_property_hash("perspective"):
+			return css_property_match(name, length, "perspective", PERSPECTIVE);
+
+		case css_property_hash("perspective-origin"):
+			return css_property_match(name, length, "perspective-origin", PERSPECTIVE_ORIGIN);
+
+		case css_property_hash("position"):
+			return css_property_match(name, length, "position", POSITION);
+
+		case css_property_hash("quotes"):
+			return css_property_match(name, length, "quotes", QUOTES);
+
+		case css_property_hash("resize"):
+			return css_property_match(name, length, "resize", RESIZE);
+
+		case css_property_hash("right"):
+			return css_property_match(name, length, "right", RIGHT);
+
+		case css_property_hash("tab-size"):
+			return css_property_match(name, length, "tab-size", TAB_SIZE);
+
+		case css_property_hash("table-layout"):
+			return css_property_match(name, length, "table-layout", TABLE_LAYOUT);
+
+		case css_property_hash("text-align"):
+			return css_property_match(name, length, "text-align", TEXT_ALIGN);
+
+		case css_property_hash("text-align-last"):
+			return css_property_match(name, length, "text-align-last", TEXT_ALIGN_LAST);
+
+		case css_property_hash("text-decoration"):
+			return css_property_match(name, length, "text-decoration", TEXT_DECORATION);
+
+		case css_property_hash("text-decoration-color"):
+			return css_property_match(name, length, "text-decoration-color", TEXT_DECORATION_COLOR);
+
+		case css_property_hash("text-decoration-line"):
+			return css_property_match(name, length, "text-decoration-line", TEXT_DECORATION_LINE);
+
+		case css_property_hash("text-decoration-style"):
+			return css_property_match(name, length, "text-decoration-style", TEXT_DECORATION_STYLE);
+
+		case css_property_hash("text-indent"):
+			return css_property_match(name, length, "text-indent", TEXT_INDENT);
+
+		case css_property_hash("text-justify"):
+			return css_property_match(name, length, "text-justify", TEXT_JUSTIFY);
+
+		case css_property_hash("text-overflow"):
+			return css_property_match(name, length, "text-overflow", TEXT_OVERFLOW);
+
+		case css_property_hash("text-shadow"):
+			return css_property_match(name, length, "text-shadow", TEXT_SHADOW);
+
+		case css_property_hash("text-transform"):
+			return css_property_match(name, length, "text-transform", TEXT_TRANSFORM);
+
+		case css_property_hash("top"):
+			return css_property_match(name, length, "top", TOP);
+
+		case css_property_hash("transform"):
+			return css_property_match(name, length, "transform", TRANSFORM);
+
+		case css_property_hash("transform-origin"):
+			return css_property_match(name, length, "transform-origin", TRANSFORM_ORIGIN);
+
+		case css_property_hash("transform-style"):
+			return css_property_match(name, length, "transform-style", TRANSFORM_STYLE);
+
+		case css_property_hash("transition"):
+			return css_property_match(name, length, "transition", TRANSITION);
+
+		case css_property_hash("transition-delay"):
+			return css_property_match(name, length, "transition-delay", TRANSITION_DELAY);
+
+		case css_property_hash("transition-duration"):
+			return css_property_match(name, length, "transition-duration", TRANSITION_DURATION);
+
+		case css_property_hash("transition-property"):
+			return css_property_match(name, length, "transition-property", TRANSITION_PROPERTY);
+
+		case css_property_hash("transition-timing-function"):
+			return css_property_match(name, length, "transition-timing-function", TRANSITION_TIMING_FUNCTION);
+
+		case css_property_hash("unicode-bidi"):
+			return css_property_match(name, length, "unicode-bidi", UNICODE_BIDI);
+
+		case css_property_hash("vertical-align"):
+			return css_property_match(name, length, "vertical-align", VERTICAL_ALIGN);
+
+		case css_property_hash("visibility"):
+			return css_property_match(name, length, "visibility", VISIBILITY);
+
+		case css_property_hash("white-space"):
+			return css_property_match(name, length, "white-space", WHITE_SPACE);
+
+		case css_property_hash("width"):
+			return css_property_match(name, length, "width", WIDTH);
+
+		case css_property_hash("word-break"):
+			return css_property_match(name, length, "word-break", WORD_BREAK);
+
+		case css_property_hash("word-spacing"):
+			return css_property_match(name, length, "word-spacing", WORD_SPACING);
+
+		case css_property_hash("word-wrap"):
+			return css_property_match(name, length, "word-wrap", WORD_WRAP);
+
+		case css_property_hash("z-index"):
+			return css_property_match(name, length, "z-index", Z_INDEX);
+
+		default:
+			return CSS_PROPERTY_UNKNOWN;
+
+	}
+
+}
+
+size_t CSSPropertyType_longhands(const CSSPropertyType type, const CSSPropertyType * & longhands)
+{
+
+	switch(type) {
+
+		case MARGIN:
+			return css_longhands(margin_longhands, longhands);
+
+		case PADDING:
+			return css_longhands(padding_longhands, longhands);
+
+		case BORDER:
+			return css_longhands(border_longhands, longhands);
+
+		case BORDER_WIDTH:
+			return css_longhands(border_width_longhands, longhands);
+
+		case BORDER_STYLE:
+			return css_longhands(border_style_longhands, longhands);
+
+		case BORDER_COLOR:
+			return css_longhands(border_color_longhands, longhands);
+
+		case BORDER_TOP:
+			return css_longhands(border_top_longhands, longhands);
+
+		case BORDER_RIGHT:
+			return css_longhands(border_right_longhands, longhands);
+
+		case BORDER_BOTTOM:
+			return css_longhands(border_bottom_longhands, longhands);
+
+		case BORDER_LEFT:
+			return css_longhands(border_left_longhands, longhands);
+
+		case FONT:
+			return css_longhands(font_longhands, longhands);
+
+		default:
+			longhands = nullptr;
+			return 0;
+
+	}
+
+}
+
+void CSSPropertyType_expand(const CSSPropertyType type, const string & value, vector<pair<CSSPropertyType, string>> & out)
+{
+	out.emplace_back(type, value);
+	css_expand_longhands(type, value, out);
+}
@@ -0,0 +1,331 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "css/CSSStatistics.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <locale>
+
+using std::move;
+using std::sort;
+using std::ostringstream;
+using std::lock_guard;
+
+CSSSelectorStatistics::CSSSelectorStatistics() :
+	lookups(0),
+	hits(0),
+	misses(0),
+	merges(0)
+{
+}
+
+CSSSelectorStatistics::CSSSelectorStatistics(CSSSelectorStatistics const & cpy) :
+	lookups(cpy.lookups),
+	hits(cpy.hits),
+	misses(cpy.misses),
+	merges(cpy.merges)
+{
+}
+
+CSSSelectorStatistics::CSSSelectorStatistics(CSSSelectorStatistics && mv) :
+	lookups(mv.lookups),
+	hits(mv.hits),
+	misses(mv.misses),
+	merges(mv.merges)
+{
+}
+
+CSSSelectorStatistics & CSSSelectorStatistics::operator =(const CSSSelectorStatistics & cpy)
+{
+	lookups = cpy.lookups;
+	hits = cpy.hits;
+	misses = cpy.misses;
+	merges = cpy.merges;
+	return *this;
+}
+
+CSSSelectorStatistics & CSSSelectorStatistics::operator =(CSSSelectorStatistics && mv)
+{
+	lookups = mv.lookups;
+	hits = mv.hits;
+	misses = mv.misses;
+	merges = mv.merges;
+	return *this;
+}
+
+CSSSelectorStatistics::~CSSSelectorStatistics()
+{
+}
+
+CSSStatistics::CSSStatistics() :
+	lock(),
+	selectors(),
+	lookups(0),
+	hits(0),
+	misses(0),
+	cascades(0),
+	matches(0),
+	candidates(0),
+	filtered(0),
+	computed(0),
+	memoised(0),
+	merges(0),
+	nanoseconds(0)
+{
+}
+
+CSSStatistics::CSSStatistics(CSSStatistics const & cpy) :
+	lock(),
+	selectors(),
+	lookups(cpy.lookups.load()),
+	hits(cpy.hits.load()),
+	misses(cpy.misses.load()),
+	cascades(cpy.cascades.load()),
+	matches(cpy.matches.load()),
+	candidates(cpy.candidates.load()),
+	filtered(cpy.filtered.load()),
+	computed(cpy.computed.load()),
+	memoised(cpy.memoised.load()),
+	merges(cpy.merges.load()),
+	nanoseconds(cpy.nanoseconds.load())
+{
+	lock_guard<mutex> guard(cpy.lock);
+	selectors = cpy.selectors;
+}
+
+CSSStatistics::CSSStatistics(CSSStatistics && mv) :
+	lock(),
+	selectors(move(mv.selectors)),
+	lookups(mv.lookups.load()),
+	hits(mv.hits.load()),
+	misses(mv.misses.load()),
+	cascades(mv.cascades.load()),
+	matches(mv.matches.load()),
+	candidates(mv.candidates.load()),
+	filtered(mv.filtered.load()),
+	computed(mv.computed.load()),
+	memoised(mv.memoised.load()),
+	merges(mv.merges.load()),
+	nanoseconds(mv.nanoseconds.load())
+{
+}
+
+CSSStatistics & CSSStatistics::operator =(const CSSStatistics & cpy)
+{
+	if(this == &cpy) {
+		return *this;
+	}
+
+	{
+		lock_guard<mutex> guard(cpy.lock);
+		selectors = cpy.selectors;
+	}
+
+	lookups = cpy.lookups.load();
+	hits = cpy.hits.load();
+	misses = cpy.misses.load();
+	cascades = cpy.cascades.load();
+	matches = cpy.matches.load();
+	candidates = cpy.candidates.load();
+	filtered = cpy.filtered.load();
+	computed = cpy.computed.load();
+	memoised = cpy.memoised.load();
+	merges = cpy.merges.load();
+	nanoseconds = cpy.nanoseconds.load();
+	return *this;
+}
+
+CSSStatistics & CSSStatistics::operator =(CSSStatistics && mv)
+{
+	selectors = move(mv.selectors);
+	lookups = mv.lookups.load();
+	hits = mv.hits.load();
+	misses = mv.misses.load();
+	cascades = mv.cascades.load();
+	matches = mv.matches.load();
+	candidates = mv.candidates.load();
+	filtered = mv.filtered.load();
+	computed = mv.computed.load();
+	memoised = mv.memoised.load();
+	merges = mv.merges.load();
+	nanoseconds = mv.nanoseconds.load();
+	return *this;
+}
+
+CSSStatistics::~CSSStatistics()
+{
+}
+
+void CSSStatistics::clear()
+{
+	*this = CSSStatistics();
+}
+
+void CSSStatistics::count(const string & _selector, const uint64_t _lookups, const uint64_t _hits, const uint64_t _misses, const uint64_t _merges)
+{
+	lock_guard<mutex> guard(lock);
+
+	CSSSelectorStatistics & counts = selectors[_selector];
+	counts.lookups += _lookups;
+	counts.hits += _hits;
+	counts.misses += _misses;
+	counts.merges += _merges;
+}
+
+CSSSelectorStatistics CSSStatistics::selector(const string & _selector) const
+{
+	lock_guard<mutex> guard(lock);
+
+	auto found = selectors.find(_selector);
+
+	if(found == selectors.end()) {
+		return CSSSelectorStatistics();
+	}
+
+	return found->second;
+}
+
+vector<pair<string, CSSSelectorStatistics>> CSSStatistics::hottest(const size_t n) const
+{
+
+	vector<pair<string, CSSSelectorStatistics>> result;
+
+	{
+		lock_guard<mutex> guard(lock);
+		result.assign(selectors.begin(), selectors.end());
+	}
+
+	//Ties go alphabetically so that reports compare cleanly.
+	sort(result.begin(), result.end(), [](const pair<string, CSSSelectorStatistics> & lhs, const pair<string, CSSSelectorStatistics> & rhs) {
+		if(lhs.second.lookups != rhs.second.lookups) {
+			return lhs.second.lookups > rhs.second.lookups;
+		}
+
+		return lhs.first < rhs.first;
+	});
+
+	if(n != 0 && result.size() > n) {
+		result.resize(n);
+	}
+
+	return result;
+
+}
+
+string CSSStatistics::to_json(const size_t limit) const
+{
+
+	ostringstream out;
+
+	//Whatever the global locale, JSON wants 1234.5 and not 1.234,5.
+	out.imbue(std::locale::classic());
+
+	out << "{";
+	out << "\"lookups\":" << lookups;
+	out << ",\"hits\":" << hits;
+	out << ",\"misses\":" << misses;
+	out << ",\"cascades\":" << cascades;
+	out << ",\"matches\":" << matches;
+	out << ",\"candidates\":" << candidates;
+	out << ",\"filtered\":" << filtered;
+	out << ",\"computed\":" << computed;
+	out << ",\"memoised\":" << memoised;
+	out << ",\"merges\":" << merges;
+	out << ",\"milliseconds\":" << (nanoseconds / 1000000.0);
+	out << ",\"selectors\":[";
+
+	bool first = true;
+
+	for(auto & selector : hottest(limit)) {
+
+		if(!first) {
+			out << ",";
+		}
+
+		first = false;
+
+		out << "{\"selector\":" << json_string(selector.first);
+		out << ",\"lookups\":" << selector.second.lookups;
+		out << ",\"hits\":" << selector.second.hits;
+		out << ",\"misses\":" << selector.second.misses;
+		out << ",\"merges\":" << selector.second.merges;
+		out << "}";
+
+	}
+
+	out << "]}";
+
+	return out.str();
+
+}
+
+string CSSStatistics::json_string(const string & value)
+{
+
+	ostringstream out;
+
+	out << '"';
+
+	for(const char c : value) {
+		switch(c) {
+			case '"':
+				out << "\\\"";
+				break;
+
+			case '\\':
+				out << "\\\\";
+				break;
+
+			case '\n':
+				out << "\\n";
+				break;
+
+			case '\t':
+				out << "\\t";
+				break;
+
+			default:
+				if((unsigned char) c < 0x20) {
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int) c);
+					out << escaped;
+				}
+				else {
+					out << c;
+				}
+
+				break;
+		}
+	}
+
+	out << '"';
+
+	return out.str();
+
+}
@@ -231,42 +231,27 @@ Container::~Container() {}
 
 void Container::save_to(sqlite3 * const db, const unsigned int epub_file_id)
 {
-	int rc;
-	char * errmsg;
-
-	const string table_sql = "CREATE TABLE container("  \
-	                         "epub_file_id INTEGER NOT NULL," \
-	                         "media_type TEXT NOT NULL," \
-	                         "full_path TEXT NOT NULL) ;";
-	sqlite3_exec(db, table_sql.c_str(), NULL, NULL, &errmsg);
-
-	//Table created.
-
-	const string container_insert_sql = "INSERT INTO container (epub_file_id, media_type, full_path) VALUES (?, ?, ?);";
+	DatabaseSession * open = DatabaseSession::open_on(db);
 
-	sqlite3_stmt * container_insert;
-	rc = sqlite3_prepare_v2(db, container_insert_sql.c_str(), -1, &container_insert, 0);
-
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+	if(open != nullptr) {
+		save_to(*open, epub_file_id);
+		return;
 	}
 
-	for(auto & rootfile : rootfiles) {
-
-		sqlite3_bind_int(container_insert, 1, epub_file_id);
-		sqlite3_bind_text(container_insert, 2, rootfile.media_type.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(container_insert, 3, rootfile.full_path.c_str(), -1, SQLITE_STATIC);
+	DatabaseSession session(db);
+	save_to(session, epub_file_id);
+}
 
-		int result = sqlite3_step(container_insert);
+void Container::save_to(DatabaseSession & session, const unsigned int epub_file_id)
+{
 
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-			throw - 1;
-		}
+	BatchInsert container_insert(session, "container", { "epub_file_id", "media_type", "full_path" });
 
-		sqlite3_reset(container_insert);
+	for(auto & rootfile : rootfiles) {
+		container_insert.bind(epub_file_id).bind(rootfile.media_type).bind(rootfile.full_path);
 	}
 
-	sqlite3_finalize(container_insert);
+	container_insert.flush();
 
 }
 
@@ -31,12 +31,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/filesystem.hpp>
 #include <libxml++/libxml++.h>
 #include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <unordered_map>
 
 #include "SQLiteUtils.hpp"
+#include "DatabaseSchema.hpp"
+#include "ContentView.hpp"
+#include "PackedContent.hpp"
 
 using std::move;
 using std::pair;
 using std::string;
+using std::unordered_map;
 
 #ifdef DEBUG
 #include <iostream>
@@ -47,13 +54,15 @@ using std::endl;
 using namespace boost::filesystem;
 using namespace xmlpp;
 
-ContentItem::ContentItem(ContentType _type, CSSRule _rule, path _file, ustring _id, ustring _content, ustring _stripped_content) :
+ContentItem::ContentItem(ContentType _type, CSSRule _rule, path _file, ustring _id, ustring _content, ustring _stripped_content, const unsigned int _file_id, const unsigned int _selector_id) :
 	type(_type),
 	rule(_rule),
 	file(_file),
 	id(_id),
 	content(_content),
-	stripped_content(_stripped_content)
+	stripped_content(_stripped_content),
+	file_id(_file_id),
+	selector_id(_selector_id)
 {
 }
 
@@ -63,7 +72,9 @@ ContentItem::ContentItem(ContentItem const & cpy)  :
 	file(cpy.file),
 	id(cpy.id),
 	content(cpy.content),
-	stripped_content(cpy.stripped_content)
+	stripped_content(cpy.stripped_content),
+	file_id(cpy.file_id),
+	selector_id(cpy.selector_id)
 {
 }
 
@@ -73,7 +84,9 @@ ContentItem::ContentItem(ContentItem && mv)  :
 	file(move(mv.file)),
 	id(move(mv.id)),
 	content(move(mv.content)),
-	stripped_content(move(mv.stripped_content))
+	stripped_content(move(mv.stripped_content)),
+	file_id(mv.file_id),
+	selector_id(mv.selector_id)
 {
 }
 
@@ -85,6 +98,8 @@ ContentItem & ContentItem::operator =(const ContentItem & cpy)
 	id = cpy.id;
 	content = cpy.content;
 	stripped_content = cpy.stripped_content;
+	file_id = cpy.file_id;
+	selector_id = cpy.selector_id;
 	return *this;
 }
 
@@ -96,6 +111,8 @@ ContentItem & ContentItem::operator =(ContentItem && mv)
 	id = move(mv.id);
 	content = move(mv.content);
 	stripped_content = move(mv.stripped_content);
+	file_id = mv.file_id;
+	selector_id = mv.selector_id;
 	return *this;
 }
 
@@ -119,268 +136,486 @@ namespace {
 		return tmp;
 	}
 
-	ustring __id = "";
-
-	string i_key;
-	string b_key;
-	string big_key;
-	string s_key;
-	string sub_key;
-	string sup_key;
-	string small_key;
-	string tt_key;
-	string u_key;
-	string a_key;
-	string span_key;
-	string class_key;
-	string hr_key;
-	string p_key;
-	string h1_key;
-	string h2_key;
-	string id_key;
-	string _blank_key;
-
-	inline CSSRule __find_css(const Element * const childElement, const CSS & css)
+	//What an element is to the content reader.
+	enum ElementRole {
+		//Text kept, element dropped.
+		ELEMENT_UNKNOWN,
+		//Text kept, wrapped in tag if there is one.
+		ELEMENT_INLINE,
+		//Text kept, made bold or italic by its computed style.
+		ELEMENT_STYLED,
+		//An item of its own, or if it holds other blocks, the blocks are
+		//items and any loose text between them makes more.
+		ELEMENT_BLOCK,
+		//An HR item.
+		ELEMENT_RULE,
+		//Nothing inside it is kept.
+		ELEMENT_IGNORED
+	};
+
+	struct ElementClass {
+		const char * name;
+		ElementRole role;
+		ContentType type;
+		const char * tag;
+	};
+
+	const ElementClass unknown_element = { "", ELEMENT_UNKNOWN, DIV, nullptr };
+
+	inline ElementClass __element_match(const char * name, const size_t length, const ElementClass & candidate)
 	{
 
-		CSSRule rule;
+		for(size_t i = 0; i < length; i++) {
+			if(candidate.name[i] == '\0' || css_property_fold(name[i]) != candidate.name[i]) {
+				return unknown_element;
+			}
+		}
+
+		return (candidate.name[length] == '\0') ? candidate : unknown_element;
+
+	}
+
+	/*
+	The XHTML vocabulary, classified. Like property names, element names
+	are looked up through the perfect hash, so an element costs one hash
+	and one compare however many are listed here. Anything not listed
+	keeps its text and loses its markup.
+	*/
+	ElementClass __classify(const ustring & element)
+	{
+
+		const string & raw = element.raw();
+		const char * name = raw.data();
+		const size_t length = raw.length();
+
+		switch(css_property_hash(name, length)) {
+
+			case css_property_hash("p"):
+				return __element_match(name, length, { "p", ELEMENT_BLOCK, P, nullptr });
+
+			case css_property_hash("h1"):
+				return __element_match(name, length, { "h1", ELEMENT_BLOCK, H1, nullptr });
+
+			case css_property_hash("h2"):
+				return __element_match(name, length, { "h2", ELEMENT_BLOCK, H2, nullptr });
+
+			case css_property_hash("h3"):
+				return __element_match(name, length, { "h3", ELEMENT_BLOCK, H3, nullptr });
+
+			case css_property_hash("h4"):
+				return __element_match(name, length, { "h4", ELEMENT_BLOCK, H4, nullptr });
+
+			case css_property_hash("h5"):
+				return __element_match(name, length, { "h5", ELEMENT_BLOCK, H5, nullptr });
+
+			case css_property_hash("h6"):
+				return __element_match(name, length, { "h6", ELEMENT_BLOCK, H6, nullptr });
+
+			case css_property_hash("blockquote"):
+				return __element_match(name, length, { "blockquote", ELEMENT_BLOCK, BLOCKQUOTE, nullptr });
+
+			case css_property_hash("li"):
+				return __element_match(name, length, { "li", ELEMENT_BLOCK, LI, nullptr });
+
+			case css_property_hash("pre"):
+				return __element_match(name, length, { "pre", ELEMENT_BLOCK, PRE, nullptr });
+
+			case css_property_hash("dt"):
+				return __element_match(name, length, { "dt", ELEMENT_BLOCK, DT, nullptr });
+
+			case css_property_hash("dd"):
+				return __element_match(name, length, { "dd", ELEMENT_BLOCK, DD, nullptr });
+
+			case css_property_hash("td"):
+				return __element_match(name, length, { "td", ELEMENT_BLOCK, TD, nullptr });
+
+			case css_property_hash("th"):
+				return __element_match(name, length, { "th", ELEMENT_BLOCK, TH, nullptr });
+
+			case css_property_hash("caption"):
+				return __element_match(name, length, { "caption", ELEMENT_BLOCK, CAPTION, nullptr });
+
+			case css_property_hash("figcaption"):
+				return __element_match(name, length, { "figcaption", ELEMENT_BLOCK, CAPTION, nullptr });
+
+			case css_property_hash("address"):
+				return __element_match(name, length, { "address", ELEMENT_BLOCK, ADDRESS, nullptr });
+
+			//Blocks that are mostly there to hold other blocks. Any text
+			//they hold directly is a DIV.
+			case css_property_hash("div"):
+				return __element_match(name, length, { "div", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("section"):
+				return __element_match(name, length, { "section", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("article"):
+				return __element_match(name, length, { "article", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("aside"):
+				return __element_match(name, length, { "aside", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("nav"):
+				return __element_match(name, length, { "nav", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("header"):
+				return __element_match(name, length, { "header", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("footer"):
+				return __element_match(name, length, { "footer", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("main"):
+				return __element_match(name, length, { "main", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("center"):
+				return __element_match(name, length, { "center", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("figure"):
+				return __element_match(name, length, { "figure", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("fieldset"):
+				return __element_match(name, length, { "fieldset", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("ul"):
+				return __element_match(name, length, { "ul", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("ol"):
+				return __element_match(name, length, { "ol", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("dl"):
+				return __element_match(name, length, { "dl", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("table"):
+				return __element_match(name, length, { "table", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("thead"):
+				return __element_match(name, length, { "thead", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("tbody"):
+				return __element_match(name, length, { "tbody", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("tfoot"):
+				return __element_match(name, length, { "tfoot", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("tr"):
+				return __element_match(name, length, { "tr", ELEMENT_BLOCK, DIV, nullptr });
+
+			case css_property_hash("hr"):
+				return __element_match(name, length, { "hr", ELEMENT_RULE, HR, nullptr });
+
+			case css_property_hash("i"):
+				return __element_match(name, length, { "i", ELEMENT_INLINE, DIV, "i" });
+
+			case css_property_hash("em"):
+				return __element_match(name, length, { "em", ELEMENT_INLINE, DIV, "i" });
+
+			case css_property_hash("cite"):
+				return __element_match(name, length, { "cite", ELEMENT_INLINE, DIV, "i" });
+
+			case css_property_hash("dfn"):
+				return __element_match(name, length, { "dfn", ELEMENT_INLINE, DIV, "i" });
+
+			case css_property_hash("var"):
+				return __element_match(name, length, { "var", ELEMENT_INLINE, DIV, "i" });
+
+			case css_property_hash("b"):
+				return __element_match(name, length, { "b", ELEMENT_INLINE, DIV, "b" });
+
+			case css_property_hash("strong"):
+				return __element_match(name, length, { "strong", ELEMENT_INLINE, DIV, "b" });
+
+			case css_property_hash("big"):
+				return __element_match(name, length, { "big", ELEMENT_INLINE, DIV, "big" });
+
+			case css_property_hash("small"):
+				return __element_match(name, length, { "small", ELEMENT_INLINE, DIV, "small" });
 
-		ustring id_name = "";
-		ustring class_name = "";
-		ustring element_name = childElement->get_name();
+			case css_property_hash("s"):
+				return __element_match(name, length, { "s", ELEMENT_INLINE, DIV, "s" });
+
+			case css_property_hash("strike"):
+				return __element_match(name, length, { "strike", ELEMENT_INLINE, DIV, "s" });
+
+			case css_property_hash("del"):
+				return __element_match(name, length, { "del", ELEMENT_INLINE, DIV, "s" });
+
+			case css_property_hash("sub"):
+				return __element_match(name, length, { "sub", ELEMENT_INLINE, DIV, "sub" });
+
+			case css_property_hash("sup"):
+				return __element_match(name, length, { "sup", ELEMENT_INLINE, DIV, "sup" });
+
+			case css_property_hash("tt"):
+				return __element_match(name, length, { "tt", ELEMENT_INLINE, DIV, "tt" });
+
+			case css_property_hash("code"):
+				return __element_match(name, length, { "code", ELEMENT_INLINE, DIV, "tt" });
+
+			case css_property_hash("kbd"):
+				return __element_match(name, length, { "kbd", ELEMENT_INLINE, DIV, "tt" });
+
+			case css_property_hash("samp"):
+				return __element_match(name, length, { "samp", ELEMENT_INLINE, DIV, "tt" });
+
+			case css_property_hash("u"):
+				return __element_match(name, length, { "u", ELEMENT_INLINE, DIV, "u" });
+
+			case css_property_hash("ins"):
+				return __element_match(name, length, { "ins", ELEMENT_INLINE, DIV, "u" });
+
+			//Hyperlinks keep their text. I suspect that I'll have to come
+			//back to this, but at the moment I'm not completely sure how to
+			//handle it.
+			case css_property_hash("a"):
+				return __element_match(name, length, { "a", ELEMENT_INLINE, DIV, nullptr });
+
+			case css_property_hash("span"):
+				return __element_match(name, length, { "span", ELEMENT_STYLED, DIV, nullptr });
+
+			case css_property_hash("script"):
+				return __element_match(name, length, { "script", ELEMENT_IGNORED, DIV, nullptr });
+
+			case css_property_hash("style"):
+				return __element_match(name, length, { "style", ELEMENT_IGNORED, DIV, nullptr });
+
+			case css_property_hash("head"):
+				return __element_match(name, length, { "head", ELEMENT_IGNORED, DIV, nullptr });
+
+			default:
+				return unknown_element;
+
+		}
+
+	}
+
+	//How the selector matching sees childElement.
+	inline CSSElement __css_element(const Element * const childElement, const CSSElement * parent, const CSSElement * previous)
+	{
+
+		string id_name = "";
+		string style = "";
+		vector<string> class_names;
 
 		const auto attributes = childElement->get_attributes();
 
 		for(auto iter = attributes.begin(); iter != attributes.end(); ++iter) {
 
 			const Attribute * attribute = *iter;
+			const string & attribute_name = attribute->get_name().raw();
 
-			if(attribute->get_name().collate_key() == class_key) {
-				//We've found a class here.
-				class_name = attribute->get_value();
+			if(attribute_name == "class") {
+				//We've found a class here. There may be several.
+				const string value = attribute->get_value().raw();
+				size_t begin = value.find_first_not_of(" \t\r\n");
+
+				while(begin != string::npos) {
+					const size_t end = value.find_first_of(" \t\r\n", begin);
+					class_names.push_back(value.substr(begin, end == string::npos ? string::npos : end - begin));
+					begin = value.find_first_not_of(" \t\r\n", end);
+				}
 			}
-			else if (attribute->get_name().collate_key() == class_key) {
+			else if (attribute_name == "id") {
 				//We've found in id here.
 				id_name = attribute->get_value();
 			}
+			else if (attribute_name == "style") {
+				//Inline declarations, parsed when the element is matched.
+				style = attribute->get_value();
+			}
 
 		}
 
-		if(!id_name.empty()) {
-
-			//Look for rules of the type p#id;
+		CSSElement element(childElement->get_name(), id_name, class_names, parent, previous);
+		element.style = style;
+		return element;
 
-			ustring tmp = "";
-			tmp += element_name;
-			tmp += "#";
-			tmp += id_name;
+	}
 
-			if(css.contains_rule(tmp)) {
-				rule.add(css.get_rule(tmp));
-			}
+	inline bool __is_bold(const CSSRule & rule)
+	{
+		const CSSDeclaration * weight = rule.find_declaration(FONT_WEIGHT);
 
-			tmp = "#";
-			tmp += id_name;
+		if(!weight) {
+			return false;
+		}
 
-			//Look for simple #id rules.
+		return weight->value == "bold" || weight->value == "bolder" || atoi(weight->value.c_str()) >= 600;
+	}
 
-			if(css.contains_rule(tmp)) {
-				rule.add(css.get_rule(tmp));
-			}
+	inline bool __is_italic(const CSSRule & rule)
+	{
+		const CSSDeclaration * style = rule.find_declaration(FONT_STYLE);
 
+		if(!style) {
+			return false;
 		}
 
-		if(!class_name.empty()) {
+		return style->value == "italic" || style->value == "oblique";
+	}
 
-			//Look for rules of the type p.class;
+	//Whether any of node's children is a block of its own.
+	inline bool __has_blocks(const Node * const node)
+	{
 
-			ustring tmp = "";
-			tmp += element_name;
-			tmp += ".";
-			tmp += class_name;
+		const auto nodelist = node->get_children();
 
-			if(css.contains_rule(tmp)) {
-				rule.add(css.get_rule(tmp));
-			}
+		for(auto niter = nodelist.begin(); niter != nodelist.end(); ++niter) {
 
-			tmp = ".";
-			tmp += class_name;
+			const Element * childElement = dynamic_cast<const Element *>(*niter);
 
-			//Look for simple .class rules.
+			if(childElement) {
 
-			if(css.contains_rule(tmp)) {
-				rule.add(css.get_rule(tmp));
-			}
+				const ElementRole role = __classify(childElement->get_name()).role;
 
-		}
+				if(role == ELEMENT_BLOCK || role == ELEMENT_RULE) {
+					return true;
+				}
+
+			}
 
-		if(css.contains_rule(element_name)) {
-			rule.add(css.get_rule(element_name));
 		}
 
-		return rule;
+		return false;
 
 	}
 
-	//This whole method is fairly awful.
-	pair<ustring, ustring> __recursive_strip(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const node)
+	pair<ustring, ustring> __recursive_strip(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const node, const CSSElement * parent, CSSAncestorFilter & filter, const ustring & id);
+
+	//Adds childNode, one of parent's children, to the text so far.
+	void __strip_child(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const childNode, const CSSElement * parent, vector<CSSElement> & siblings, CSSAncestorFilter & filter, const ustring & id, ustring & value, ustring & value_stripped)
 	{
 
-		const TextNode * nodeText = dynamic_cast<const TextNode *>(node);
+		//Still still Genuinely horrible.
+		const Element * childElement = dynamic_cast<const Element *>(childNode);
+		const TextNode * childText = dynamic_cast<const TextNode *>(childNode);
 
-		if(nodeText) {
-			if(nodeText->is_white_space()) {
-				return pair<ustring, ustring>("", "");
+		if(childText) {
+			if(!childText->is_white_space()) {
+				value += childText->get_content();
+				value_stripped += childText->get_content();
 			}
 
-			ustring content = nodeText->get_content();
-			return pair<ustring, ustring>(content, content);
+			return;
 		}
 
-		const Element * nodeElement = dynamic_cast<const Element *>(node);
-		const auto nodelist = nodeElement->get_children();
-
-		ustring value = "";
-		ustring value_stripped = "";
+		if(!childElement) {
+			return;
+		}
 
-		for(auto niter = nodelist.begin(); niter != nodelist.end(); ++niter) {
+		siblings.push_back(__css_element(childElement, parent, siblings.empty() ? nullptr : &siblings.back()));
+		const CSSElement & element = siblings.back();
 
-			const Node * childNode = *niter;
+		const ElementClass element_class = __classify(childElement->get_name());
 
-			//Still still Genuinely horrible.
-			const Element * childElement = dynamic_cast<const Element *>(childNode);
-			const TextNode * childText = dynamic_cast<const TextNode *>(childNode);
+		//For everything below. The element finding itself in the filter
+		//when it's matched can only let a selector through to the full
+		//check, never make it match.
+		filter.push(element);
 
-			if(!childElement && !childText) {
-				continue;
-			}
+		switch(element_class.role) {
 
-			if(childText) {
-				pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-				value += res.first;
+			case ELEMENT_INLINE: {
+				pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode, &element, filter, id);
+				value += element_class.tag ? __create_text(element_class.tag, res.first) : res.first;
 				value_stripped += res.second;
+				break;
 			}
 
-			if(childElement) {
+			case ELEMENT_STYLED: {
+				//Work out the style from its classes.
+				const CSSRule & tmp = css.match(element, filter);
 
-				const ustring childname = childElement->get_name();
-				const string childname_key = childname.collate_key();
+				pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode, &element, filter, id);
 
-				if(childname_key == i_key) {
-					//italic.
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("i", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == b_key) {
-					//bold;
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
+				if(__is_bold(tmp)) {
 					value += __create_text("b", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == big_key) {
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("big", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == s_key) {
-					//strikethrough
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("s", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == sub_key) {
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("sub", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == sup_key) {
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("sup", res.first);
-					value_stripped += res.second;
 				}
-				else if(childname_key == small_key) {
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
+				else if (__is_italic(tmp)) {
 					value += __create_text("i", res.first);
-					value_stripped += res.second;
 				}
-				else if(childname_key == tt_key) {
-					//monospace
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("tt", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == u_key) {
-					//underline
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-					value += __create_text("u", res.first);
-					value_stripped += res.second;
-				}
-				else if(childname_key == a_key) {
-					//specific bheaviour for stripping hyperlinks within the text.
-					//I suspect that I'll have to come back to this, but at the moment I'm
-					//not completely sure how to handle it.
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
+				else {
 					value += res.first;
-					value_stripped += res.second;
 				}
-				else if(childname_key == span_key) {
-					//specific bheaviour for stripping span tags
-					//Try to find a class attribute.
-					CSSRule tmp;
-					const auto attributes = childElement->get_attributes();
-
-					for(auto iter = attributes.begin(); iter != attributes.end(); ++iter) {
-
-						const Attribute * attribute = *iter;
-
-						if(attribute->get_name().collate_key() == class_key) {
-							//We've found a class here.
-							ustring cname = attribute->get_value();
-							//Need to do this better in the future:
-							tmp = css.get_rule(ustring(".") + cname);
-						}
-					}
-
-					pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode);
-
-					if(tmp.fontweight == FONTWEIGHT_BOLD) {
-						value += __create_text("b", res.first);
-					}
-					else if (tmp.fontstyle == FONTSTYLE_ITALIC) {
-						value += __create_text("i", res.first);
-					}
-					else {
-						value += res.first;
-					}
-
-					value_stripped += res.second;
 
-				}
-				else if(childname_key == hr_key)  {
-					//What to do if this is a nested <hr> tag within (frequently)
-					//a <p> tag.
-					ContentType ct = HR;
+				value_stripped += res.second;
+				break;
+			}
 
-					//See if we can find a CSS class for this.
-					CSSRule rule = css.get_rule("hr");
+			case ELEMENT_RULE: {
+				//What to do if this is a nested <hr> tag within (frequently)
+				//a <p> tag.
+				const CSSRule & rule = css.match(element, filter);
 
-					//Add it directly to the items:
-					items.emplace_back(ct, rule, file, __id, "", "");
+				//Add it directly to the items:
+				items.emplace_back(HR, rule, file, id, "", "");
 
-					value = "";
-					value_stripped = "";
-				}
+				value = "";
+				value_stripped = "";
+				break;
+			}
+
+			case ELEMENT_IGNORED:
+				break;
+
+			//Blocks this deep inside another are flattened into it.
+			default: {
+				pair<ustring, ustring> res = __recursive_strip(items, css, file, childNode, &element, filter, id);
+				value += res.first;
+				value_stripped += res.second;
+				break;
 			}
+
+		}
+
+		filter.pop(element);
+
+	}
+
+	//This whole method is fairly awful.
+	//parent is node as a CSSElement, and filter holds it and everything above it.
+	pair<ustring, ustring> __recursive_strip(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const node, const CSSElement * parent, CSSAncestorFilter & filter, const ustring & id)
+	{
+
+		const auto nodelist = node->get_children();
+
+		ustring value = "";
+		ustring value_stripped = "";
+
+		//The elements among node's children, so that each can point at
+		//the one before it. Reserved so those pointers stay put.
+		vector<CSSElement> siblings;
+		siblings.reserve(nodelist.size());
+
+		for(auto niter = nodelist.begin(); niter != nodelist.end(); ++niter) {
+			__strip_child(items, css, file, *niter, parent, siblings, filter, id, value, value_stripped);
 		}
 
 		return pair<ustring, ustring>(value, value_stripped);
 	}
 
-	void __recursive_find(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const node)
+	//node's children are blocks, or text and inline elements between
+	//them, which are an item of type. parent is node as a CSSElement, and
+	//filter holds it and everything above it. id is the last id seen.
+	void __recursive_find(vector<ContentItem> & items, const CSS & css, const path & file, const Node * const node, const CSSElement * parent, CSSAncestorFilter & filter, const ContentType type, ustring & id)
 	{
 		const auto nlist = node->get_children();
 
+		vector<CSSElement> siblings;
+		siblings.reserve(nlist.size());
+
+		//Text between the blocks.
+		ustring value = "";
+		ustring value_stripped = "";
+
+		auto flush = [&]() {
+			if(!value.empty()) {
+				items.emplace_back(type, css.match(*parent, filter), file, id, value, value_stripped);
+			}
+
+			value = "";
+			value_stripped = "";
+		};
+
 		for(auto niter = nlist.begin(); niter != nlist.end(); ++niter) {
 
 			const Node * ntmp = *niter;
@@ -388,89 +623,114 @@ namespace {
 			//Still still Genuinely horrible.
 			const Element * tmpnode = dynamic_cast<const Element *>(ntmp);
 
-			if(!tmpnode) {
+			const ElementClass element_class = tmpnode ? __classify(tmpnode->get_name()) : unknown_element;
+			const bool block = element_class.role == ELEMENT_BLOCK || element_class.role == ELEMENT_RULE;
+
+			//Inline elements wrapped round blocks are looked through.
+			if(!tmpnode || (!block && (element_class.role == ELEMENT_IGNORED || !__has_blocks(ntmp)))) {
+				__strip_child(items, css, file, ntmp, parent, siblings, filter, id, value, value_stripped);
 				continue;
 			}
 
-			const ustring tmpnodename = tmpnode->get_name();
-			const string name_key = tmpnodename.collate_key();
+			flush();
 
-			if(name_key != p_key && name_key !=  h1_key && name_key != h2_key && name_key != hr_key) {
-				__recursive_find(items, css, file, ntmp);
+			siblings.push_back(__css_element(tmpnode, parent, siblings.empty() ? nullptr : &siblings.back()));
+			const CSSElement & element = siblings.back();
+
+			if(!element.id.empty()) {
+				id = element.id;
+			}
+
+			filter.push(element);
+
+			if(element_class.role == ELEMENT_RULE) {
+				items.emplace_back(HR, css.match(element, filter), file, id, "", "");
+			}
+			else if(!block || __has_blocks(ntmp)) {
+				__recursive_find(items, css, file, ntmp, &element, filter, block ? element_class.type : type, id);
 			}
 			else {
 
-				ContentType ct = P;
-				//Try to get a class for the content type.
-				CSSRule rule;
+				//Get the computed style for the element.
+				const CSSRule & rule = css.match(element, filter);
+
+				pair<ustring, ustring> content = __recursive_strip(items, css, file, ntmp, &element, filter, id);
+
+				if(!content.first.empty()) {
+
+					#ifdef DEBUG
+					cout << tmpnode->get_name()  << " " << id << endl;
+					cout << " \t " << content.first << endl;
+					cout << " \t " << content.second << endl;
+					#endif
+
+					items.emplace_back(element_class.type, rule, file, id, content.first, content.second);
 
-				if(name_key == p_key) {
-					ct = P;
-					rule = css.get_rule("p");
-				}
-				else if (name_key == h1_key) {
-					ct = H1;
-					rule = css.get_rule("h1");
-				}
-				else if (name_key == h2_key) {
-					ct = H2;
-					rule = css.get_rule("h2");
-				}
-				else if (name_key == hr_key) {
-					ct = HR;
-					rule = css.get_rule("hr");
 				}
 
-				const auto attributes = tmpnode->get_attributes();
+			}
+
+			filter.pop(element);
 
-				for(auto iter = attributes.begin(); iter != attributes.end(); ++iter) {
-					const Attribute * attribute = *iter;
+		}
 
-					const string attr_key = attribute->get_name().collate_key();
+		flush();
+	}
 
-					if(attr_key == id_key) {
-						__id = attribute->get_value();
-					}
+	//The id of value's row in an interned table (files or selectors),
+	//adding it if it isn't there. ids holds what this save has already
+	//looked up, so each string costs at most two statements per save.
+	inline unsigned int __intern(DatabaseSession & session, unordered_map<string, unsigned int> & ids, const string & table, const string & id_column, const string & column, const string & value)
+	{
 
-					/* TODO!!!!!
-					if(attr_key == class_key) {
-						//We've found an additional class here.
-						ustring cname = attribute->get_value();
-						CSSClass tmp = classes.get_class(cname);
-						cssclass.add(tmp);
-					}
-					*/
-				}
+		auto found = ids.find(value);
 
-				pair<ustring, ustring> content = __recursive_strip(items, css, file, ntmp);
+		if(found != ids.end()) {
+			return found->second;
+		}
 
-				if(ct != HR && content.first.empty()) {
-					continue;
-				}
+		sqlite3_stmt * insert = session.statement("INSERT OR IGNORE INTO " + table + "(" + column + ") VALUES(?);");
+		sqlite3_bind_text(insert, 1, value.c_str(), -1, SQLITE_TRANSIENT);
 
-				#ifdef DEBUG
-				cout << tmpnode->get_name()  << " " << __id << endl;
-				cout << " \t " << content.first << endl;
-				cout << " \t " << content.second << endl;
-				#endif
-				items.emplace_back(ct, rule, file, __id, content.first, content.second);
+		int rc = sqlite3_step(insert);
+		sqlite3_reset(insert);
 
-			}
+		if(rc != SQLITE_DONE) {
+			throw - 1;
+		}
+
+		sqlite3_stmt * select = session.statement("SELECT " + id_column + " FROM " + table + " WHERE " + column + "=?;");
+		sqlite3_bind_text(select, 1, value.c_str(), -1, SQLITE_TRANSIENT);
+
+		rc = sqlite3_step(select);
+		const unsigned int id = sqlite3_column_int(select, 0);
+		sqlite3_reset(select);
+
+		if(rc != SQLITE_ROW) {
+			throw - 1;
 		}
+
+		ids.emplace(value, id);
+
+		return id;
+
 	}
+
 } // end anonymous namespace
 
-Content::Content(CSS & _css, vector<path> _files) :
-	css(_css),
+Content::Content(CSS & _css, vector<path> _files, const path & _root) :
+	css(&_css),
 	files(_files),
-	items()
+	items(),
+	root(_root)
 {
 
 	items.reserve(2000);
 
 	for(const auto file : files) {
 
-		__id = "";
+		//The id of the last element that had one, for the items after it.
+		ustring id = "";
 
 		if(!exists(file)) {
 			throw std::runtime_error("Content file specified in OPF file does not exist!");
@@ -483,39 +743,20 @@ Content::Content(CSS & _css, vector<path> _files) :
 		DomParser parser;
 		parser.parse_file(file.string());
 
-		//The DomParser futzes with the locale,
-		//which means that the collation keys
-		//created _before_ this will be incompatible
-		//with the collation keys created during the
-		//recursive methods.
-		//
-		//So, setup the keys here.
-		i_key = ustring("i").collate_key();
-		b_key = ustring("b").collate_key();
-		big_key = ustring("big").collate_key();
-		s_key = ustring("s").collate_key();
-		sub_key = ustring("sub").collate_key();
-		sup_key = ustring("sup").collate_key();
-		small_key = ustring("small").collate_key();
-		tt_key = ustring("tt").collate_key();
-		u_key = ustring("u").collate_key();
-		a_key = ustring("a").collate_key();
-		span_key = ustring("span").collate_key();
-		class_key = ustring("class").collate_key();
-		hr_key = ustring("hr").collate_key();
-		p_key = ustring("p").collate_key();
-		h1_key = ustring("h1").collate_key();
-		h2_key = ustring("h2").collate_key();
-		id_key = ustring("id").collate_key();
-		_blank_key = ustring ("").collate_key();
-
-		const Node * root = parser.get_document()->get_root_node();
+		const Element * root = parser.get_document()->get_root_node();
 		const ustring rootname = root->get_name();
 
 		if(rootname.compare("html") != 0) {
 			throw std::runtime_error("Linked content file isn't HTML. So we can't read it. Mostly through laziness.");
 		}
 
+		const CSSElement html = __css_element(root, nullptr, nullptr);
+
+		const path name = _root.empty() ? file : file.lexically_relative(_root);
+
+		CSSAncestorFilter filter;
+		filter.push(html);
+
 		const auto nlist = root->get_children();
 
 		for(auto niter = nlist.begin(); niter != nlist.end(); ++niter) {
@@ -529,7 +770,12 @@ Content::Content(CSS & _css, vector<path> _files) :
 			}
 
 			if(tmpnode->get_name().compare("body") == 0)  {
-				__recursive_find(items, _css, file, ntmp);
+				//head comes first, but nothing in it is ever matched against.
+				const CSSElement body = __css_element(tmpnode, &html, nullptr);
+
+				filter.push(body);
+				__recursive_find(items, _css, name, ntmp, &body, filter, DIV, id);
+				filter.pop(body);
 			}
 
 		}
@@ -537,60 +783,39 @@ Content::Content(CSS & _css, vector<path> _files) :
 }
 
 Content::Content(CSS & _css, sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index) :
-	css(_css),
+	css(&_css),
 	files(),
-	items()
+	items(),
+	root()
 {
 
-	items.reserve(2000);
-
-	int rc;
-
-	const string content_select_sql = "SELECT * FROM content WHERE epub_file_id=? AND opf_id=?;";
+	//All of it, however it was saved. Use a ContentView or a
+	//PackedContent to read only some.
+	SQLiteReadTransaction snapshot(db);
 
-	sqlite3_stmt * content_select;
+	ContentView view(_css, db, epub_file_id, opf_index);
+	items = view.range(view.first_id(), view.last_id());
 
-	rc = sqlite3_prepare_v2(db, content_select_sql.c_str(), -1, &content_select, 0);
-
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+	if(items.empty()) {
+		PackedContent packed(_css, db, epub_file_id, opf_index);
+		items = packed.all();
 	}
 
-	sqlite3_bind_int(content_select, 1, epub_file_id);
-	sqlite3_bind_int(content_select, 2, opf_index);
-
-	rc = sqlite3_step(content_select);
-
-	while ( rc == SQLITE_ROW ) {
-
-		ContentType type = (ContentType) sqlite3_column_int(content_select, 3);
-		CSSRule rule = _css.get_rule(sqlite3_column_ustring(content_select, 4));
-		path file(sqlite3_column_string(content_select, 5));
-		ustring id = sqlite3_column_ustring(content_select, 6);
-		ustring content = sqlite3_column_ustring(content_select, 7);
-		ustring stripped_content = sqlite3_column_ustring(content_select, 8);
-
-		items.emplace_back(type, rule, file, id, content, stripped_content);
-
-		rc = sqlite3_step(content_select);
-
-	}
-
-	sqlite3_finalize(content_select);
-
 }
 
 Content::Content(Content const & cpy) :
 	css(cpy.css),
 	files(cpy.files),
-	items(cpy.items)
+	items(cpy.items),
+	root(cpy.root)
 {
 }
 
 Content::Content(Content && mv) :
 	css(mv.css),
 	files(move(mv.files)),
-	items(move(mv.items))
+	items(move(mv.items)),
+	root(move(mv.root))
 {
 }
 
@@ -599,6 +824,7 @@ Content & Content::operator =(const Content & cpy)
 	css = cpy.css;
 	files = cpy.files;
 	items = cpy.items;
+	root = cpy.root;
 	return *this;
 }
 
@@ -607,6 +833,7 @@ Content & Content::operator =(Content && mv)
 	css = mv.css;
 	files = move(mv.files);
 	items = move(mv.items);
+	root = move(mv.root);
 	return *this;
 }
 
@@ -616,59 +843,86 @@ Content::~Content()
 
 void Content::save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)
 {
+	DatabaseSession * open = DatabaseSession::open_on(db);
 
-	int rc;
-	char * errmsg;
+	if(open != nullptr) {
+		save_to(*open, epub_file_id, opf_index);
+		return;
+	}
 
-	const string content_table_sql = "CREATE TABLE IF NOT EXISTS content("  \
-	                                 "content_id 				INTEGER PRIMARY KEY," \
-	                                 "epub_file_id			INTEGER NOT NULL," \
-	                                 "opf_id 				INTEGER NOT NULL," \
-	                                 "type			 		INTEGER NOT NULL," \
-	                                 "css_selector		 		TEXT NOT NULL," \
-	                                 "filename	 			TEXT NOT NULL," \
-	                                 "id			 		TEXT NOT NULL," \
-	                                 "content	 			TEXT NOT NULL," \
-	                                 "stripped_content		TEXT NOT NULL) ;";
-	sqlite3_exec(db, content_table_sql.c_str(), NULL, NULL, &errmsg);
+	DatabaseSession session(db);
+	save_to(session, epub_file_id, opf_index);
+}
 
-	//Tables created.
+void Content::save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index, const ContentStorage storage)
+{
 
-	sqlite3_stmt * content_insert;
+	//The content ids are worked out from what's already there, so
+	//nothing else may write between reading them and the rows going in.
+	session.begin();
 
-	const string content_insert_sql = "INSERT INTO content (epub_file_id, opf_id, type, css_selector, filename, id, content, stripped_content) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+	try {
 
-	rc = sqlite3_prepare_v2(db, content_insert_sql.c_str(), -1, &content_insert, 0);
+		unordered_map<string, unsigned int> file_ids;
+		unordered_map<string, unsigned int> selector_ids;
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+		for(auto & contentitem : items) {
+			contentitem.file_id = __intern(session, file_ids, "files", "file_id", "filename", contentitem.file.string());
+			contentitem.selector_id = __intern(session, selector_ids, "selectors", "selector_id", "css_selector", contentitem.rule.selector.raw_text);
+		}
 
-	for(auto & contentitem : items) {
+		if(storage == CONTENT_PACKED) {
+			//Saved, it would never turn up in a search.
+			if(DatabaseSchema::has_search(session)) {
+				throw std::runtime_error("Packed content can't be searched!");
+			}
 
-		sqlite3_bind_int(content_insert, 1, epub_file_id);
-		sqlite3_bind_int(content_insert, 2, opf_index);
-		sqlite3_bind_int(content_insert, 3, (int) contentitem.type);
-		sqlite3_bind_text(content_insert, 4, contentitem.rule.selector.raw_text.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(content_insert, 5, contentitem.file.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(content_insert, 6,  contentitem.id.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(content_insert, 7, contentitem.content.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(content_insert, 8, contentitem.stripped_content.c_str(), -1, SQLITE_STATIC);
+			PackedContent::save_to(session, items, epub_file_id, opf_index);
+			session.commit();
+			return;
+		}
 
-		int result = sqlite3_step(content_insert);
+		const bool search = DatabaseSchema::has_search(session);
 
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
+		//Rows are batched, so their ids are handed out here, and each
+		//one's search entry goes in next to it.
+		sqlite3_stmt * last = session.statement("SELECT IFNULL(MAX(content_id), 0) FROM content;");
+
+		const int rc = sqlite3_step(last);
+
+		sqlite3_int64 content_id = sqlite3_column_int64(last, 0);
+		sqlite3_reset(last);
+
+		if(rc != SQLITE_ROW) {
 			throw - 1;
 		}
 
-		sqlite3_reset(content_insert);
+		BatchInsert content_insert(session, "content", { "content_id", "epub_file_id", "opf_id", "type", "selector_id", "file_id", "id", "content", "stripped_content" });
+		BatchInsert search_insert(session, "content_search", { "rowid", "stripped_content" });
 
-	}
+		for(auto & contentitem : items) {
 
-	sqlite3_finalize(content_insert);
+			content_id++;
+
+			content_insert.bind(content_id).bind(epub_file_id).bind(opf_index).bind((sqlite3_int64) contentitem.type);
+			content_insert.bind((sqlite3_int64) contentitem.selector_id).bind((sqlite3_int64) contentitem.file_id).bind(contentitem.id);
+			content_insert.bind(contentitem.content).bind(contentitem.stripped_content);
+
+			if(search) {
+				search_insert.bind(content_id).bind(contentitem.stripped_content);
+			}
 
-	//Create an index
-	const string content_index_sql = "CREATE INDEX index_content ON content(epub_file_id, opf_id);";
-	sqlite3_exec(db, content_index_sql.c_str(), NULL, NULL, &errmsg);
+		}
+
+		content_insert.flush();
+		search_insert.flush();
+
+		session.commit();
+
+	}
+	catch(...) {
+		session.rollback();
+		throw;
+	}
 
 }
@@ -0,0 +1,300 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ContentView.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "SQLiteUtils.hpp"
+
+using std::move;
+using std::swap;
+
+namespace {
+
+	//Columns in the order read() wants them.
+	const string content_columns = "SELECT content_id, type, css_selector, filename, id, content, stripped_content, file_id, selector_id "
+	                               "FROM content JOIN files USING(file_id) JOIN selectors USING(selector_id) ";
+
+	inline sqlite3_stmt * __prepare(sqlite3 * const db, const string & sql)
+	{
+
+		sqlite3_stmt * stmt;
+
+		if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+			sqlite3_finalize(stmt);
+			throw - 1;
+		}
+
+		return stmt;
+
+	}
+
+}
+
+const unsigned int ContentView::default_window;
+
+ContentView::ContentView(CSS & _css, sqlite3 * const _db, const unsigned int _epub_file_id, const unsigned int _opf_index, const unsigned int _window_size) :
+	css(&_css),
+	db(_db),
+	epub_file_id(_epub_file_id),
+	opf_index(_opf_index),
+	window_size(std::max(_window_size, 1u)),
+	first(0),
+	last(0),
+	counted(false),
+	count(0),
+	window_select(nullptr),
+	range_select(nullptr),
+	file_select(nullptr),
+	window_ids(),
+	window()
+{
+
+	//index_content is ordered by (epub_file_id, opf_id, content_id), so
+	//each of these is one seek. Asked for together, as MIN() and MAX()
+	//of the same SELECT, they would read every row of the book instead.
+	sqlite3_stmt * bounds = __prepare(db, "SELECT "
+	                                  "IFNULL((SELECT MIN(content_id) FROM content WHERE epub_file_id=?1 AND opf_id=?2), 0), "
+	                                  "IFNULL((SELECT MAX(content_id) FROM content WHERE epub_file_id=?1 AND opf_id=?2), 0);");
+
+	sqlite3_bind_int(bounds, 1, epub_file_id);
+	sqlite3_bind_int(bounds, 2, opf_index);
+
+	if(sqlite3_step(bounds) != SQLITE_ROW) {
+		sqlite3_finalize(bounds);
+		throw - 1;
+	}
+
+	first = sqlite3_column_int64(bounds, 0);
+	last = sqlite3_column_int64(bounds, 1);
+
+	sqlite3_finalize(bounds);
+
+	try {
+		window_select = __prepare(db, content_columns + "WHERE epub_file_id=? AND opf_id=? AND content_id>=? ORDER BY content_id LIMIT ?;");
+		range_select = __prepare(db, content_columns + "WHERE epub_file_id=? AND opf_id=? AND content_id BETWEEN ? AND ? ORDER BY content_id;");
+		file_select = __prepare(db, content_columns + "WHERE epub_file_id=? AND opf_id=? AND file_id=(SELECT file_id FROM files WHERE filename=?) ORDER BY content_id;");
+	}
+	catch(...) {
+		finalize();
+		throw;
+	}
+
+}
+
+ContentView::ContentView(ContentView && mv) :
+	css(mv.css),
+	db(mv.db),
+	epub_file_id(mv.epub_file_id),
+	opf_index(mv.opf_index),
+	window_size(mv.window_size),
+	first(mv.first),
+	last(mv.last),
+	counted(mv.counted),
+	count(mv.count),
+	window_select(mv.window_select),
+	range_select(mv.range_select),
+	file_select(mv.file_select),
+	window_ids(move(mv.window_ids)),
+	window(move(mv.window))
+{
+	mv.window_select = nullptr;
+	mv.range_select = nullptr;
+	mv.file_select = nullptr;
+}
+
+ContentView & ContentView::operator =(ContentView && mv)
+{
+	swap(css, mv.css);
+	swap(db, mv.db);
+	swap(epub_file_id, mv.epub_file_id);
+	swap(opf_index, mv.opf_index);
+	swap(window_size, mv.window_size);
+	swap(first, mv.first);
+	swap(last, mv.last);
+	swap(counted, mv.counted);
+	swap(count, mv.count);
+	swap(window_select, mv.window_select);
+	swap(range_select, mv.range_select);
+	swap(file_select, mv.file_select);
+	swap(window_ids, mv.window_ids);
+	swap(window, mv.window);
+	return *this;
+}
+
+ContentView::~ContentView()
+{
+	finalize();
+}
+
+void ContentView::finalize()
+{
+
+	//Finalizing a null statement does nothing.
+	sqlite3_finalize(window_select);
+	sqlite3_finalize(range_select);
+	sqlite3_finalize(file_select);
+
+	window_select = nullptr;
+	range_select = nullptr;
+	file_select = nullptr;
+
+}
+
+vector<ContentItem> ContentView::read(sqlite3_stmt * const select, vector<sqlite3_int64> * const ids, const size_t expected)
+{
+
+	vector<ContentItem> items;
+	items.reserve(expected);
+
+	int rc = sqlite3_step(select);
+
+	while(rc == SQLITE_ROW) {
+
+		if(ids) {
+			ids->push_back(sqlite3_column_int64(select, 0));
+		}
+
+		ContentType type = (ContentType) sqlite3_column_int(select, 1);
+		const CSSRule & rule = css->cascade(sqlite3_column_string(select, 2));
+		path file(sqlite3_column_string(select, 3));
+		ustring id = sqlite3_column_ustring(select, 4);
+		ustring content = sqlite3_column_ustring(select, 5);
+		ustring stripped_content = sqlite3_column_ustring(select, 6);
+		const unsigned int file_id = sqlite3_column_int(select, 7);
+		const unsigned int selector_id = sqlite3_column_int(select, 8);
+
+		items.emplace_back(type, rule, file, id, content, stripped_content, file_id, selector_id);
+
+		rc = sqlite3_step(select);
+
+	}
+
+	sqlite3_reset(select);
+
+	if(rc != SQLITE_DONE) {
+		throw - 1;
+	}
+
+	return items;
+
+}
+
+size_t ContentView::size()
+{
+
+	if(!counted) {
+		sqlite3_stmt * count_select = __prepare(db, "SELECT COUNT(*) FROM content WHERE epub_file_id=? AND opf_id=?;");
+
+		sqlite3_bind_int(count_select, 1, epub_file_id);
+		sqlite3_bind_int(count_select, 2, opf_index);
+
+		const int rc = sqlite3_step(count_select);
+		count = sqlite3_column_int64(count_select, 0);
+
+		sqlite3_finalize(count_select);
+
+		if(rc != SQLITE_ROW) {
+			throw - 1;
+		}
+
+		counted = true;
+	}
+
+	return count;
+
+}
+
+sqlite3_int64 ContentView::first_id() const
+{
+	return first;
+}
+
+sqlite3_int64 ContentView::last_id() const
+{
+	return last;
+}
+
+const ContentItem & ContentView::at(const sqlite3_int64 content_id)
+{
+
+	auto found = std::lower_bound(window_ids.begin(), window_ids.end(), content_id);
+
+	if(found == window_ids.end() || *found != content_id) {
+
+		//Not read yet: read ahead from here.
+		window_ids.clear();
+
+		sqlite3_bind_int(window_select, 1, epub_file_id);
+		sqlite3_bind_int(window_select, 2, opf_index);
+		sqlite3_bind_int64(window_select, 3, content_id);
+		sqlite3_bind_int(window_select, 4, window_size);
+
+		window = read(window_select, &window_ids, window_size);
+
+		if(window_ids.empty() || window_ids.front() != content_id) {
+			throw std::out_of_range("No content with that id in this book!");
+		}
+
+		found = window_ids.begin();
+
+	}
+
+	return window[found - window_ids.begin()];
+
+}
+
+vector<ContentItem> ContentView::range(const sqlite3_int64 first_id, const sqlite3_int64 last_id)
+{
+
+	sqlite3_bind_int(range_select, 1, epub_file_id);
+	sqlite3_bind_int(range_select, 2, opf_index);
+	sqlite3_bind_int64(range_select, 3, first_id);
+	sqlite3_bind_int64(range_select, 4, last_id);
+
+	//Only a guess at how many there are, but a book saved in one go
+	//has a run of content_ids, so it's usually right.
+	const sqlite3_int64 from = std::max(first_id, first);
+	const sqlite3_int64 to = std::min(last_id, last);
+
+	return read(range_select, nullptr, to >= from ? to - from + 1 : 0);
+
+}
+
+vector<ContentItem> ContentView::file(const path & file)
+{
+
+	sqlite3_bind_int(file_select, 1, epub_file_id);
+	sqlite3_bind_int(file_select, 2, opf_index);
+	sqlite3_bind_text(file_select, 3, file.c_str(), -1, SQLITE_TRANSIENT);
+
+	return read(file_select, nullptr, 0);
+
+}
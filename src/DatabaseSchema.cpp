@@ -0,0 +1,527 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "DatabaseSchema.hpp"
+#include "DatabaseSession.hpp"
+
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+	//Every table save_to() writes to.
+	const char * const table_sql[] = {
+		"CREATE TABLE IF NOT EXISTS epub_files("
+		"epub_file_id INTEGER PRIMARY KEY,"
+		"filename TEXT NOT NULL,"
+		"absolute_path TEXT NOT NULL,"
+		"hash INTEGER NOT NULL,"
+		"hash_string TEXT NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS container("
+		"epub_file_id INTEGER NOT NULL,"
+		"media_type TEXT NOT NULL,"
+		"full_path TEXT NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS opf("
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS metadata("
+		"metadata_id INTEGER PRIMARY KEY,"
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"metadata_type INTEGER NOT NULL,"
+		"contents TEXT NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS metadata_tags("
+		"metadata_id INTEGER NOT NULL,"
+		"tagname TEXT NOT NULL,"
+		"tagvalue TEXT NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS manifest("
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"href TEXT NOT NULL,"
+		"id TEXT NOT NULL,"
+		"media_type TEXT NOT NULL) ;",
+
+		"CREATE TABLE IF NOT EXISTS spine("
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"idref TEXT NOT NULL,"
+		"linear INTEGER NOT NULL) ;",
+
+		//One row per rootfile; everything else is in the blobs. The image
+		//is a CSSImage of the same rules, NULL in rows from before there
+		//were images.
+		"CREATE TABLE IF NOT EXISTS css("
+		"css_id INTEGER PRIMARY KEY,"
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"rules BLOB NOT NULL,"
+		"image BLOB) ;",
+
+		//Content files and style names, each saved once however many
+		//content rows refer to them.
+		"CREATE TABLE IF NOT EXISTS files("
+		"file_id INTEGER PRIMARY KEY,"
+		"filename TEXT NOT NULL UNIQUE) ;",
+
+		"CREATE TABLE IF NOT EXISTS selectors("
+		"selector_id INTEGER PRIMARY KEY,"
+		"css_selector TEXT NOT NULL UNIQUE) ;",
+
+		"CREATE TABLE IF NOT EXISTS content("
+		"content_id INTEGER PRIMARY KEY,"
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"type INTEGER NOT NULL,"
+		"selector_id INTEGER NOT NULL,"
+		"file_id INTEGER NOT NULL,"
+		"id TEXT NOT NULL,"
+		"content TEXT NOT NULL,"
+		"stripped_content TEXT NOT NULL) ;",
+
+		//Content saved packed: one deflated blob per run of items from a
+		//content file, and where each item starts in it. See PackedContent.
+		"CREATE TABLE IF NOT EXISTS content_blobs("
+		"blob_id INTEGER PRIMARY KEY,"
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"file_id INTEGER NOT NULL,"
+		"items INTEGER NOT NULL,"
+		"size INTEGER NOT NULL,"
+		"offsets BLOB NOT NULL,"
+		"data BLOB NOT NULL) ;"
+	};
+
+	//Version 1 kept the filename and selector in every content row.
+	//content_ids are kept, so the search index still lines up.
+	const char * const intern_content_sql[] = {
+		"INSERT OR IGNORE INTO files(filename) SELECT DISTINCT filename FROM content;",
+		"INSERT OR IGNORE INTO selectors(css_selector) SELECT DISTINCT css_selector FROM content;",
+
+		"CREATE TABLE content_interned("
+		"content_id INTEGER PRIMARY KEY,"
+		"epub_file_id INTEGER NOT NULL,"
+		"opf_id INTEGER NOT NULL,"
+		"type INTEGER NOT NULL,"
+		"selector_id INTEGER NOT NULL,"
+		"file_id INTEGER NOT NULL,"
+		"id TEXT NOT NULL,"
+		"content TEXT NOT NULL,"
+		"stripped_content TEXT NOT NULL) ;",
+
+		"INSERT INTO content_interned "
+		"SELECT content_id, epub_file_id, opf_id, type, selector_id, file_id, id, content, stripped_content "
+		"FROM content JOIN selectors USING(css_selector) JOIN files USING(filename);",
+
+		"DROP TABLE content;",
+		"ALTER TABLE content_interned RENAME TO content;"
+	};
+
+	struct Index {
+		const char * name;
+		const char * sql;
+		//Kept through a bulk load. Indexes on epub_file_id only ever grow
+		//at the end as books are added, so they cost little to keep up,
+		//and replacing a book needs them to find its rows.
+		bool kept;
+	};
+
+	//Unique indexes are constraints, so they stay put through a bulk
+	//load; the rest are only there to make reading quicker.
+	const char * const unique_index_sql[] = {
+		"CREATE UNIQUE INDEX IF NOT EXISTS index_css ON css(epub_file_id, opf_id);",
+		"CREATE UNIQUE INDEX IF NOT EXISTS index_epub_files ON epub_files(hash_string);"
+	};
+
+	const Index secondary_indexes[] = {
+		{ "index_epub_files_path", "CREATE INDEX IF NOT EXISTS index_epub_files_path ON epub_files(absolute_path);", false },
+		{ "index_container", "CREATE INDEX IF NOT EXISTS index_container ON container(epub_file_id);", true },
+		{ "index_opf", "CREATE INDEX IF NOT EXISTS index_opf ON opf(epub_file_id);", true },
+		{ "index_metadata", "CREATE INDEX IF NOT EXISTS index_metadata ON metadata(epub_file_id, opf_id);", true },
+		{ "index_metadata_tags", "CREATE INDEX IF NOT EXISTS index_metadata_tags ON metadata_tags(metadata_id);", false },
+		{ "index_manifest", "CREATE INDEX IF NOT EXISTS index_manifest ON manifest(epub_file_id, opf_id);", true },
+		{ "index_spine", "CREATE INDEX IF NOT EXISTS index_spine ON spine(epub_file_id, opf_id);", true },
+		{ "index_content", "CREATE INDEX IF NOT EXISTS index_content ON content(epub_file_id, opf_id);", true },
+		{ "index_content_blobs", "CREATE INDEX IF NOT EXISTS index_content_blobs ON content_blobs(epub_file_id, opf_id);", true },
+		//So that telling whether anything still uses a file or selector
+		//doesn't mean reading every book's content.
+		{ "index_content_files", "CREATE INDEX IF NOT EXISTS index_content_files ON content(file_id);", false },
+		{ "index_content_selectors", "CREATE INDEX IF NOT EXISTS index_content_selectors ON content(selector_id);", false },
+		{ "index_content_blobs_files", "CREATE INDEX IF NOT EXISTS index_content_blobs_files ON content_blobs(file_id);", false }
+	};
+
+	//Everything saved for one book, in an order that leaves nothing
+	//pointing at a row that's gone. ? is the epub_file_id.
+	const char * const remove_book_sql[] = {
+		"DELETE FROM metadata_tags WHERE metadata_id IN (SELECT metadata_id FROM metadata WHERE epub_file_id=?);",
+		"DELETE FROM metadata WHERE epub_file_id=?;",
+		"DELETE FROM container WHERE epub_file_id=?;",
+		"DELETE FROM opf WHERE epub_file_id=?;",
+		"DELETE FROM manifest WHERE epub_file_id=?;",
+		"DELETE FROM spine WHERE epub_file_id=?;",
+		"DELETE FROM css WHERE epub_file_id=?;",
+		"DELETE FROM content WHERE epub_file_id=?;",
+		"DELETE FROM content_blobs WHERE epub_file_id=?;",
+		"DELETE FROM epub_files WHERE epub_file_id=?;"
+	};
+
+	//The files and selectors a book uses, looked up before it goes. Packed
+	//content keeps its selector ids inside the blobs, out of sight, so
+	//selectors are only cleared out while there's no packed content.
+	const char * const book_files_sql = "SELECT file_id FROM content WHERE epub_file_id=?1 UNION SELECT file_id FROM content_blobs WHERE epub_file_id=?1;";
+	const char * const book_selectors_sql = "SELECT DISTINCT selector_id FROM content WHERE epub_file_id=?;";
+	const char * const book_packed_sql = "SELECT 1 FROM content_blobs WHERE epub_file_id=? LIMIT 1;";
+	const char * const any_packed_sql = "SELECT 1 FROM content_blobs LIMIT 1;";
+
+	//Then whichever of those nothing uses any more, each found through
+	//an index rather than by reading every book's content.
+	const char * const remove_file_sql = "DELETE FROM files WHERE file_id=?1 AND NOT EXISTS (SELECT 1 FROM content WHERE file_id=?1) "
+	                                     "AND NOT EXISTS (SELECT 1 FROM content_blobs WHERE file_id=?1);";
+	const char * const remove_selector_sql = "DELETE FROM selectors WHERE selector_id=?1 AND NOT EXISTS (SELECT 1 FROM content WHERE selector_id=?1);";
+
+	//Every file and selector nothing uses, for after a bulk load, which
+	//leaves them until its indexes are back.
+	const char * const remove_files_sql = "DELETE FROM files WHERE NOT EXISTS (SELECT 1 FROM content WHERE content.file_id=files.file_id) "
+	                                      "AND NOT EXISTS (SELECT 1 FROM content_blobs WHERE content_blobs.file_id=files.file_id);";
+	const char * const remove_selectors_sql = "DELETE FROM selectors WHERE NOT EXISTS (SELECT 1 FROM content WHERE content.selector_id=selectors.selector_id);";
+
+	//The first column of each row sql gives, with ? bound to id if it has one.
+	vector<sqlite3_int64> __ids(DatabaseSession & session, const char * const sql, const unsigned int id = 0)
+	{
+		sqlite3_stmt * select = session.statement(sql);
+
+		if(sqlite3_bind_parameter_count(select) > 0) {
+			sqlite3_bind_int(select, 1, id);
+		}
+
+		vector<sqlite3_int64> ids;
+		int rc;
+
+		while((rc = sqlite3_step(select)) == SQLITE_ROW) {
+			ids.push_back(sqlite3_column_int64(select, 0));
+		}
+
+		sqlite3_reset(select);
+
+		if(rc != SQLITE_DONE) {
+			throw - 1;
+		}
+
+		return ids;
+	}
+
+	void __step(DatabaseSession & session, const char * const sql, const sqlite3_int64 id)
+	{
+		sqlite3_stmt * remove = session.statement(sql);
+		sqlite3_bind_int64(remove, 1, id);
+
+		const int rc = sqlite3_step(remove);
+		sqlite3_reset(remove);
+
+		if(rc != SQLITE_DONE) {
+			throw - 1;
+		}
+	}
+
+	//External content: the text stays in content, keyed by content_id.
+	const char * const search_sql =
+		"CREATE VIRTUAL TABLE content_search USING fts5("
+		"stripped_content,"
+		"content='content',"
+		"content_rowid='content_id',"
+		"tokenize='unicode61 remove_diacritics 2') ;";
+
+}
+
+const int DatabaseSchema::version;
+
+int DatabaseSchema::stored_version(DatabaseSession & session)
+{
+
+	sqlite3_stmt * pragma = session.statement("PRAGMA user_version;");
+
+	const int rc = sqlite3_step(pragma);
+	const int stored = sqlite3_column_int(pragma, 0);
+
+	sqlite3_reset(pragma);
+
+	if(rc != SQLITE_ROW) {
+		throw - 1;
+	}
+
+	return stored;
+
+}
+
+void DatabaseSchema::create(DatabaseSession & session)
+{
+
+	const int stored = stored_version(session);
+
+	if(stored > version) {
+		//Written by a newer libepub. Better not touch it.
+		throw - 1;
+	}
+
+	if(stored < version) {
+
+		//New, or from before the schema had a version, in which case
+		//whichever tables are there are the same as version 1's.
+		session.begin();
+
+		//Whatever goes wrong part way through, the database is left as
+		//it was and the session isn't stuck in the transaction.
+		try {
+
+			for(const char * sql : table_sql) {
+				session.execute(sql);
+			}
+
+			sqlite3_stmt * interned = session.statement("SELECT COUNT(*) FROM pragma_table_info('content') WHERE name='filename';");
+
+			const int rc = sqlite3_step(interned);
+			const bool intern = sqlite3_column_int(interned, 0) > 0;
+
+			sqlite3_reset(interned);
+
+			if(rc != SQLITE_ROW) {
+				throw - 1;
+			}
+
+			if(intern) {
+				for(const char * sql : intern_content_sql) {
+					session.execute(sql);
+				}
+			}
+
+			//Version 5 keeps a CSSImage next to the rules. Books saved
+			//before go on loading from the rules alone.
+			sqlite3_stmt * imaged = session.statement("SELECT COUNT(*) FROM pragma_table_info('css') WHERE name='image';");
+
+			const int image_rc = sqlite3_step(imaged);
+			const bool add_image = sqlite3_column_int(imaged, 0) == 0;
+
+			sqlite3_reset(imaged);
+
+			if(image_rc != SQLITE_ROW) {
+				throw - 1;
+			}
+
+			if(add_image) {
+				session.execute("ALTER TABLE css ADD COLUMN image BLOB;");
+			}
+
+			//Before version 4 saving a book twice saved it twice. The first
+			//copy is kept, so hash_string can be unique.
+			sqlite3_stmt * duplicates = session.statement("SELECT epub_file_id FROM epub_files WHERE epub_file_id NOT IN (SELECT MIN(epub_file_id) FROM epub_files GROUP BY hash_string);");
+
+			vector<unsigned int> duplicate_ids;
+
+			while(sqlite3_step(duplicates) == SQLITE_ROW) {
+				duplicate_ids.push_back(sqlite3_column_int(duplicates, 0));
+			}
+
+			sqlite3_reset(duplicates);
+
+			for(auto epub_file_id : duplicate_ids) {
+				remove_book(session, epub_file_id);
+			}
+
+			for(const char * sql : unique_index_sql) {
+				session.execute(sql);
+			}
+
+			session.execute("PRAGMA user_version = " + std::to_string(version) + ";");
+
+			session.commit();
+
+		}
+		catch (...) {
+			session.rollback();
+			throw;
+		}
+
+	}
+
+	//A bulk load that never finished leaves these missing. If they're
+	//all there, this is only a lookup in sqlite_master each. One that's
+	//under way wants them left until it's done.
+	if(!session.is_bulk_loading()) {
+		create_indexes(session);
+	}
+
+}
+
+void DatabaseSchema::drop_indexes(DatabaseSession & session)
+{
+
+	for(auto & index : secondary_indexes) {
+		if(!index.kept) {
+			session.execute(string("DROP INDEX IF EXISTS ") + index.name + ";");
+		}
+	}
+
+}
+
+void DatabaseSchema::create_indexes(DatabaseSession & session)
+{
+
+	for(auto & index : secondary_indexes) {
+		session.execute(index.sql);
+	}
+
+}
+
+void DatabaseSchema::remove_book(DatabaseSession & session, const unsigned int epub_file_id)
+{
+
+	session.begin();
+
+	try {
+
+		if(has_search(session)) {
+			//An external content index can only forget a row while it can
+			//still see what the row said.
+			sqlite3_stmt * unindex = session.statement("INSERT INTO content_search(content_search, rowid, stripped_content) "
+			                                           "SELECT 'delete', content_id, stripped_content FROM content WHERE epub_file_id=?;");
+			sqlite3_bind_int(unindex, 1, epub_file_id);
+
+			const int rc = sqlite3_step(unindex);
+			sqlite3_reset(unindex);
+
+			if(rc != SQLITE_DONE) {
+				throw - 1;
+			}
+		}
+
+		const vector<sqlite3_int64> file_ids = __ids(session, book_files_sql, epub_file_id);
+		const vector<sqlite3_int64> selector_ids = __ids(session, book_selectors_sql, epub_file_id);
+		const bool packed = !__ids(session, book_packed_sql, epub_file_id).empty();
+
+		for(const char * sql : remove_book_sql) {
+			__step(session, sql, epub_file_id);
+		}
+
+		//A bulk load clears up once at the end, with its indexes back.
+		if(!session.is_bulk_loading()) {
+
+			for(auto file_id : file_ids) {
+				__step(session, remove_file_sql, file_id);
+			}
+
+			if(__ids(session, any_packed_sql).empty()) {
+				//The last packed book's selectors weren't to be seen.
+				if(packed) {
+					session.execute(remove_selectors_sql);
+				}
+				else {
+					for(auto selector_id : selector_ids) {
+						__step(session, remove_selector_sql, selector_id);
+					}
+				}
+			}
+
+		}
+
+		session.commit();
+
+	}
+	catch (...) {
+		session.rollback();
+		throw;
+	}
+
+}
+
+void DatabaseSchema::remove_orphans(DatabaseSession & session)
+{
+
+	session.begin();
+
+	try {
+		session.execute(remove_files_sql);
+
+		if(__ids(session, any_packed_sql).empty()) {
+			session.execute(remove_selectors_sql);
+		}
+
+		session.commit();
+	}
+	catch (...) {
+		session.rollback();
+		throw;
+	}
+
+}
+
+void DatabaseSchema::create_search(DatabaseSession & session)
+{
+
+	if(has_search(session)) {
+		return;
+	}
+
+	session.begin();
+
+	try {
+		session.execute(search_sql);
+		session.execute("INSERT INTO content_search(content_search) VALUES('rebuild');");
+		session.commit();
+	}
+	catch (...) {
+		session.rollback();
+		throw;
+	}
+
+}
+
+bool DatabaseSchema::has_search(DatabaseSession & session)
+{
+
+	sqlite3_stmt * table = session.statement("SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='content_search';");
+
+	const int rc = sqlite3_step(table);
+	const bool found = sqlite3_column_int(table, 0) > 0;
+
+	sqlite3_reset(table);
+
+	if(rc != SQLITE_ROW) {
+		throw - 1;
+	}
+
+	return found;
+
+}
\ No newline at end of file
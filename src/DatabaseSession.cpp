@@ -0,0 +1,568 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "DatabaseSession.hpp"
+
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "DatabaseSchema.hpp"
+
+using std::move;
+using std::swap;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::mutex;
+using std::lock_guard;
+
+#ifdef DEBUG
+#include <iostream>
+using std::cout;
+using std::endl;
+#endif
+
+namespace {
+
+	const int value_integer = 1;
+	const int value_text = 2;
+	const int value_blob = 3;
+
+	//The sessions open on each connection, oldest first. Only the first
+	//checks the schema; the rest are inside something that already did.
+	mutex sessions_lock;
+	unordered_map<sqlite3 *, vector<DatabaseSession *>> sessions;
+
+	//Adds session to those open on db, and says whether it was the first.
+	bool __open_session(sqlite3 * const db, DatabaseSession * const session)
+	{
+		lock_guard<mutex> lock(sessions_lock);
+		vector<DatabaseSession *> & open = sessions[db];
+		open.push_back(session);
+		return open.size() == 1;
+	}
+
+	void __close_session(sqlite3 * const db, DatabaseSession * const session)
+	{
+		lock_guard<mutex> lock(sessions_lock);
+
+		auto found = sessions.find(db);
+
+		if(found == sessions.end()) {
+			return;
+		}
+
+		vector<DatabaseSession *> & open = found->second;
+		open.erase(std::remove(open.begin(), open.end(), session), open.end());
+
+		if(open.empty()) {
+			sessions.erase(found);
+		}
+	}
+
+	//a and b have swapped connections, which are first and second.
+	void __swap_sessions(sqlite3 * const first, sqlite3 * const second, DatabaseSession * const a, DatabaseSession * const b)
+	{
+		lock_guard<mutex> lock(sessions_lock);
+
+		vector<sqlite3 *> dbs { first };
+
+		if(second != first) {
+			dbs.push_back(second);
+		}
+
+		for(auto db : dbs) {
+
+			auto found = sessions.find(db);
+
+			if(found == sessions.end()) {
+				continue;
+			}
+
+			for(auto & session : found->second) {
+				if(session == a) {
+					session = b;
+				}
+				else if(session == b) {
+					session = a;
+				}
+			}
+
+		}
+	}
+
+	const char * savepoint = "libepub_level";
+
+}
+
+DatabaseSession::DatabaseSession(const path & file) :
+	db(nullptr),
+	owned(true),
+	transaction_depth(0),
+	inside_outer(false),
+	failed(false),
+	bulk_loading(false),
+	index_milliseconds(0),
+	statements()
+{
+
+	if(sqlite3_open(file.c_str(), &db) != SQLITE_OK) {
+		sqlite3_close(db);
+		db = nullptr;
+		throw - 1;
+	}
+
+	__open_session(db, this);
+
+	try {
+		DatabaseSchema::create(*this);
+	}
+	catch (...) {
+		__close_session(db, this);
+		finalize();
+		sqlite3_close(db);
+		throw;
+	}
+
+}
+
+DatabaseSession::DatabaseSession(sqlite3 * const _db) :
+	db(_db),
+	owned(false),
+	transaction_depth(0),
+	inside_outer(false),
+	failed(false),
+	bulk_loading(false),
+	index_milliseconds(0),
+	statements()
+{
+
+	//Saving through a connection that already has a session open, say a
+	//bulk load, mustn't check the schema again or build the indexes
+	//that session dropped.
+	if(!__open_session(db, this)) {
+		return;
+	}
+
+	try {
+		DatabaseSchema::create(*this);
+	}
+	catch (...) {
+		__close_session(db, this);
+		finalize();
+		throw;
+	}
+
+}
+
+DatabaseSession::DatabaseSession(DatabaseSession && mv) :
+	db(mv.db),
+	owned(mv.owned),
+	transaction_depth(mv.transaction_depth),
+	inside_outer(mv.inside_outer),
+	failed(mv.failed),
+	bulk_loading(mv.bulk_loading),
+	index_milliseconds(mv.index_milliseconds),
+	statements(move(mv.statements))
+{
+	__swap_sessions(db, db, this, &mv);
+	mv.db = nullptr;
+	mv.owned = false;
+	mv.statements.clear();
+}
+
+DatabaseSession & DatabaseSession::operator =(DatabaseSession && mv)
+{
+	swap(db, mv.db);
+	swap(owned, mv.owned);
+	swap(transaction_depth, mv.transaction_depth);
+	swap(inside_outer, mv.inside_outer);
+	swap(failed, mv.failed);
+	swap(bulk_loading, mv.bulk_loading);
+	swap(index_milliseconds, mv.index_milliseconds);
+	swap(statements, mv.statements);
+	__swap_sessions(db, mv.db, this, &mv);
+	return *this;
+}
+
+DatabaseSession::~DatabaseSession()
+{
+
+	finalize();
+
+	if(db != nullptr) {
+		__close_session(db, this);
+	}
+
+	if(owned) {
+		sqlite3_close(db);
+	}
+
+}
+
+void DatabaseSession::finalize()
+{
+
+	for(auto & statement : statements) {
+		sqlite3_finalize(statement.second);
+	}
+
+	statements.clear();
+
+}
+
+void DatabaseSession::begin_bulk_load()
+{
+
+	if(bulk_loading) {
+		return;
+	}
+
+	DatabaseSchema::drop_indexes(*this);
+	bulk_loading = true;
+
+}
+
+void DatabaseSession::end_bulk_load()
+{
+
+	if(!bulk_loading) {
+		return;
+	}
+
+	const auto start = steady_clock::now();
+
+	begin();
+
+	try {
+		DatabaseSchema::create_indexes(*this);
+		DatabaseSchema::remove_orphans(*this);
+		commit();
+	}
+	catch (...) {
+		rollback();
+		throw;
+	}
+
+	index_milliseconds += duration<double, std::milli>(steady_clock::now() - start).count();
+	bulk_loading = false;
+
+}
+
+bool DatabaseSession::is_bulk_loading() const
+{
+	return bulk_loading;
+}
+
+double DatabaseSession::index_build_milliseconds() const
+{
+	return index_milliseconds;
+}
+
+DatabaseSession * DatabaseSession::open_on(sqlite3 * const db)
+{
+	lock_guard<mutex> lock(sessions_lock);
+
+	auto found = sessions.find(db);
+
+	if(found == sessions.end()) {
+		return nullptr;
+	}
+
+	return found->second.front();
+}
+
+sqlite3 * DatabaseSession::handle() const
+{
+	return db;
+}
+
+sqlite3_stmt * DatabaseSession::statement(const string & sql)
+{
+
+	auto found = statements.find(sql);
+
+	if(found != statements.end()) {
+		sqlite3_reset(found->second);
+		sqlite3_clear_bindings(found->second);
+		return found->second;
+	}
+
+	sqlite3_stmt * prepared;
+
+	const int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &prepared, 0);
+
+	if(rc != SQLITE_OK) {
+		#ifdef DEBUG
+		cout << "Couldn't prepare " << sql << ": " << sqlite3_errmsg(db) << endl;
+		#endif
+		throw - 1;
+	}
+
+	statements.emplace(sql, prepared);
+
+	return prepared;
+
+}
+
+size_t DatabaseSession::statement_count() const
+{
+	return statements.size();
+}
+
+void DatabaseSession::execute(const string & sql)
+{
+
+	char * errmsg = nullptr;
+
+	const int rc = sqlite3_exec(db, sql.c_str(), NULL, NULL, &errmsg);
+
+	if(rc != SQLITE_OK) {
+		#ifdef DEBUG
+		cout << "Couldn't run " << sql << ": " << errmsg << endl;
+		#endif
+		sqlite3_free(errmsg);
+		throw - 1;
+	}
+
+}
+
+void DatabaseSession::begin()
+{
+
+	if(transaction_depth == 0) {
+		inside_outer = !sqlite3_get_autocommit(db);
+		failed = false;
+	}
+	else if(failed) {
+		//A savepoint now would start a transaction of its own.
+		throw - 1;
+	}
+
+	if(transaction_depth == 0 && !inside_outer) {
+		execute("BEGIN TRANSACTION");
+	}
+	else {
+		execute(string("SAVEPOINT ") + savepoint);
+	}
+
+	transaction_depth++;
+
+}
+
+void DatabaseSession::commit()
+{
+
+	if(transaction_depth == 0) {
+		return;
+	}
+
+	if(failed) {
+		throw - 1;
+	}
+
+	if(transaction_depth == 1 && !inside_outer) {
+		execute("END TRANSACTION");
+	}
+	else {
+		execute(string("RELEASE ") + savepoint);
+	}
+
+	transaction_depth--;
+
+}
+
+void DatabaseSession::rollback()
+{
+
+	if(transaction_depth == 0) {
+		return;
+	}
+
+	transaction_depth--;
+
+	//Some errors, a full disk say, make SQLite roll the whole transaction
+	//back itself. The levels further out find out when they commit.
+	if(failed || sqlite3_get_autocommit(db)) {
+		failed = transaction_depth > 0;
+		return;
+	}
+
+	if(transaction_depth == 0 && !inside_outer) {
+		execute("ROLLBACK TRANSACTION");
+	}
+	else {
+		//Undoes this level and leaves the ones outside it as they were.
+		execute(string("ROLLBACK TO ") + savepoint);
+		execute(string("RELEASE ") + savepoint);
+	}
+
+}
+
+const unsigned int BatchInsert::default_rows;
+
+BatchInsert::BatchInsert(DatabaseSession & _session, const string & table, const vector<string> & column_names, const unsigned int rows) :
+	session(_session),
+	prefix(),
+	row(),
+	columns(column_names.size()),
+	rows_per_statement(rows),
+	values(),
+	n_values(0)
+{
+
+	prefix = "INSERT INTO " + table + " (";
+
+	for(unsigned int i = 0; i < columns; i++) {
+		prefix += (i == 0) ? "" : ", ";
+		prefix += column_names[i];
+		row += (i == 0) ? "?" : ", ?";
+	}
+
+	prefix += ") VALUES ";
+	row = "(" + row + ")";
+
+	//Older SQLites allow 999 parameters to a statement.
+	if(rows_per_statement * columns > 999) {
+		rows_per_statement = 999 / columns;
+	}
+
+	if(rows_per_statement == 0) {
+		rows_per_statement = 1;
+	}
+
+	values.resize(rows_per_statement * columns);
+
+}
+
+BatchInsert::~BatchInsert()
+{
+}
+
+BatchInsert::Value & BatchInsert::next()
+{
+
+	if(n_values == values.size()) {
+		flush();
+	}
+
+	return values[n_values++];
+
+}
+
+BatchInsert & BatchInsert::bind(const sqlite3_int64 value)
+{
+	Value & v = next();
+	v.type = value_integer;
+	v.integer = value;
+	return *this;
+}
+
+BatchInsert & BatchInsert::bind(const string & value)
+{
+	Value & v = next();
+	v.type = value_text;
+	v.text = value;
+	return *this;
+}
+
+BatchInsert & BatchInsert::bind(const ustring & value)
+{
+	return bind(value.raw());
+}
+
+BatchInsert & BatchInsert::bind_blob(const string & value)
+{
+	Value & v = next();
+	v.type = value_blob;
+	v.text = value;
+	return *this;
+}
+
+void BatchInsert::flush()
+{
+
+	const unsigned int n_rows = n_values / columns;
+
+	if(n_rows == 0) {
+		return;
+	}
+
+	//A full batch is the usual case. Whatever is left at the end gets a
+	//statement of its own size, which the session keeps for next time.
+	string sql = prefix;
+
+	for(unsigned int i = 0; i < n_rows; i++) {
+		sql += (i == 0) ? row : "," + row;
+	}
+
+	sqlite3_stmt * insert = session.statement(sql);
+
+	for(size_t i = 0; i < n_rows * columns; i++) {
+
+		const Value & v = values[i];
+		const int parameter = i + 1;
+
+		switch(v.type) {
+			case value_integer:
+				sqlite3_bind_int64(insert, parameter, v.integer);
+				break;
+
+			case value_text:
+				sqlite3_bind_text(insert, parameter, v.text.data(), v.text.length(), SQLITE_STATIC);
+				break;
+
+			case value_blob:
+				sqlite3_bind_blob(insert, parameter, v.text.data(), v.text.length(), SQLITE_STATIC);
+				break;
+
+			default:
+				sqlite3_bind_null(insert, parameter);
+				break;
+		}
+
+	}
+
+	const int result = sqlite3_step(insert);
+
+	sqlite3_reset(insert);
+
+	//Anything of a partial row stays for the next flush.
+	const size_t sent = n_rows * columns;
+
+	for(size_t i = sent; i < n_values; i++) {
+		swap(values[i - sent], values[i]);
+	}
+
+	n_values -= sent;
+
+	if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
+		throw - 1;
+	}
+
+}
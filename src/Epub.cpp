@@ -40,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/functional/hash.hpp>
 
 #include "SQLiteUtils.hpp"
+#include "DatabaseSchema.hpp"
 
 using std::string;
 using std::move;
@@ -58,7 +59,7 @@ using std::cout;
 using std::endl;
 #endif
 
-Epub::Epub(string _filename) :
+Epub::Epub(string _filename, const bool css_statistics) :
 	from_epub(true),
 	filename(_filename)
 {
@@ -73,15 +74,7 @@ Epub::Epub(string _filename) :
 	//It does exist.
 	//Compute the hash
 	hash = compute_epub_hash(absolute_path);
-	stringstream stream;
-	//Have to set the locale on the stringstream
-	//to "C" otherwise it does insane things like
-	//formatting hex with decimal comma groups.
-	//Yeah. About that.
-	locale cloc("C");
-	stream.imbue(cloc);
-	stream << std::hex << (unsigned long) hash;
-	hash_string = stream.str();
+	hash_string = compute_hash_string(hash);
 	#ifdef DEBUG
 	cout << "\t Hash: " << hash_string << endl;
 	#endif
@@ -165,6 +158,10 @@ Epub::Epub(string _filename) :
 	//OK, file is validated and unpacked in a temporary directory
 	container.load(directory_path);
 
+	//Content keeps a reference to its rootfile's CSS, and resolves its
+	//styles through it, so the CSS has to stay put once it's in here.
+	css.reserve(container.rootfiles.size());
+
 	for(auto rf : container.rootfiles) {
 
 		OPF tmp(directory_path, rf.full_path);
@@ -181,8 +178,11 @@ Epub::Epub(string _filename) :
 			cssfiles.push_back(cssfile);
 		}
 
-		CSS cssclasses(cssfiles);
-		css.push_back(cssclasses);
+		css.emplace_back(cssfiles);
+
+		if(css_statistics) {
+			css.back().enable_statistics();
+		}
 
 		vector<path> contentfiles;
 
@@ -197,7 +197,7 @@ Epub::Epub(string _filename) :
 			contentfiles.push_back(contentfile);
 		}
 
-		Content content(cssclasses, contentfiles);
+		Content content(css.back(), contentfiles, directory_path);
 		contents.push_back(content);
 
 	}
@@ -206,6 +206,9 @@ Epub::Epub(string _filename) :
 Epub::Epub(sqlite3 * const db, const unsigned int file_id) : from_epub(false)
 {
 
+	//The container, OPFs and CSS all from the same commit.
+	SQLiteReadTransaction snapshot(db);
+
 	int rc;
 
 	const string files_select_sql = "SELECT * FROM epub_files WHERE epub_file_id=?;";
@@ -245,13 +248,13 @@ Epub::Epub(sqlite3 * const db, const unsigned int file_id) : from_epub(false)
 		OPF tmp(db, file_id, i);
 		opf_files.push_back(tmp);
 
-		CSS cssclasses(db, file_id, i);
-		css.push_back(cssclasses);
+		//Only the saved image is read; the rules wait until needed.
+		css.emplace_back(db, file_id, i);
 	}
 
 }
 
-size_t inline Epub::compute_epub_hash(const path & _absolute_path)
+size_t Epub::compute_epub_hash(const path & _absolute_path)
 {
 
 	unsigned int size = file_size(_absolute_path);
@@ -275,6 +278,19 @@ size_t inline Epub::compute_epub_hash(const path & _absolute_path)
 	return filehash;
 }
 
+string Epub::compute_hash_string(const size_t _hash)
+{
+	stringstream stream;
+	//Have to set the locale on the stringstream
+	//to "C" otherwise it does insane things like
+	//formatting hex with decimal comma groups.
+	//Yeah. About that.
+	locale cloc("C");
+	stream.imbue(cloc);
+	stream << std::hex << (unsigned long) _hash;
+	return stream.str();
+}
+
 Epub::Epub(Epub const & cpy) :
 	from_epub(cpy.from_epub),
 	filename(cpy.filename),
@@ -284,8 +300,10 @@ Epub::Epub(Epub const & cpy) :
 	directory_path(cpy.directory_path),
 	container(cpy.container),
 	opf_files(cpy.opf_files),
+	css(cpy.css),
 	contents(cpy.contents)
 {
+	rebind(cpy);
 }
 
 Epub::Epub(Epub && mv)  :
@@ -297,8 +315,11 @@ Epub::Epub(Epub && mv)  :
 	directory_path(move(mv.directory_path)),
 	container(move(mv.container)),
 	opf_files(move(mv.opf_files)),
+	css(move(mv.css)),
 	contents(move(mv.contents))
 {
+	//The unpacked files are this one's to clean up now.
+	mv.from_epub = false;
 }
 
 Epub & Epub::operator =(const Epub & cpy)
@@ -311,24 +332,43 @@ Epub & Epub::operator =(const Epub & cpy)
 	directory_path = cpy.directory_path;
 	container = cpy.container;
 	opf_files = cpy.opf_files;
+	css = cpy.css;
 	contents = cpy.contents;
+	rebind(cpy);
 	return *this;
 }
 
 Epub & Epub::operator =(Epub && mv)
 {
-	from_epub = move(mv.from_epub);
 	filename = move(mv.filename);
 	absolute_path = move(mv.absolute_path);
 	hash = move(mv.hash);
 	hash_string = move(mv.hash_string);
-	directory_path = move(mv.directory_path);
 	container = move(mv.container);
 	opf_files = move(mv.opf_files);
+	css = move(mv.css);
 	contents = move(mv.contents);
+	std::swap(from_epub, mv.from_epub);
+	std::swap(directory_path, mv.directory_path);
 	return *this;
 }
 
+void Epub::rebind(const Epub & from)
+{
+
+	//Copied, they'd still be using from's CSS, which could be gone by
+	//the time they're saved.
+	const CSS * const begin = from.css.data();
+	const CSS * const end = begin + from.css.size();
+
+	for(auto & content : contents) {
+		if(content.css >= begin && content.css < end) {
+			content.css = &css[content.css - begin];
+		}
+	}
+
+}
+
 Epub::~Epub()
 {
 	if(from_epub) {
@@ -341,30 +381,57 @@ Epub::~Epub()
 
 void Epub::save_to(sqlite3 * const db)
 {
-	int rc;
-	char * errmsg;
+	DatabaseSession * open = DatabaseSession::open_on(db);
+
+	if(open != nullptr) {
+		save_to(*open);
+		return;
+	}
+
+	DatabaseSession session(db);
+	save_to(session);
+}
+
+void Epub::save_to(DatabaseSession & session, const ContentStorage storage)
+{
 
 	//Do all the following inserts in an SQLite Transaction, because this speeds up the inserts like crazy.
-	sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg);
+	session.begin();
 
-	//First, write a little high-level information to the database.
-	const string table_sql = "CREATE TABLE IF NOT EXISTS epub_files("  \
-	                         "epub_file_id INTEGER PRIMARY KEY," \
-	                         "filename TEXT NOT NULL," \
-	                         "absolute_path TEXT NOT NULL," \
-	                         "hash INTEGER NOT NULL," \
-	                         "hash_string TEXT NOT NULL) ;";
-	sqlite3_exec(db, table_sql.c_str(), NULL, NULL, &errmsg);
-	//Table created.
-
-	const string files_insert_sql = "INSERT INTO epub_files (filename, absolute_path, hash, hash_string) VALUES (?, ?, ?, ?);";
-	sqlite3_stmt * files_insert;
-	rc = sqlite3_prepare_v2(db, files_insert_sql.c_str(), -1, &files_insert, 0);
+	try {
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+		//Already saved, exactly as it is now.
+		if(find(session, hash_string) != 0) {
+			session.commit();
+			return;
+		}
+
+		//Saved before it last changed. The old one goes, in the same
+		//transaction as the new one arrives.
+		sqlite3_stmt * path_select = session.statement("SELECT epub_file_id FROM epub_files WHERE absolute_path=?;");
+		sqlite3_bind_text(path_select, 1, absolute_path.c_str(), -1, SQLITE_STATIC);
+
+		vector<unsigned int> replaced;
+
+		while(sqlite3_step(path_select) == SQLITE_ROW) {
+			replaced.push_back(sqlite3_column_int(path_select, 0));
+		}
+
+		sqlite3_reset(path_select);
+
+		for(auto epub_file_id : replaced) {
+			DatabaseSchema::remove_book(session, epub_file_id);
+		}
+
+	}
+	catch(...) {
+		session.rollback();
+		throw;
 	}
 
+	//First, write a little high-level information to the database.
+	sqlite3_stmt * files_insert = session.statement("INSERT INTO epub_files (filename, absolute_path, hash, hash_string) VALUES (?, ?, ?, ?);");
+
 	sqlite3_bind_text(files_insert, 1, filename.c_str(), -1, SQLITE_STATIC);
 	sqlite3_bind_text(files_insert, 2, absolute_path.c_str(), -1, SQLITE_STATIC);
 	sqlite3_bind_int64(files_insert, 3, hash);
@@ -372,35 +439,101 @@ void Epub::save_to(sqlite3 * const db)
 
 	int result = sqlite3_step(files_insert);
 
+	sqlite3_reset(files_insert);
+
 	if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
+		session.rollback();
 		throw - 1;
 	}
 
 	//get the new id:
-	const auto key = sqlite3_last_insert_rowid(db);
+	const auto key = sqlite3_last_insert_rowid(session.handle());
 
-	sqlite3_finalize(files_insert);
+	try {
 
-	container.save_to(db, key);
-	unsigned int index = 0;
+		container.save_to(session, key);
+		unsigned int index = 0;
 
-	for(auto & opf : opf_files) {
-		opf.save_to(db, key, index++);
-	}
+		for(auto & opf : opf_files) {
+			opf.save_to(session, key, index++);
+		}
+
+		index = 0;
 
-	index = 0;
+		for(auto & cssclasses : css) {
+			cssclasses.save_to(session, key, index++);
+		}
+
+		index = 0;
+
+		for(auto & content : contents) {
+			content.save_to(session, key, index++, storage);
+		}
+
+		session.commit();
 
-	for(auto & cssclasses : css) {
-		cssclasses.save_to(db, key, index++);
+	}
+	catch(...) {
+		session.rollback();
+		throw;
 	}
 
-	index = 0;
+}
 
-	for(auto & content : contents) {
-		content.save_to(db, key, index++);
+unsigned int Epub::find(DatabaseSession & session, const string & _hash_string)
+{
+
+	sqlite3_stmt * hash_select = session.statement("SELECT epub_file_id FROM epub_files WHERE hash_string=?;");
+	sqlite3_bind_text(hash_select, 1, _hash_string.c_str(), -1, SQLITE_TRANSIENT);
+
+	const int rc = sqlite3_step(hash_select);
+	const unsigned int epub_file_id = rc == SQLITE_ROW ? sqlite3_column_int(hash_select, 0) : 0;
+
+	sqlite3_reset(hash_select);
+
+	if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		throw - 1;
 	}
 
-	sqlite3_exec(db, "END TRANSACTION", NULL, NULL, &errmsg);
+	return epub_file_id;
 
 }
 
+string Epub::css_statistics_json() const
+{
+
+	stringstream out;
+	out.imbue(locale("C"));
+
+	double milliseconds = 0;
+
+	for(auto & c : css) {
+		if(c.statistics() != nullptr) {
+			milliseconds += c.statistics()->nanoseconds / 1000000.0;
+		}
+	}
+
+	out << "{\"file\":" << CSSStatistics::json_string(filename.string());
+	out << ",\"milliseconds\":" << milliseconds;
+	out << ",\"rootfiles\":[";
+
+	for(unsigned int i = 0; i < css.size(); i++) {
+
+		if(i > 0) {
+			out << ",";
+		}
+
+		if(css[i].statistics() != nullptr) {
+			out << css[i].statistics()->to_json();
+		}
+		else {
+			out << "null";
+		}
+
+	}
+
+	out << "]}";
+
+	return out.str();
+
+}
@@ -0,0 +1,475 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "EpubStore.hpp"
+#include "DatabaseSchema.hpp"
+
+#include <utility>
+#include <stdexcept>
+#include <unordered_map>
+
+using std::move;
+using std::lock_guard;
+using std::to_string;
+using std::weak_ptr;
+using std::unordered_map;
+using std::pair;
+using std::make_pair;
+
+#ifdef DEBUG
+#include <iostream>
+using std::cout;
+using std::endl;
+#endif
+
+namespace {
+
+	inline void __execute(sqlite3 * const db, const string & sql)
+	{
+
+		char * errmsg = nullptr;
+
+		if(sqlite3_exec(db, sql.c_str(), NULL, NULL, &errmsg) != SQLITE_OK) {
+			#ifdef DEBUG
+			cout << "Couldn't run " << sql << ": " << errmsg << endl;
+			#endif
+			sqlite3_free(errmsg);
+			throw - 1;
+		}
+
+	}
+
+	//This thread's read connection for each store it has read from,
+	//handed back when the thread exits. The weak_ptr tells a store
+	//that has since closed from a new one at the same address.
+	class ThreadReaders {
+
+		public:
+			unordered_map<const EpubStoreReaders *, pair<weak_ptr<EpubStoreReaders>, sqlite3 *>> connections;
+
+			~ThreadReaders()
+			{
+				for(auto & connection : connections) {
+					auto readers = connection.second.first.lock();
+
+					if(readers) {
+						readers->release(connection.second.second);
+					}
+				}
+			}
+
+	};
+
+	thread_local ThreadReaders thread_readers;
+
+}
+
+EpubStoreReaders::EpubStoreReaders() :
+	lock(),
+	open()
+{
+}
+
+EpubStoreReaders::~EpubStoreReaders()
+{
+	close();
+}
+
+void EpubStoreReaders::release(sqlite3 * const db)
+{
+
+	lock_guard<mutex> guard(lock);
+
+	if(open.erase(db) > 0) {
+		sqlite3_close_v2(db);
+	}
+
+}
+
+void EpubStoreReaders::close()
+{
+
+	lock_guard<mutex> guard(lock);
+
+	for(auto db : open) {
+		sqlite3_close_v2(db);
+	}
+
+	open.clear();
+
+}
+
+EpubStoreSettings::EpubStoreSettings() :
+	synchronous("NORMAL"),
+	cache_size(-65536),
+	mmap_size(268435456),
+	busy_timeout(5000),
+	search(true),
+	storage(CONTENT_ROWS)
+{
+}
+
+EpubStoreSettings::EpubStoreSettings(EpubStoreSettings const & cpy) :
+	synchronous(cpy.synchronous),
+	cache_size(cpy.cache_size),
+	mmap_size(cpy.mmap_size),
+	busy_timeout(cpy.busy_timeout),
+	search(cpy.search),
+	storage(cpy.storage)
+{
+}
+
+EpubStoreSettings::EpubStoreSettings(EpubStoreSettings && mv) :
+	synchronous(move(mv.synchronous)),
+	cache_size(mv.cache_size),
+	mmap_size(mv.mmap_size),
+	busy_timeout(mv.busy_timeout),
+	search(mv.search),
+	storage(mv.storage)
+{
+}
+
+EpubStoreSettings & EpubStoreSettings::operator =(const EpubStoreSettings & cpy)
+{
+	synchronous = cpy.synchronous;
+	cache_size = cpy.cache_size;
+	mmap_size = cpy.mmap_size;
+	busy_timeout = cpy.busy_timeout;
+	search = cpy.search;
+	storage = cpy.storage;
+	return *this;
+}
+
+EpubStoreSettings & EpubStoreSettings::operator =(EpubStoreSettings && mv)
+{
+	synchronous = move(mv.synchronous);
+	cache_size = mv.cache_size;
+	mmap_size = mv.mmap_size;
+	busy_timeout = mv.busy_timeout;
+	search = mv.search;
+	storage = mv.storage;
+	return *this;
+}
+
+EpubStoreSettings::~EpubStoreSettings()
+{
+}
+
+SearchHit::SearchHit() :
+	epub_file_id(0),
+	opf_id(0),
+	content_id(0),
+	snippet()
+{
+}
+
+SearchHit::SearchHit(const unsigned int _epub_file_id, const unsigned int _opf_id, const unsigned int _content_id, const string & _snippet) :
+	epub_file_id(_epub_file_id),
+	opf_id(_opf_id),
+	content_id(_content_id),
+	snippet(_snippet)
+{
+}
+
+SearchHit::SearchHit(SearchHit const & cpy) :
+	epub_file_id(cpy.epub_file_id),
+	opf_id(cpy.opf_id),
+	content_id(cpy.content_id),
+	snippet(cpy.snippet)
+{
+}
+
+SearchHit::SearchHit(SearchHit && mv) :
+	epub_file_id(mv.epub_file_id),
+	opf_id(mv.opf_id),
+	content_id(mv.content_id),
+	snippet(move(mv.snippet))
+{
+}
+
+SearchHit & SearchHit::operator =(const SearchHit & cpy)
+{
+	epub_file_id = cpy.epub_file_id;
+	opf_id = cpy.opf_id;
+	content_id = cpy.content_id;
+	snippet = cpy.snippet;
+	return *this;
+}
+
+SearchHit & SearchHit::operator =(SearchHit && mv)
+{
+	epub_file_id = mv.epub_file_id;
+	opf_id = mv.opf_id;
+	content_id = mv.content_id;
+	snippet = move(mv.snippet);
+	return *this;
+}
+
+SearchHit::~SearchHit()
+{
+}
+
+EpubStore::EpubStore(const path & _file, const EpubStoreSettings & _settings) :
+	file(_file),
+	settings(_settings),
+	write_db(nullptr),
+	write_session(),
+	readers(std::make_shared<EpubStoreReaders>())
+{
+
+	//Every thread has its own connections, but SQLite still has to be
+	//built to allow that.
+	if(!sqlite3_threadsafe()) {
+		throw std::runtime_error("SQLite was built without thread support!");
+	}
+
+	write_db = open(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+	try {
+		//Has to be set from the write side; it sticks to the file after.
+		__execute(write_db, "PRAGMA journal_mode = WAL;");
+		__execute(write_db, "PRAGMA synchronous = " + settings.synchronous + ";");
+
+		write_session.reset(new DatabaseSession(write_db));
+
+		if(settings.storage == CONTENT_PACKED && (settings.search || DatabaseSchema::has_search(*write_session))) {
+			throw std::runtime_error("Packed content can't be searched!");
+		}
+
+		if(settings.search) {
+			DatabaseSchema::create_search(*write_session);
+		}
+	}
+	catch(...) {
+		close();
+		throw;
+	}
+
+}
+
+EpubStore::~EpubStore()
+{
+	close();
+}
+
+sqlite3 * EpubStore::open(const int flags)
+{
+
+	sqlite3 * db;
+
+	//Each connection is only ever used by one thread at a time.
+	if(sqlite3_open_v2(file.c_str(), &db, flags | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+		sqlite3_close_v2(db);
+		throw - 1;
+	}
+
+	try {
+		sqlite3_busy_timeout(db, settings.busy_timeout);
+		__execute(db, "PRAGMA cache_size = " + to_string(settings.cache_size) + ";");
+		__execute(db, "PRAGMA mmap_size = " + to_string(settings.mmap_size) + ";");
+	}
+	catch(...) {
+		sqlite3_close_v2(db);
+		throw;
+	}
+
+	return db;
+
+}
+
+void EpubStore::close()
+{
+
+	//Its statements have to go before the connection does. Any others
+	//keep the connection around until they're finalized.
+	write_session.reset();
+
+	if(write_db) {
+		sqlite3_close_v2(write_db);
+		write_db = nullptr;
+	}
+
+	readers->close();
+
+}
+
+DatabaseSession & EpubStore::writer()
+{
+	return *write_session;
+}
+
+sqlite3 * EpubStore::reader()
+{
+
+	auto found = thread_readers.connections.find(readers.get());
+
+	if(found != thread_readers.connections.end()) {
+		if(!found->second.first.expired()) {
+			return found->second.second;
+		}
+
+		//Left over from a store that's gone.
+		thread_readers.connections.erase(found);
+	}
+
+	//Opened outside the lock, so other threads don't wait on it.
+	sqlite3 * db = open(SQLITE_OPEN_READONLY);
+
+	{
+		lock_guard<mutex> lock(readers->lock);
+		readers->open.insert(db);
+	}
+
+	thread_readers.connections.emplace(readers.get(), make_pair(weak_ptr<EpubStoreReaders>(readers), db));
+
+	return db;
+
+}
+
+vector<unsigned int> EpubStore::books()
+{
+
+	sqlite3 * db = reader();
+	sqlite3_stmt * books_select;
+
+	if(sqlite3_prepare_v2(db, "SELECT epub_file_id FROM epub_files ORDER BY epub_file_id;", -1, &books_select, 0) != SQLITE_OK) {
+		throw - 1;
+	}
+
+	vector<unsigned int> ids;
+
+	int rc = sqlite3_step(books_select);
+
+	while(rc == SQLITE_ROW) {
+		ids.push_back(sqlite3_column_int(books_select, 0));
+		rc = sqlite3_step(books_select);
+	}
+
+	sqlite3_finalize(books_select);
+
+	if(rc != SQLITE_DONE) {
+		throw - 1;
+	}
+
+	return ids;
+
+}
+
+Epub EpubStore::load(const unsigned int file_id)
+{
+	//Epub reads the whole book in one snapshot itself.
+	return Epub(reader(), file_id);
+}
+
+void EpubStore::save(Epub & book)
+{
+	book.save_to(writer(), settings.storage);
+}
+
+IngestResult EpubStore::ingest(const path & file)
+{
+
+	if(!exists(file)) {
+		throw std::runtime_error("No such filename");
+	}
+
+	const path absolute_path = absolute(file);
+	const string hash_string = Epub::compute_hash_string(Epub::compute_epub_hash(absolute_path));
+
+	DatabaseSession & session = writer();
+
+	if(Epub::find(session, hash_string) != 0) {
+		return INGEST_UNCHANGED;
+	}
+
+	sqlite3_stmt * path_select = session.statement("SELECT COUNT(*) FROM epub_files WHERE absolute_path=?;");
+	sqlite3_bind_text(path_select, 1, absolute_path.c_str(), -1, SQLITE_TRANSIENT);
+
+	const int rc = sqlite3_step(path_select);
+	const bool replacing = sqlite3_column_int(path_select, 0) > 0;
+
+	sqlite3_reset(path_select);
+
+	if(rc != SQLITE_ROW) {
+		throw - 1;
+	}
+
+	Epub book(file.string());
+	save(book);
+
+	return replacing ? INGEST_REPLACED : INGEST_ADDED;
+
+}
+
+ContentView EpubStore::content(CSS & css, const unsigned int file_id, const unsigned int opf_index, const unsigned int window)
+{
+	return ContentView(css, reader(), file_id, opf_index, window);
+}
+
+vector<SearchHit> EpubStore::search(const string & query, const unsigned int limit)
+{
+
+	sqlite3 * db = reader();
+	sqlite3_stmt * search_select;
+
+	//bm25 over the index, so this is only as slow as the number of
+	//paragraphs that match, not the size of the library.
+	const char * sql = "SELECT content.epub_file_id, content.opf_id, content.content_id, "
+	                   "snippet(content_search, 0, '[', ']', '...', 16) "
+	                   "FROM content_search JOIN content ON content.content_id = content_search.rowid "
+	                   "WHERE content_search MATCH ? ORDER BY rank LIMIT ?;";
+
+	if(sqlite3_prepare_v2(db, sql, -1, &search_select, 0) != SQLITE_OK) {
+		throw - 1;
+	}
+
+	sqlite3_bind_text(search_select, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(search_select, 2, limit);
+
+	vector<SearchHit> hits;
+
+	int rc = sqlite3_step(search_select);
+
+	while(rc == SQLITE_ROW) {
+		hits.emplace_back(sqlite3_column_int(search_select, 0), sqlite3_column_int(search_select, 1), sqlite3_column_int(search_select, 2), string((const char *) sqlite3_column_text(search_select, 3)));
+		rc = sqlite3_step(search_select);
+	}
+
+	sqlite3_finalize(search_select);
+
+	if(rc != SQLITE_DONE) {
+		throw - 1;
+	}
+
+	return hits;
+
+}
+
+const EpubStoreSettings & EpubStore::configuration() const
+{
+	return settings;
+}
\ No newline at end of file
@@ -0,0 +1,240 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "EpubWriter.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using std::move;
+using std::unique_lock;
+using std::lock_guard;
+
+const size_t EpubWriter::default_capacity;
+const size_t EpubWriter::default_group_size;
+
+EpubWriter::EpubWriter(EpubStore & _store, const size_t _capacity, const size_t _group_size) :
+	store(_store),
+	capacity(std::max(_capacity, (size_t) 1)),
+	group_size(std::max(_group_size, (size_t) 1)),
+	queue_mutex(),
+	not_empty(),
+	not_full(),
+	idle(),
+	queue(),
+	in_flight(0),
+	stopping(false),
+	books_written(0),
+	transaction_count(0),
+	error(),
+	worker()
+{
+	worker = thread(&EpubWriter::run, this);
+}
+
+EpubWriter::~EpubWriter()
+{
+
+	try {
+		close();
+	}
+	catch(...) {
+	}
+
+}
+
+void EpubWriter::push(Epub && book)
+{
+
+	unique_lock<mutex> lock(queue_mutex);
+
+	not_full.wait(lock, [this]() {
+		return queue.size() < capacity || stopping;
+	});
+
+	if(stopping) {
+		throw std::runtime_error("EpubWriter is closed!");
+	}
+
+	queue.push_back(move(book));
+
+	not_empty.notify_one();
+
+}
+
+void EpubWriter::flush()
+{
+
+	unique_lock<mutex> lock(queue_mutex);
+
+	idle.wait(lock, [this]() {
+		return queue.empty() && in_flight == 0;
+	});
+
+	if(error) {
+		exception_ptr failed = error;
+		error = nullptr;
+		std::rethrow_exception(failed);
+	}
+
+}
+
+void EpubWriter::close()
+{
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+
+		if(stopping && !worker.joinable()) {
+			return;
+		}
+
+		stopping = true;
+	}
+
+	//The thread saves what's left before it stops.
+	not_empty.notify_all();
+	not_full.notify_all();
+
+	if(worker.joinable()) {
+		worker.join();
+	}
+
+	flush();
+
+}
+
+size_t EpubWriter::written()
+{
+	lock_guard<mutex> lock(queue_mutex);
+	return books_written;
+}
+
+size_t EpubWriter::transactions()
+{
+	lock_guard<mutex> lock(queue_mutex);
+	return transaction_count;
+}
+
+void EpubWriter::run()
+{
+
+	vector<Epub> books;
+
+	while(true) {
+
+		{
+			unique_lock<mutex> lock(queue_mutex);
+
+			not_empty.wait(lock, [this]() {
+				return !queue.empty() || stopping;
+			});
+
+			if(queue.empty()) {
+				//Only once stopping, with nothing left to save.
+				return;
+			}
+
+			//Whatever has built up while the last group was saved goes
+			//in the next transaction.
+			while(!queue.empty() && books.size() < group_size) {
+				books.push_back(move(queue.front()));
+				queue.pop_front();
+			}
+
+			in_flight = books.size();
+		}
+
+		not_full.notify_all();
+
+		write(books);
+
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			in_flight = 0;
+		}
+
+		idle.notify_all();
+
+		//Freeing a book takes a while, and nobody is waiting for it.
+		books.clear();
+
+	}
+
+}
+
+void EpubWriter::write(vector<Epub> & books)
+{
+
+	DatabaseSession & session = store.writer();
+
+	size_t saved = 0;
+	size_t committed = 0;
+
+	try {
+		session.begin();
+
+		for(auto & book : books) {
+			store.save(book);
+		}
+
+		session.commit();
+
+		saved = books.size();
+		committed = 1;
+	}
+	catch(...) {
+
+		//One bad book takes the whole transaction with it, so the rest
+		//are saved again one at a time, and only the bad one is lost.
+		session.rollback();
+
+		for(auto & book : books) {
+			try {
+				store.save(book);
+				saved++;
+				committed++;
+			}
+			catch(...) {
+				session.rollback();
+
+				lock_guard<mutex> lock(queue_mutex);
+
+				if(!error) {
+					error = std::current_exception();
+				}
+			}
+		}
+
+	}
+
+	lock_guard<mutex> lock(queue_mutex);
+	books_written += saved;
+	transaction_count += committed;
+
+}
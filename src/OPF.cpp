@@ -408,13 +408,15 @@ OPF::OPF(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int
 
 	int rc;
 
-	const string metadata_select_sql = "SELECT metadata_id, metadata_type, contents FROM metadata WHERE epub_file_id=? AND opf_id=?;";
-	const string metadata_tags_select_sql = "SELECT tagname, tagvalue FROM metadata_tags WHERE metadata_id=?;";
+	//Each metadata item with its attributes, if it has any, one row per
+	//attribute, so the whole lot is one query however much there is.
+	const string metadata_select_sql = "SELECT metadata.metadata_id, metadata_type, contents, tagname, tagvalue FROM metadata "
+	                                   "LEFT JOIN metadata_tags ON metadata_tags.metadata_id = metadata.metadata_id "
+	                                   "WHERE epub_file_id=? AND opf_id=? ORDER BY metadata.metadata_id, metadata_tags.rowid;";
 	const string manifest_select_sql = "SELECT href, id, media_type FROM manifest WHERE epub_file_id=? AND opf_id=?;";
 	const string spine_select_sql = "SELECT idref, linear FROM spine WHERE epub_file_id=? AND opf_id=?;";
 
 	sqlite3_stmt * metadata_select;
-	sqlite3_stmt * metadata_tags_select;
 	sqlite3_stmt * manifest_select;
 	sqlite3_stmt * spine_select;
 
@@ -424,12 +426,6 @@ OPF::OPF(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int
 		throw - 1;
 	}
 
-	rc = sqlite3_prepare_v2(db, metadata_tags_select_sql.c_str(), -1, &metadata_tags_select, 0);
-
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
-
 	rc = sqlite3_prepare_v2(db, manifest_select_sql.c_str(), -1, &manifest_select, 0);
 
 	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
@@ -450,36 +446,33 @@ OPF::OPF(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int
 	while ( rc == SQLITE_ROW ) {
 
 		//Get the basic data
-		unsigned int metadata_id = sqlite3_column_int(metadata_select, 0);
+		const unsigned int metadata_id = sqlite3_column_int(metadata_select, 0);
 		MetadataType mdtype = (MetadataType) sqlite3_column_int(metadata_select, 1);
 		ustring content = sqlite3_column_ustring(metadata_select, 2);
 
 		//Create the object
 		MetadataItem md(mdtype, content);
 
-		int rc2;
-
-		sqlite3_bind_int(metadata_tags_select, 1, metadata_id);
+		//Then its attributes, which are on this row and the ones after it
+		//until the metadata_id changes. No attributes leaves them NULL.
+		do {
 
-		rc2 = sqlite3_step(metadata_tags_select);
+			if(sqlite3_column_type(metadata_select, 3) != SQLITE_NULL) {
 
-		while(rc2 == SQLITE_ROW) {
+				ustring tagname = sqlite3_column_ustring(metadata_select, 3);
+				ustring tagvalue = sqlite3_column_ustring(metadata_select, 4);
 
-			ustring tagname = sqlite3_column_ustring(metadata_tags_select, 0);
-			ustring tagvalue = sqlite3_column_ustring(metadata_tags_select, 1);
+				md.add_attribute(tagname, tagvalue);
 
-			md.add_attribute(tagname, tagvalue);
+			}
 
-			rc2 = sqlite3_step(metadata_tags_select);
+			rc = sqlite3_step(metadata_select);
 
 		}
+		while(rc == SQLITE_ROW && (unsigned int) sqlite3_column_int(metadata_select, 0) == metadata_id);
 
 		metadata.insert(pair<MetadataType, MetadataItem>(mdtype, md));
 
-		sqlite3_reset(metadata_tags_select);
-
-		rc = sqlite3_step(metadata_select);
-
 	}
 
 	sqlite3_bind_int(manifest_select, 1, epub_file_id);
@@ -518,7 +511,6 @@ OPF::OPF(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int
 	}
 
 	sqlite3_finalize(metadata_select);
-	sqlite3_finalize(metadata_tags_select);
 	sqlite3_finalize(manifest_select);
 	sqlite3_finalize(spine_select);
 
@@ -596,188 +588,91 @@ vector<ManifestItem> OPF::find_manifestitems_by_type(ustring type)
 
 void OPF::save_to(sqlite3 * const db, const unsigned int epub_file_id, const unsigned int opf_index)
 {
-	int rc;
-	char * errmsg;
-
-	const string opf_table_sql = "CREATE TABLE IF NOT EXISTS opf("  \
-	                             "epub_file_id INTEGER NOT NULL," \
-	                             "opf_id INTEGER NOT NULL) ;";
-	sqlite3_exec(db, opf_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	const string metadata_table_sql = "CREATE TABLE IF NOT EXISTS metadata("  \
-	                                  "metadata_id INTEGER PRIMARY KEY," \
-	                                  "epub_file_id INTEGER NOT NULL," \
-	                                  "opf_id INTEGER NOT NULL," \
-	                                  "metadata_type INTEGER NOT NULL," \
-	                                  "contents TEXT NOT NULL) ;";
-	sqlite3_exec(db, metadata_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	const string metadata_tags_table_sql = "CREATE TABLE IF NOT EXISTS metadata_tags("  \
-	                                       "metadata_id INTEGER NOT NULL," \
-	                                       "tagname TEXT NOT NULL," \
-	                                       "tagvalue TEXT NOT NULL) ;";
-	sqlite3_exec(db, metadata_tags_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	const string manifest_table_sql = "CREATE TABLE IF NOT EXISTS manifest("  \
-	                                  "epub_file_id INTEGER NOT NULL," \
-	                                  "opf_id INTEGER NOT NULL," \
-	                                  "href TEXT NOT NULL," \
-	                                  "id TEXT NOT NULL," \
-	                                  "media_type TEXT NOT NULL) ;";
-	sqlite3_exec(db, manifest_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	const string spine_table_sql = "CREATE TABLE IF NOT EXISTS spine("  \
-	                               "epub_file_id INTEGER NOT NULL," \
-	                               "opf_id INTEGER NOT NULL," \
-	                               "idref TEXT NOT NULL," \
-	                               "linear INTEGER NOT NULL) ;";
-	sqlite3_exec(db, spine_table_sql.c_str(), NULL, NULL, &errmsg);
-
-	//Tables created.
-
-	sqlite3_stmt * opf_insert;
-	sqlite3_stmt * metadata_insert;
-	sqlite3_stmt * metadata_tags_insert;
-	sqlite3_stmt * manifest_insert;
-	sqlite3_stmt * spine_insert;
-
-	const string opf_insert_sql = "INSERT INTO opf (epub_file_id, opf_id) VALUES (?, ?);";
-	const string metadata_insert_sql = "INSERT INTO metadata (epub_file_id, opf_id, metadata_type, contents) VALUES (?, ?, ?, ?);";
-	const string metadata_tags_insert_sql = "INSERT INTO metadata_tags (metadata_id, tagname, tagvalue) VALUES (?, ?, ?);";
-	const string manifest_insert_sql = "INSERT INTO manifest (epub_file_id, opf_id, href, id, media_type) VALUES (?, ?, ?, ?, ?);";
-	const string spine_insert_sql = "INSERT INTO spine (epub_file_id, opf_id, idref, linear) VALUES (?, ?, ?, ?);";
-
-	rc = sqlite3_prepare_v2(db, opf_insert_sql.c_str(), -1, &opf_insert, 0);
+	DatabaseSession * open = DatabaseSession::open_on(db);
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
+	if(open != nullptr) {
+		save_to(*open, epub_file_id, opf_index);
+		return;
 	}
 
-	rc = sqlite3_prepare_v2(db, metadata_insert_sql.c_str(), -1, &metadata_insert, 0);
+	DatabaseSession session(db);
+	save_to(session, epub_file_id, opf_index);
+}
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+void OPF::save_to(DatabaseSession & session, const unsigned int epub_file_id, const unsigned int opf_index)
+{
 
-	rc = sqlite3_prepare_v2(db, metadata_tags_insert_sql.c_str(), -1, &metadata_tags_insert, 0);
+	//The metadata ids are worked out from what's already there, so
+	//nothing else may write between reading them and the rows going in.
+	session.begin();
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+	try {
 
-	rc = sqlite3_prepare_v2(db, manifest_insert_sql.c_str(), -1, &manifest_insert, 0);
+		//Populate the OPF table:
+		sqlite3_stmt * opf_insert = session.statement("INSERT INTO opf (epub_file_id, opf_id) VALUES (?, ?);");
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+		sqlite3_bind_int(opf_insert, 1, epub_file_id);
+		sqlite3_bind_int(opf_insert, 2, opf_index);
 
-	rc = sqlite3_prepare_v2(db, spine_insert_sql.c_str(), -1, &spine_insert, 0);
+		int rc = sqlite3_step(opf_insert);
 
-	if(rc != SQLITE_OK && rc != SQLITE_DONE) {
-		throw - 1;
-	}
-
-	//Populate the OPF table:
-	sqlite3_bind_int(opf_insert, 1, epub_file_id);
-	sqlite3_bind_int(opf_insert, 2, opf_index);
-
-	rc = sqlite3_step(opf_insert);
+		sqlite3_reset(opf_insert);
 
-	if(rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE) {
-		throw - 1;
-	}
+		if(rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE) {
+			throw - 1;
+		}
 
-	for(auto & mi : metadata) {
+		//Metadata rows are batched, so the ids the tags point at are handed
+		//out here rather than read back one insert at a time.
+		sqlite3_stmt * metadata_max = session.statement("SELECT COALESCE(MAX(metadata_id), 0) FROM metadata;");
 
-		sqlite3_bind_int(metadata_insert, 1, epub_file_id);
-		sqlite3_bind_int(metadata_insert, 2, opf_index);
-		sqlite3_bind_int(metadata_insert, 3, mi.second.type);
-		sqlite3_bind_text(metadata_insert, 4, mi.second.contents.c_str(), -1, SQLITE_STATIC);
+		rc = sqlite3_step(metadata_max);
 
-		int result = sqlite3_step(metadata_insert);
+		sqlite3_int64 metadata_id = sqlite3_column_int64(metadata_max, 0);
+		sqlite3_reset(metadata_max);
 
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
+		if(rc != SQLITE_ROW) {
 			throw - 1;
 		}
 
-		sqlite3_reset(metadata_insert);
+		BatchInsert metadata_insert(session, "metadata", { "metadata_id", "epub_file_id", "opf_id", "metadata_type", "contents" });
+		BatchInsert metadata_tags_insert(session, "metadata_tags", { "metadata_id", "tagname", "tagvalue" });
 
-		//get the new id:
-		auto key = sqlite3_last_insert_rowid(db);
+		for(auto & mi : metadata) {
 
-		for(auto tags : mi.second.other_tags) {
+			metadata_id++;
 
-			sqlite3_bind_int(metadata_tags_insert, 1, key);
-			sqlite3_bind_text(metadata_tags_insert, 2, tags.first.c_str(), -1, SQLITE_STATIC);
-			sqlite3_bind_text(metadata_tags_insert, 3, tags.second.c_str(), -1, SQLITE_STATIC);
-			int result = sqlite3_step(metadata_tags_insert);
+			metadata_insert.bind(metadata_id).bind(epub_file_id).bind(opf_index).bind((sqlite3_int64) mi.second.type).bind(mi.second.contents);
 
-			if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-				throw - 1;
+			for(auto & tags : mi.second.other_tags) {
+				metadata_tags_insert.bind(metadata_id).bind(tags.first).bind(tags.second);
 			}
 
-			sqlite3_reset(metadata_tags_insert);
-
 		}
-	}
 
-	for (auto & mi : manifest) {
+		BatchInsert manifest_insert(session, "manifest", { "epub_file_id", "opf_id", "href", "id", "media_type" });
 
-		sqlite3_bind_int(manifest_insert, 1, epub_file_id);
-		sqlite3_bind_int(manifest_insert, 2, opf_index);
-		sqlite3_bind_text(manifest_insert, 3, mi.second.href.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(manifest_insert, 4, mi.second.id.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_text(manifest_insert, 5, mi.second.media_type.c_str(), -1, SQLITE_STATIC);
-		int result = sqlite3_step(manifest_insert);
-
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-			throw - 1;
+		for (auto & mi : manifest) {
+			manifest_insert.bind(epub_file_id).bind(opf_index).bind(mi.second.href).bind(mi.second.id).bind(mi.second.media_type);
 		}
 
-		sqlite3_reset(manifest_insert);
-
-	}
-
-	for (auto & si : spine) {
-
-		sqlite3_bind_int(spine_insert, 1, epub_file_id);
-		sqlite3_bind_int(spine_insert, 2, opf_index);
-		sqlite3_bind_text(spine_insert, 3, si.idref.c_str(), -1, SQLITE_STATIC);
-		sqlite3_bind_int(spine_insert, 4, (int) si.linear);
-		int result = sqlite3_step(spine_insert);
+		BatchInsert spine_insert(session, "spine", { "epub_file_id", "opf_id", "idref", "linear" });
 
-		if(result != SQLITE_OK && result != SQLITE_ROW && result != SQLITE_DONE) {
-			throw - 1;
+		for (auto & si : spine) {
+			spine_insert.bind(epub_file_id).bind(opf_index).bind(si.idref).bind((sqlite3_int64) si.linear);
 		}
 
-		sqlite3_reset(spine_insert);
-
-	}
-
-	//Create an index for the opf table
-	const string opf_index_sql = "CREATE INDEX index_opf ON opf(epub_file_id);";
-	sqlite3_exec(db, opf_index_sql.c_str(), NULL, NULL, &errmsg);
-
-	//Create an index for the metadata
-	const string metadata_index_sql = "CREATE INDEX index_metadata ON metadata(epub_file_id, opf_id);";
-	sqlite3_exec(db, metadata_index_sql.c_str(), NULL, NULL, &errmsg);
-
-	//Create an index for the metadata tags
-	const string metadata_tags_index_sql = "CREATE INDEX index_metadata_tags ON metadata_tags(metadata_id);";
-	sqlite3_exec(db, metadata_tags_index_sql.c_str(), NULL, NULL, &errmsg);
+		metadata_insert.flush();
+		metadata_tags_insert.flush();
+		manifest_insert.flush();
+		spine_insert.flush();
 
-	//Create an index for the manifest
-	const string manifest_index_sql = "CREATE INDEX index_manifest ON manifest(epub_file_id, opf_id);";
-	sqlite3_exec(db, manifest_index_sql.c_str(), NULL, NULL, &errmsg);
+		session.commit();
 
-	//Create an index for the spine
-	const string spine_index_sql = "CREATE INDEX index_spine ON spine(epub_file_id, opf_id);";
-	sqlite3_exec(db, spine_index_sql.c_str(), NULL, NULL, &errmsg);
-
-	sqlite3_finalize(opf_insert);
-	sqlite3_finalize(metadata_insert);
-	sqlite3_finalize(metadata_tags_insert);
-	sqlite3_finalize(manifest_insert);
-	sqlite3_finalize(spine_insert);
+	}
+	catch(...) {
+		session.rollback();
+		throw;
+	}
 
 }
\ No newline at end of file
@@ -0,0 +1,491 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "PackedContent.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <zlib.h>
+
+#include "SQLiteUtils.hpp"
+
+using std::move;
+using std::swap;
+
+namespace {
+
+	inline void __write_u32(string & out, const uint32_t value)
+	{
+		out += (char)(value & 0xff);
+		out += (char)((value >> 8) & 0xff);
+		out += (char)((value >> 16) & 0xff);
+		out += (char)((value >> 24) & 0xff);
+	}
+
+	inline void __write_string(string & out, const string & value)
+	{
+		__write_u32(out, value.length());
+		out += value;
+	}
+
+	inline uint32_t __read_u32(const string & data, size_t & pos)
+	{
+
+		if(pos > data.length() || data.length() - pos < 4) {
+			throw std::runtime_error("Packed content is corrupt!");
+		}
+
+		const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data.data() + pos);
+		pos += 4;
+
+		return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+
+	}
+
+	inline ustring __read_string(const string & data, size_t & pos)
+	{
+
+		const uint32_t size = __read_u32(data, pos);
+
+		if(data.length() - pos < size) {
+			throw std::runtime_error("Packed content is corrupt!");
+		}
+
+		ustring value(data.substr(pos, size));
+		pos += size;
+
+		return value;
+
+	}
+
+	inline sqlite3_stmt * __prepare(sqlite3 * const db, const string & sql)
+	{
+
+		sqlite3_stmt * stmt;
+
+		if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+			sqlite3_finalize(stmt);
+			throw - 1;
+		}
+
+		return stmt;
+
+	}
+
+	//One run of items from the same file.
+	inline void __save_blob(DatabaseSession & session, const vector<ContentItem> & items, const size_t begin, const size_t end, const unsigned int epub_file_id, const unsigned int opf_index)
+	{
+
+		string data;
+		string offsets;
+
+		for(size_t i = begin; i < end; i++) {
+
+			const ContentItem & item = items[i];
+
+			__write_u32(offsets, data.length());
+
+			__write_u32(data, item.type);
+			__write_u32(data, item.selector_id);
+			__write_string(data, item.id.raw());
+			__write_string(data, item.content.raw());
+			__write_string(data, item.stripped_content.raw());
+
+		}
+
+		uLongf compressed_length = compressBound(data.length());
+		string compressed(compressed_length, '\0');
+
+		if(compress2(reinterpret_cast<Bytef *>(&compressed[0]), &compressed_length, reinterpret_cast<const Bytef *>(data.data()), data.length(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+			throw std::runtime_error("Couldn't compress content!");
+		}
+
+		compressed.resize(compressed_length);
+
+		sqlite3_stmt * blob_insert = session.statement("INSERT INTO content_blobs (epub_file_id, opf_id, file_id, items, size, offsets, data) VALUES (?, ?, ?, ?, ?, ?, ?);");
+
+		sqlite3_bind_int(blob_insert, 1, epub_file_id);
+		sqlite3_bind_int(blob_insert, 2, opf_index);
+		sqlite3_bind_int(blob_insert, 3, items[begin].file_id);
+		sqlite3_bind_int64(blob_insert, 4, end - begin);
+		sqlite3_bind_int64(blob_insert, 5, data.length());
+		sqlite3_bind_blob(blob_insert, 6, offsets.data(), offsets.length(), SQLITE_STATIC);
+		sqlite3_bind_blob(blob_insert, 7, compressed.data(), compressed.length(), SQLITE_STATIC);
+
+		const int rc = sqlite3_step(blob_insert);
+		sqlite3_reset(blob_insert);
+
+		if(rc != SQLITE_DONE) {
+			throw - 1;
+		}
+
+	}
+
+}
+
+PackedContent::PackedContent(CSS & _css, sqlite3 * const _db, const unsigned int _epub_file_id, const unsigned int _opf_index) :
+	css(&_css),
+	db(_db),
+	epub_file_id(_epub_file_id),
+	opf_index(_opf_index),
+	file_list(),
+	file_ids(),
+	blob_ids(),
+	blob_files(),
+	item_counts(),
+	selectors(),
+	blob_select(nullptr),
+	selector_select(nullptr),
+	cached_blob_id(0),
+	cached_data(),
+	cached_offsets()
+{
+
+	sqlite3_stmt * blobs_select = __prepare(db, "SELECT blob_id, file_id, filename, items FROM content_blobs JOIN files USING(file_id) WHERE epub_file_id=? AND opf_id=? ORDER BY blob_id;");
+
+	sqlite3_bind_int(blobs_select, 1, epub_file_id);
+	sqlite3_bind_int(blobs_select, 2, opf_index);
+
+	int rc = sqlite3_step(blobs_select);
+
+	while(rc == SQLITE_ROW) {
+
+		const unsigned int file_id = sqlite3_column_int(blobs_select, 1);
+		const size_t file_index = std::find(file_ids.begin(), file_ids.end(), file_id) - file_ids.begin();
+
+		if(file_index == file_ids.size()) {
+			file_ids.push_back(file_id);
+			file_list.push_back(path(sqlite3_column_string(blobs_select, 2)));
+		}
+
+		blob_ids.push_back(sqlite3_column_int64(blobs_select, 0));
+		blob_files.push_back(file_index);
+		item_counts.push_back(sqlite3_column_int(blobs_select, 3));
+
+		rc = sqlite3_step(blobs_select);
+
+	}
+
+	sqlite3_finalize(blobs_select);
+
+	if(rc != SQLITE_DONE) {
+		throw - 1;
+	}
+
+	try {
+		blob_select = __prepare(db, "SELECT size, offsets, data FROM content_blobs WHERE blob_id=?;");
+		selector_select = __prepare(db, "SELECT css_selector FROM selectors WHERE selector_id=?;");
+	}
+	catch(...) {
+		finalize();
+		throw;
+	}
+
+}
+
+PackedContent::PackedContent(PackedContent && mv) :
+	css(mv.css),
+	db(mv.db),
+	epub_file_id(mv.epub_file_id),
+	opf_index(mv.opf_index),
+	file_list(move(mv.file_list)),
+	file_ids(move(mv.file_ids)),
+	blob_ids(move(mv.blob_ids)),
+	blob_files(move(mv.blob_files)),
+	item_counts(move(mv.item_counts)),
+	selectors(move(mv.selectors)),
+	blob_select(mv.blob_select),
+	selector_select(mv.selector_select),
+	cached_blob_id(mv.cached_blob_id),
+	cached_data(move(mv.cached_data)),
+	cached_offsets(move(mv.cached_offsets))
+{
+	mv.blob_select = nullptr;
+	mv.selector_select = nullptr;
+	mv.cached_blob_id = 0;
+}
+
+PackedContent & PackedContent::operator =(PackedContent && mv)
+{
+	swap(css, mv.css);
+	swap(db, mv.db);
+	swap(epub_file_id, mv.epub_file_id);
+	swap(opf_index, mv.opf_index);
+	swap(file_list, mv.file_list);
+	swap(file_ids, mv.file_ids);
+	swap(blob_ids, mv.blob_ids);
+	swap(blob_files, mv.blob_files);
+	swap(item_counts, mv.item_counts);
+	swap(selectors, mv.selectors);
+	swap(blob_select, mv.blob_select);
+	swap(selector_select, mv.selector_select);
+	swap(cached_blob_id, mv.cached_blob_id);
+	swap(cached_data, mv.cached_data);
+	swap(cached_offsets, mv.cached_offsets);
+	return *this;
+}
+
+PackedContent::~PackedContent()
+{
+	finalize();
+}
+
+void PackedContent::finalize()
+{
+
+	//Finalizing a null statement does nothing.
+	sqlite3_finalize(blob_select);
+	sqlite3_finalize(selector_select);
+
+	blob_select = nullptr;
+	selector_select = nullptr;
+
+}
+
+size_t PackedContent::find(const path & file) const
+{
+
+	for(size_t i = 0; i < file_list.size(); i++) {
+		if(file_list[i] == file) {
+			return i;
+		}
+	}
+
+	throw std::out_of_range("No packed content for that file in this book!");
+
+}
+
+void PackedContent::inflate(const size_t blob_index)
+{
+
+	if(cached_blob_id == blob_ids[blob_index]) {
+		return;
+	}
+
+	sqlite3_reset(blob_select);
+	sqlite3_bind_int64(blob_select, 1, blob_ids[blob_index]);
+
+	if(sqlite3_step(blob_select) != SQLITE_ROW) {
+		sqlite3_reset(blob_select);
+		throw - 1;
+	}
+
+	uLongf size = sqlite3_column_int64(blob_select, 0);
+
+	const char * offsets = (const char *) sqlite3_column_blob(blob_select, 1);
+	const string offset_data(offsets ? offsets : "", sqlite3_column_bytes(blob_select, 1));
+
+	const Bytef * data = (const Bytef *) sqlite3_column_blob(blob_select, 2);
+	const uLong data_length = sqlite3_column_bytes(blob_select, 2);
+
+	cached_blob_id = 0;
+	cached_data.assign(size, '\0');
+
+	const int z = uncompress(reinterpret_cast<Bytef *>(&cached_data[0]), &size, data, data_length);
+
+	sqlite3_reset(blob_select);
+
+	if(z != Z_OK || size != cached_data.length() || offset_data.length() != item_counts[blob_index] * 4) {
+		throw std::runtime_error("Packed content is corrupt!");
+	}
+
+	cached_offsets.clear();
+	cached_offsets.reserve(item_counts[blob_index]);
+
+	size_t pos = 0;
+
+	while(pos < offset_data.length()) {
+		cached_offsets.push_back(__read_u32(offset_data, pos));
+	}
+
+	cached_blob_id = blob_ids[blob_index];
+
+}
+
+const string & PackedContent::selector(const unsigned int selector_id)
+{
+
+	auto found = selectors.find(selector_id);
+
+	if(found != selectors.end()) {
+		return found->second;
+	}
+
+	sqlite3_reset(selector_select);
+	sqlite3_bind_int(selector_select, 1, selector_id);
+
+	if(sqlite3_step(selector_select) != SQLITE_ROW) {
+		sqlite3_reset(selector_select);
+		throw - 1;
+	}
+
+	const string name = sqlite3_column_string(selector_select, 0);
+
+	sqlite3_reset(selector_select);
+
+	return selectors.emplace(selector_id, name).first->second;
+
+}
+
+ContentItem PackedContent::decode(const size_t blob_index, const uint32_t offset)
+{
+
+	size_t pos = offset;
+
+	const ContentType type = (ContentType) __read_u32(cached_data, pos);
+	const unsigned int selector_id = __read_u32(cached_data, pos);
+	const ustring id = __read_string(cached_data, pos);
+	const ustring content = __read_string(cached_data, pos);
+	const ustring stripped_content = __read_string(cached_data, pos);
+
+	//Every item in the blob is from the same file, so that's saved once.
+	const size_t file_index = blob_files[blob_index];
+
+	return ContentItem(type, css->cascade(selector(selector_id)), file_list[file_index], id, content, stripped_content, file_ids[file_index], selector_id);
+
+}
+
+void PackedContent::append(const size_t blob_index, vector<ContentItem> & items)
+{
+
+	inflate(blob_index);
+
+	for(auto offset : cached_offsets) {
+		items.push_back(decode(blob_index, offset));
+	}
+
+}
+
+const vector<path> & PackedContent::files() const
+{
+	return file_list;
+}
+
+size_t PackedContent::size() const
+{
+
+	size_t total = 0;
+
+	for(auto count : item_counts) {
+		total += count;
+	}
+
+	return total;
+
+}
+
+size_t PackedContent::size(const path & file) const
+{
+
+	const size_t file_index = find(file);
+
+	size_t total = 0;
+
+	for(size_t i = 0; i < blob_ids.size(); i++) {
+		if(blob_files[i] == file_index) {
+			total += item_counts[i];
+		}
+	}
+
+	return total;
+
+}
+
+vector<ContentItem> PackedContent::file(const path & file)
+{
+
+	const size_t file_index = find(file);
+
+	vector<ContentItem> items;
+	items.reserve(size(file));
+
+	for(size_t i = 0; i < blob_ids.size(); i++) {
+		if(blob_files[i] == file_index) {
+			append(i, items);
+		}
+	}
+
+	return items;
+
+}
+
+ContentItem PackedContent::item(const path & file, const size_t index)
+{
+
+	const size_t file_index = find(file);
+
+	size_t remaining = index;
+
+	for(size_t i = 0; i < blob_ids.size(); i++) {
+
+		if(blob_files[i] != file_index) {
+			continue;
+		}
+
+		if(remaining < item_counts[i]) {
+			inflate(i);
+			return decode(i, cached_offsets[remaining]);
+		}
+
+		remaining -= item_counts[i];
+
+	}
+
+	throw std::out_of_range("No packed content item with that index in this file!");
+
+}
+
+vector<ContentItem> PackedContent::all()
+{
+
+	vector<ContentItem> items;
+	items.reserve(size());
+
+	for(size_t i = 0; i < blob_ids.size(); i++) {
+		append(i, items);
+	}
+
+	return items;
+
+}
+
+void PackedContent::save_to(DatabaseSession & session, const vector<ContentItem> & items, const unsigned int epub_file_id, const unsigned int opf_index)
+{
+
+	size_t begin = 0;
+
+	for(size_t i = 1; i <= items.size(); i++) {
+
+		if(i == items.size() || items[i].file_id != items[begin].file_id) {
+			__save_blob(session, items, begin, i, epub_file_id, opf_index);
+			begin = i;
+		}
+
+	}
+
+}
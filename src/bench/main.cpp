@@ -0,0 +1,807 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+Rough timings for the CSS engine. Run a release build:
+
+	bin/bench
+
+The numbers are only meaningful relative to each other on the same
+machine, so compare runs of this before and after a change.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <boost/filesystem.hpp>
+
+#include "CSS.hpp"
+#include "DatabaseSession.hpp"
+#include "DatabaseSchema.hpp"
+#include "EpubStore.hpp"
+#include "ContentView.hpp"
+#include "PackedContent.hpp"
+#include "Epub.hpp"
+#include "EpubWriter.hpp"
+
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::stringstream;
+using std::vector;
+using std::multiset;
+using std::mt19937;
+using std::uniform_int_distribution;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using namespace boost::filesystem;
+
+namespace {
+
+	//The four-field comparison CSSSpecificity used before it was packed,
+	//kept here so that the two can be timed side by side.
+	struct LegacySpecificity {
+		unsigned int a;
+		unsigned int b;
+		unsigned int c;
+		unsigned int d;
+	};
+
+	inline bool operator< (const LegacySpecificity & lhs, const LegacySpecificity & rhs)
+	{
+		if(lhs.a < rhs.a) {
+			return true;
+		}
+
+		if(lhs.a > rhs.a) {
+			return false;
+		}
+
+		if(lhs.b < rhs.b) {
+			return true;
+		}
+
+		if(lhs.b > rhs.b) {
+			return false;
+		}
+
+		if(lhs.c < rhs.c) {
+			return true;
+		}
+
+		if(lhs.c > rhs.c) {
+			return false;
+		}
+
+		if(lhs.d < rhs.d) {
+			return true;
+		}
+
+		return false;
+	}
+
+	template<typename F>
+	double time_ms(F f)
+	{
+		auto start = steady_clock::now();
+		f();
+		auto end = steady_clock::now();
+		return duration<double, std::milli>(end - start).count();
+	}
+
+	void report(const string & name, const double ms)
+	{
+		cout.width(40);
+		cout << std::left << name << ms << " ms" << endl;
+	}
+
+	//A stylesheet shaped roughly like a large publisher one: mostly
+	//classes, some element.class and id rules, and a few groups.
+	path write_stylesheet(const unsigned int n_rules, const string name = "libepub_bench.css")
+	{
+		path file = temp_directory_path();
+		file /= name;
+		ofstream out(file.string());
+
+		for(unsigned int i = 0; i < n_rules; i++) {
+
+			switch(i % 5) {
+				case 0:
+					out << ".c" << i << " {" << endl;
+					break;
+
+				case 1:
+					out << "p.c" << i << " {" << endl;
+					break;
+
+				case 2:
+					out << "#id" << i << " {" << endl;
+					break;
+
+				case 3:
+					out << "h1, h2, .c" << i << " {" << endl;
+					break;
+
+				default:
+					out << "div.c" << i << " p {" << endl;
+					break;
+			}
+
+			out << "\tmargin: " << (i % 3) << "em 0;" << endl;
+			out << "\tfont-weight: bold;" << endl;
+			out << "\ttext-indent: " << (i % 7) << "%;" << endl;
+			out << "}" << endl;
+
+		}
+
+		return file;
+	}
+
+	void bench_specificity()
+	{
+		const unsigned int n = 1000000;
+
+		mt19937 generator(42);
+		uniform_int_distribution<unsigned int> component(0, 3);
+
+		vector<LegacySpecificity> legacy;
+		vector<CSSSpecificity> packed;
+		legacy.reserve(n);
+		packed.reserve(n);
+
+		for(unsigned int i = 0; i < n; i++) {
+			LegacySpecificity s = { component(generator), component(generator), component(generator), component(generator) };
+			legacy.push_back(s);
+			packed.emplace_back(s.a, s.b, s.c, s.d);
+		}
+
+		report("specificity sort, legacy (1M)", time_ms([&]() {
+			std::sort(legacy.begin(), legacy.end());
+		}));
+
+		report("specificity sort, packed (1M)", time_ms([&]() {
+			std::sort(packed.begin(), packed.end());
+		}));
+
+		multiset<LegacySpecificity> legacy_set;
+		multiset<CSSSpecificity> packed_set;
+
+		std::shuffle(legacy.begin(), legacy.end(), generator);
+		std::shuffle(packed.begin(), packed.end(), generator);
+
+		report("specificity multiset, legacy (1M)", time_ms([&]() {
+			for(auto & s : legacy) {
+				legacy_set.insert(s);
+			}
+		}));
+
+		report("specificity multiset, packed (1M)", time_ms([&]() {
+			for(auto & s : packed) {
+				packed_set.insert(s);
+			}
+		}));
+	}
+
+	void bench_css()
+	{
+		const unsigned int n_rules = 2000;
+		const unsigned int n_runs = 5;
+
+		path file = write_stylesheet(n_rules);
+		vector<path> files { file };
+
+		double build = 0;
+		double build_cached = 0;
+
+		for(unsigned int i = 0; i < n_runs; i++) {
+			CSS::clear_stylesheet_cache();
+
+			build += time_ms([&]() {
+				CSS css(files);
+			});
+
+			//Another book with the same stylesheet.
+			build_cached += time_ms([&]() {
+				CSS css(files);
+			});
+		}
+
+		report("rule set build (2000 rules)", build / n_runs);
+		report("rule set build, cached stylesheet", build_cached / n_runs);
+
+		//The same rules spread over a dozen stylesheets, parsed side by side.
+		vector<path> split;
+
+		for(unsigned int i = 0; i < 12; i++) {
+			stringstream name;
+			name << "libepub_bench_" << i << ".css";
+			split.push_back(write_stylesheet(n_rules / 12, name.str()));
+		}
+
+		double build_split = 0;
+
+		for(unsigned int i = 0; i < n_runs; i++) {
+			CSS::clear_stylesheet_cache();
+
+			build_split += time_ms([&]() {
+				CSS css(split);
+			});
+		}
+
+		report("rule set build, 12 stylesheets", build_split / n_runs);
+
+		for(auto & f : split) {
+			remove(f);
+		}
+
+		CSS css(files);
+
+		//Every signature is distinct, so each one runs the full cascade.
+		vector<string> signatures;
+
+		for(unsigned int i = 0; i < 500; i++) {
+			stringstream signature;
+			signature << "p#id" << (i * 5 + 2) << ".c" << (i * 5 + 1) << ".c" << (i * 5 + 3);
+			signatures.push_back(signature.str());
+		}
+
+		report("cascade (500 signatures)", time_ms([&]() {
+			for(auto & signature : signatures) {
+				css.cascade(signature);
+			}
+		}));
+
+		report("cascade, memoised (500 signatures)", time_ms([&]() {
+			for(auto & signature : signatures) {
+				css.cascade(signature);
+			}
+		}));
+
+		//A p under 32 levels of div, every one of which has a class that
+		//some "div.cN p" rule names, bar the one it needs.
+		vector<CSSElement> chain;
+		chain.reserve(32);
+		CSSAncestorFilter filter;
+
+		for(unsigned int i = 0; i < 32; i++) {
+			stringstream name;
+			name << "c" << (i * 5 + 5);
+			chain.emplace_back("div", "", vector<string> { name.str() }, chain.empty() ? nullptr : &chain.back(), nullptr);
+			filter.push(chain.back());
+		}
+
+		vector<CSSElement> elements;
+
+		for(unsigned int i = 0; i < 500; i++) {
+			stringstream id;
+			id << "id" << (i * 5 + 2);
+			elements.emplace_back("p", id.str(), vector<string>(), &chain.back(), nullptr);
+		}
+
+		report("match, 32 deep (500 elements)", time_ms([&]() {
+			for(auto & element : elements) {
+				css.match(element, filter);
+			}
+		}));
+
+		//Reopening a book: the rules and the styles match() named, from
+		//the database or from a compiled image.
+		sqlite3 * db;
+		sqlite3_open(":memory:", &db);
+		css.save_to(db, 1, 0);
+
+		path image = temp_directory_path() / "libepub_bench.ecss";
+		CSSImage::write(css, image);
+
+		const string name = css.match(elements[0], filter).selector.raw_text;
+
+		report("reload from database", time_ms([&]() {
+			for(unsigned int i = 0; i < n_runs; i++) {
+				CSS loaded(db, 1, 0);
+				loaded.cascade(name);
+			}
+		}) / n_runs);
+
+		report("reload from database, all rules", time_ms([&]() {
+			for(unsigned int i = 0; i < n_runs; i++) {
+				CSS loaded(db, 1, 0);
+				loaded.load_rules();
+			}
+		}) / n_runs);
+
+		report("reload from image", time_ms([&]() {
+			for(unsigned int i = 0; i < n_runs; i++) {
+				CSSImage loaded(image);
+				loaded.contains_rule("p");
+			}
+		}) / n_runs);
+
+		sqlite3_close(db);
+		remove(image);
+
+		remove(file);
+	}
+
+	//The same selectors parsed on one thread and then split between as
+	//many threads as the hardware has. Selector parsing shares nothing
+	//between threads, so the throughput should scale with the cores.
+	void bench_selectors()
+	{
+		const unsigned int n_selectors = 40000;
+		const unsigned int n_runs = 5;
+		const unsigned int n_hardware = std::max(1u, std::thread::hardware_concurrency());
+
+		vector<string> text;
+		text.reserve(n_selectors);
+
+		for(unsigned int i = 0; i < n_selectors; i++) {
+			stringstream selector;
+			selector << "div.c" << i << " > p#id" << i << ".a:first-child + span, h1.c" << i;
+			text.push_back(selector.str());
+		}
+
+		vector<unsigned int> thread_counts { 1 };
+
+		if(n_hardware > 1) {
+			thread_counts.push_back(n_hardware);
+		}
+
+		double single = 0;
+
+		for(unsigned int n_threads : thread_counts) {
+
+			double ms = 0;
+
+			for(unsigned int run = 0; run < n_runs; run++) {
+				ms += time_ms([&]() {
+					vector<std::thread> threads;
+
+					for(unsigned int t = 0; t < n_threads; t++) {
+						threads.emplace_back([&text, t, n_threads]() {
+							for(unsigned int i = t; i < text.size(); i += n_threads) {
+								CSSSelector selector(text[i]);
+							}
+						});
+					}
+
+					for(auto & thread : threads) {
+						thread.join();
+					}
+				});
+			}
+
+			ms /= n_runs;
+
+			if(n_threads == 1) {
+				single = ms;
+			}
+
+			stringstream name;
+			name << "selector parse (40k), " << n_threads << " thread" << (n_threads > 1 ? "s" : "");
+			report(name.str(), ms);
+			cout << "  " << (unsigned int)(n_selectors / ms) << " selectors/ms, " << single / ms << "x one thread" << endl;
+
+		}
+
+		if(n_hardware == 1) {
+			cout << "(one hardware thread, so no parallel run to compare)" << endl;
+		}
+	}
+
+	//Content-shaped rows into a database on disk, a row per statement
+	//and then in batches.
+	void bench_database()
+	{
+		const unsigned int n_rows = 50000;
+
+		const string paragraph = "It is a truth universally acknowledged, that a single man in possession of a good fortune, must be in want of a wife.";
+
+		//The last run drops the indexes first and builds them afterwards.
+		for(unsigned int rows : { 1u, 16u, 64u, 0u }) {
+
+			const bool bulk = rows == 0;
+
+			if(bulk) {
+				rows = 64;
+			}
+
+			path file = temp_directory_path() / "libepub_bench.db";
+			remove(file);
+
+			DatabaseSession session(file);
+
+			if(bulk) {
+				session.begin_bulk_load();
+			}
+
+			const double ms = time_ms([&]() {
+				session.begin();
+
+				BatchInsert insert(session, "content", { "epub_file_id", "opf_id", "type", "selector_id", "file_id", "id", "content", "stripped_content" }, rows);
+
+				for(unsigned int i = 0; i < n_rows; i++) {
+					insert.bind((sqlite3_int64) 1).bind((sqlite3_int64) 0).bind((sqlite3_int64) 0);
+					insert.bind((sqlite3_int64) 1).bind((sqlite3_int64) 1).bind(string("id"));
+					insert.bind(paragraph).bind(paragraph);
+				}
+
+				insert.flush();
+				session.commit();
+			});
+
+			stringstream name;
+			name << "insert 50k rows, " << rows << " per statement" << (bulk ? ", bulk" : "");
+			report(name.str(), ms);
+
+			if(bulk) {
+				session.end_bulk_load();
+				report("  then building indexes", session.index_build_milliseconds());
+			}
+
+			remove(file);
+
+		}
+	}
+
+	//LIKE scans against the FTS5 index, over paragraphs made from a
+	//few thousand made-up words. Each query is for two words, which
+	//only turn up together in a handful of paragraphs.
+	void bench_search()
+	{
+		const unsigned int n_rows = 200000;
+
+		path file = temp_directory_path() / "libepub_bench_search.db";
+		remove(file);
+
+		{
+			EpubStoreSettings settings;
+			settings.search = false;
+
+			EpubStore store(file, settings);
+			DatabaseSession & session = store.writer();
+
+			mt19937 rng(42);
+			uniform_int_distribution<unsigned int> word(0, 4999);
+
+			session.begin();
+
+			BatchInsert insert(session, "content", { "epub_file_id", "opf_id", "type", "selector_id", "file_id", "id", "content", "stripped_content" });
+
+			for(unsigned int i = 0; i < n_rows; i++) {
+				stringstream paragraph;
+
+				for(unsigned int j = 0; j < 20; j++) {
+					paragraph << "w" << word(rng) << " ";
+				}
+
+				insert.bind((sqlite3_int64)(i / 2000 + 1)).bind((sqlite3_int64) 0).bind((sqlite3_int64) 0);
+				insert.bind((sqlite3_int64) 1).bind((sqlite3_int64) 1).bind(string("id"));
+				insert.bind(paragraph.str()).bind(paragraph.str());
+			}
+
+			insert.flush();
+			session.commit();
+
+			report("build search index (200k rows)", time_ms([&]() {
+				DatabaseSchema::create_search(session);
+			}));
+
+			sqlite3 * db = store.reader();
+			size_t found = 0;
+
+			report("LIKE scan, 20 queries", time_ms([&]() {
+				for(unsigned int i = 0; i < 20; i++) {
+					sqlite3_stmt * like;
+					const string first = "%w" + std::to_string(i * 37) + " %";
+					const string second = "%w" + std::to_string(i * 37 + 1) + " %";
+					sqlite3_prepare_v2(db, "SELECT content_id FROM content WHERE stripped_content LIKE ? AND stripped_content LIKE ? LIMIT 20;", -1, &like, 0);
+					sqlite3_bind_text(like, 1, first.c_str(), -1, SQLITE_TRANSIENT);
+					sqlite3_bind_text(like, 2, second.c_str(), -1, SQLITE_TRANSIENT);
+
+					while(sqlite3_step(like) == SQLITE_ROW) {
+						found++;
+					}
+
+					sqlite3_finalize(like);
+				}
+			}));
+
+			report("FTS5 search, 20 queries", time_ms([&]() {
+				for(unsigned int i = 0; i < 20; i++) {
+					found += store.search("w" + std::to_string(i * 37) + " w" + std::to_string(i * 37 + 1)).size();
+				}
+			}));
+
+			cout << "  " << found << " hits" << endl;
+		}
+
+		remove(file);
+	}
+
+	//Opening a 20,000 paragraph book from the database, all at once and
+	//through a view.
+	void bench_content_view()
+	{
+		const unsigned int n_rows = 20000;
+
+		const string paragraph = "It is a truth universally acknowledged, that a single man in possession of a good fortune, must be in want of a wife.";
+
+		path file = temp_directory_path() / "libepub_bench_view.db";
+		remove(file);
+
+		{
+			EpubStoreSettings settings;
+			settings.search = false;
+
+			EpubStore store(file, settings);
+			DatabaseSession & session = store.writer();
+
+			session.begin();
+
+			session.execute("INSERT INTO selectors(selector_id, css_selector) VALUES(1, 'p');");
+
+			for(unsigned int i = 0; i < n_rows / 500; i++) {
+				session.execute("INSERT INTO files(file_id, filename) VALUES(" + std::to_string(i + 1) + ", '/tmp/epub/chapter" + std::to_string(i) + ".html');");
+			}
+
+			BatchInsert insert(session, "content", { "epub_file_id", "opf_id", "type", "selector_id", "file_id", "id", "content", "stripped_content" });
+
+			for(unsigned int i = 0; i < n_rows; i++) {
+				insert.bind((sqlite3_int64) 1).bind((sqlite3_int64) 0).bind((sqlite3_int64) 0);
+				insert.bind((sqlite3_int64) 1).bind((sqlite3_int64)(i / 500 + 1)).bind(string("id"));
+				insert.bind(paragraph).bind(paragraph);
+			}
+
+			insert.flush();
+			session.commit();
+
+			CSS css;
+			sqlite3 * db = store.reader();
+
+			report("load all content (20k items)", time_ms([&]() {
+				Content content(css, db, 1, 0);
+			}));
+
+			report("open view, read first item", time_ms([&]() {
+				ContentView view(css, db, 1, 0);
+				view.at(view.first_id());
+			}));
+
+			ContentView view(css, db, 1, 0);
+
+			report("read 20k items through view", time_ms([&]() {
+				for(sqlite3_int64 id = view.first_id(); id <= view.last_id(); id++) {
+					view.at(id);
+				}
+			}));
+		}
+
+		remove(file);
+	}
+
+	//A real book saved both ways: how big the database is, and how long
+	//reading every chapter takes. Run from the top of the repository.
+	void bench_packed_content()
+	{
+		const path book_file = "books/PrideAndPrejudice.epub";
+
+		if(!exists(book_file)) {
+			cout << "(no " << book_file << ", skipping packed content)" << endl;
+			return;
+		}
+
+		Epub book(book_file.string());
+
+		for(ContentStorage storage : { CONTENT_ROWS, CONTENT_PACKED }) {
+
+			const bool packed = storage == CONTENT_PACKED;
+
+			path file = temp_directory_path() / "libepub_bench_packed.db";
+			remove(file);
+
+			{
+				EpubStoreSettings settings;
+				settings.search = false;
+				settings.storage = storage;
+
+				EpubStore store(file, settings);
+				store.save(book);
+
+				store.writer().execute("PRAGMA wal_checkpoint(TRUNCATE);");
+				store.writer().execute("VACUUM;");
+
+				Epub loaded = store.load(1);
+				size_t items = 0;
+
+				const double ms = time_ms([&]() {
+					if(packed) {
+						PackedContent content(loaded.css[0], store.reader(), 1, 0);
+
+						for(auto & chapter : content.files()) {
+							items += content.file(chapter).size();
+						}
+					}
+					else {
+						ContentView content = store.content(loaded.css[0], 1, 0);
+
+						for(auto & chapter : book.contents[0].files) {
+							items += content.file(chapter).size();
+						}
+					}
+				});
+
+				report(string("read every chapter, ") + (packed ? "packed" : "rows"), ms);
+				cout << "  " << items << " items, " << file_size(file) / 1024 << " KiB" << endl;
+			}
+
+			remove(file);
+
+		}
+	}
+
+	//Loading an OPF with a lot of metadata, most of it with attributes,
+	//from the database.
+	void bench_opf()
+	{
+		const unsigned int n_metadata = 5000;
+
+		path file = temp_directory_path() / "libepub_bench_opf.db";
+		remove(file);
+
+		{
+			EpubStoreSettings settings;
+			settings.search = false;
+
+			EpubStore store(file, settings);
+			DatabaseSession & session = store.writer();
+
+			session.begin();
+
+			BatchInsert metadata(session, "metadata", { "metadata_id", "epub_file_id", "opf_id", "metadata_type", "contents" });
+			BatchInsert tags(session, "metadata_tags", { "metadata_id", "tagname", "tagvalue" });
+
+			for(unsigned int i = 1; i <= n_metadata; i++) {
+				metadata.bind((sqlite3_int64) i).bind((sqlite3_int64) 1).bind((sqlite3_int64) 0).bind((sqlite3_int64)(i % 10)).bind(string("Some metadata"));
+
+				for(unsigned int j = 0; j < i % 3; j++) {
+					tags.bind((sqlite3_int64) i).bind(string("opf:role")).bind(string("aut"));
+				}
+			}
+
+			metadata.flush();
+			tags.flush();
+			session.commit();
+
+			sqlite3 * db = store.reader();
+
+			report("load OPF, 5000 metadata items", time_ms([&]() {
+				OPF opf(db, 1, 0);
+			}));
+		}
+
+		remove(file);
+	}
+
+	//Saving 24 copies of a book a transaction each, on the parsing
+	//thread, against handing them to an EpubWriter. Synchronous is FULL,
+	//so each commit is a real sync.
+	void bench_writer()
+	{
+		const path book_file = "books/PrideAndPrejudice.epub";
+
+		if(!exists(book_file)) {
+			cout << "(no " << book_file << ", skipping writer)" << endl;
+			return;
+		}
+
+		const unsigned int n_books = 24;
+		const Epub parsed(book_file.string());
+
+		auto copy = [&](const unsigned int i) {
+			Epub book(parsed);
+			book.absolute_path = "/library/" + std::to_string(i) + ".epub";
+			book.hash_string = std::to_string(i);
+			return book;
+		};
+
+		for(bool queued : { false, true }) {
+
+			path file = temp_directory_path() / "libepub_bench_writer.db";
+			remove(file);
+
+			{
+				EpubStoreSettings settings;
+				settings.synchronous = "FULL";
+				settings.search = false;
+
+				EpubStore store(file, settings);
+
+				if(queued) {
+					vector<Epub> books;
+
+					for(unsigned int i = 0; i < n_books; i++) {
+						books.push_back(copy(i));
+					}
+
+					EpubWriter writer(store, n_books);
+					double pushed = 0;
+
+					const double ms = time_ms([&]() {
+						pushed = time_ms([&]() {
+							for(auto & book : books) {
+								writer.push(std::move(book));
+							}
+						});
+
+						writer.flush();
+					});
+
+					report("save 24 books, writer thread", ms);
+					cout << "  " << writer.transactions() << " transactions, parser waited " << pushed << " ms" << endl;
+				}
+				else {
+					vector<Epub> books;
+
+					for(unsigned int i = 0; i < n_books; i++) {
+						books.push_back(copy(i));
+					}
+
+					report("save 24 books, one at a time", time_ms([&]() {
+						for(auto & book : books) {
+							store.save(book);
+						}
+					}));
+				}
+			}
+
+			remove(file);
+
+		}
+	}
+
+}
+
+int main()
+{
+	std::locale::global(std::locale(""));
+
+	bench_specificity();
+	bench_css();
+	bench_selectors();
+	bench_database();
+	bench_search();
+	bench_content_view();
+	bench_packed_content();
+	bench_opf();
+	bench_writer();
+}
@@ -30,9 +30,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sqlite3.h>
 
 #include "Epub.hpp"
+#include "EpubStore.hpp"
 
 using std::cout;
 using std::endl;
+using std::string;
 
 int main(int argc, char * argv[])
 {
@@ -43,15 +45,18 @@ int main(int argc, char * argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	Epub book(argv[1]);
-	sqlite3 * db;
-	int rc;
-	rc = sqlite3_open("database", &db);
+	//--css-stats prints how the book's styles were resolved, as JSON.
+	const bool css_statistics = argc > 2 && string(argv[2]) == "--css-stats";
 
-	if( rc ) {
-		//Failed to open
-	}
+	EpubStore store(path("database"));
 
-	book.save_to(db);
-	sqlite3_close(db);
+	if(css_statistics) {
+		Epub book(argv[1], css_statistics);
+		cout << book.css_statistics_json() << endl;
+		store.save(book);
+	}
+	else {
+		//Only unpacked if it isn't in the database as it is already.
+		store.ingest(argv[1]);
+	}
 }
@@ -33,9 +33,30 @@ Selectors : http://www.w3.org/TR/WD-css2-971104/selector.html
 */
 
 #include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <boost/filesystem.hpp>
 
 #include "CSS.hpp"
 
+using std::ofstream;
+using std::ostringstream;
+using namespace boost::filesystem;
+
+namespace {
+
+	path write_stylesheet(const string & name, const string & contents)
+	{
+		path file = temp_directory_path();
+		file /= name;
+		ofstream out(file.string());
+		out << contents;
+		return file;
+	}
+
+}
+
 TEST(CSSTest, Specificity_Equality)
 {
 
@@ -216,3 +237,1000 @@ TEST(CSSTest, Selector_Specificity)
 
 }
 
+TEST(CSSTest, Selector_Compiled)
+{
+
+	CSSSelector selector_a("DIV.note  >  p#first.a.b + span ~ em::before");
+
+	ASSERT_EQ(1u, selector_a.count());
+	ASSERT_TRUE(selector_a.matches("div.note > p#first.a.b + span ~ em::before"));
+
+	const CSSComplexSelector & complex_a = selector_a.compiled()[0];
+
+	ASSERT_EQ(4u, complex_a.compounds.size());
+	ASSERT_TRUE(complex_a.specificity == CSSSpecificity(0, 1, 3, 5));
+
+	ASSERT_EQ("div", complex_a.compounds[0].element);
+	ASSERT_EQ(CSS_COMBINATOR_NONE, complex_a.compounds[0].combinator);
+
+	ASSERT_EQ("p", complex_a.compounds[1].element);
+	ASSERT_EQ("first", complex_a.compounds[1].id);
+	ASSERT_EQ(2u, complex_a.compounds[1].classes.size());
+	ASSERT_EQ(CSS_COMBINATOR_CHILD, complex_a.compounds[1].combinator);
+
+	ASSERT_EQ(CSS_COMBINATOR_ADJACENT, complex_a.compounds[2].combinator);
+	ASSERT_EQ(CSS_COMBINATOR_SIBLING, complex_a.compounds[3].combinator);
+	ASSERT_EQ("::before", complex_a.compounds[3].other[0]);
+
+	CSSSelector selector_b("p span, a[href=\"x,y\"]:hover");
+
+	ASSERT_EQ(2u, selector_b.count());
+	ASSERT_EQ(CSS_COMBINATOR_DESCENDANT, selector_b.compiled()[0].compounds[1].combinator);
+	ASSERT_TRUE(selector_b.compiled()[1].specificity == CSSSpecificity(0, 0, 2, 1));
+
+	//Anything malformed throws the whole selector away.
+	CSSSelector selector_c("p, h1 >, span");
+
+	ASSERT_EQ(0u, selector_c.count());
+	ASSERT_FALSE(selector_c.matches("p"));
+
+	CSSSelector selector_d("p..x");
+
+	ASSERT_EQ(0u, selector_d.count());
+
+}
+
+TEST(CSSTest, Selector_Threads)
+{
+
+	//Parsing keeps no state outside the selector being built, so
+	//selectors built side by side come out the same as built alone.
+	vector<string> text;
+
+	for(unsigned int i = 0; i < 200; i++) {
+		ostringstream selector;
+		selector << "div.c" << i << " > p#id" << i << ".a + span, h" << (i % 6 + 1) << ".c" << i;
+		text.push_back(selector.str());
+	}
+
+	vector<CSSSelector> expected;
+
+	for(auto & t : text) {
+		expected.emplace_back(t);
+	}
+
+	const unsigned int n_threads = 4;
+	vector<vector<CSSSelector>> results(n_threads);
+	vector<std::thread> threads;
+
+	for(unsigned int i = 0; i < n_threads; i++) {
+		threads.emplace_back([&text, &results, i]() {
+			for(unsigned int run = 0; run < 10; run++) {
+				results[i].clear();
+
+				for(auto & t : text) {
+					results[i].emplace_back(t);
+				}
+			}
+		});
+	}
+
+	for(auto & thread : threads) {
+		thread.join();
+	}
+
+	for(auto & result : results) {
+		ASSERT_EQ(expected.size(), result.size());
+
+		for(unsigned int i = 0; i < expected.size(); i++) {
+			ASSERT_EQ(2u, result[i].count());
+			ASSERT_TRUE(expected[i].keys() == result[i].keys());
+			ASSERT_TRUE(expected[i].specificity == result[i].specificity);
+			ASSERT_TRUE(expected[i].compiled()[0].specificity == result[i].compiled()[0].specificity);
+		}
+	}
+
+}
+
+TEST(CSSTest, Property_Lookup)
+{
+
+	ASSERT_EQ(MARGIN_TOP, CSSPropertyType_from_string("margin-top"));
+	ASSERT_EQ(FONT_WEIGHT, CSSPropertyType_from_string("font-weight"));
+	ASSERT_EQ(FONT_WEIGHT, CSSPropertyType_from_string("Font-Weight"));
+	ASSERT_EQ(FLEX_BASI, CSSPropertyType_from_string("flex-basis"));
+	ASSERT_EQ(CSS_OVERFLOW, CSSPropertyType_from_string("overflow"));
+	ASSERT_EQ(Z_INDEX, CSSPropertyType_from_string("z-index"));
+
+	ASSERT_EQ(CSS_PROPERTY_UNKNOWN, CSSPropertyType_from_string(""));
+	ASSERT_EQ(CSS_PROPERTY_UNKNOWN, CSSPropertyType_from_string("margin-"));
+	ASSERT_EQ(CSS_PROPERTY_UNKNOWN, CSSPropertyType_from_string("margin-topp"));
+	ASSERT_EQ(CSS_PROPERTY_UNKNOWN, CSSPropertyType_from_string("-webkit-hyphens"));
+
+}
+
+TEST(CSSTest, Property_Shorthands)
+{
+
+	vector<pair<CSSPropertyType, string>> expanded;
+
+	CSSPropertyType_expand(MARGIN, "1em 2em", expanded);
+
+	ASSERT_EQ(5u, expanded.size());
+	ASSERT_EQ(MARGIN, expanded[0].first);
+	ASSERT_EQ("1em", expanded[1].second);
+	ASSERT_EQ("2em", expanded[2].second);
+	ASSERT_EQ(MARGIN_BOTTOM, expanded[3].first);
+	ASSERT_EQ("1em", expanded[3].second);
+	ASSERT_EQ(MARGIN_LEFT, expanded[4].first);
+	ASSERT_EQ("2em", expanded[4].second);
+
+	expanded.clear();
+	CSSPropertyType_expand(FONT, "italic bold 12px/1.5 \"Times New Roman\", serif", expanded);
+
+	ASSERT_EQ(7u, expanded.size());
+	ASSERT_EQ(FONT_STYLE, expanded[1].first);
+	ASSERT_EQ("italic", expanded[1].second);
+	ASSERT_EQ(FONT_WEIGHT, expanded[3].first);
+	ASSERT_EQ("bold", expanded[3].second);
+	ASSERT_EQ("12px", expanded[4].second);
+	ASSERT_EQ("1.5", expanded[5].second);
+	ASSERT_EQ("\"Times New Roman\", serif", expanded[6].second);
+
+	expanded.clear();
+	CSSPropertyType_expand(BORDER, "1px solid black", expanded);
+
+	//border, then each side followed by its width, style and colour.
+	ASSERT_EQ(17u, expanded.size());
+	ASSERT_EQ(BORDER_LEFT, expanded[13].first);
+	ASSERT_EQ(BORDER_LEFT_STYLE, expanded[15].first);
+	ASSERT_EQ("solid", expanded[15].second);
+
+	expanded.clear();
+	CSSPropertyType_expand(COLOR, "red", expanded);
+
+	ASSERT_EQ(1u, expanded.size());
+
+}
+
+TEST(CSSTest, Cascade)
+{
+
+	path file = write_stylesheet("cascade_test.css",
+	                             "p {\n"
+	                             "\tmargin: 1em;\n"
+	                             "\tfont-weight: normal;\n"
+	                             "\tcolor: black !important;\n"
+	                             "}\n"
+	                             ".bold {\n"
+	                             "\tfont-weight: bold;\n"
+	                             "\tcolor: red;\n"
+	                             "}\n"
+	                             "p.bold {\n"
+	                             "\tmargin-top: 2em;\n"
+	                             "}\n"
+	                             ".bold {\n"
+	                             "\tfont-style: italic;\n"
+	                             "}\n");
+
+	CSS css(vector<path> { file });
+
+	const CSSRule & plain = css.cascade("p");
+
+	ASSERT_EQ("normal", plain.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_EQ("1em", plain.find_declaration(MARGIN_TOP)->value);
+	ASSERT_TRUE(plain.find_declaration(FONT_STYLE) == nullptr);
+
+	const CSSRule & bold = css.cascade(CSS::signature("p", "", vector<ustring> { "bold" }));
+
+	//.bold beats p, p.bold beats .bold, and later rules beat earlier ones.
+	ASSERT_EQ("bold", bold.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_EQ("2em", bold.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("1em", bold.find_declaration(MARGIN_BOTTOM)->value);
+	ASSERT_EQ("italic", bold.find_declaration(FONT_STYLE)->value);
+
+	//!important survives a more specific rule.
+	ASSERT_EQ("black", bold.find_declaration(COLOR)->value);
+	ASSERT_TRUE(bold.find_declaration(COLOR)->important);
+
+	//The same signature is only computed once.
+	ASSERT_EQ(&bold, &css.cascade("p.bold"));
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Declarations_Repeated)
+{
+
+	path file = write_stylesheet("repeated_test.css",
+	                             "p {\n"
+	                             "\tmargin: 0;\n"
+	                             "\tmargin-top: 5px;\n"
+	                             "\tcolor: red;\n"
+	                             "\tcolor: blue;\n"
+	                             "\tfont-weight: bold !important;\n"
+	                             "\tfont-weight: normal;\n"
+	                             "}\n"
+	                             "h1 {\n"
+	                             "\tmargin-top: 5px;\n"
+	                             "\tmargin: 1em;\n"
+	                             "}\n");
+
+	CSS css(vector<path> { file });
+
+	ASSERT_EQ(2u, css.rules.size());
+
+	for(auto & rule : css.rules) {
+		//Each property is declared once, as the last declaration has it.
+		for(auto & declaration : rule.declarations) {
+			ASSERT_EQ(&declaration, rule.find_declaration(declaration.type));
+		}
+	}
+
+	const CSSRule & p = css.cascade("p");
+
+	//A longhand after its shorthand only replaces its own part.
+	ASSERT_EQ("5px", p.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("0", p.find_declaration(MARGIN_BOTTOM)->value);
+	ASSERT_EQ("blue", p.find_declaration(COLOR)->value);
+	ASSERT_EQ("blue", p.raw_pairs.at("color"));
+
+	//Except that !important isn't replaced by a later plain one.
+	ASSERT_EQ("bold", p.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_TRUE(p.find_declaration(FONT_WEIGHT)->important);
+
+	//A shorthand after a longhand replaces it.
+	const CSSRule & h1 = css.cascade("h1");
+
+	ASSERT_EQ("1em", h1.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("1em", h1.raw_pairs.at("margin"));
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Specificity_Saturation)
+{
+
+	CSSSpecificity test_a(0, 0, 300, 0);
+	CSSSpecificity test_b(0, 0, 255, 0);
+	CSSSpecificity test_c(0, 0, 254, 1000);
+	CSSSpecificity test_d(0, 1, 0, 0);
+
+	ASSERT_TRUE(test_a == test_b);
+	ASSERT_TRUE(test_c < test_b);
+	ASSERT_TRUE(test_a < test_d);
+
+}
+
+TEST(CSSTest, Rules_Sorted)
+{
+
+	path file = write_stylesheet("sorted_test.css",
+	                             "#id {\n"
+	                             "\tcolor: red;\n"
+	                             "}\n"
+	                             "p.a {\n"
+	                             "\tcolor: green;\n"
+	                             "}\n"
+	                             "p {\n"
+	                             "\tcolor: blue;\n"
+	                             "}\n"
+	                             "p {\n"
+	                             "\tcolor: black;\n"
+	                             "}\n");
+
+	CSS css(vector<path> { file });
+
+	ASSERT_EQ(4u, css.rules.size());
+
+	for(unsigned int i = 1; i < css.rules.size(); i++) {
+		ASSERT_TRUE(css.rules[i - 1].selector.specificity <= css.rules[i].selector.specificity);
+	}
+
+	//Equal specificity keeps source order.
+	ASSERT_EQ("blue", css.rules[0].raw_pairs.at("color"));
+	ASSERT_EQ("black", css.rules[1].raw_pairs.at("color"));
+
+	ASSERT_TRUE(css.contains_rule("p.a"));
+	ASSERT_TRUE(css.contains_rule("#id"));
+	ASSERT_FALSE(css.contains_rule("div"));
+	ASSERT_EQ("green", css.get_rule("p.a").raw_pairs["color"]);
+
+	remove(file);
+
+}
+
+
+TEST(CSSTest, Match_Contextual)
+{
+
+	path file = write_stylesheet("match_test.css",
+	                             "p {\n"
+	                             "\tmargin: 1em;\n"
+	                             "}\n"
+	                             "div.chapter p {\n"
+	                             "\tfont-style: italic;\n"
+	                             "}\n"
+	                             "body > p {\n"
+	                             "\tfont-weight: bold;\n"
+	                             "}\n"
+	                             "h1 + p {\n"
+	                             "\tmargin-top: 0;\n"
+	                             "}\n"
+	                             "h1 ~ p.note {\n"
+	                             "\tcolor: red;\n"
+	                             "}\n"
+	                             "p:hover, a[href] p {\n"
+	                             "\tcolor: blue;\n"
+	                             "}\n");
+
+	CSS css(vector<path> { file });
+
+	//body > div.chapter > (h1, p, p.note)
+	CSSElement body("body", "", vector<string>(), nullptr, nullptr);
+	CSSElement chapter("div", "", vector<string> { "chapter" }, &body, nullptr);
+	CSSElement h1("h1", "", vector<string>(), &chapter, nullptr);
+	CSSElement first("p", "", vector<string>(), &chapter, &h1);
+	CSSElement note("p", "", vector<string> { "note" }, &chapter, &first);
+	CSSElement outside("p", "", vector<string>(), &body, &chapter);
+
+	CSSAncestorFilter filter;
+	filter.push(body);
+
+	const CSSRule & outside_style = css.match(outside, filter);
+
+	ASSERT_EQ("bold", outside_style.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_TRUE(outside_style.find_declaration(FONT_STYLE) == nullptr);
+	ASSERT_EQ("1em", outside_style.find_declaration(MARGIN_TOP)->value);
+
+	filter.push(chapter);
+
+	const CSSRule & first_style = css.match(first, filter);
+
+	ASSERT_EQ("italic", first_style.find_declaration(FONT_STYLE)->value);
+	ASSERT_TRUE(first_style.find_declaration(FONT_WEIGHT) == nullptr);
+	ASSERT_EQ("0", first_style.find_declaration(MARGIN_TOP)->value);
+	ASSERT_TRUE(first_style.find_declaration(COLOR) == nullptr);
+
+	const CSSRule & note_style = css.match(note, filter);
+
+	ASSERT_EQ("italic", note_style.find_declaration(FONT_STYLE)->value);
+	ASSERT_EQ("1em", note_style.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("red", note_style.find_declaration(COLOR)->value);
+
+	filter.pop(chapter);
+
+	ASSERT_FALSE(filter.may_contain(CSSAncestorFilter::hash(".chapter")));
+	ASSERT_TRUE(filter.may_contain(CSSAncestorFilter::hash("body")));
+
+	//Elements picking up the same rules share a computed style.
+	CSSElement other("p", "", vector<string>(), &body, nullptr);
+
+	ASSERT_EQ(&outside_style, &css.match(other, filter));
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Stylesheet_Cache)
+{
+
+	const string contents = "p {\n"
+	                        "\tmargin: 1em;\n"
+	                        "}\n"
+	                        ".bold {\n"
+	                        "\tfont-weight: bold;\n"
+	                        "}\n";
+
+	CSS::clear_stylesheet_cache();
+
+	path file_a = write_stylesheet("cache_test_a.css", contents);
+	path file_b = write_stylesheet("cache_test_b.css", contents);
+	path file_c = write_stylesheet("cache_test_c.css", contents + "h1 {\n\tmargin: 0;\n}\n");
+
+	//Same bytes under a different name is the same stylesheet.
+	auto sheet_a = CSS::stylesheet(file_a);
+	auto sheet_b = CSS::stylesheet(file_b);
+
+	ASSERT_EQ(sheet_a.get(), sheet_b.get());
+	ASSERT_EQ(2u, sheet_a->size());
+	ASSERT_EQ(1u, CSS::stylesheet_cache_size());
+
+	auto sheet_c = CSS::stylesheet(file_c);
+
+	ASSERT_NE(sheet_a.get(), sheet_c.get());
+	ASSERT_EQ(3u, sheet_c->size());
+	ASSERT_EQ(2u, CSS::stylesheet_cache_size());
+
+	//Rules from later files still come later in the cascade.
+	CSS css(vector<path> { file_a, file_c });
+
+	ASSERT_EQ(5u, css.rules.size());
+	ASSERT_EQ("0", css.cascade("h1").find_declaration(MARGIN_TOP)->value);
+
+	//They're the cached stylesheets' own rules, not copies of them.
+	for(auto & rule : css.rules) {
+		const bool in_a = &rule >= sheet_a->data() && &rule < sheet_a->data() + sheet_a->size();
+		const bool in_c = &rule >= sheet_c->data() && &rule < sheet_c->data() + sheet_c->size();
+		ASSERT_TRUE(in_a || in_c);
+	}
+
+	unsigned int last = 0;
+
+	for(unsigned int i = 0; i < css.rules.size(); i++) {
+		if(css.rules[i].selector.matches("p")) {
+			last = i;
+		}
+	}
+
+	ASSERT_EQ(2u, css.rules.source_order(last));
+
+	//A sheet is parsed again when something it imports has changed,
+	//even though its own bytes haven't.
+	path imported = write_stylesheet("cache_test_imported.css", "h2 {\n\tmargin: 0;\n}\n");
+	path importing = write_stylesheet("cache_test_importing.css", "@import \"cache_test_imported.css\";\n");
+
+	auto before = CSS::stylesheet(importing);
+
+	ASSERT_EQ(before.get(), CSS::stylesheet(importing).get());
+	ASSERT_EQ("0", before->front().raw_pairs.at("margin"));
+
+	write_stylesheet("cache_test_imported.css", "h2 {\n\tmargin: 1em;\n}\nh3 {\n}\n");
+	last_write_time(imported, last_write_time(imported) + 60);
+
+	auto after = CSS::stylesheet(importing);
+
+	ASSERT_NE(before.get(), after.get());
+	ASSERT_EQ("1em", after->front().raw_pairs.at("margin"));
+	ASSERT_EQ(after.get(), CSS::stylesheet(importing).get());
+
+	remove(file_a);
+	remove(file_b);
+	remove(file_c);
+	remove(imported);
+	remove(importing);
+
+}
+
+TEST(CSSTest, Stylesheets_Parallel)
+{
+
+	//A dozen stylesheets that all set p's margin, each with a few rules
+	//of its own first. The last one listed has to win.
+	vector<path> files;
+
+	for(unsigned int i = 0; i < 12; i++) {
+
+		ostringstream contents;
+
+		for(unsigned int j = 0; j < i; j++) {
+			contents << ".c" << i << "_" << j << " {\n\tmargin: 0;\n}\n";
+		}
+
+		contents << "p {\n\tmargin: " << i << "em;\n}\n";
+
+		ostringstream name;
+		name << "parallel_test_" << i << ".css";
+
+		files.push_back(write_stylesheet(name.str(), contents.str()));
+
+	}
+
+	CSS css(files);
+
+	ASSERT_EQ(78u, css.rules.size());
+	ASSERT_EQ("11em", css.cascade("p").find_declaration(MARGIN_TOP)->value);
+
+	//Source order runs through the files in the order they were given.
+	unsigned int expected = 0;
+
+	for(unsigned int i = 0; i < 12; i++) {
+		ostringstream name;
+		name << ".c" << i << "_0";
+
+		if(i > 0) {
+			ASSERT_EQ(expected, css.get_rule(name.str()).source_order);
+		}
+
+		expected += i + 1;
+	}
+
+	files.push_back("does_not_exist.css");
+
+	ASSERT_THROW(CSS failed(files), std::runtime_error);
+
+	files.pop_back();
+
+	for(auto & file : files) {
+		remove(file);
+	}
+
+}
+
+TEST(CSSTest, Device_MediaQueries)
+{
+
+	CSSDevice device("screen", 600, 800, 8, 0);
+
+	ASSERT_TRUE(device.matches(""));
+	ASSERT_TRUE(device.matches("all"));
+	ASSERT_TRUE(device.matches("screen"));
+	ASSERT_FALSE(device.matches("print"));
+	ASSERT_TRUE(device.matches("print, screen"));
+	ASSERT_TRUE(device.matches("only screen and (min-width: 30em)"));
+	ASSERT_FALSE(device.matches("screen and (min-width: 40em)"));
+	ASSERT_TRUE(device.matches("(max-device-width: 600px) and (orientation: portrait)"));
+	ASSERT_FALSE(device.matches("(orientation: landscape)"));
+	ASSERT_TRUE(device.matches("not print"));
+	ASSERT_FALSE(device.matches("(monochrome)"));
+	ASSERT_TRUE(device.matches("(color)"));
+
+	//Features we don't know about never apply, even with not.
+	ASSERT_FALSE(device.matches("(-webkit-min-device-pixel-ratio: 2)"));
+	ASSERT_FALSE(device.matches("not screen and (grid)"));
+
+	CSSDevice reader("print", 1072, 1448, 0, 4);
+
+	ASSERT_TRUE(reader.matches("print and (monochrome)"));
+	ASSERT_FALSE(reader.matches("screen"));
+	ASSERT_NE(device.key(), reader.key());
+
+}
+
+TEST(CSSTest, AtRules)
+{
+
+	path imported = write_stylesheet("atrule_imported.css",
+	                                 "@import \"atrule_test.css\";\n"
+	                                 "h1 { margin: 3em }\n");
+
+	path printed = write_stylesheet("atrule_print.css",
+	                                "h2 { margin: 4em }\n");
+
+	path file = write_stylesheet("atrule_test.css",
+	                             "@charset \"utf-8\";\n"
+	                             "@import url(\"atrule_imported.css\");\n"
+	                             "@import 'atrule_print.css' print;\n"
+	                             "@import url(missing.css);\n"
+	                             "/* p { margin: 9em }\n"
+	                             "   spread over lines */\n"
+	                             "@font-face {\n"
+	                             "\tfont-family: \"Body\";\n"
+	                             "\tsrc: url(fonts/body.otf);\n"
+	                             "}\n"
+	                             "p { margin: 1em; font-weight: normal }\n"
+	                             "@media screen and (min-width: 20em) {\n"
+	                             "\tp { margin: 2em }\n"
+	                             "\t@media (orientation: landscape) {\n"
+	                             "\t\tp { font-weight: bold }\n"
+	                             "\t}\n"
+	                             "}\n"
+	                             "@media print { p { font-style: italic } }\n"
+	                             "@page { margin: 0 }\n"
+	                             "span { content: \"}\"; font-style: italic }\n");
+
+	CSS css(vector<path> { file }, CSSDevice("screen", 600, 800, 8, 0));
+
+	//h1 from the import, then p, the p in @media and span.
+	ASSERT_EQ(4u, css.rules.size());
+	ASSERT_TRUE(css.contains_rule("h1"));
+	ASSERT_FALSE(css.contains_rule("h2"));
+
+	const CSSRule & p = css.cascade("p");
+
+	ASSERT_EQ("2em", p.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("normal", p.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_TRUE(p.find_declaration(FONT_STYLE) == nullptr);
+
+	ASSERT_EQ("italic", css.cascade("span").find_declaration(FONT_STYLE)->value);
+
+	//The same file for a printer keeps a different set of rules.
+	CSS print(vector<path> { file }, CSSDevice("print", 600, 800, 0, 1));
+
+	ASSERT_TRUE(print.contains_rule("h2"));
+	ASSERT_EQ("1em", print.cascade("p").find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("italic", print.cascade("p").find_declaration(FONT_STYLE)->value);
+
+	remove(file);
+	remove(imported);
+	remove(printed);
+
+}
+
+TEST(CSSTest, Inline_Style)
+{
+
+	path file = write_stylesheet("inline_test.css",
+	                             "span {\n"
+	                             "\tfont-weight: normal;\n"
+	                             "\tcolor: black !important;\n"
+	                             "}\n"
+	                             "#note {\n"
+	                             "\tfont-style: normal;\n"
+	                             "}\n");
+
+	CSS css(vector<path> { file });
+	CSSAncestorFilter filter;
+
+	CSSElement plain("span", "", vector<string>(), nullptr, nullptr);
+	CSSElement styled("span", "note", vector<string>(), nullptr, nullptr);
+	styled.style = "font-weight:bold; font-style: italic; color: red; /* margin: 1em */";
+
+	ASSERT_EQ("normal", css.match(plain, filter).find_declaration(FONT_WEIGHT)->value);
+
+	const CSSRule & style = css.match(styled, filter);
+
+	//Inline beats the id selector, but not !important.
+	ASSERT_EQ("bold", style.find_declaration(FONT_WEIGHT)->value);
+	ASSERT_EQ("italic", style.find_declaration(FONT_STYLE)->value);
+	ASSERT_EQ("black", style.find_declaration(COLOR)->value);
+	ASSERT_TRUE(style.find_declaration(MARGIN_TOP) == nullptr);
+
+	//The same attribute is parsed once, and the same element with it
+	//gets the same computed style.
+	ASSERT_EQ(&css.inline_style(styled.style), &css.inline_style(styled.style));
+	ASSERT_TRUE(css.inline_style(styled.style).selector.specificity == CSSSpecificity(1, 0, 0, 0));
+
+	CSSElement again("span", "note", vector<string>(), nullptr, nullptr);
+	again.style = styled.style;
+
+	ASSERT_EQ(&style, &css.match(again, filter));
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Match_Threads)
+{
+
+	ostringstream text;
+
+	for(unsigned int i = 0; i < 50; i++) {
+		text << "p.c" << i << " {\n\tmargin-top: " << i << "px;\n}\n";
+		text << "div > p.c" << i << " {\n\tcolor: #" << (100 + i) << ";\n}\n";
+	}
+
+	path file = write_stylesheet("threads_test.css", text.str());
+
+	//Every thread asks the same shared CSS for the same styles, so they
+	//are all worked out, and looked up, at once.
+	CSS css(vector<path> { file });
+
+	CSSElement div("div", "", vector<string>(), nullptr, nullptr);
+	CSSAncestorFilter filter;
+	filter.push(div);
+
+	const unsigned int n_threads = 4;
+	vector<vector<const CSSRule *>> matched(n_threads);
+	vector<vector<const CSSRule *>> cascaded(n_threads);
+	vector<std::thread> threads;
+
+	for(unsigned int i = 0; i < n_threads; i++) {
+		threads.emplace_back([&css, &div, &filter, &matched, &cascaded, i]() {
+			for(unsigned int c = 0; c < 50; c++) {
+				CSSElement p("p", "", vector<string> { "c" + std::to_string(c) }, &div, nullptr);
+				p.style = "font-weight: " + std::to_string(100 * (c % 9 + 1));
+
+				matched[i].push_back(&css.match(p, filter));
+				cascaded[i].push_back(&css.cascade(matched[i].back()->selector.raw_text));
+			}
+		});
+	}
+
+	for(auto & thread : threads) {
+		thread.join();
+	}
+
+	for(unsigned int c = 0; c < 50; c++) {
+
+		const CSSRule & style = *matched[0][c];
+
+		ASSERT_EQ(std::to_string(c) + "px", style.find_declaration(MARGIN_TOP)->value);
+		ASSERT_EQ("#" + std::to_string(100 + c), style.find_declaration(COLOR)->value);
+		ASSERT_EQ(std::to_string(100 * (c % 9 + 1)), style.find_declaration(FONT_WEIGHT)->value);
+
+		for(unsigned int i = 0; i < n_threads; i++) {
+			ASSERT_EQ(&style, matched[i][c]);
+			ASSERT_EQ(&style, cascaded[i][c]);
+		}
+
+	}
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Database)
+{
+
+	path file = write_stylesheet("database_test.css",
+	                             "p { margin: 1em; color: black !important }\n"
+	                             "div.chapter p { font-style: italic }\n"
+	                             ".bold, h1 { font-weight: bold }\n");
+
+	CSS css(vector<path> { file });
+
+	CSSElement chapter("div", "", vector<string> { "chapter" }, nullptr, nullptr);
+	CSSElement p("p", "", vector<string>(), &chapter, nullptr);
+	p.style = "margin-top: 3em";
+
+	CSSAncestorFilter filter;
+	filter.push(chapter);
+
+	const string name = css.match(p, filter).selector.raw_text;
+
+	sqlite3 * db;
+
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+
+	css.save_to(db, 1, 0);
+
+	CSS loaded(db, 1, 0);
+
+	//The contextual, inline-styled computed style comes back by name,
+	//from the saved image, without the rules being read in.
+	const CSSRule & style = loaded.cascade(name);
+
+	ASSERT_EQ("italic", style.find_declaration(FONT_STYLE)->value);
+	ASSERT_EQ("3em", style.find_declaration(MARGIN_TOP)->value);
+	ASSERT_EQ("1em", style.find_declaration(MARGIN_BOTTOM)->value);
+	ASSERT_TRUE(style.find_declaration(COLOR)->important);
+
+	ASSERT_TRUE(loaded.contains_rule("h1"));
+	ASSERT_FALSE(loaded.contains_rule("h2"));
+	ASSERT_TRUE(loaded.files.empty());
+
+	//It is the style match() worked out, declaration for declaration.
+	const CSSRule & computed = css.cascade(name);
+
+	ASSERT_TRUE(computed.raw_pairs == style.raw_pairs);
+	ASSERT_EQ(computed.declarations.size(), style.declarations.size());
+
+	for(unsigned int i = 0; i < computed.declarations.size(); i++) {
+		ASSERT_EQ(computed.declarations[i].type, style.declarations[i].type);
+		ASSERT_EQ(computed.declarations[i].value, style.declarations[i].value);
+		ASSERT_EQ(computed.declarations[i].important, style.declarations[i].important);
+		ASSERT_TRUE(computed.declarations[i].specificity == style.declarations[i].specificity);
+	}
+
+	//Copies read their rules in when they need them too.
+	CSS copy(loaded);
+
+	ASSERT_EQ(name, copy.match(p, filter).selector.raw_text);
+
+	//Asking for the rules reads them in.
+	ASSERT_EQ(css.rules.size(), loaded.rules.size());
+	ASSERT_EQ(css.files.size(), loaded.files.size());
+
+	for(unsigned int i = 0; i < css.rules.size(); i++) {
+		ASSERT_TRUE(css.rules[i].selector == loaded.rules[i].selector);
+		ASSERT_TRUE(css.rules[i].selector.specificity == loaded.rules[i].selector.specificity);
+		ASSERT_EQ(css.rules.source_order(i), loaded.rules.source_order(i));
+		ASSERT_EQ(css.rules[i].declarations.size(), loaded.rules[i].declarations.size());
+	}
+
+	//Handed out before the rules were read in, and still good.
+	ASSERT_EQ(&style, &loaded.cascade(name));
+	ASSERT_EQ("bold", loaded.cascade("h1").find_declaration(FONT_WEIGHT)->value);
+
+	//Readers on several threads can all be the first to need the rules.
+	CSS shared(db, 1, 0);
+	vector<const CSSRule *> matched(4);
+	vector<std::thread> threads;
+
+	for(unsigned int i = 0; i < matched.size(); i++) {
+		threads.emplace_back([&shared, &p, &filter, &matched, i]() {
+			matched[i] = &shared.match(p, filter);
+		});
+	}
+
+	for(auto & thread : threads) {
+		thread.join();
+	}
+
+	for(auto rule : matched) {
+		ASSERT_EQ(matched[0], rule);
+		ASSERT_EQ(name, rule->selector.raw_text);
+	}
+
+	//Saved before there were images: the rules are read in straight away.
+	ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "UPDATE css SET image = NULL;", NULL, NULL, NULL));
+
+	CSS unimaged(db, 1, 0);
+
+	ASSERT_EQ(css.rules.size(), unimaged.rules.size());
+	ASSERT_EQ("italic", unimaged.cascade(name).find_declaration(FONT_STYLE)->value);
+
+	//Nothing saved for that rootfile is an empty stylesheet.
+	CSS missing(db, 1, 1);
+
+	ASSERT_EQ(0u, missing.rules.size());
+
+	sqlite3_close(db);
+
+	remove(file);
+
+}
+
+TEST(CSSTest, Image)
+{
+
+	path file = write_stylesheet("image_test.css",
+	                             "p { margin: 1em; color: black !important }\n"
+	                             "div.chapter p { font-style: italic }\n"
+	                             ".bold, h1 { font-weight: bold }\n");
+
+	CSS css(vector<path> { file });
+
+	CSSElement chapter("div", "", vector<string> { "chapter" }, nullptr, nullptr);
+	CSSElement p("p", "", vector<string>(), &chapter, nullptr);
+	p.style = "margin-top: 3em";
+
+	CSSAncestorFilter filter;
+	filter.push(chapter);
+
+	const string name = css.match(p, filter).selector.raw_text;
+
+	path image_file = temp_directory_path() / "image_test.ecss";
+
+	CSSImage::write(css, image_file);
+
+	CSSImage image(image_file);
+
+	ASSERT_FALSE(image.empty());
+	ASSERT_TRUE(CSSImage().empty());
+	ASSERT_EQ(css.rules.size(), image.count());
+
+	uint32_t length;
+	bool important;
+
+	for(unsigned int i = 0; i < css.rules.size(); i++) {
+		const char * selector = image.selector(i, length);
+		ASSERT_EQ(css.rules[i].selector.raw_text, string(selector, length));
+	}
+
+	ASSERT_EQ(nullptr, image.selector(css.rules.size(), length));
+
+	ASSERT_TRUE(image.contains_rule("p"));
+	ASSERT_TRUE(image.contains_rule(".bold"));
+	ASSERT_TRUE(image.contains_rule("h1"));
+	ASSERT_FALSE(image.contains_rule("h2"));
+
+	//The computed style comes back by name without cascading anything.
+	const int style = image.find_style(name);
+
+	ASSERT_LE(0, style);
+	ASSERT_EQ(-1, image.find_style("p@99"));
+
+	const char * value = image.find_declaration(style, FONT_STYLE, length, important);
+
+	ASSERT_EQ("italic", string(value, length));
+
+	value = image.find_declaration(style, MARGIN_TOP, length, important);
+
+	ASSERT_EQ("3em", string(value, length));
+
+	value = image.find_declaration(style, COLOR, length, important);
+
+	ASSERT_TRUE(important);
+	ASSERT_EQ(nullptr, image.find_declaration(style, FONT_WEIGHT, length, important));
+
+	//Copies share the mapping.
+	CSSImage copy(image);
+	image = CSSImage();
+
+	ASSERT_TRUE(copy.contains_rule("p"));
+
+	//Truncated images are refused.
+	resize_file(image_file, file_size(image_file) - 1);
+
+	ASSERT_THROW(CSSImage truncated(image_file), std::runtime_error);
+
+	//Nowhere to put it, or no room for it.
+	ASSERT_THROW(CSSImage::write(css, temp_directory_path() / "no_such_directory" / "image.ecss"), std::runtime_error);
+
+	if(exists("/dev/full")) {
+		ASSERT_THROW(CSSImage::write(css, "/dev/full"), std::runtime_error);
+	}
+
+	remove(image_file);
+	remove(file);
+
+}
+
+TEST(CSSTest, Statistics)
+{
+
+	path file = write_stylesheet("statistics_test.css",
+	                             "p { margin: 1em }\n"
+	                             "div.chapter p { font-style: italic }\n"
+	                             "h1 { font-weight: bold }\n");
+
+	CSS css(vector<path> { file });
+
+	//Off until asked for.
+	ASSERT_EQ(nullptr, css.statistics());
+
+	css.enable_statistics();
+
+	ASSERT_TRUE(css.contains_rule("p"));
+	ASSERT_FALSE(css.contains_rule("h2"));
+	css.get_rule("p");
+
+	CSSElement chapter("div", "", vector<string> { "chapter" }, nullptr, nullptr);
+	CSSElement p("p", "", vector<string>(), &chapter, nullptr);
+
+	CSSAncestorFilter filter;
+
+	//Nothing above p yet, so the contextual rule is filtered out.
+	css.match(p, filter);
+
+	filter.push(chapter);
+	css.match(p, filter);
+	css.match(p, filter);
+
+	const CSSStatistics & stats = *css.statistics();
+
+	ASSERT_EQ(3u, stats.lookups);
+	ASSERT_EQ(2u, stats.hits);
+	ASSERT_EQ(1u, stats.misses);
+	ASSERT_EQ(3u, stats.matches);
+	ASSERT_EQ(6u, stats.candidates);
+	ASSERT_EQ(1u, stats.filtered);
+	ASSERT_EQ(2u, stats.computed);
+	ASSERT_EQ(1u, stats.memoised);
+	ASSERT_EQ(3u, stats.merges);
+
+	ASSERT_EQ(5u, stats.selector("p").lookups);
+	ASSERT_EQ(2u, stats.selector("div.chapter p").hits);
+	ASSERT_EQ(1u, stats.selector("div.chapter p").misses);
+	ASSERT_EQ(1u, stats.selector("div.chapter p").merges);
+	ASSERT_EQ(1u, stats.selector("h2").misses);
+	ASSERT_EQ(0u, stats.selector("h3").lookups);
+
+	ASSERT_EQ("p", stats.hottest(1)[0].first);
+
+	const string json = stats.to_json(2);
+
+	ASSERT_EQ(0u, json.find("{\"lookups\":3,\"hits\":2,\"misses\":1,"));
+	ASSERT_NE(string::npos, json.find("\"selectors\":[{\"selector\":\"p\",\"lookups\":5,"));
+	ASSERT_EQ(string::npos, json.find("h2"));
+
+	ASSERT_EQ("\"a\\\"b\\\\c\\n\\u0001\"", CSSStatistics::json_string("a\"b\\c\n\x01"));
+
+	//Copies count separately.
+	CSS copy(css);
+	copy.contains_rule("p");
+
+	ASSERT_EQ(3u, css.statistics()->lookups);
+	ASSERT_EQ(4u, copy.statistics()->lookups);
+
+	//Readers on several threads all count into the same statistics.
+	vector<std::thread> threads;
+
+	for(unsigned int i = 0; i < 4; i++) {
+		threads.emplace_back([&css, &p, &filter]() {
+			for(unsigned int j = 0; j < 250; j++) {
+				css.contains_rule("p");
+				css.match(p, filter);
+			}
+		});
+	}
+
+	for(auto & thread : threads) {
+		thread.join();
+	}
+
+	ASSERT_EQ(1003u, stats.lookups);
+	ASSERT_EQ(1003u, stats.matches);
+	ASSERT_EQ(2005u, stats.selector("p").lookups);
+
+	css.disable_statistics();
+
+	ASSERT_EQ(nullptr, css.statistics());
+
+	remove(file);
+
+}
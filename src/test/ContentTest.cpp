@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "Content.hpp"
+
+using std::ofstream;
+using namespace boost::filesystem;
+
+namespace {
+
+	path write_file(const string & name, const string & contents)
+	{
+		path file = temp_directory_path();
+		file /= name;
+		ofstream out(file.string());
+		out << contents;
+		return file;
+	}
+
+}
+
+TEST(ContentTest, Blocks)
+{
+
+	path css_file = write_file("content_test.css",
+	                           ".loud { font-weight: bold }\n"
+	                           "blockquote p { font-style: italic }\n");
+
+	path html_file = write_file("content_test.xhtml",
+	                            "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	                            "<html xmlns=\"http://www.w3.org/1999/xhtml\"><head><title>t</title><style>p { }</style></head><body>\n"
+	                            "<h1>One</h1>\n"
+	                            "<h3 id=\"three\">Three</h3>\n"
+	                            "<h6>Six</h6>\n"
+	                            "<div id=\"chapter\">\n"
+	                            "<p>A <em>first</em>, <span class=\"loud\">para</span>.</p>\n"
+	                            "Loose <strong>text</strong>\n"
+	                            "<blockquote><p>Quoted</p></blockquote>\n"
+	                            "</div>\n"
+	                            "<blockquote>Said <small>quietly</small></blockquote>\n"
+	                            "<ul><li>Item <code>x</code></li><li>Item <custom>y</custom></li></ul>\n"
+	                            "<table><tr><th>Head</th><td>Cell</td></tr></table>\n"
+	                            "<a href=\"#\"><p>Linked</p></a>\n"
+	                            "<hr/>\n"
+	                            "<pre>code</pre><script>ignored()</script>\n"
+	                            "</body></html>\n");
+
+	CSS css(vector<path> { css_file });
+	Content content(css, vector<path> { html_file });
+
+	vector<pair<ContentType, string>> expected {
+		{ H1, "One" },
+		{ H3, "Three" },
+		{ H6, "Six" },
+		{ P, "A <i>first</i>, <b>para</b>." },
+		{ DIV, "\nLoose <b>text</b>" },
+		{ P, "Quoted" },
+		{ BLOCKQUOTE, "Said <small>quietly</small>" },
+		{ LI, "Item <tt>x</tt>" },
+		{ LI, "Item y" },
+		{ TH, "Head" },
+		{ TD, "Cell" },
+		{ P, "Linked" },
+		{ HR, "" },
+		{ PRE, "code" }
+	};
+
+	ASSERT_EQ(expected.size(), content.items.size());
+
+	for(unsigned int i = 0; i < expected.size(); i++) {
+		ASSERT_EQ(expected[i].first, content.items[i].type);
+		ASSERT_EQ(expected[i].second, content.items[i].content.raw());
+	}
+
+	//Ids carry on to the items after them.
+	ASSERT_EQ("", content.items[0].id.raw());
+	ASSERT_EQ("three", content.items[1].id.raw());
+	ASSERT_EQ("chapter", content.items[3].id.raw());
+
+	//Each block is styled in place.
+	ASSERT_EQ("Quoted", content.items[5].stripped_content.raw());
+	ASSERT_EQ("italic", content.items[5].rule.find_declaration(FONT_STYLE)->value);
+	ASSERT_EQ(nullptr, content.items[3].rule.find_declaration(FONT_STYLE));
+
+	remove(html_file);
+	remove(css_file);
+
+}
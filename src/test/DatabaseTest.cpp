@@ -0,0 +1,372 @@
+/*
+Copyright (c) 2014, Richard Martin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Richard Martin nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL RICHARD MARTIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <sqlite3.h>
+#include <thread>
+
+#include "DatabaseSession.hpp"
+#include "DatabaseSchema.hpp"
+#include "EpubStore.hpp"
+
+TEST(DatabaseTest, BatchInsert)
+{
+
+	DatabaseSession session(path(":memory:"));
+
+	//The schema is there as soon as the session is.
+	sqlite3_stmt * tables = session.statement("SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='content';");
+
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(tables));
+	ASSERT_EQ(1, sqlite3_column_int(tables, 0));
+
+	session.execute("CREATE TABLE test(a INTEGER, b TEXT, c BLOB);");
+
+	const size_t statements = session.statement_count();
+
+	//Two full batches of 64 and 22 left over.
+	session.begin();
+
+	BatchInsert insert(session, "test", { "a", "b", "c" });
+
+	for(unsigned int i = 0; i < 150; i++) {
+		insert.bind((sqlite3_int64) i).bind(string("row ") + std::to_string(i)).bind_blob(string("\0x", 2));
+	}
+
+	insert.flush();
+
+	session.commit();
+
+	ASSERT_EQ(statements + 2, session.statement_count());
+
+	sqlite3_stmt * rows = session.statement("SELECT a, b, length(c) FROM test ORDER BY rowid;");
+
+	for(unsigned int i = 0; i < 150; i++) {
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(rows));
+		ASSERT_EQ((int) i, sqlite3_column_int(rows, 0));
+		ASSERT_EQ("row " + std::to_string(i), string((const char *) sqlite3_column_text(rows, 1)));
+		ASSERT_EQ(2, sqlite3_column_int(rows, 2));
+	}
+
+	ASSERT_EQ(SQLITE_DONE, sqlite3_step(rows));
+
+	//Another table's worth of the same shape reuses both statements.
+	BatchInsert again(session, "test", { "a", "b", "c" });
+
+	for(unsigned int i = 0; i < 86; i++) {
+		again.bind((sqlite3_int64) i).bind(string("again")).bind_blob(string());
+	}
+
+	again.flush();
+
+	ASSERT_EQ(statements + 3, session.statement_count());
+
+	//Nested transactions only commit at the outside, and a rollback
+	//anywhere takes everything with it.
+	session.begin();
+	session.begin();
+	session.execute("DELETE FROM test;");
+	session.commit();
+	session.rollback();
+
+	sqlite3_stmt * count = session.statement("SELECT COUNT(*) FROM test;");
+
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(count));
+	ASSERT_EQ(236, sqlite3_column_int(count, 0));
+
+	//An inner rollback only undoes its own level, and the outer one
+	//still commits.
+	session.begin();
+	session.execute("DELETE FROM test WHERE a < 100;");
+	session.begin();
+	session.execute("DELETE FROM test;");
+	session.rollback();
+	session.commit();
+
+	ASSERT_TRUE(sqlite3_get_autocommit(session.handle()));
+
+	count = session.statement("SELECT COUNT(*) FROM test;");
+
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(count));
+	ASSERT_EQ(50, sqlite3_column_int(count, 0));
+
+	//Saving through the bare connection goes through this session, even
+	//once it has been moved.
+	ASSERT_EQ(&session, DatabaseSession::open_on(session.handle()));
+
+	{
+		DatabaseSession nested(session.handle());
+		ASSERT_EQ(&session, DatabaseSession::open_on(session.handle()));
+
+		DatabaseSession moved(std::move(session));
+		ASSERT_EQ(&moved, DatabaseSession::open_on(moved.handle()));
+
+		session = std::move(moved);
+		ASSERT_EQ(&session, DatabaseSession::open_on(session.handle()));
+	}
+
+	ASSERT_EQ(&session, DatabaseSession::open_on(session.handle()));
+
+	ASSERT_THROW(session.execute("NOT SQL"), int);
+
+}
+
+TEST(DatabaseTest, Schema)
+{
+
+	path file = temp_directory_path() / "schema_test.db";
+	remove(file);
+
+	auto indexes = [](DatabaseSession & session) {
+		sqlite3_stmt * count = session.statement("SELECT COUNT(*) FROM sqlite_master WHERE type='index' AND name LIKE 'index_%';");
+		sqlite3_step(count);
+		const int n = sqlite3_column_int(count, 0);
+		sqlite3_reset(count);
+		return n;
+	};
+
+	{
+		DatabaseSession session(file);
+
+		ASSERT_EQ(DatabaseSchema::version, DatabaseSchema::stored_version(session));
+		ASSERT_EQ(14, indexes(session));
+
+		//Only the unique indexes and those on epub_file_id survive a
+		//bulk load.
+		session.begin_bulk_load();
+
+		ASSERT_TRUE(session.is_bulk_loading());
+		ASSERT_EQ(9, indexes(session));
+
+		//Nor does saving through the same connection meanwhile, the way
+		//the save_to(sqlite3 *) overloads do, build them again.
+		{
+			DatabaseSession nested(session.handle());
+		}
+
+		ASSERT_EQ(9, indexes(session));
+
+		session.end_bulk_load();
+
+		ASSERT_FALSE(session.is_bulk_loading());
+		ASSERT_EQ(14, indexes(session));
+		ASSERT_LE(0, session.index_build_milliseconds());
+
+		//Left half done, to be finished by the next session.
+		session.begin_bulk_load();
+	}
+
+	{
+		DatabaseSession session(file);
+
+		ASSERT_EQ(14, indexes(session));
+
+		session.execute("PRAGMA user_version = " + std::to_string(DatabaseSchema::version + 1) + ";");
+	}
+
+	//Newer than this code.
+	ASSERT_THROW(DatabaseSession newer(file), int);
+
+	remove(file);
+
+}
+
+
+TEST(DatabaseTest, Interning)
+{
+
+	path file = temp_directory_path() / "interning_test.db";
+	remove(file);
+
+	//Content as version 1 saved it.
+	{
+		sqlite3 * db;
+		ASSERT_EQ(SQLITE_OK, sqlite3_open(file.c_str(), &db));
+
+		ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+		                                  "CREATE TABLE content(content_id INTEGER PRIMARY KEY, epub_file_id INTEGER NOT NULL, opf_id INTEGER NOT NULL,"
+		                                  "type INTEGER NOT NULL, css_selector TEXT NOT NULL, filename TEXT NOT NULL, id TEXT NOT NULL,"
+		                                  "content TEXT NOT NULL, stripped_content TEXT NOT NULL);"
+		                                  "INSERT INTO content VALUES(5, 1, 0, 0, 'p@0', 'a.html', '', 'one', 'one');"
+		                                  "INSERT INTO content VALUES(6, 1, 0, 0, 'p@1', 'a.html', '', 'two', 'two');"
+		                                  "INSERT INTO content VALUES(7, 1, 0, 0, 'p@0', 'b.html', '', 'three', 'three');"
+		                                  "PRAGMA user_version = 1;", NULL, NULL, NULL));
+
+		sqlite3_close(db);
+	}
+
+	DatabaseSession session(file);
+
+	ASSERT_EQ(DatabaseSchema::version, DatabaseSchema::stored_version(session));
+
+	sqlite3_stmt * counts = session.statement("SELECT (SELECT COUNT(*) FROM files), (SELECT COUNT(*) FROM selectors);");
+
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(counts));
+	ASSERT_EQ(2, sqlite3_column_int(counts, 0));
+	ASSERT_EQ(2, sqlite3_column_int(counts, 1));
+
+	sqlite3_stmt * rows = session.statement("SELECT content_id, filename, css_selector, content FROM content "
+	                                        "JOIN files USING(file_id) JOIN selectors USING(selector_id) ORDER BY content_id;");
+
+	const char * expected[][3] = { { "a.html", "p@0", "one" }, { "a.html", "p@1", "two" }, { "b.html", "p@0", "three" } };
+
+	for(unsigned int i = 0; i < 3; i++) {
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(rows));
+		ASSERT_EQ((int) (5 + i), sqlite3_column_int(rows, 0));
+		ASSERT_EQ(expected[i][0], string((const char *) sqlite3_column_text(rows, 1)));
+		ASSERT_EQ(expected[i][1], string((const char *) sqlite3_column_text(rows, 2)));
+		ASSERT_EQ(expected[i][2], string((const char *) sqlite3_column_text(rows, 3)));
+	}
+
+	ASSERT_EQ(SQLITE_DONE, sqlite3_step(rows));
+
+	remove(file);
+
+	//A migration that fails part way through is undone entirely, and
+	//doesn't leave the connection inside a transaction.
+	path broken = temp_directory_path() / "interning_broken_test.db";
+	remove(broken);
+
+	sqlite3 * db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(broken.c_str(), &db));
+
+	ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+	                                  "CREATE TABLE content(content_id INTEGER PRIMARY KEY, filename TEXT NOT NULL);"
+	                                  "PRAGMA user_version = 1;", NULL, NULL, NULL));
+
+	ASSERT_THROW(DatabaseSession failed(db), int);
+	ASSERT_NE(0, sqlite3_get_autocommit(db));
+
+	sqlite3_stmt * tables;
+	ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master WHERE type='table';", -1, &tables, 0));
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(tables));
+	ASSERT_EQ(1, sqlite3_column_int(tables, 0));
+	sqlite3_finalize(tables);
+
+	sqlite3_close(db);
+	remove(broken);
+
+}
+
+TEST(DatabaseTest, CSSImages)
+{
+
+	//A css table from before version 5 gets an image column, and the
+	//rows already in it are left without one.
+	sqlite3 * db;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+
+	ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+	                                  "CREATE TABLE css(css_id INTEGER PRIMARY KEY, epub_file_id INTEGER NOT NULL,"
+	                                  "opf_id INTEGER NOT NULL, rules BLOB NOT NULL);"
+	                                  "INSERT INTO css(epub_file_id, opf_id, rules) VALUES(1, 0, x'00');"
+	                                  "PRAGMA user_version = 4;", NULL, NULL, NULL));
+
+	{
+		DatabaseSession session(db);
+
+		ASSERT_EQ(DatabaseSchema::version, DatabaseSchema::stored_version(session));
+
+		sqlite3_stmt * images = session.statement("SELECT COUNT(*), COUNT(image) FROM css;");
+
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(images));
+		ASSERT_EQ(1, sqlite3_column_int(images, 0));
+		ASSERT_EQ(0, sqlite3_column_int(images, 1));
+
+		sqlite3_reset(images);
+	}
+
+	sqlite3_close(db);
+
+}
+
+TEST(DatabaseTest, Store)
+{
+
+	path file = temp_directory_path() / "store_test.db";
+	remove(file);
+
+	EpubStoreSettings settings;
+	settings.synchronous = "OFF";
+
+	EpubStore store(file, settings);
+
+	auto count = [](sqlite3 * db) {
+		sqlite3_stmt * select;
+		sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM test;", -1, &select, 0);
+		sqlite3_step(select);
+		const int n = sqlite3_column_int(select, 0);
+		sqlite3_finalize(select);
+		return n;
+	};
+
+	DatabaseSession & writer = store.writer();
+
+	sqlite3_stmt * mode = writer.statement("PRAGMA journal_mode;");
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(mode));
+	ASSERT_EQ("wal", string((const char *) sqlite3_column_text(mode, 0)));
+	sqlite3_reset(mode);
+
+	writer.execute("CREATE TABLE test(a INTEGER);");
+	writer.execute("INSERT INTO test VALUES (1);");
+
+	//Another thread reads the last commit, on its own connection, while
+	//the writer is half way through a transaction.
+	writer.begin();
+	writer.execute("INSERT INTO test VALUES (2);");
+
+	sqlite3 * main_reader = store.reader();
+	sqlite3 * thread_reader = nullptr;
+	int seen = -1;
+
+	std::thread reading([&]() {
+		thread_reader = store.reader();
+		seen = count(thread_reader);
+	});
+
+	reading.join();
+
+	writer.commit();
+
+	ASSERT_EQ(1, seen);
+	ASSERT_NE(main_reader, thread_reader);
+	ASSERT_EQ(main_reader, store.reader());
+	ASSERT_EQ(2, count(main_reader));
+
+	//Readers can't write.
+	ASSERT_NE(SQLITE_OK, sqlite3_exec(main_reader, "INSERT INTO test VALUES (3);", NULL, NULL, NULL));
+
+	ASSERT_TRUE(store.books().empty());
+
+	//A thread's connections close with the store, and a later store,
+	//however likely to turn up at the same address, opens its own.
+	for(unsigned int i = 0; i < 2; i++) {
+		std::unique_ptr<EpubStore> again(new EpubStore(file, settings));
+		ASSERT_EQ(2, count(again->reader()));
+	}
+
+}
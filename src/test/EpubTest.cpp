@@ -26,10 +26,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <sqlite3.h>
 #include <boost/filesystem.hpp>
 
 #include "Epub.hpp"
+#include "EpubStore.hpp"
+#include "PackedContent.hpp"
+#include "EpubWriter.hpp"
+#include "DatabaseSchema.hpp"
 
 using namespace boost::filesystem;
 
@@ -150,26 +157,23 @@ TEST(EpubTest, Database)
 
 		ASSERT_TRUE(file_book.css[i].rules.size() == sql_book.css[i].rules.size());
 
-		auto book_css_it = file_book.css[i].rules.begin();
-		auto sql_css_it = sql_book.css[i].rules.begin();
+		for(unsigned int k = 0; k < file_book.css[i].rules.size(); k++) {
 
-		while(book_css_it != file_book.css[i].rules.end()) {
-
-			CSSRule c_book = *book_css_it;
-			CSSRule c_sql = *sql_css_it;
+			const CSSRule & c_book = file_book.css[i].rules[k];
+			const CSSRule & c_sql = sql_book.css[i].rules[k];
 
 			ASSERT_TRUE(c_book.selector == c_sql.selector);
+			ASSERT_TRUE(c_book.selector.specificity == c_sql.selector.specificity);
 			ASSERT_TRUE(c_book.collation_key == c_sql.collation_key);
-			ASSERT_TRUE(c_book.displaytype == c_sql.displaytype);
-			ASSERT_TRUE(c_book.fontsize == c_sql.fontsize);
-			ASSERT_TRUE(c_book.fontweight == c_sql.fontweight);
-			ASSERT_TRUE(c_book.fontstyle == c_sql.fontstyle);
-			ASSERT_TRUE(c_book.margintop == c_sql.margintop);
-			ASSERT_TRUE(c_book.marginbottom == c_sql.marginbottom);
-			ASSERT_TRUE(c_book.pagebreakbefore == c_sql.pagebreakbefore);
-			ASSERT_TRUE(c_book.pagebreakafter == c_sql.pagebreakafter);
-			ASSERT_TRUE(c_book.textalign == c_sql.textalign);
-			ASSERT_TRUE(c_book.textindent == c_sql.textindent);
+			ASSERT_TRUE(file_book.css[i].rules.source_order(k) == sql_book.css[i].rules.source_order(k));
+			ASSERT_TRUE(c_book.raw_pairs.size() == c_sql.raw_pairs.size());
+			ASSERT_TRUE(c_book.declarations.size() == c_sql.declarations.size());
+
+			for(unsigned int j = 0; j < c_book.declarations.size(); j++) {
+				ASSERT_TRUE(c_book.declarations[j].type == c_sql.declarations[j].type);
+				ASSERT_TRUE(c_book.declarations[j].value == c_sql.declarations[j].value);
+				ASSERT_TRUE(c_book.declarations[j].important == c_sql.declarations[j].important);
+			}
 
 			auto book_tags_it = c_book.raw_pairs.begin();
 			auto sql_tags_it = c_sql.raw_pairs.begin();
@@ -189,9 +193,6 @@ TEST(EpubTest, Database)
 
 			}
 
-			++book_css_it;
-			++sql_css_it;
-
 		}
 
 
@@ -204,4 +205,578 @@ TEST(EpubTest, Database)
 
 }
 
+TEST(EpubTest, Search)
+{
+
+	path file = temp_directory_path() / "search_test.db";
+	remove(file);
+
+	{
+		EpubStore store(file);
+
+		Epub book("books/PrideAndPrejudice.epub");
+		book.save_to(store.writer());
+
+		vector<SearchHit> hits = store.search("netherfield", 5);
+
+		ASSERT_EQ(5u, hits.size());
+
+		for(auto & hit : hits) {
+			ASSERT_EQ(1u, hit.epub_file_id);
+			ASSERT_NE(string::npos, hit.snippet.find("[Netherfield]"));
+		}
+
+		//Phrases, and nothing for words that aren't there.
+		ASSERT_FALSE(store.search("\"truth universally acknowledged\"").empty());
+		ASSERT_TRUE(store.search("zeppelin").empty());
+	}
+
+	{
+		//Once the index is there it stays, whatever the settings say.
+		EpubStoreSettings settings;
+		settings.search = false;
+
+		EpubStore store(file, settings);
+
+		ASSERT_FALSE(store.search("netherfield").empty());
+	}
+
+	remove(file);
+
+	{
+		EpubStoreSettings settings;
+		settings.search = false;
+
+		EpubStore store(file, settings);
+
+		ASSERT_THROW(store.search("netherfield"), int);
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, ContentView)
+{
+
+	path file = temp_directory_path() / "view_test.db";
+	remove(file);
+
+	{
+		EpubStore store(file);
+
+		Epub("books/PrideAndPrejudice.epub").save_to(store.writer());
+
+		Epub book = store.load(1);
+		Content all(book.css[0], store.reader(), 1, 0);
+
+		ContentView view = store.content(book.css[0], 1, 0, 16);
+
+		ASSERT_EQ(all.items.size(), view.size());
+		ASSERT_EQ((sqlite3_int64) view.size(), view.last_id() - view.first_id() + 1);
+
+		//Straight through, a window at a time.
+		for(sqlite3_int64 id = view.first_id(); id <= view.last_id(); id++) {
+			const ContentItem & item = view.at(id);
+			const ContentItem & expected = all.items[id - view.first_id()];
+
+			ASSERT_EQ(expected.type, item.type);
+			ASSERT_EQ(expected.file, item.file);
+			ASSERT_TRUE(expected.stripped_content == item.stripped_content);
+			ASSERT_EQ(expected.file_id, item.file_id);
+			ASSERT_EQ(expected.selector_id, item.selector_id);
+			ASSERT_LT(0u, item.file_id);
+		}
+
+		//Backwards too.
+		ASSERT_TRUE(all.items[10].content == view.at(view.first_id() + 10).content);
+		ASSERT_TRUE(all.items[5].content == view.at(view.first_id() + 5).content);
+
+		ASSERT_THROW(view.at(view.last_id() + 1), std::out_of_range);
+
+		vector<ContentItem> chapter = view.range(view.first_id() + 100, view.first_id() + 199);
+
+		ASSERT_EQ(100u, chapter.size());
+		ASSERT_TRUE(all.items[100].content == chapter.front().content);
+
+		const path & chapter_file = all.items[100].file;
+		vector<ContentItem> whole_file = view.file(chapter_file);
+
+		const size_t in_file = std::count_if(all.items.begin(), all.items.end(), [&](const ContentItem & item) {
+			return item.file == chapter_file;
+		});
+
+		ASSERT_LT(0u, in_file);
+		ASSERT_EQ(in_file, whole_file.size());
+
+		//Another book, or none at all.
+		ContentView empty = store.content(book.css[0], 2, 0);
+
+		ASSERT_EQ(0u, empty.size());
+		ASSERT_TRUE(empty.range(empty.first_id(), empty.last_id()).empty());
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, PackedContent)
+{
+
+	path file = temp_directory_path() / "packed_test.db";
+	remove(file);
+
+	{
+		EpubStoreSettings settings;
+		settings.storage = CONTENT_PACKED;
+
+		//Packed content has no rows for the search index to read.
+		ASSERT_THROW(EpubStore searched(file, settings), std::runtime_error);
+
+		settings.search = false;
+
+		EpubStore store(file, settings);
+
+		Epub original("books/PrideAndPrejudice.epub");
+		store.save(original);
+
+		const vector<ContentItem> & items = original.contents[0].items;
+
+		Epub book = store.load(1);
+		PackedContent packed(book.css[0], store.reader(), 1, 0);
+
+		ASSERT_EQ(items.size(), packed.size());
+
+		//Packed, there are no rows to view, but Content still loads it all.
+		ASSERT_EQ(0, store.content(book.css[0], 1, 0).first_id());
+
+		Content all(book.css[0], store.reader(), 1, 0);
+
+		ASSERT_EQ(items.size(), all.items.size());
+
+		for(size_t i = 0; i < items.size(); i++) {
+			ASSERT_EQ(items[i].type, all.items[i].type);
+			ASSERT_EQ(items[i].file, all.items[i].file);
+			ASSERT_EQ(items[i].file_id, all.items[i].file_id);
+			ASSERT_EQ(items[i].selector_id, all.items[i].selector_id);
+			ASSERT_TRUE(items[i].id == all.items[i].id);
+			ASSERT_TRUE(items[i].content == all.items[i].content);
+			ASSERT_TRUE(items[i].stripped_content == all.items[i].stripped_content);
+		}
+
+		//A chapter at a time, or an item at a time.
+		const path & chapter = packed.files()[5];
+		vector<ContentItem> chapter_items = packed.file(chapter);
+
+		ASSERT_EQ(packed.size(chapter), chapter_items.size());
+		ASSERT_TRUE(chapter_items.back().content == packed.item(chapter, chapter_items.size() - 1).content);
+
+		ASSERT_THROW(packed.item(chapter, chapter_items.size()), std::out_of_range);
+		ASSERT_THROW(packed.file("nowhere.html"), std::out_of_range);
+
+		//A spine that comes back to a file it has already had.
+		const Content & parsed = original.contents[0];
+		Content repeated(original.css[0], vector<path> { parsed.files[1], parsed.files[2], parsed.files[1] }, parsed.root);
+
+		repeated.save_to(store.writer(), 2, 0, CONTENT_PACKED);
+
+		Content reloaded(book.css[0], store.reader(), 2, 0);
+
+		ASSERT_EQ(repeated.items.size(), reloaded.items.size());
+
+		for(size_t i = 0; i < repeated.items.size(); i++) {
+			ASSERT_EQ(repeated.items[i].file, reloaded.items[i].file);
+			ASSERT_TRUE(repeated.items[i].content == reloaded.items[i].content);
+		}
+
+		PackedContent twice(book.css[0], store.reader(), 2, 0);
+		const path & first = repeated.items.front().file;
+		const size_t once = std::count_if(items.begin(), items.end(), [&](const ContentItem & item) {
+			return item.file == first;
+		});
+
+		ASSERT_EQ(2u, twice.files().size());
+		ASSERT_EQ(2 * once, twice.size(first));
+		ASSERT_EQ(2 * once, twice.file(first).size());
+		ASSERT_TRUE(twice.item(first, once).content == twice.item(first, 0).content);
+
+		//Nor does saving it by hand to a database that has the index.
+		DatabaseSession searchable(path(":memory:"));
+		DatabaseSchema::create_search(searchable);
+
+		ASSERT_THROW(repeated.save_to(searchable, 1, 0, CONTENT_PACKED), std::runtime_error);
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, Reingest)
+{
+
+	path file = temp_directory_path() / "reingest_test.db";
+	path copy = temp_directory_path() / "reingest_test.epub";
+	remove(file);
+	remove(copy);
+
+	{
+		EpubStore store(file);
+
+		ASSERT_EQ(INGEST_ADDED, store.ingest("books/PrideAndPrejudice.epub"));
+		ASSERT_EQ(INGEST_UNCHANGED, store.ingest("books/PrideAndPrejudice.epub"));
+
+		//Saving by hand doesn't duplicate it either.
+		Epub book("books/PrideAndPrejudice.epub");
+		store.save(book);
+
+		ASSERT_EQ(1u, store.books().size());
+
+		auto count_rows = [&](const string & table) {
+			sqlite3_stmt * count;
+			sqlite3_prepare_v2(store.reader(), ("SELECT COUNT(*) FROM " + table + ";").c_str(), -1, &count, 0);
+			sqlite3_step(count);
+			const int n = sqlite3_column_int(count, 0);
+			sqlite3_finalize(count);
+			return n;
+		};
+
+		const size_t hits = store.search("netherfield", 1000).size();
+		const int rows = count_rows("content");
+		const int files = count_rows("files");
+
+		copy_file("books/PrideAndPrejudice.epub", copy);
+
+		ASSERT_EQ(INGEST_ADDED, store.ingest(copy));
+		ASSERT_EQ(2u, store.books().size());
+
+		//Files are named as they are inside the book, so the copy's are
+		//the ones already there.
+		ASSERT_EQ(files, count_rows("files"));
+
+		//Changed since: the old copy goes, content, search and all.
+		last_write_time(copy, last_write_time(copy) + 60);
+
+		ASSERT_EQ(INGEST_REPLACED, store.ingest(copy));
+
+		ASSERT_EQ(2u, store.books().size());
+		ASSERT_EQ(rows * 2, count_rows("content"));
+		ASSERT_EQ(files, count_rows("files"));
+		ASSERT_EQ(hits * 2, store.search("netherfield", 1000).size());
+		ASSERT_EQ(INGEST_UNCHANGED, store.ingest(copy));
+
+		//Once no book uses them, their files and selectors go as well.
+		for(auto epub_file_id : store.books()) {
+			DatabaseSchema::remove_book(store.writer(), epub_file_id);
+		}
+
+		ASSERT_EQ(0, count_rows("content"));
+		ASSERT_EQ(0, count_rows("files"));
+		ASSERT_EQ(0, count_rows("selectors"));
+
+		//A bulk load leaves them until it ends.
+		store.writer().begin_bulk_load();
+		store.save(book);
+
+		for(auto epub_file_id : store.books()) {
+			DatabaseSchema::remove_book(store.writer(), epub_file_id);
+		}
+
+		ASSERT_EQ(files, count_rows("files"));
+
+		store.writer().end_bulk_load();
+
+		ASSERT_EQ(0, count_rows("files"));
+		ASSERT_EQ(0, count_rows("selectors"));
+	}
+
+	remove(file);
+	remove(copy);
+
+}
+
+TEST(EpubTest, Writer)
+{
+
+	path file = temp_directory_path() / "writer_test.db";
+	remove(file);
+
+	{
+		EpubStore store(file);
+
+		const Epub parsed("books/PrideAndPrejudice.epub");
+
+		//Copies use their own stylesheets, not the original's, so the
+		//original can go before they're saved.
+		Epub copied(parsed);
+		ASSERT_EQ(&copied.css[0], copied.contents[0].css);
+
+		copied = parsed;
+		ASSERT_EQ(&copied.css[0], copied.contents[0].css);
+
+		//A small queue and small groups, so pushing has to wait.
+		EpubWriter writer(store, 2, 3);
+
+		vector<std::thread> parsers;
+
+		for(unsigned int i = 0; i < 4; i++) {
+			parsers.emplace_back([&, i]() {
+				for(unsigned int j = 0; j < 3; j++) {
+					//Copies of one book, each passed off as another file.
+					Epub book(parsed);
+					book.absolute_path = "/library/" + std::to_string(i) + "/" + std::to_string(j) + ".epub";
+					book.hash_string = std::to_string(i * 3 + j);
+					writer.push(std::move(book));
+				}
+			});
+		}
+
+		for(auto & parser : parsers) {
+			parser.join();
+		}
+
+		writer.flush();
+
+		ASSERT_EQ(12u, writer.written());
+		ASSERT_LE(4u, writer.transactions());
+		ASSERT_GE(12u, writer.transactions());
+
+		writer.close();
+
+		ASSERT_THROW(writer.push(Epub(parsed)), std::runtime_error);
+
+		ASSERT_EQ(12u, store.books().size());
+
+		//Moved in whole, stylesheets and all.
+		Epub saved = store.load(12);
+
+		ASSERT_EQ(parsed.css[0].rules.size(), saved.css[0].rules.size());
+		ASSERT_EQ(parsed.contents[0].items.size(), Content(saved.css[0], store.reader(), 12, 0).items.size());
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, WriterFallback)
+{
+
+	path file = temp_directory_path() / "writer_fallback_test.db";
+	remove(file);
+
+	{
+		EpubStore store(file);
+
+		//One book the database won't take, however it's saved.
+		store.writer().execute("CREATE TRIGGER reject_bad BEFORE INSERT ON epub_files WHEN NEW.hash_string='bad' "
+		                       "BEGIN SELECT RAISE(ABORT, 'bad book'); END;");
+
+		const Epub parsed("books/PrideAndPrejudice.epub");
+
+		//The writer is held up on the first book until the rest have
+		//queued up behind it, so they go in together as one group.
+		std::promise<void> release;
+		std::shared_future<void> released = release.get_future().share();
+
+		sqlite3_create_function(store.writer().handle(), "wait_for_release", 0, SQLITE_UTF8, &released, [](sqlite3_context * context, int, sqlite3_value **) {
+			static_cast<std::shared_future<void> *>(sqlite3_user_data(context))->wait();
+			sqlite3_result_null(context);
+		}, nullptr, nullptr);
+
+		store.writer().execute("CREATE TRIGGER hold_first BEFORE INSERT ON epub_files WHEN NEW.hash_string='first' "
+		                       "BEGIN SELECT wait_for_release(); END;");
+
+		EpubWriter writer(store, 8, 8);
+
+		const char * hashes[] = { "first", "second", "bad", "third" };
+
+		for(unsigned int i = 0; i < 4; i++) {
+			Epub book(parsed);
+			book.absolute_path = string("/library/") + hashes[i] + ".epub";
+			book.hash_string = hashes[i];
+			writer.push(std::move(book));
+		}
+
+		release.set_value();
+
+		//The bad book's error comes out of flush(), once, and the books
+		//in its group are saved again one at a time.
+		ASSERT_THROW(writer.flush(), int);
+		ASSERT_NO_THROW(writer.flush());
+
+		ASSERT_EQ(3u, writer.written());
+		ASSERT_EQ(3u, writer.transactions());
+		ASSERT_EQ(3u, store.books().size());
+
+		DatabaseSession & session = store.writer();
+
+		for(auto hash : { "first", "second", "third" }) {
+			ASSERT_NE(0u, Epub::find(session, hash));
+		}
+
+		ASSERT_EQ(0u, Epub::find(session, "bad"));
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, LoadQueries)
+{
+
+	path file = temp_directory_path() / "queries_test.db";
+	remove(file);
+
+	{
+		EpubStore store(file);
+		store.ingest("books/PrideAndPrejudice.epub");
+
+		sqlite3 * db = store.reader();
+		unsigned int statements = 0;
+
+		sqlite3_trace_v2(db, SQLITE_TRACE_STMT, [](unsigned, void * count, void *, void *) {
+			(*(unsigned int *) count)++;
+			return 0;
+		}, &statements);
+
+		Epub book(db, 1);
+		const unsigned int before = statements;
+
+		//Much more metadata, every item with attributes.
+		DatabaseSession & session = store.writer();
+
+		session.execute("INSERT INTO metadata(epub_file_id, opf_id, metadata_type, contents) "
+		                "SELECT 1, 0, 0, 'More' FROM (WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 200) SELECT i FROM n);");
+		session.execute("INSERT INTO metadata_tags(metadata_id, tagname, tagvalue) SELECT metadata_id, 'opf:role', 'aut' FROM metadata WHERE contents='More';");
+		session.execute("INSERT INTO metadata_tags(metadata_id, tagname, tagvalue) SELECT metadata_id, 'opf:file-as', 'More' FROM metadata WHERE contents='More';");
+
+		statements = 0;
+		Epub more(db, 1);
+
+		ASSERT_EQ(before, statements);
+		ASSERT_EQ(book.opf_files[0].metadata.size() + 200, more.opf_files[0].metadata.size());
+
+		sqlite3_trace_v2(db, 0, nullptr, nullptr);
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, ConcurrentOPF)
+{
+
+	path file = temp_directory_path() / "concurrent_opf_test.db";
+	remove(file);
+
+	{
+		const Epub parsed("books/PrideAndPrejudice.epub");
+		OPF opf = parsed.opf_files[0];
+
+		//Plenty of metadata, so each save takes a while.
+		for(unsigned int i = 0; i < 500; i++) {
+			MetadataItem item(opf.metadata.begin()->first, "More");
+			item.other_tags.emplace("opf:role", "aut");
+			opf.metadata.emplace(item.type, item);
+		}
+
+		//Two connections saving metadata at once each pick ids from what
+		//the other has already written.
+		EpubStore first(file);
+		EpubStore second(file);
+
+		EpubStore * stores[] = { &first, &second };
+		vector<std::thread> savers;
+		std::atomic<unsigned int> failures(0);
+
+		for(unsigned int i = 0; i < 2; i++) {
+			savers.emplace_back([&, i]() {
+				OPF copy(opf);
+
+				for(unsigned int j = 0; j < 20; j++) {
+					try {
+						copy.save_to(stores[i]->writer(), i * 20 + j + 1, 0);
+					}
+					catch(...) {
+						failures++;
+					}
+				}
+			});
+		}
+
+		for(auto & saver : savers) {
+			saver.join();
+		}
+
+		ASSERT_EQ(0u, failures);
+
+		sqlite3_stmt * count;
+		ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(first.reader(), "SELECT COUNT(*), COUNT(DISTINCT epub_file_id) FROM metadata;", -1, &count, 0));
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(count));
+		ASSERT_EQ((int) (40 * opf.metadata.size()), sqlite3_column_int(count, 0));
+		ASSERT_EQ(40, sqlite3_column_int(count, 1));
+		sqlite3_finalize(count);
+	}
+
+	remove(file);
+
+}
+
+TEST(EpubTest, ConcurrentContent)
+{
+
+	path file = temp_directory_path() / "concurrent_content_test.db";
+	remove(file);
+
+	{
+		const Epub parsed("books/PrideAndPrejudice.epub");
+
+		//Two connections saving content at once, each indexing it for
+		//search while the other is writing rows of its own.
+		EpubStore first(file);
+		EpubStore second(file);
+
+		EpubStore * stores[] = { &first, &second };
+		vector<std::thread> savers;
+		std::atomic<unsigned int> failures(0);
+
+		for(unsigned int i = 0; i < 2; i++) {
+			savers.emplace_back([&, i]() {
+				Content copy(parsed.contents[0]);
+
+				for(unsigned int j = 0; j < 5; j++) {
+					try {
+						copy.save_to(stores[i]->writer(), i * 5 + j + 1, 0);
+					}
+					catch(...) {
+						failures++;
+					}
+				}
+			});
+		}
+
+		for(auto & saver : savers) {
+			saver.join();
+		}
+
+		ASSERT_EQ(0u, failures);
+
+		//Every row is in the index once, under its own id.
+		ASSERT_NO_THROW(first.writer().execute("INSERT INTO content_search(content_search, rank) VALUES('integrity-check', 1);"));
+
+		sqlite3_stmt * count;
+		ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(first.reader(), "SELECT COUNT(*) FROM content_search WHERE content_search MATCH 'netherfield';", -1, &count, 0));
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(count));
+		const int hits = sqlite3_column_int(count, 0);
+		sqlite3_finalize(count);
+
+		ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(first.reader(), "SELECT COUNT(*) FROM content WHERE stripped_content LIKE '%netherfield%';", -1, &count, 0));
+		ASSERT_EQ(SQLITE_ROW, sqlite3_step(count));
+		ASSERT_EQ(sqlite3_column_int(count, 0), hits);
+		sqlite3_finalize(count);
+	}
+
+	remove(file);
+
+}
+
 